@@ -4,501 +4,5253 @@
 // Author: Hamza Sultan Khan Niazi
 //
 // Description: Implements the alternating bit protocol (i.e., stop and wait)
-// defined in ABP.h
+// defined in ABP.h, generalized to a sliding window that recovers from
+// losses with either Go-Back-N or Selective Repeat.
+//
+// The protocol is driven either by SIGIO/SIGALRM handlers or by an epoll
+// event loop with a timerfd for retransmission timeouts.  The virtual
+// backend runs over a link simulated in memory (see virtualLink.h)
+// instead, on the link's clock.  All the backends run the same packet
+// processing routines.
+//
+// All protocol state lives in an ABP_session, so a process can run any
+// number of independent flows.  The original ABP_* calls use a default
+// session.  A receiving session keeps a separate receive window for every
+// sender (peer), found by hashing the sender's address and port.
 //
 
+#define _GNU_SOURCE     // recvmmsg, sendmmsg
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>  // UDP_SEGMENT, UDP_GRO
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <signal.h>
 #include <fcntl.h>
 #include "calcChecksum.h"
+#include "calcCRC.h"
+#include "inetChecksum.h"
+#include "fec.h"
+#include "ecc.h"
 #include "unreliableSend.h"
+#include "virtualLink.h"
+#include "trace.h"
 #include <sys/file.h>   // for FASYNC
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>   // shm_open, mmap
+#include <sys/stat.h>   // fstat
+#include <errno.h>
 #include <sys/time.h>   // timer
+#include <time.h>       // clock_gettime
 #include <stdio.h>
+#include <stdlib.h>     // calloc, free
+#include <stddef.h>     // offsetof
 #include <string.h>     // memmove
-#include <unistd.h>     // getpid, pause
+#include <unistd.h>     // getpid, close
 #include "ABP.h"
 
 // define constants and structs
 
-#define ABP_PAYLOAD_SIZE  1024 /* this value MUST be a multiple of 4*/
-#define ABP_TIMEOUT_SECS 0
-#define ABP_TIMEOUT_USECS 250000
+// packets carry up to ABP_DEFAULT_PAYLOAD_SIZE bytes of data unless
+// ABP_setPayloadSize says otherwise, and a sender keeps to that until the
+// receiver says it takes more.  It's also how much ABP_recv returns and
+// ABP_sendAsync copies.  ABP_MAX_PAYLOAD_SIZE (in ABP.h) is the largest
+// UDP datagram, ABP_MAX_DATAGRAM bytes, less ABP_DATA_HDR_SIZE.
+#define ABP_DEFAULT_PAYLOAD_SIZE 1024
+#define ABP_MAX_DATAGRAM 65507
 #define ABP_MAX_TIMEOUTS 25
 
+// retransmission timeout limits.  The timeout starts at
+// ABP_INITIAL_RTO_USECS and then follows the measured round trip time
+// (RFC 6298), doubling on every timeout.
+#define ABP_INITIAL_RTO_USECS 250000
+#define ABP_MIN_RTO_USECS     1000
+#define ABP_MAX_RTO_USECS     2000000
+
+// events the epoll backend waits for
+#define ABP_EVENT_ACK   0
+#define ABP_EVENT_DATA  1
+#define ABP_EVENT_TIMER 2
+#define ABP_MAX_EVENTS  8
+
+// most datagrams read or written by one recvmmsg or sendmmsg, and most
+// packets in the datagrams written
+#define ABP_BATCH_SIZE 16
+#define ABP_BATCH_PACKETS 128
+
+// with UDP GSO a run of packets of the same size is sent as one datagram
+// of up to ABP_GSO_MAX_SEGMENTS of them (the kernel's limit), which the
+// kernel splits up again.  Receivers using UDP GRO are handed runs put back
+// together, up to ABP_GRO_BUFFER_SIZE bytes.
+#define ABP_GSO_MAX_SEGMENTS 64
+#define ABP_GRO_BUFFER_SIZE  65535
+
+// default limits on the senders a receiving session keeps state for.
+// Peers that haven't sent anything for the idle timeout are forgotten.
+#define ABP_DEFAULT_MAX_PEERS         16
+#define ABP_DEFAULT_PEER_TIMEOUT_MSECS 30000
+
+// default and largest number of messages ABP_sendAsync can have waiting
+// for an ack or to be collected by ABP_sendComplete
+#define ABP_DEFAULT_SEND_QUEUE 64
+#define ABP_MAX_SEND_QUEUE     32768
+
+// default and largest number of messages a receiving session holds for
+// ABP_recv.  The free space is sent to senders in 16 bits.
+#define ABP_DEFAULT_RECV_QUEUE 256
+#define ABP_MAX_RECV_QUEUE     32768
+
+// default longest message a receiving session puts together.  A message's
+// first fragment says how long it is, and that much is allocated for it.
+#define ABP_DEFAULT_MAX_MESSAGE (16 * 1024 * 1024)
+
+// a packet is retransmitted without waiting for its timeout once this many
+// acks show that later packets arrived without it
+#define ABP_DUP_ACK_THRESHOLD 3
+
+// congestion window a sender starts with (packets), as in RFC 6928
+#define ABP_INITIAL_CWND 10
+
+// the delay-based controller aims to keep between ABP_DELAY_ALPHA and
+// ABP_DELAY_BETA packets queued along the path, and leaves slow start
+// once more than ABP_DELAY_GAMMA are (TCP Vegas)
+#define ABP_DELAY_ALPHA 2
+#define ABP_DELAY_BETA  4
+#define ABP_DELAY_GAMMA 1
+
+// forward error correction.  Receivers keep copies of the data packets
+// that a lost packet might have to be rebuilt from, at least a window and
+// a group's worth, and the repair packets of up to ABP_FEC_REPAIR_SLOTS
+// groups that are missing packets, per peer.
+#define ABP_FEC_REPAIR_SLOTS (2 * ABP_FEC_MAX_REPAIR)
+
+// hybrid ARQ.  Two damaged copies of a packet are combined by trying the
+// bits they differ in, if there are no more than ABP_HARQ_MAX_FLIPS of
+// them (2^ABP_HARQ_MAX_FLIPS crcs at most).
+#define ABP_HARQ_MAX_FLIPS 6
+
+// size of the sequence number space.  A window of 1 uses a single bit
+// (i.e., the alternating bit protocol), larger windows use all 8 bits.
+#define ABP_SEQ_SPACE 256
+#define ABP_SEQ_MODULUS(s) ((s)->windowSize == 1 ? 2 : ABP_SEQ_SPACE)
+
+// every packet starts with a byte holding the wire format version and the
+// packet type, then a byte saying how crc was calculated (an
+// ABP_INTEGRITY_* value).  crc covers the whole packet with crc set to 0.
+// Multi-byte fields are in network byte order, there is no padding, and
+// data packets only carry length bytes of data.
+//
+// Messages longer than a packet's payload are split into fragments, each
+// sent as a packet of its own.  msgLength is the length of the whole
+// message and fragOffset is where the packet's data goes in it, so the
+// last fragment is the one that reaches msgLength.  Fragments needn't all
+// be the same size.
+//
+// With error correction, data and repair packets are followed by check
+// words (see ecc.h) covering the whole packet, crc and all.
+#define ABP_WIRE_VERSION 7
+#define ABP_TYPE_DATA    0
+#define ABP_TYPE_ACK     1
+#define ABP_TYPE_REPAIR  2
+#define ABP_VERSION_TYPE(type) (ABP_WIRE_VERSION << 4 | (type))
+#define ABP_LAST_INTEGRITY ABP_INTEGRITY_INET
+
 struct ABP_dataMsg {
+  unsigned char versionType;
+  unsigned char integrity;
   unsigned char seqNum;
-  int length;
-  unsigned char data[ABP_PAYLOAD_SIZE];
+  unsigned short length;
+  unsigned int msgLength;
+  unsigned int fragOffset;
   unsigned int crc;
-};
+  unsigned char data[];
+} __attribute__ ((packed));
+
+// bytes in a data packet before the data
+#define ABP_DATA_HDR_SIZE offsetof(struct ABP_dataMsg, data)
+
+// acks are cumulative: every packet up to and including ackNum has been
+// received.  Bit i of sack[j] (counting from the least significant bit)
+// is set if packet ackNum + 2 + 8j + i has also been received; packet
+// ackNum + 1 is missing, or it would have been acknowledged.  Only the
+// first sackLen bytes of sack are sent.  window is how many packets after
+// ackNum the receiver has room for, and maxPayload is the most data it
+// takes in one.  recovered counts the packets it has rebuilt from repair
+// packets, which were lost even though they needn't be resent.
+#define ABP_MAX_SACK_BYTES (ABP_MAX_WINDOW_SIZE / 8)
 
 struct ABP_ackMsg {
+  unsigned char versionType;
+  unsigned char integrity;
   unsigned char ackNum;
+  unsigned char sackLen;
+  unsigned short window;
+  unsigned short maxPayload;
+  unsigned short recovered;
+  unsigned int crc;
+  unsigned char sack[ABP_MAX_SACK_BYTES];
+} __attribute__ ((packed));
+
+// bytes in an ack before the sack bitmap
+#define ABP_ACK_HDR_SIZE ((int)offsetof(struct ABP_ackMsg, sack))
+
+// with forward error correction, each group of groupSize data packets
+// (sequence numbers groupBase onwards) is followed by repair packets.
+// Repair packet repairIdx holds the sum (see fec.h) of the group's packets,
+// header and all, each as sent and padded with zeros to length bytes, the
+// length of the longest.  The receiver rebuilds as many lost packets of the
+// group as it has repair packets for, and their crcs tell it they came out
+// right.
+struct ABP_repairMsg {
+  unsigned char versionType;
+  unsigned char integrity;
+  unsigned char groupBase;
+  unsigned char groupSize;
+  unsigned char repairIdx;
+  unsigned short length;
   unsigned int crc;
+  unsigned char data[];
+} __attribute__ ((packed));
+
+// bytes in a repair packet before the sum, and the size of buffers for
+// them
+#define ABP_REPAIR_HDR_SIZE offsetof(struct ABP_repairMsg, data)
+#define ABP_REPAIR_BUF_SIZE(s) \
+  (((s)->packetBufSize + ABP_REPAIR_HDR_SIZE + 7) & ~7)
+
+// a packet that has been sent but not yet acknowledged.  Packet buffers
+// are allocated separately, as their size is only known at run time.
+struct ABP_sendSlot {
+  struct ABP_dataMsg *msg;
+  int acked;                   // selective repeat only
+  int numTimeouts;
+  int retransmitted;           // no round trip sample if it was resent
+  int fastRetransmitted;       // resent before its timeout
+  long long sentTime;          // time of first transmission (usecs)
+  int timeoutSet;              // indicates if a timeout is set, and if so,
+  long long timeout;           // when it expires (usecs)
+  int gaveUp;                  // too many timeouts
+  unsigned int packetNum;      // counts every new packet the session sends
+
+  // messages from ABP_sendAsync report back when they leave the window
+  int async;
+  struct ABP_sendCompletion completion;
 };
 
-// define state variables
+// a message from ABP_sendAsync waiting for room in the send window.  buf
+// is either the caller's buffer or data.  sent counts the bytes already
+// in the send window when the message is fragmented.
+struct ABP_sendRequest {
+  char *buf;
+  int length;
+  int sent;
+  struct ABP_sendCompletion completion;
+  char data[ABP_DEFAULT_PAYLOAD_SIZE];
+};
 
-// status of the module
-static int ABP_sendWait;
-static int ABP_recvWait;
+// a packet that has been received but can't be passed to ABP_recv yet
+struct ABP_recvSlot {
+  struct ABP_dataMsg *msg;
+  int valid;
+};
 
-// socket variables and addresses
-static int ABP_sendDataSock, ABP_recvDataSock;
-static struct sockaddr_in ABP_sendDataAddr, ABP_recvDataAddr;
+// a message waiting for ABP_recv, and who sent it
+struct ABP_queueSlot {
+  struct sockaddr_in addr;
+  struct ABP_dataMsg *msg;
+};
 
-// sequence numbers for send and receive
-static int ABP_nextSendSeqNum, ABP_nextRecvSeqNum;
+// a data packet a receiver keeps in case a lost packet of its group has to
+// be rebuilt.  packetNum says which of the peer's packets it is.
+struct ABP_fecSlot {
+  struct ABP_dataMsg *msg;
+  unsigned int packetNum;
+  int valid;
+};
 
-// buffers for sending and receiving data and acks
-static struct ABP_dataMsg ABP_sendMsg, ABP_recvMsg;
+// a repair packet a receiver keeps until its group's lost packets are
+// rebuilt or arrive.  groupBase is the packet number of the group's first
+// packet.
+struct ABP_fecRepair {
+  struct ABP_repairMsg *msg;
+  unsigned int groupBase;
+  int valid;
+};
 
-// number of timeouts
-static int ABP_numTimeouts;
+// a packet that arrived damaged, kept by a receiver in case more copies
+// of it arrive damaged too (hybrid ARQ).  buf holds size bytes as they
+// arrived, and age says which of a peer's copies is oldest.
+struct ABP_harqCopy {
+  char *buf;
+  int size;
+  unsigned int age;
+  int valid;
+};
 
-// indicates if a timeout is set, and if so, when it expires
-static int ABP_sendTimeoutSet;
-static struct timeval ABP_sendTimeout;
+// a message from one peer put together outside ABP_recv's buffer, because
+// it was interleaved with the message being returned.  received bytes of
+// it have arrived; it's complete once that reaches msgLength.
+struct ABP_assembly {
+  struct sockaddr_in addr;
+  char *buf;
+  int msgLength;
+  int received;
+  struct ABP_assembly *next;
+};
 
-// define prototypes for asynchronous handlers
-static void ABP_ackSIGIO (int signalType);
-static void ABP_sendTimer(int signalType);
-static void ABP_dataSIGIO (int signalType);
+// the receive window for one sender.  nextRecvSeqNum is the next sequence
+// number expected in order, and recvSlots[nextRecvIdx] is where it's kept
+// if it arrives while ABP_recv's queue is full.  Selective repeat also keeps
+// up to a window of packets that arrive after it.
+struct ABP_peer {
+  struct sockaddr_in addr;
+  struct ABP_recvSlot *recvSlots;
+  int nextRecvSeqNum, nextRecvIdx;
+  long long lastHeard;              // when the last packet arrived (usecs)
+  int windowClosed;                 // was last told there's no room
 
-// define prototypes for utility routines
-static void ABP_setSendTimeout ();
-static void ABP_clearSendTimeout ();
+  struct ABP_peer *hashNext;        // next in hash bucket, or free list
+  struct ABP_peer *idlePrev, *idleNext;  // least recently heard first
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// ABP_sendInit
-//
-///////////////////////////////////////////////////////////////////////////////
-int ABP_sendInit (char *hostname,short portNum)
-{
-  struct hostent *hp;
-  struct sigaction handler1;
-  struct sigaction handler2;
-  struct itimerval timeVal;
+  // packets received since the last ack.  Peers waiting for a delayed ack
+  // are on a list in order of ackDeadline.
+  int unackedCount;
+  long long ackDeadline;            // usecs
+  struct ABP_peer *ackPrev, *ackNext;
+  int ackPending;                   // on the delayed ack list
 
-  // translate hostname into host's IP address
-  hp = gethostbyname(hostname);
-  if (!hp){
-    perror ("sendInit: gethostbyname");
-    return -1;
-  }
+  // forward error correction.  Packets are numbered from the first one the
+  // peer sent, so they can be told apart once sequence numbers wrap:
+  // nextRecvNum is nextRecvSeqNum's.  fecSlots keeps the packets received
+  // (fecRingSize of them, by number) and fecRepairs the repair packets of
+  // groups missing some.  recovered counts the packets rebuilt.
+  unsigned int nextRecvNum;
+  struct ABP_fecSlot *fecSlots;
+  struct ABP_fecRepair *fecRepairs;
+  unsigned short recovered;
 
-  // build address data structures
-  memset (&ABP_sendDataAddr, 0, sizeof(ABP_sendDataAddr));
-  ABP_sendDataAddr.sin_family = AF_INET;
-  memmove (&ABP_sendDataAddr.sin_addr, hp->h_addr_list[0], hp->h_length);
-  ABP_sendDataAddr.sin_port = htons(portNum);
+  // damaged packets, to be put together with more copies of them
+  struct ABP_harqCopy *harqCopies;
+};
 
-  // create send socket
-  if((ABP_sendDataSock = socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP)) < 0){
-    printf ("sendInit: socket error\n");
-    return -1;
-  }
+// datagrams waiting to be sent together with sendmmsg.  With GSO, packets
+// the same size as the ones before them (or shorter, which ends the run)
+// join their datagram as iovecs of their own.  gsoSize is the size of the
+// packets in the last datagram while more can join it, and gsoBytes its
+// length.  maxSegment is the largest packet GSO is used for, or 0.
+// flushes counts the times the batch has been sent.  session is the one
+// whose channel it's sent through.
+struct ABP_sendBatch {
+  struct mmsghdr hdrs[ABP_BATCH_SIZE];
+  struct iovec iov[ABP_BATCH_PACKETS];
+  char control[ABP_BATCH_SIZE][CMSG_SPACE(sizeof(unsigned short))];
+  int count, numIov;
+  int gsoSize, gsoBytes;
+  int maxSegment;
+  unsigned int flushes;
+  struct ABP_session *session;
+};
 
-  // set up SIGIO handler for received acks
-  handler1.sa_handler = ABP_ackSIGIO;
-  if (sigfillset (&handler1.sa_mask) < 0){
-    printf ("sendInit: segfillset1 error\n");
-    return -1;
-  }
-  handler1.sa_flags = 0;
-  if (sigaction(SIGIO, &handler1, 0) < 0){
-    printf ("sendInit: sigaction1 error\n");
-    return -1;
-  }
+// the state of one flow
+struct ABP_session {
+  // window configuration
+  int windowSize;
+  int windowMode;
 
-  if (fcntl(ABP_sendDataSock, F_SETOWN, getpid()) < 0){
-    perror("sendInit:fcntl1 ");
-    return -1;
-  }
-  if (fcntl(ABP_sendDataSock, F_SETFL, O_NONBLOCK|FASYNC) < 0){
-    printf ("sendInit: fcntl2 error\n");
-    return -1;
-  }
+  // how the crc of packets we send is calculated (ABP_INTEGRITY_*).
+  // Packets received with any of them are checked.  With ecc set, data
+  // and repair packets carry check words to put small errors right.
+  int integrity;
+  int ecc;
 
-  // no send timeouts yet
-  ABP_sendTimeoutSet = 0;
+  // most data in a packet (bytes).  A sender also keeps to peerPayload,
+  // what the receiver last said it takes.  Packet buffers are
+  // packetBufSize bytes, header and all.
+  int payloadSize;
+  int peerPayload;
+  int packetBufSize;
 
-  // set up timer handler so it ticks every tenth of a second
-  if (sigfillset (&handler2.sa_mask) < 0){
-    printf ("sendInit: segfillset2 error\n");
-    return -1;
-  }
+  // backend driving the protocol.  The epoll backend waits for the sockets
+  // and timerFd on epollFd.
+  int backend;
+  int epollFd;
+  int timerFd;
 
-  handler2.sa_handler = ABP_sendTimer;
-  handler2.sa_flags = 0;
-  if (sigaction(SIGALRM, &handler2, 0) < 0){
-    printf ("sendInit: sigaction3 error\n");
-    return -1;
-  }
+  // socket variables and addresses
+  int sendDataSock, recvDataSock;
+  struct sockaddr_in sendDataAddr, recvDataAddr;
 
-  timeVal.it_interval.tv_sec = 0;
-  timeVal.it_interval.tv_usec = 100000;
-  timeVal.it_value.tv_sec = 0;
-  timeVal.it_value.tv_usec = 100000;
-  if (setitimer (ITIMER_REAL,&timeVal,0) < 0) {
-    perror ("ABP_sendInit: setitimer error");
-    return -1;
-  }
-  
-  // initialize initial sequence number
-  ABP_nextSendSeqNum  = 0;
+  // send window.  sendBase is the sequence number of the oldest
+  // unacknowledged packet, which is held in sendSlots[sendBaseIdx].
+  struct ABP_sendSlot *sendSlots;
+  char *sendBufs;
+  int sendBase, sendBaseIdx, sendCount;
+  int nextSendSeqNum;
 
-  // we're not waiting for an ack
-  ABP_sendWait = 0;
+  // round trip time estimates and the current retransmission timeout, in
+  // usecs.  srtt is scaled by 8 and rttvar by 4.
+  long long srtt, rttvar;
+  long long rto;
+  long long minRtt;
 
-  return 0;
-}
+  // acks that repeated the last cumulative ack (i.e., that were sent
+  // because later packets arrived)
+  int dupAcks;
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// ABP_send
-//
-///////////////////////////////////////////////////////////////////////////////
-void ABP_send (char *buf, int length)
-{
-  sigset_t oldsigset,sigset;
+  // packets the receiver last said it had room for, counting from the
+  // oldest unacknowledged one
+  int sendWindow;
 
-  // wait until it's OK to proceed (i.e., we're not waiting for an ACK
-  while (ABP_sendWait)
-    pause();
+  // a fragment of the message leaving the send window was given up on
+  int msgGaveUp;
 
-  // can't send more than payload size
-  if (length > ABP_PAYLOAD_SIZE)
-    length = ABP_PAYLOAD_SIZE;
+  // congestion control.  cwnd is how many packets the path is trusted
+  // with; in congestion avoidance it grows by one once cwndCount packets
+  // have been acknowledged.  Losses of packets numbered before
+  // recoverPacket were already reacted to when the window was cut.
+  int congestion;
+  int cwnd, ssthresh, cwndCount;
+  unsigned int packetsSent, recoverPacket;
 
-  // copy data into message buffer
-  memmove (&ABP_sendMsg.data, buf, length);
-  ABP_sendMsg.length = length;
-  ABP_sendMsg.seqNum = ABP_nextSendSeqNum;
-  // *** calculate checksum of ABP_sendMesg and place in ABP_sendMsg.crc ***
-  ABP_sendMsg.crc=0;
-  ABP_sendMsg.crc = calcChecksum( (char *)&ABP_sendMsg, sizeof(ABP_sendMsg) );
+  // the delay-based controller compares the smallest round trip time of
+  // each round (which ends once packet roundEnd has been acknowledged)
+  // with the smallest ever seen
+  long long roundMinRtt;
+  unsigned int roundEnd;
 
-  // block SIGIO and SIGALRM so that we can't get a signal between
-  // the sendto and setting the timers.
-  sigemptyset (&sigset);
-  sigaddset (&sigset,SIGALRM);
-  sigaddset (&sigset,SIGIO);
-  sigprocmask (SIG_BLOCK,&sigset,&oldsigset);
+  // forward error correction.  Each group of fecGroup new packets is
+  // followed by fecRepair repair packets, which the sender keeps between
+  // fecMinRepair and fecMaxRepair to suit the loss rate.  The group's
+  // repair packets are summed in fecRepairs[fecSet] as its fecCount packets
+  // (the first numbered fecBase, the longest fecLength bytes) go out.  The
+  // last group's are in the other set, and may still be in sendBatch
+  // unless it has been flushed since fecQueued[] of that set.
+  int fecGroup, fecMinRepair, fecMaxRepair;
+  int fecRepair, fecCount, fecBase, fecLength;
+  int fecSet;
+  struct ABP_repairMsg *fecRepairs[2][ABP_FEC_MAX_REPAIR];
+  char *fecBufs;
+  unsigned int fecQueued[2];
 
-  // send the message
-  US_sendto(ABP_sendDataSock,(char *)&ABP_sendMsg,sizeof(ABP_sendMsg),0,
-	    (struct sockaddr *)&ABP_sendDataAddr,sizeof(ABP_sendDataAddr));
+  // packets lost, i.e. resent or rebuilt by the receiver (which reports
+  // peerRecovered so far).  lossRate is the fraction of packets lost
+  // (scaled by 65536) averaged over recent groups, and fecLastSent and
+  // fecLastLost where the last group started.
+  unsigned int packetsLost;
+  unsigned short peerRecovered;
+  int lossRate;
+  unsigned int fecLastSent, fecLastLost;
 
-  // set timeout
-  ABP_setSendTimeout ();
+  // messages from ABP_sendAsync.  sendQueue holds the ones waiting for room
+  // in the send window, from sendQueueHead up to sendQueueTail, and is only
+  // touched with the signals blocked.  Each message counts against
+  // sendQueueSize until its completion has been passed to sendCallback or
+  // collected from the completion ring, which has a single producer (the
+  // protocol) and a single consumer (ABP_sendComplete).  Indexes only ever
+  // increase; sendQueueSize is a power of 2.
+  struct ABP_sendRequest *sendQueue;
+  unsigned int sendQueueSize, sendHighWater;
+  unsigned int sendQueueHead, sendQueueTail;
+  unsigned int asyncSubmitted, asyncCollected;
+  struct ABP_sendCompletion *completions;
+  unsigned int completionHead, completionTail;
+  ABP_sendCallback sendCallback;
+  void *sendCallbackArg;
 
-  // no timeouts yet
-  ABP_numTimeouts = 0;
+  // receive windows, one per peer.  Everything is allocated up front by
+  // ABP_sessionRecvInit (the signal handlers can't call malloc): peers and
+  // recvSlots hold maxPeers receive windows, and unused peers are kept on
+  // freePeers.  Peers in use are found through peerHash, which has
+  // peerHashMask + 1 buckets.
+  int maxPeers;
+  long long peerTimeout;            // usecs
+  int reusePort;                    // bind with SO_REUSEPORT
+  struct ABP_peer *peers;
+  struct ABP_recvSlot *recvSlots;
+  char *recvSlotBufs;
+  struct ABP_peer **peerHash;
+  unsigned int peerHashMask;
+  struct ABP_peer *freePeers;
 
-  // alter status
-  ABP_sendWait = 1;
+  // peers in use, least recently heard from first
+  struct ABP_peer *idleHead, *idleTail;
+  int numPeers;
 
-  // restore signal mask
-  sigprocmask (SIG_SETMASK,&oldsigset,0);
-}
+  // kept data and repair packets for forward error correction, if senders
+  // may use it (fecGroup is set), shared out between the peers
+  unsigned int fecRingSize;
+  struct ABP_fecSlot *fecSlots;
+  char *fecSlotBufs;
+  struct ABP_fecRepair *fecRepairSlots;
+  char *fecRepairBufs;
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// ABP_flush
-//
-///////////////////////////////////////////////////////////////////////////////
-void ABP_flush (void)
-{
-  // wait until all data has been acknowledged (i.e., we're not waiting for
-  // an ACK)
-  while (ABP_sendWait)
-    pause();
-}
+  // damaged packets kept for combining, harqCopies per peer.  harqAge
+  // numbers them as they're kept, and copies are combined in harqScratch.
+  int harqCopies;
+  struct ABP_harqCopy *harqSlots;
+  char *harqBufs;
+  char *harqScratch;
+  unsigned int harqAge;
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// ABP_ackSIGIO
-//
-///////////////////////////////////////////////////////////////////////////////
-void ABP_ackSIGIO (int signalType)
-{
-  // SIGIO callback for received ack
-  int ackAddrSize;
-  int ackSize;
-  struct sockaddr_in ABP_recvAckAddr;
-  struct ABP_ackMsg ABP_recvAck;
-  struct itimerval timeVal;
+  // messages received in order from every peer and waiting for ABP_recv.
+  // This is a ring with a single producer and a single consumer: the
+  // protocol adds messages at recvTail and ABP_recv takes them from
+  // recvHead, so ABP_recv doesn't have to block the signal handlers.  Both
+  // only ever increase; recvQueueSize is a power of 2.  windowUpdate is set
+  // when a peer was told the queue was full, so ABP_recv lets it know once
+  // there's room again.
+  struct ABP_queueSlot *recvQueue;
+  char *recvQueueBufs;
+  unsigned int recvQueueSize;
+  int maxMessage;                 // longest message taken (bytes)
+  unsigned int recvHead, recvTail;
+  int windowUpdate;
 
-  // receive message
-  ackSize = recvfrom(ABP_sendDataSock,
-		     (char *)&ABP_recvAck,sizeof(ABP_recvAck),0,
-		     (struct sockaddr *)&ABP_recvAckAddr,&ackAddrSize);
+  // fragmented messages taken from the queue by ABP_recv but not returned
+  // yet, oldest first.  Only ABP_recv touches them.
+  struct ABP_assembly *assemblies;
 
-  // discard ack if it's not the expected size
-  if (ackSize != sizeof(ABP_recvAck)) {
-    printf("ABP_ackSIGIO:received ack not correct size\n");
-    return;
-  }
-  // discard ack if error in transmission
-  // *** calculate checksum of ABP_recvAck, and discard packet if it's not correct ***
-  if( calcChecksum((char *)&ABP_recvAck,sizeof(ABP_recvAck))!=0)
-      return;
-    
-  // ignore if we weren't expecting this ack
-  if (ABP_recvAck.ackNum != ABP_nextSendSeqNum)
-    return;
+  // receivers ack every ackEvery packets, or ackDelay usecs after the
+  // first unacknowledged one if that's sooner.  Peers waiting for an ack
+  // are listed with the earliest deadline first.
+  int ackEvery;
+  long long ackDelay;
+  struct ABP_peer *ackHead, *ackTail;
 
-  // ack received so cancel timeout
-  ABP_clearSendTimeout ();
+  // datagrams read by the last recvmmsg and where they came from.  Data
+  // is read into recvBatchBufs, recvBatchBufSize bytes each: enough for a
+  // packet, or for a run of them with GRO.
+  char *recvBatchBufs;
+  int recvBatchBufSize;
+  struct ABP_ackMsg recvAckBatch[ABP_BATCH_SIZE];
+  struct sockaddr_in recvBatchAddrs[ABP_BATCH_SIZE];
+  struct mmsghdr recvBatchHdrs[ABP_BATCH_SIZE];
+  struct iovec recvBatchIov[ABP_BATCH_SIZE];
+  char recvBatchControl[ABP_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
 
-  // increment sequence number
-  ABP_nextSendSeqNum = (ABP_nextSendSeqNum+1) & 0x1;
+  // acks, retransmissions and queued messages are collected while a batch
+  // of received packets or timeouts is processed, then sent together
+  struct ABP_sendBatch ackBatch;
+  struct ABP_ackMsg ackBatchMsgs[ABP_BATCH_SIZE];
+  struct sockaddr_in ackBatchAddrs[ABP_BATCH_SIZE];
+  struct ABP_sendBatch sendBatch;
+
+  // packets are sent through channel (see unreliableSend.h), or the
+  // default channel if it's 0
+  US_channel *channel;
+
+  // sessions driven by signals are linked together so the handlers can
+  // find them
+  struct ABP_session *nextSignalSession;
+  int onSignalList;
+
+  // with the virtual backend, the sockets are the link's, and so is the
+  // clock.  Sessions on links are linked together too, so the session that
+  // moves a link's clock on can process the others on it.  ownChannel is
+  // set if the session opened its channel itself.
+  VL_link *link;
+  struct ABP_session *nextLinkSession;
+  int onLinkList;
+  int ownChannel;
+
+  // counts of everything the session has done (see ABP_count).  They're
+  // kept in ownCounters, or in shared, the shared memory object sharedName,
+  // for another process to follow.
+  struct ABP_counters *counters;
+  struct ABP_counters ownCounters;
+  struct ABP_sharedCounters *shared;
+  char *sharedName;
+};
+
+// define state variables
+
+// session used by the original ABP_* calls, created on first use
+static ABP_session *ABP_defaultSession;
+
+// sessions using the signal backend, and whether the handlers have been
+// installed
+static ABP_session *ABP_signalSessions;
+static int ABP_handlersInstalled;
+
+// sessions using the virtual backend, whatever link they're on
+static ABP_session *ABP_linkSessions;
+
+// define prototypes for asynchronous handlers
+static void ABP_SIGIO (int signalType);
+static void ABP_sendTimer(int signalType);
+
+// define prototypes for packet processing
+static int ABP_recvAcks (ABP_session *s);
+static int ABP_recvData (ABP_session *s);
+static int ABP_recvBatch (ABP_session *s, int sock, void *bufs, int size);
+static void ABP_processAck (ABP_session *s, struct ABP_ackMsg *ack,
+			    int ackSize);
+static int ABP_processPacket (ABP_session *s, char *packet, int size,
+			      struct sockaddr_in *fromAddr);
+static int ABP_processData (ABP_session *s, struct ABP_dataMsg *msg,
+			    int dataSize, struct sockaddr_in *fromAddr);
+static int ABP_processRepair (ABP_session *s, struct ABP_repairMsg *msg,
+			      int repairSize, struct sockaddr_in *fromAddr);
+static void ABP_checkTimeouts (ABP_session *s);
+static void ABP_checkSendTimeouts (ABP_session *s, long long currTime);
+static void ABP_checkAckTimeouts (ABP_session *s, long long currTime);
+static void ABP_fastRetransmit (ABP_session *s);
+
+// define prototypes for backend routines
+static ABP_session *ABP_default ();
+static int ABP_backendInit (ABP_session *s, int sock, int event);
+static int ABP_installHandlers ();
+static int ABP_epollAdd (ABP_session *s, int fd, int event);
+static void ABP_blockSignals (ABP_session *s, sigset_t *oldsigset);
+static void ABP_restoreSignals (ABP_session *s, sigset_t *oldsigset);
+static int ABP_wait (ABP_session *s, sigset_t *oldsigset);
+static int ABP_linkProcess (ABP_session *s, int timeoutMsecs);
+
+// define prototypes for utility routines
+static int ABP_seqOffset (ABP_session *s, int seqNum, int base);
+static void ABP_resend (ABP_session *s, struct ABP_sendSlot *slot);
+static struct ABP_sendSlot *ABP_newPacket (ABP_session *s,
+					   const struct iovec *iov,
+					   int iovcnt, int length,
+					   int msgLength, int fragOffset);
+static int ABP_fragLength (ABP_session *s, int msgLength, int fragOffset);
+static int ABP_wireSize (ABP_session *s, int length);
+static char *ABP_allocPackets (ABP_session *s, size_t count);
+static struct ABP_dataMsg *ABP_packetBuf (ABP_session *s, char *bufs,
+					  size_t i);
+static int ABP_maxSegment (ABP_session *s);
+static int ABP_segmentSize (struct msghdr *hdr);
+static int ABP_windowOpen (ABP_session *s);
+static void ABP_sendQueued (ABP_session *s);
+static void ABP_complete (ABP_session *s, struct ABP_sendSlot *slot);
+static void ABP_advanceSendBase (ABP_session *s, int count);
+static struct ABP_recvSlot *ABP_recvSlot (ABP_session *s,
+					  struct ABP_peer *peer, int seqNum);
+static struct ABP_peer *ABP_findPeer (ABP_session *s,
+				      struct sockaddr_in *addr);
+static struct ABP_peer **ABP_peerBucket (ABP_session *s,
+					 struct sockaddr_in *addr);
+static void ABP_expirePeers (ABP_session *s, long long currTime);
+static int ABP_deliver (ABP_session *s, struct ABP_peer *peer);
+static void ABP_advanceRecv (ABP_session *s, struct ABP_peer *peer);
+static unsigned int ABP_queueFree (ABP_session *s);
+static void ABP_queuePush (ABP_session *s, struct ABP_peer *peer,
+			   struct ABP_dataMsg *msg);
+static struct ABP_queueSlot *ABP_queuePeek (ABP_session *s, int block);
+static void ABP_queueRelease (ABP_session *s);
+static int ABP_reassemble (ABP_session *s, char **buf, int *bufSize,
+			   int grow, int block, struct sockaddr_in *fromAddr);
+static int ABP_fitBuffer (char **buf, int *bufSize, int grow, int size);
+static void ABP_setAside (ABP_session *s, struct ABP_queueSlot *slot);
+static struct ABP_assembly *ABP_newAssembly (ABP_session *s,
+					     struct sockaddr_in *addr,
+					     int msgLength);
+static struct ABP_assembly *ABP_findAssembly (ABP_session *s,
+					      struct sockaddr_in *addr,
+					      int complete);
+static void ABP_freeAssembly (ABP_session *s, struct ABP_assembly *a);
+static int ABP_recvWindow (ABP_session *s);
+static void ABP_sendWindowUpdates (ABP_session *s);
+static void ABP_sendAck (ABP_session *s, struct ABP_peer *peer);
+static void ABP_delayAck (ABP_session *s, struct ABP_peer *peer);
+static void ABP_removeAckPending (ABP_session *s, struct ABP_peer *peer);
+static void ABP_batchAdd (struct ABP_sendBatch *batch, int sock, void *buf,
+			  int len, struct sockaddr_in *toAddr);
+static void ABP_batchFlush (struct ABP_sendBatch *batch, int sock);
+static void ABP_setSendTimeout (ABP_session *s, struct ABP_sendSlot *slot);
+static void ABP_clearSendTimeout (ABP_session *s, struct ABP_sendSlot *slot);
+static void ABP_armTimer (ABP_session *s);
+static long long ABP_earliestTimeout (ABP_session *s);
+static void ABP_updateRtt (ABP_session *s, struct ABP_sendSlot *slot);
+static unsigned int ABP_calcCRC (int integrity, void *packet, int size);
+static long long ABP_now (ABP_session *s);
+static void ABP_count (unsigned long long *counter, unsigned long long n);
+static void ABP_countRtt (ABP_session *s, long long rtt);
+static void ABP_traceAck (ABP_session *s, int offset, int window);
+static void ABP_traceData (ABP_session *s, struct ABP_peer *peer, int offset,
+			   int length);
+
+// define prototypes for congestion control
+static void ABP_congestionAcked (ABP_session *s, int numAcked);
+static void ABP_congestionLoss (ABP_session *s, struct ABP_sendSlot *slot,
+				int timeout);
+static int ABP_inRecovery (ABP_session *s);
+static void ABP_renoAcked (ABP_session *s, int numAcked);
+static void ABP_delayAcked (ABP_session *s, int numAcked);
+static void ABP_delayRtt (ABP_session *s, long long rtt);
+
+// define prototypes for forward error correction
+static void ABP_fecAdd (ABP_session *s, struct ABP_dataMsg *msg, int length);
+static void ABP_fecStart (ABP_session *s, int seqNum);
+static void ABP_fecFinish (ABP_session *s);
+static unsigned int ABP_fecPacketNum (ABP_session *s, struct ABP_peer *peer,
+				      int seqNum);
+static int ABP_fecKeep (ABP_session *s, struct ABP_peer *peer,
+			struct ABP_dataMsg *msg, int length,
+			unsigned int packetNum);
+static struct ABP_dataMsg *ABP_fecPacket (ABP_session *s,
+					  struct ABP_peer *peer,
+					  unsigned int packetNum);
+static void ABP_fecKeepRepair (struct ABP_peer *peer,
+			       struct ABP_repairMsg *msg, int length,
+			       unsigned int groupBase);
+static void ABP_fecRecover (ABP_session *s, struct ABP_peer *peer,
+			    unsigned int packetNum);
+static void ABP_fecDecode (ABP_session *s, struct ABP_peer *peer,
+			   unsigned int groupBase, int groupSize);
+static void ABP_fecDrop (struct ABP_peer *peer, unsigned int groupBase);
+
+// define prototypes for hybrid ARQ
+static int ABP_harqCombine (ABP_session *s, char *packet, int size,
+			    struct sockaddr_in *fromAddr);
+static int ABP_harqVote (ABP_session *s, const char *a, const char *b,
+			 const char *c, int length);
+static int ABP_harqFlip (ABP_session *s, const char *packet,
+			 const char *other, int length);
+static int ABP_harqValid (char *packet, int length, int strong);
+static int ABP_harqDistance (const char *a, const char *b, int length);
+
+// congestion control algorithms, indexed by ABP_CONGESTION_*.  They are
+// told about acknowledged packets and round trip time samples; every
+// algorithm reacts to losses the same way.
+struct ABP_congestionOps {
+  void (*acked) (ABP_session *s, int numAcked);
+  void (*rtt) (ABP_session *s, long long rtt);
+};
+
+static const struct ABP_congestionOps ABP_congestionOps[] = {
+  { 0, 0 },                                     // ABP_CONGESTION_NONE
+  { ABP_renoAcked, 0 },                         // ABP_CONGESTION_RENO
+  { ABP_delayAcked, ABP_delayRtt },             // ABP_CONGESTION_DELAY
+};
 
-  // we're no longer waiting for the ack
-  ABP_sendWait = 0;
-}
- 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_sendTimer
+// ABP_open
 //
 ///////////////////////////////////////////////////////////////////////////////
-void ABP_sendTimer(int signalType)
+ABP_session *ABP_open (void)
 {
-  struct itimerval timeVal;
-  struct timeval currTime;
-  // timer ticked, which means one tenth of a second has passed.
+  ABP_session *s;
 
-  // nothing to do unless there is a timeout set
-  if (!ABP_sendTimeoutSet)
-    return;
+  s = calloc (1, sizeof(*s));
+  if (!s) {
+    perror ("ABP_open: calloc");
+    return 0;
+  }
 
-  // still nothing to do unless the timeout time has passed
-  gettimeofday (&currTime,0);
-  if (timercmp(&currTime,&ABP_sendTimeout,<))
-    return;
+  // alternating bit protocol driven by signals until configured otherwise
+  s->windowSize = 1;
+  s->windowMode = ABP_GO_BACK_N;
+  s->backend = ABP_BACKEND_SIGNAL;
+  s->integrity = ABP_INTEGRITY_CRC32C;
+  s->congestion = ABP_CONGESTION_RENO;
+  s->payloadSize = ABP_DEFAULT_PAYLOAD_SIZE;
 
-  // timeout has occurred, so handle it
-  // increment number of timeouts
-  ABP_numTimeouts++;
+  // nothing opened yet
+  s->epollFd = -1;
+  s->timerFd = -1;
+  s->sendDataSock = -1;
+  s->recvDataSock = -1;
 
-  // if too many timeouts we'll just give up
-  if (ABP_numTimeouts > ABP_MAX_TIMEOUTS) {
-    ABP_nextSendSeqNum = (ABP_nextSendSeqNum + 1) & 0x1;
-    ABP_sendWait = 0;
-    printf ("Too many timeouts - giving up\n");
-    ABP_clearSendTimeout ();
-    return;
-  }
+  // receive from a handful of senders at once
+  s->maxPeers = ABP_DEFAULT_MAX_PEERS;
+  s->peerTimeout = (long long)ABP_DEFAULT_PEER_TIMEOUT_MSECS * 1000;
 
-  // resend message
-  US_sendto(ABP_sendDataSock,(char *)&ABP_sendMsg,sizeof(ABP_sendMsg),0,
-	    (struct sockaddr *)&ABP_sendDataAddr,sizeof(ABP_sendDataAddr));
+  // ack every packet right away
+  s->ackEvery = 1;
+  s->ackDelay = 0;
 
-  // reset timeout
-  ABP_setSendTimeout ();
+  s->recvQueueSize = ABP_DEFAULT_RECV_QUEUE;
+  s->maxMessage = ABP_DEFAULT_MAX_MESSAGE;
+  s->sendQueueSize = ABP_DEFAULT_SEND_QUEUE;
+  s->sendHighWater = ABP_DEFAULT_SEND_QUEUE;
+
+  s->sendBatch.session = s;
+  s->ackBatch.session = s;
+  s->counters = &s->ownCounters;
+  return s;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_setSendTimeout
+// ABP_close
 //
 ///////////////////////////////////////////////////////////////////////////////
-static void ABP_setSendTimeout ()
+void ABP_close (ABP_session *s)
 {
-  // set the send timeout time to be the current time + ABP_TIMEOUT
+  sigset_t oldsigset;
+  ABP_session **link;
 
-  sigset_t oldsigset,sigset;
-
-  // first, block SIGALRM and SIGIO so the timer and asynchronous input
-  // can't happen while we're playing with the timeout structures
-  sigemptyset (&sigset);
-  sigaddset (&sigset,SIGALRM);
-  sigaddset (&sigset,SIGIO);
-  sigprocmask (SIG_BLOCK,&sigset,&oldsigset);
-  
-  // get the current time
-  gettimeofday (&ABP_sendTimeout,0);
+  if (!s)
+    return;
 
-  // add ABP_TIMEOUT constants to the time to get the time the timeout
-  // expires
-  ABP_sendTimeout.tv_usec += ABP_TIMEOUT_USECS;
-  if (ABP_sendTimeout.tv_usec >= 1000000)
-    {
-      ABP_sendTimeout.tv_sec++;
-      ABP_sendTimeout.tv_usec -= 1000000;
+  // stop the handlers from seeing the session
+  ABP_blockSignals (s, &oldsigset);
+  for (link = &ABP_signalSessions; *link; link = &(*link)->nextSignalSession)
+    if (*link == s) {
+      *link = s->nextSignalSession;
+      break;
+    }
+  for (link = &ABP_linkSessions; *link; link = &(*link)->nextLinkSession)
+    if (*link == s) {
+      *link = s->nextLinkSession;
+      break;
     }
-  ABP_sendTimeout.tv_sec += ABP_TIMEOUT_SECS;
+  s->sendCount = 0;
+  s->ackHead = 0;
+  ABP_armTimer (s);
+  ABP_restoreSignals (s, &oldsigset);
 
-  // the timeout is now set
-  ABP_sendTimeoutSet = 1;
+  // sockets on a link are the link's
+  if (s->link) {
+    if (s->sendDataSock >= 0)
+      VL_closeSocket (s->link, s->sendDataSock);
+    if (s->recvDataSock >= 0)
+      VL_closeSocket (s->link, s->recvDataSock);
+  }
+  else {
+    if (s->sendDataSock >= 0)
+      close (s->sendDataSock);
+    if (s->recvDataSock >= 0)
+      close (s->recvDataSock);
+  }
+  if (s->timerFd >= 0)
+    close (s->timerFd);
+  if (s->epollFd >= 0)
+    close (s->epollFd);
 
-  // restore signal mask
-  sigprocmask (SIG_SETMASK,&oldsigset,0);
+  if (s == ABP_defaultSession)
+    ABP_defaultSession = 0;
+  free (s->sendSlots);
+  free (s->sendBufs);
+  free (s->recvSlots);
+  free (s->recvSlotBufs);
+  free (s->peers);
+  free (s->peerHash);
+  free (s->recvQueue);
+  free (s->recvQueueBufs);
+  free (s->recvBatchBufs);
+  free (s->sendQueue);
+  free (s->completions);
+  free (s->fecBufs);
+  free (s->fecSlots);
+  free (s->fecSlotBufs);
+  free (s->fecRepairSlots);
+  free (s->fecRepairBufs);
+  free (s->harqSlots);
+  free (s->harqBufs);
+  if (s->ownChannel)
+    US_close (s->channel);
+  if (s->shared) {
+    munmap (s->shared, sizeof(*s->shared));
+    shm_unlink (s->sharedName);
+    free (s->sharedName);
+  }
+  while (s->assemblies)
+    ABP_freeAssembly (s, s->assemblies);
+  free (s);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_clearSendTimeout
+// ABP_sessionSetWindow
 //
 ///////////////////////////////////////////////////////////////////////////////
-static void ABP_clearSendTimeout ()
+int ABP_sessionSetWindow (ABP_session *s, int windowSize, int mode)
 {
-  // clear the send timeout
-
-  sigset_t oldsigset,sigset;
-
-  // first, block SIGALRM and SIGIO so the timer and asynchronous input
-  // can't happen while we're playing with the timeout structures
-  sigemptyset (&sigset);
-  sigaddset (&sigset,SIGALRM);
-  sigaddset (&sigset,SIGIO);
-  sigprocmask (SIG_BLOCK,&sigset,&oldsigset);
-  
-  // the timeout is not set anymore
-  ABP_sendTimeoutSet = 0;
+  if (windowSize < 1 || windowSize > ABP_MAX_WINDOW_SIZE) {
+    printf ("setWindow: window size must be between 1 and %d\n",
+	    ABP_MAX_WINDOW_SIZE);
+    return -1;
+  }
+  if (mode != ABP_GO_BACK_N && mode != ABP_SELECTIVE_REPEAT) {
+    printf ("setWindow: unknown window mode\n");
+    return -1;
+  }
+  if (s->sendSlots || s->recvSlots) {
+    printf ("setWindow: session already initialized\n");
+    return -1;
+  }
 
-  // restore signal mask
-  sigprocmask (SIG_SETMASK,&oldsigset,0);
+  s->windowSize = windowSize;
+  s->windowMode = mode;
+  return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_recvInit
+// ABP_sessionSetPeers
 //
 ///////////////////////////////////////////////////////////////////////////////
-int ABP_recvInit (short portNum)
+int ABP_sessionSetPeers (ABP_session *s, int maxPeers, int idleTimeoutMsecs)
 {
-  struct sigaction handler;
-
-  // build address data structures
-  memset (&ABP_recvDataAddr, 0, sizeof(ABP_recvDataAddr));
-  ABP_recvDataAddr.sin_family = AF_INET;
-  ABP_recvDataAddr.sin_addr.s_addr = INADDR_ANY;
-  ABP_recvDataAddr.sin_port = htons(portNum);
-
-  // create socket for receiving data and bind it to port
-  if((ABP_recvDataSock = socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP)) < 0){
-    perror("recvInit:socket");
+  if (maxPeers < 1) {
+    printf ("setPeers: must allow at least one peer\n");
     return -1;
   }
-
-  if (bind (ABP_recvDataSock,(struct sockaddr *)&ABP_recvDataAddr,
-	    sizeof(ABP_recvDataAddr)) < 0){
-    perror("recvInit:bind");
+  if (idleTimeoutMsecs < 0) {
+    printf ("setPeers: idle timeout can't be negative\n");
+    return -1;
+  }
+  if (s->recvSlots) {
+    printf ("setPeers: session already initialized\n");
     return -1;
   }
 
-  // set up SIGIO handler for received data
-  handler.sa_handler = ABP_dataSIGIO;
-  if (sigfillset (&handler.sa_mask) < 0){
-    perror("recvInit:sigfillset");
+  s->maxPeers = maxPeers;
+  s->peerTimeout = (long long)idleTimeoutMsecs * 1000;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetDelayedAck
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetDelayedAck (ABP_session *s, int everyPackets,
+			      int maxDelayUsecs)
+{
+  if (everyPackets < 1) {
+    printf ("setDelayedAck: must ack at least every packet\n");
     return -1;
   }
-  handler.sa_flags = 0;
-  if (sigaction(SIGIO, &handler, 0) < 0){
-    perror("recvInit:sigaction:SIGIO");
+  if (maxDelayUsecs < 0) {
+    printf ("setDelayedAck: delay can't be negative\n");
     return -1;
   }
+  if (s->recvSlots) {
+    printf ("setDelayedAck: session already initialized\n");
+    return -1;
+  }
+
+  s->ackEvery = everyPackets;
+  s->ackDelay = maxDelayUsecs;
+  return 0;
+}
 
-  if (fcntl(ABP_recvDataSock, F_SETOWN, getpid()) < 0){
-    perror("recvInit:fcntl1 ");
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetRecvQueue
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetRecvQueue (ABP_session *s, int numMessages)
+{
+  if (numMessages < 1 || numMessages > ABP_MAX_RECV_QUEUE) {
+    printf ("setRecvQueue: queue must hold 1 to %d messages\n",
+	    ABP_MAX_RECV_QUEUE);
     return -1;
   }
-  if (fcntl(ABP_recvDataSock, F_SETFL, O_NONBLOCK|FASYNC) < 0){
-    perror("recvInit:fcntl2 ");
+  if (s->recvSlots) {
+    printf ("setRecvQueue: session already initialized\n");
     return -1;
   }
 
-  // initialize initial sequence numbers
-  ABP_nextRecvSeqNum = 0;
+  s->recvQueueSize = numMessages;
+  return 0;
+}
 
-  // we're waiting for data
-  ABP_recvWait = 1;
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetMaxMessage
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetMaxMessage (ABP_session *s, int length)
+{
+  if (length < 1) {
+    printf ("setMaxMessage: messages must be allowed at least 1 byte\n");
+    return -1;
+  }
+  if (s->recvSlots) {
+    printf ("setMaxMessage: session already initialized\n");
+    return -1;
+  }
 
+  s->maxMessage = length;
+  return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_recv
+// ABP_sessionSetPayloadSize
 //
 ///////////////////////////////////////////////////////////////////////////////
-void ABP_recv (char *buf, int *length)
+int ABP_sessionSetPayloadSize (ABP_session *s, int size)
 {
-  // wait for message to come in
-  while (ABP_recvWait)
-    pause();
-
-  // copy message data to parameters
-  memmove (buf,&ABP_recvMsg.data,ABP_recvMsg.length);
-  *length = ABP_recvMsg.length;
+  // senders use the default until they hear from the receiver, so every
+  // receiver has to take at least that much
+  if (size < ABP_DEFAULT_PAYLOAD_SIZE || size > ABP_MAX_PAYLOAD_SIZE) {
+    printf ("setPayloadSize: size must be between %d and %d\n",
+	    ABP_DEFAULT_PAYLOAD_SIZE, ABP_MAX_PAYLOAD_SIZE);
+    return -1;
+  }
+  if (s->sendSlots || s->recvSlots) {
+    printf ("setPayloadSize: session already initialized\n");
+    return -1;
+  }
 
-  // we must wait for next message
-  ABP_recvWait = 1;
+  s->payloadSize = size;
+  return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// ABP_dataSIGIO
+// ABP_sessionSetFec
 //
 ///////////////////////////////////////////////////////////////////////////////
-void ABP_dataSIGIO (int signalType)
+int ABP_sessionSetFec (ABP_session *s, int groupSize, int minRepair,
+		       int maxRepair)
 {
-  // SIGIO callback for received data
-  int addrSize;
-  int dataSize;
-  struct sockaddr_in fromAddr;
-  struct ABP_ackMsg ackMsg;
-  struct ABP_dataMsg tempMsg;
+  if (groupSize < 0 || groupSize > ABP_FEC_MAX_GROUP) {
+    printf ("setFec: group size must be between 0 and %d\n",
+	    ABP_FEC_MAX_GROUP);
+    return -1;
+  }
+  if (groupSize > 0 && (minRepair < 0 || maxRepair < 1 ||
+			minRepair > maxRepair ||
+			maxRepair > ABP_FEC_MAX_REPAIR)) {
+    printf ("setFec: repair packets must be between 0 and %d\n",
+	    ABP_FEC_MAX_REPAIR);
+    return -1;
+  }
+  if (s->sendSlots || s->recvSlots) {
+    printf ("setFec: session already initialized\n");
+    return -1;
+  }
 
-  // receive message
-  addrSize = sizeof(fromAddr);
-  dataSize = recvfrom(ABP_recvDataSock,(char *)&tempMsg,
-		      sizeof(tempMsg),0,
-		      (struct sockaddr *)&fromAddr,&addrSize);
+  s->fecGroup = groupSize;
+  s->fecMinRepair = minRepair;
+  s->fecMaxRepair = maxRepair;
+  return 0;
+}
 
-  // discard data if application hasn't consumed previous data
-  if (!ABP_recvWait) {
-    printf ("ABP_dataSIGIO: received data overrun\n");
-    return;
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetSendQueue
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetSendQueue (ABP_session *s, int numMessages, int highWater)
+{
+  if (numMessages < 1 || numMessages > ABP_MAX_SEND_QUEUE) {
+    printf ("setSendQueue: queue must hold 1 to %d messages\n",
+	    ABP_MAX_SEND_QUEUE);
+    return -1;
   }
-
-  // discard data if it's not the expected size
-  if (dataSize != sizeof(tempMsg)) {
-    printf("ABP_dataSIGIO:received data not correct size\n");
-    return;
+  if (highWater < 1 || highWater > numMessages) {
+    printf ("setSendQueue: high-water mark must be 1 to numMessages\n");
+    return -1;
+  }
+  if (s->sendSlots) {
+    printf ("setSendQueue: session already initialized\n");
+    return -1;
   }
 
-  // discard data if error in transmission
-  // *** calculate checksum of tempMsg and discard if it's not what we expect ***
-  if (calcChecksum((char *)&tempMsg,sizeof(tempMsg))!=0)
-    return;
-  // send ACK
-  ackMsg.ackNum = tempMsg.seqNum;
-  // *** calculate checksum of ackMsg and place in ackMsg.crc ***
-    ackMsg.crc=0;
-    ackMsg.crc=calcChecksum((char *)&ackMsg,sizeof(ackMsg));
-
-  US_sendto(ABP_recvDataSock,(char *)&ackMsg,sizeof(ackMsg),0,
-	    (struct sockaddr *)&fromAddr,sizeof(fromAddr));
+  s->sendQueueSize = numMessages;
+  s->sendHighWater = highWater;
+  return 0;
+}
 
-  // ignore data packet if we weren't expecting it
-  if (tempMsg.seqNum != ABP_nextRecvSeqNum)
-    return;
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetSendCallback
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetSendCallback (ABP_session *s, ABP_sendCallback callback,
+				void *arg)
+{
+  if (s->sendSlots) {
+    printf ("setSendCallback: session already initialized\n");
+    return -1;
+  }
+
+  s->sendCallback = callback;
+  s->sendCallbackArg = arg;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetIntegrity
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetIntegrity (ABP_session *s, int integrity)
+{
+  if (integrity < ABP_INTEGRITY_CHECKSUM || integrity > ABP_LAST_INTEGRITY) {
+    printf ("setIntegrity: unknown integrity check\n");
+    return -1;
+  }
+
+  // takes effect with the next packet we send
+  s->integrity = integrity;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetEcc
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetEcc (ABP_session *s, int ecc)
+{
+  // packet buffers are allocated with room for the check words
+  if (s->sendSlots || s->recvSlots) {
+    printf ("setEcc: session already initialized\n");
+    return -1;
+  }
+
+  s->ecc = ecc != 0;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetHarq
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetHarq (ABP_session *s, int copies)
+{
+  if (copies < 0 || copies > ABP_MAX_HARQ_COPIES) {
+    printf ("setHarq: copies must be between 0 and %d\n",
+	    ABP_MAX_HARQ_COPIES);
+    return -1;
+  }
+  if (s->recvSlots) {
+    printf ("setHarq: session already initialized\n");
+    return -1;
+  }
+
+  s->harqCopies = copies;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetChannel
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetChannel (ABP_session *s, US_channel *channel)
+{
+  if (s->sendSlots || s->recvSlots) {
+    printf ("setChannel: session already initialized\n");
+    return -1;
+  }
+
+  s->channel = channel;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetLink
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetLink (ABP_session *s, VL_link *link)
+{
+  if (s->sendDataSock >= 0 || s->recvDataSock >= 0) {
+    printf ("setLink: session already initialized\n");
+    return -1;
+  }
+
+  // the link drives the session; without one it's back to signals
+  s->link = link;
+  s->backend = link ? ABP_BACKEND_VIRTUAL : ABP_BACKEND_SIGNAL;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetCongestion
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetCongestion (ABP_session *s, int algorithm)
+{
+  if (algorithm < ABP_CONGESTION_NONE || algorithm > ABP_CONGESTION_DELAY) {
+    printf ("setCongestion: unknown algorithm\n");
+    return -1;
+  }
+  if (s->sendSlots) {
+    printf ("setCongestion: session already initialized\n");
+    return -1;
+  }
+
+  s->congestion = algorithm;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionGetStats
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_sessionGetStats (ABP_session *s, struct ABP_stats *stats)
+{
+  sigset_t oldsigset;
+
+  // take a consistent copy
+  ABP_blockSignals (s, &oldsigset);
+  stats->cwnd = s->cwnd;
+  stats->ssthresh = s->ssthresh;
+  stats->srttUsecs = s->srtt >> 3;
+  stats->minRttUsecs = s->minRtt;
+  stats->rtoUsecs = s->rto;
+  stats->packetsSent = s->packetsSent;
+  stats->packetsLost = s->packetsLost;
+  stats->fecRepair = s->fecGroup ? s->fecRepair : 0;
+  ABP_restoreSignals (s, &oldsigset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionGetCounters
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_sessionGetCounters (ABP_session *s, struct ABP_counters *counters)
+{
+  // the counts are read one at a time, as another process would, so the
+  // protocol isn't held up
+  const unsigned long long *from = (const unsigned long long *)s->counters;
+  unsigned long long *to = (unsigned long long *)counters;
+  size_t i;
+
+  for (i = 0; i < sizeof(*counters) / sizeof(*to); i++)
+    to[i] = __atomic_load_n (&from[i], __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetSharedCounters
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetSharedCounters (ABP_session *s, const char *name)
+{
+  struct ABP_sharedCounters *shared;
+  int fd;
+
+  if (s->sendDataSock >= 0 || s->recvDataSock >= 0) {
+    printf ("setSharedCounters: session already initialized\n");
+    return -1;
+  }
+  if (s->shared) {
+    printf ("setSharedCounters: counters already shared\n");
+    return -1;
+  }
+
+  // start from nothing, even if an earlier run left the object behind
+  fd = shm_open (name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror ("setSharedCounters: shm_open");
+    return -1;
+  }
+  if (ftruncate (fd, sizeof(*shared)) < 0) {
+    perror ("setSharedCounters: ftruncate");
+    close (fd);
+    shm_unlink (name);
+    return -1;
+  }
+  shared = mmap (0, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		 0);
+  close (fd);
+  if (shared == MAP_FAILED || !(s->sharedName = strdup (name))) {
+    perror ("setSharedCounters: mmap");
+    if (shared != MAP_FAILED)
+      munmap (shared, sizeof(*shared));
+    shm_unlink (name);
+    return -1;
+  }
+
+  // readers check the magic number last
+  shared->size = sizeof(*shared);
+  shared->pid = getpid ();
+  __atomic_store_n (&shared->magic, ABP_COUNTERS_MAGIC, __ATOMIC_RELEASE);
+  s->shared = shared;
+  s->counters = &shared->counters;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_readSharedCounters
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_readSharedCounters (const char *name, struct ABP_counters *counters)
+{
+  // map another process's counts just long enough to copy them
+  const struct ABP_sharedCounters *shared;
+  const unsigned long long *from;
+  unsigned long long *to = (unsigned long long *)counters;
+  struct stat st;
+  size_t i;
+  int fd;
+
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0) {
+    perror ("readSharedCounters: shm_open");
+    return -1;
+  }
+  if (fstat (fd, &st) < 0 || st.st_size < (off_t)sizeof(*shared)) {
+    printf ("readSharedCounters: %s doesn't hold ABP counters\n", name);
+    close (fd);
+    return -1;
+  }
+  shared = mmap (0, sizeof(*shared), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (shared == MAP_FAILED) {
+    perror ("readSharedCounters: mmap");
+    return -1;
+  }
+  if (__atomic_load_n (&shared->magic, __ATOMIC_ACQUIRE) !=
+      ABP_COUNTERS_MAGIC || shared->size != sizeof(*shared)) {
+    printf ("readSharedCounters: %s doesn't hold ABP counters\n", name);
+    munmap ((void *)shared, sizeof(*shared));
+    return -1;
+  }
+
+  from = (const unsigned long long *)&shared->counters;
+  for (i = 0; i < sizeof(*counters) / sizeof(*to); i++)
+    to[i] = __atomic_load_n (&from[i], __ATOMIC_RELAXED);
+  munmap ((void *)shared, sizeof(*shared));
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetReusePort
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetReusePort (ABP_session *s, int reusePort)
+{
+  if (s->recvDataSock >= 0) {
+    printf ("setReusePort: session already initialized\n");
+    return -1;
+  }
+
+  s->reusePort = reusePort;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSetBackend
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSetBackend (ABP_session *s, int backend)
+{
+  if (backend != ABP_BACKEND_SIGNAL && backend != ABP_BACKEND_EPOLL &&
+      backend != ABP_BACKEND_VIRTUAL) {
+    printf ("setBackend: unknown backend\n");
+    return -1;
+  }
+  if (s->sendDataSock >= 0 || s->recvDataSock >= 0) {
+    printf ("setBackend: session already initialized\n");
+    return -1;
+  }
+  if (backend == ABP_BACKEND_VIRTUAL && !s->link) {
+    printf ("setBackend: the virtual backend needs a link (setLink)\n");
+    return -1;
+  }
+
+  // only the virtual backend runs over a link
+  s->backend = backend;
+  if (backend != ABP_BACKEND_VIRTUAL)
+    s->link = 0;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionGetFd
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionGetFd (ABP_session *s)
+{
+  // the epoll descriptor becomes readable whenever ABP_sessionProcess has
+  // work
+  return s->epollFd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionProcess
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionProcess (ABP_session *s, int timeoutMsecs)
+{
+  struct epoll_event events[ABP_MAX_EVENTS];
+  unsigned long long expirations;
+  int numEvents;
+  int i;
+
+  if (s->backend == ABP_BACKEND_VIRTUAL)
+    return ABP_linkProcess (s, timeoutMsecs);
+  if (s->epollFd < 0) {
+    printf ("ABP_process: epoll backend not initialized\n");
+    return -1;
+  }
+
+  numEvents = epoll_wait (s->epollFd, events, ABP_MAX_EVENTS, timeoutMsecs);
+  if (numEvents < 0) {
+    if (errno == EINTR)
+      return 0;
+    perror ("ABP_process: epoll_wait");
+    return -1;
+  }
+
+  for (i = 0; i < numEvents; i++) {
+    switch (events[i].data.u32) {
+    case ABP_EVENT_ACK:
+      while (ABP_recvAcks (s) == ABP_BATCH_SIZE)
+	;
+      break;
+    case ABP_EVENT_DATA:
+      while (ABP_recvData (s) == ABP_BATCH_SIZE)
+	;
+      break;
+    case ABP_EVENT_TIMER:
+      // reset the timerfd's expiration count before handling the timeouts
+      if (read (s->timerFd, &expirations, sizeof(expirations)) > 0)
+	ABP_checkTimeouts (s);
+      break;
+    }
+  }
+
+  return numEvents;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSendInit
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSendInit (ABP_session *s, char *hostname, short portNum)
+{
+  struct hostent *hp;
+  unsigned int queueSize;
+  int i;
+
+  if (s->sendSlots) {
+    printf ("sendInit: session already initialized\n");
+    return -1;
+  }
+  if (s->fecGroup && (s->windowSize == 1 || s->fecGroup > s->windowSize)) {
+    printf ("sendInit: FEC groups must fit in a window of more than 1\n");
+    return -1;
+  }
+
+  // the send window is empty, and so is the queue for ABP_sendAsync and
+  // its completions.  The queue size is rounded up to a power of 2 so
+  // positions can be masked.
+  for (queueSize = 1; queueSize < s->sendQueueSize; queueSize <<= 1)
+    ;
+  s->sendQueueSize = queueSize;
+  s->sendSlots = calloc (s->windowSize, sizeof(struct ABP_sendSlot));
+  s->sendBufs = ABP_allocPackets (s, s->windowSize);
+  s->sendQueue = malloc ((size_t)queueSize * sizeof(struct ABP_sendRequest));
+  s->completions = malloc ((size_t)queueSize *
+			   sizeof(struct ABP_sendCompletion));
+  if (!s->sendSlots || !s->sendBufs || !s->sendQueue || !s->completions) {
+    perror ("sendInit: calloc");
+    return -1;
+  }
+  for (i = 0; i < s->windowSize; i++)
+    s->sendSlots[i].msg = ABP_packetBuf (s, s->sendBufs, i);
+
+  // two sets of repair packets, so one group's can wait to be sent while
+  // the next group's are built
+  if (s->fecGroup) {
+    s->fecBufs = malloc (2 * s->fecMaxRepair * ABP_REPAIR_BUF_SIZE (s));
+    if (!s->fecBufs) {
+      perror ("sendInit: malloc");
+      return -1;
+    }
+    for (i = 0; i < 2 * s->fecMaxRepair; i++)
+      s->fecRepairs[i / s->fecMaxRepair][i % s->fecMaxRepair] =
+	(struct ABP_repairMsg *)(s->fecBufs + i * ABP_REPAIR_BUF_SIZE (s));
+    s->fecRepair = s->fecMinRepair;
+    s->fecCount = 0;
+    s->fecSet = 0;
+    s->fecQueued[0] = s->fecQueued[1] = 0;
+    s->packetsLost = 0;
+    s->peerRecovered = 0;
+    s->lossRate = 0;
+    s->fecLastSent = s->fecLastLost = 0;
+  }
+  s->sendBase = 0;
+  s->sendBaseIdx = 0;
+  s->sendCount = 0;
+  s->dupAcks = 0;
+
+  // assume the receiver has room for a window, and takes packets of the
+  // default size, until it says otherwise
+  s->sendWindow = s->windowSize;
+  s->peerPayload = ABP_DEFAULT_PAYLOAD_SIZE;
+
+  // start in slow start, which lasts until the first loss unless the
+  // window fills up first
+  s->cwnd = ABP_INITIAL_CWND;
+  if (s->congestion == ABP_CONGESTION_NONE || s->cwnd > s->windowSize)
+    s->cwnd = s->windowSize;
+  s->ssthresh = s->windowSize;
+  s->cwndCount = 0;
+  s->packetsSent = 0;
+  s->recoverPacket = 0;
+  s->minRtt = 0;
+  s->roundMinRtt = 0;
+  s->roundEnd = 0;
+
+  // no round trip time measured yet
+  s->srtt = 0;
+  s->rttvar = 0;
+  s->rto = ABP_INITIAL_RTO_USECS;
+
+  // initialize initial sequence number
+  s->nextSendSeqNum  = 0;
+
+  // translate hostname into host's IP address
+  hp = gethostbyname(hostname);
+  if (!hp){
+    perror ("sendInit: gethostbyname");
+    return -1;
+  }
+
+  // build address data structures
+  memset (&s->sendDataAddr, 0, sizeof(s->sendDataAddr));
+  s->sendDataAddr.sin_family = AF_INET;
+  memmove (&s->sendDataAddr.sin_addr, hp->h_addr_list[0], hp->h_length);
+  s->sendDataAddr.sin_port = htons(portNum);
+
+  // create send socket, on the link with the virtual backend
+  if (s->link)
+    s->sendDataSock = VL_socket (s->link);
+  else
+    s->sendDataSock = socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
+  if (s->sendDataSock < 0){
+    printf ("sendInit: socket error\n");
+    return -1;
+  }
+
+  // send runs of packets with UDP GSO if we can (links don't do GSO)
+  s->sendBatch.maxSegment = s->link ? 0 : ABP_maxSegment (s);
+
+  // wait for acks
+  return ABP_backendInit (s, s->sendDataSock, ABP_EVENT_ACK);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSend
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSend (ABP_session *s, char *buf, int length)
+{
+  struct iovec iov;
+
+  iov.iov_base = buf;
+  iov.iov_len = length > 0 ? length : 0;
+  return ABP_sessionSendv (s, &iov, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSendv
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSendv (ABP_session *s, const struct iovec *iov, int iovcnt)
+{
+  sigset_t oldsigset;
+  struct ABP_sendSlot *slot;
+  int length = 0;
+  int offset = 0;
+  int fragLength;
+  int i;
+
+  // the message is the pieces one after another
+  for (i = 0; i < iovcnt; i++)
+    length += iov[i].iov_len;
+
+  // block SIGIO and SIGALRM so that we can't get a signal between
+  // testing the window and waiting, or between the sendto and setting the
+  // timers.
+  ABP_blockSignals (s, &oldsigset);
+
+  // send the message a fragment at a time.  Fragments that fit in the
+  // window go out together.
+  do {
+    // wait until it's OK to proceed (i.e., there is room in the send
+    // window, the receiver has room for another packet, and messages queued
+    // by ABP_sendAsync have gone first)
+    if (!ABP_windowOpen (s) || s->sendQueueHead != s->sendQueueTail) {
+      ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+      while (!ABP_windowOpen (s) || s->sendQueueHead != s->sendQueueTail)
+	if (ABP_wait (s, &oldsigset) < 0) {
+	  ABP_restoreSignals (s, &oldsigset);
+	  return -1;
+	}
+    }
+
+    fragLength = ABP_fragLength (s, length, offset);
+    slot = ABP_newPacket (s, iov, iovcnt, fragLength, length, offset);
+    slot->async = 0;
+    offset += fragLength;
+  } while (offset < length);
+  ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+
+  // restore signal mask
+  ABP_restoreSignals (s, &oldsigset);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionFlush
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionFlush (ABP_session *s)
+{
+  sigset_t oldsigset;
+  int result = 0;
+
+  // block SIGIO and SIGALRM so the last ack can't arrive between testing
+  // the window and waiting
+  ABP_blockSignals (s, &oldsigset);
+
+  // send the repair packets for the last group, even though it isn't
+  // full, once everything queued has gone into the window
+  if (s->fecGroup) {
+    while (result == 0 && s->sendQueueHead != s->sendQueueTail)
+      result = ABP_wait (s, &oldsigset);
+    if (result == 0) {
+      ABP_fecFinish (s);
+      ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+    }
+  }
+
+  // wait until all data has been acknowledged (i.e., the send window and
+  // the queue for it are empty)
+  while (result == 0 &&
+	 (s->sendCount > 0 || s->sendQueueHead != s->sendQueueTail))
+    result = ABP_wait (s, &oldsigset);
+
+  // restore signal mask
+  ABP_restoreSignals (s, &oldsigset);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSendAsync
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSendAsync (ABP_session *s, char *buf, int length, int flags,
+			  void *context)
+{
+  sigset_t oldsigset;
+  struct ABP_sendRequest *req;
+  int result = 0;
+
+  if (!s->sendSlots) {
+    printf ("sendAsync: session not initialized\n");
+    return -1;
+  }
+  if (length < 0) {
+    printf ("sendAsync: length can't be negative\n");
+    return -1;
+  }
+
+  // only a default packet's worth is copied; longer messages are sent from
+  // the caller's buffer
+  if (length > ABP_DEFAULT_PAYLOAD_SIZE && !(flags & ABP_SEND_NOCOPY)) {
+    printf ("sendAsync: messages over %d bytes need ABP_SEND_NOCOPY\n",
+	    ABP_DEFAULT_PAYLOAD_SIZE);
+    return -1;
+  }
+
+  ABP_blockSignals (s, &oldsigset);
+
+  // push back once too many messages are waiting to be sent, or their
+  // completions haven't been collected
+  if (s->sendQueueTail - s->sendQueueHead >= s->sendHighWater ||
+      s->asyncSubmitted - __atomic_load_n (&s->asyncCollected,
+					   __ATOMIC_ACQUIRE) >= s->sendQueueSize)
+    result = ABP_SEND_QUEUE_FULL;
+  else {
+    // keep a copy of the message unless the caller is handing it over
+    req = &s->sendQueue[s->sendQueueTail & (s->sendQueueSize - 1)];
+    if (flags & ABP_SEND_NOCOPY)
+      req->buf = buf;
+    else {
+      memmove (req->data, buf, length);
+      req->buf = req->data;
+    }
+    req->length = length;
+    req->sent = 0;
+    req->completion.context = context;
+    req->completion.buf = (flags & ABP_SEND_NOCOPY) ? buf : 0;
+    req->completion.status = 0;
+    s->sendQueueTail++;
+    s->asyncSubmitted++;
+
+    // send it right away if there's room
+    ABP_sendQueued (s);
+    ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+  }
+
+  ABP_restoreSignals (s, &oldsigset);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionSendComplete
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionSendComplete (ABP_session *s,
+			     struct ABP_sendCompletion *completion)
+{
+  // take the oldest completion from the ring without blocking the signals.
+  // The protocol won't reuse its entry until completionHead moves past it.
+  unsigned int head = s->completionHead;
+
+  if (!s->completions ||
+      __atomic_load_n (&s->completionTail, __ATOMIC_ACQUIRE) == head)
+    return 0;
+
+  *completion = s->completions[head & (s->sendQueueSize - 1)];
+  __atomic_store_n (&s->completionHead, head + 1, __ATOMIC_RELEASE);
+  __atomic_store_n (&s->asyncCollected, s->asyncCollected + 1,
+		    __ATOMIC_RELEASE);
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_SIGIO
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_SIGIO (int signalType)
+{
+  // SIGIO callback for received acks and data.  The signal doesn't say
+  // which socket is readable, and several packets may have arrived for a
+  // single signal, so read every session's sockets until they're empty.
+  ABP_session *s;
+
+  for (s = ABP_signalSessions; s; s = s->nextSignalSession) {
+    while (ABP_recvAcks (s) == ABP_BATCH_SIZE)
+      ;
+    while (ABP_recvData (s) == ABP_BATCH_SIZE)
+      ;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_recvAcks
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_recvAcks (ABP_session *s)
+{
+  // read and process up to a batch of acks.  Returns the number read; a
+  // negative value indicates there was nothing to read.
+  int numAcks;
+  int i;
+
+  if (s->sendDataSock < 0)
+    return -1;
+
+  numAcks = ABP_recvBatch (s, s->sendDataSock, s->recvAckBatch,
+			   sizeof(struct ABP_ackMsg));
+  if (numAcks <= 0)
+    return numAcks;
+  for (i = 0; i < numAcks; i++)
+    ABP_processAck (s, &s->recvAckBatch[i], s->recvBatchHdrs[i].msg_len);
+
+  // fill the room the acks made with queued messages, send them with any
+  // fast retransmissions, and wait for the next timeout
+  ABP_sendQueued (s);
+  ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+  ABP_armTimer (s);
+  return numAcks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_processAck
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_processAck (ABP_session *s, struct ABP_ackMsg *ack,
+			    int ackSize)
+{
+  // process one ack.  The caller arms the timer afterwards.
+  unsigned int crc;
+  unsigned int delta;
+  int offset;
+  int window;
+  int numAcked = 0;
+  long long restart;
+  int i;
+  struct ABP_sendSlot *slot;
+
+  // discard ack if it's not the expected size or version
+  if (ackSize < ABP_ACK_HDR_SIZE || ack->sackLen > ABP_MAX_SACK_BYTES ||
+      ackSize != ABP_ACK_HDR_SIZE + ack->sackLen ||
+      ack->versionType != ABP_VERSION_TYPE(ABP_TYPE_ACK) ||
+      ack->integrity > ABP_LAST_INTEGRITY) {
+    ABP_count (&s->counters->malformed, 1);
+    return;
+  }
+  // discard ack if error in transmission
+  crc = ack->crc;
+  ack->crc = 0;
+  if (ABP_calcCRC (ack->integrity, ack, ackSize) != crc) {
+    ABP_count (&s->counters->checksumFailures, 1);
+    TR_EVENT (TR_CHECKSUM, TR_PACKET_ACK, ntohs(s->sendDataAddr.sin_port), 0,
+	      ackSize, 0);
+    return;
+  }
+  ABP_count (&s->counters->acksReceived, 1);
+
+  // packets the receiver rebuilt were lost too.  The count wraps, and acks
+  // can arrive out of order.
+  delta = (unsigned short)(ntohs(ack->recovered) - s->peerRecovered);
+  if (delta < 32768) {
+    s->packetsLost += delta;
+    s->peerRecovered += delta;
+  }
+
+  // fragments from now on can be as big as the receiver takes
+  s->peerPayload = ntohs(ack->maxPayload);
+  if (s->peerPayload < ABP_DEFAULT_PAYLOAD_SIZE)
+    s->peerPayload = ABP_DEFAULT_PAYLOAD_SIZE;
+
+  offset = ABP_seqOffset (s, ack->ackNum, s->sendBase);
+  window = ntohs(ack->window);
+  if (TR_active)
+    ABP_traceAck (s, offset, window);
+  if (offset < s->sendCount) {
+    // everything up to and including ackNum has been received
+    slot = &s->sendSlots[(s->sendBaseIdx + offset) % s->windowSize];
+    if (!slot->acked)
+      ABP_updateRtt (s, slot);
+    for (i = 0; i <= offset; i++) {
+      slot = &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize];
+      slot->timeoutSet = 0;
+      if (!slot->acked)
+	numAcked++;
+    }
+    ABP_advanceSendBase (s, offset + 1);
+    s->dupAcks = 0;
+
+    // restart the timer for the new oldest packet
+    if (s->windowMode == ABP_GO_BACK_N && s->sendCount > 0)
+      ABP_setSendTimeout (s, &s->sendSlots[s->sendBaseIdx]);
+  }
+  else if (offset == ABP_SEQ_MODULUS(s) - 1) {
+    // repeats the last cumulative ack.  If the receiver's room hasn't
+    // changed, a later packet arrived.  A receiver with no room is still
+    // there, so don't give up on the packet it can't take yet.
+    ABP_count (&s->counters->duplicateAcks, 1);
+    if (s->sendCount > 0 && window > 0 && window == s->sendWindow)
+      s->dupAcks++;
+    if (s->sendCount > 0 && window == 0)
+      s->sendSlots[s->sendBaseIdx].numTimeouts = 0;
+  }
+  else {
+    // an old ack that arrived late
+    ABP_count (&s->counters->staleAcks, 1);
+    return;
+  }
+
+  s->sendWindow = window;
+
+  // selective repeat also learns about packets received out of order.  The
+  // window slides past every acknowledged packet at its start.
+  if (s->windowMode == ABP_SELECTIVE_REPEAT) {
+    for (i = 0; i < ack->sackLen * 8; i++) {
+      if (!(ack->sack[i / 8] & (1 << (i % 8))))
+	continue;
+      offset = ABP_seqOffset (s, (ack->ackNum + 2 + i) % ABP_SEQ_MODULUS(s),
+			      s->sendBase);
+      if (offset >= s->sendCount)
+	continue;
+      slot = &s->sendSlots[(s->sendBaseIdx + offset) % s->windowSize];
+      if (!slot->acked) {
+	ABP_updateRtt (s, slot);
+	numAcked++;
+      }
+      slot->acked = 1;
+      slot->timeoutSet = 0;
+    }
+
+    while (s->sendCount > 0 && s->sendSlots[s->sendBaseIdx].acked)
+      ABP_advanceSendBase (s, 1);
+
+    // an ack for new data shows packets are getting through, so the
+    // outstanding ones' timeouts run from now (RFC 6298 5.3), not from
+    // when they were queued behind the rest of their burst
+    if (numAcked > 0) {
+      restart = ABP_now (s) + s->rto;
+      for (i = 0; i < s->sendCount; i++) {
+	slot = &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize];
+	if (slot->timeoutSet && slot->timeout < restart)
+	  slot->timeout = restart;
+      }
+    }
+  }
+
+  ABP_congestionAcked (s, numAcked);
+  ABP_fastRetransmit (s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fastRetransmit
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fastRetransmit (ABP_session *s)
+{
+  // resend packets the acks show were lost, without waiting for them to
+  // time out.  Each packet is only resent this way once.
+  struct ABP_sendSlot *slot;
+  int laterAcked;
+  int i;
+
+  if (s->sendCount == 0)
+    return;
+
+  if (s->windowMode == ABP_GO_BACK_N) {
+    // the receiver has been throwing away the packets after the oldest
+    // one, so go back and resend all of them
+    slot = &s->sendSlots[s->sendBaseIdx];
+    if (s->dupAcks < ABP_DUP_ACK_THRESHOLD || slot->fastRetransmitted)
+      return;
+    slot->fastRetransmitted = 1;
+    s->packetsLost++;
+    ABP_congestionLoss (s, slot, 0);
+    for (i = 0; i < s->sendCount; i++)
+      ABP_resend (s, &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize]);
+    ABP_setSendTimeout (s, slot);
+    return;
+  }
+
+  // selective repeat resends a packet once enough packets after it have
+  // been acknowledged.  Duplicate acks count against the oldest packet
+  // too, in case the acks that carried the sack bits were lost.
+  laterAcked = 0;
+  for (i = s->sendCount - 1; i >= 0; i--) {
+    slot = &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize];
+    if (slot->acked) {
+      laterAcked++;
+      continue;
+    }
+    if (slot->fastRetransmitted)
+      continue;
+    if (laterAcked >= ABP_DUP_ACK_THRESHOLD ||
+	(i == 0 && s->dupAcks >= ABP_DUP_ACK_THRESHOLD)) {
+      slot->fastRetransmitted = 1;
+      s->packetsLost++;
+      ABP_congestionLoss (s, slot, 0);
+      ABP_resend (s, slot);
+      ABP_setSendTimeout (s, slot);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sendTimer
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_sendTimer(int signalType)
+{
+  // SIGALRM callback for the retransmission timer, which is shared by all
+  // sessions using signals
+  ABP_session *s;
+
+  for (s = ABP_signalSessions; s; s = s->nextSignalSession)
+    ABP_checkTimeouts (s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_checkTimeouts
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_checkTimeouts (ABP_session *s)
+{
+  long long currTime;
+  // timer expired, which means at least one timeout has passed.
+
+  // the channel may be holding back packets that are due by now
+  US_channelFlush (s->channel);
+
+  currTime = ABP_now (s);
+  ABP_checkSendTimeouts (s, currTime);
+  ABP_checkAckTimeouts (s, currTime);
+
+  // giving up on packets may have made room for queued messages
+  ABP_sendQueued (s);
+  ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+
+  // wait for the next timeout
+  ABP_armTimer (s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_checkSendTimeouts
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_checkSendTimeouts (ABP_session *s, long long currTime)
+{
+  struct ABP_sendSlot *slot;
+  int backedOff = 0;
+  int i;
+
+  // check every outstanding packet.  Go-Back-N only has a timeout set on
+  // the oldest one.
+  for (i = 0; i < s->sendCount; i++) {
+    slot = &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize];
+
+    // nothing to do unless there is a timeout set
+    if (!slot->timeoutSet)
+      continue;
+
+    // still nothing to do unless the timeout time has passed
+    if (currTime < slot->timeout)
+      continue;
+
+    // timeout has occurred, so handle it
+    // increment number of timeouts
+    slot->numTimeouts++;
+    s->packetsLost++;
+    ABP_count (&s->counters->timeouts, 1);
+    TR_EVENT (TR_TIMEOUT, 0, ntohs(s->sendDataAddr.sin_port), slot->packetNum,
+	      0, s->rto);
+
+    // back off exponentially until an ack arrives, and start again from
+    // slow start.  Packets that time out together only count once.
+    if (!backedOff) {
+      s->rto *= 2;
+      if (s->rto > ABP_MAX_RTO_USECS)
+	s->rto = ABP_MAX_RTO_USECS;
+      ABP_congestionLoss (s, slot, 1);
+      backedOff = 1;
+    }
+
+    // if too many timeouts we'll just give up on this packet
+    if (slot->numTimeouts > ABP_MAX_TIMEOUTS) {
+      ABP_count (&s->counters->gaveUp, 1);
+      ABP_clearSendTimeout (s, slot);
+      slot->gaveUp = 1;
+      if (s->windowMode == ABP_GO_BACK_N) {
+	ABP_advanceSendBase (s, 1);
+	if (s->sendCount > 0)
+	  ABP_setSendTimeout (s, &s->sendSlots[s->sendBaseIdx]);
+	break;
+      }
+      slot->acked = 1;
+      continue;
+    }
+
+    if (s->windowMode == ABP_GO_BACK_N) {
+      // go back and resend every outstanding packet
+      int j;
+      for (j = 0; j < s->sendCount; j++)
+	ABP_resend (s, &s->sendSlots[(s->sendBaseIdx + j) % s->windowSize]);
+    }
+    else
+      // resend just this message
+      ABP_resend (s, slot);
+
+    // reset timeout
+    ABP_setSendTimeout (s, slot);
+  }
+
+  // send the retransmissions together
+  ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+
+  // selective repeat may have given up on the oldest packets
+  while (s->sendCount > 0 && s->sendSlots[s->sendBaseIdx].acked)
+    ABP_advanceSendBase (s, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_checkAckTimeouts
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_checkAckTimeouts (ABP_session *s, long long currTime)
+{
+  // send the delayed acks that are due.  The list is in deadline order,
+  // so stop at the first one that isn't.
+  while (s->ackHead && s->ackHead->ackDeadline <= currTime)
+    ABP_sendAck (s, s->ackHead);
+  ABP_batchFlush (&s->ackBatch, s->recvDataSock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_resend
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_resend (ABP_session *s, struct ABP_sendSlot *slot)
+{
+  // retransmit an outstanding packet with the others that timed out.  Its
+  // ack can't be used to measure the round trip time (Karn's algorithm).
+  slot->retransmitted = 1;
+  TR_EVENT (TR_RETRANSMIT, 0, ntohs(s->sendDataAddr.sin_port), slot->packetNum,
+	    ntohs(slot->msg->length), s->cwnd);
+  ABP_count (&s->counters->retransmissions, 1);
+  ABP_count (&s->counters->packetsSent, 1);
+  ABP_count (&s->counters->bytesSent, ntohs(slot->msg->length));
+  ABP_batchAdd (&s->sendBatch, s->sendDataSock, slot->msg,
+		ABP_wireSize (s, ABP_DATA_HDR_SIZE + ntohs(slot->msg->length)),
+		&s->sendDataAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_newPacket
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_sendSlot *ABP_newPacket (ABP_session *s,
+					   const struct iovec *iov,
+					   int iovcnt, int length,
+					   int msgLength, int fragOffset)
+{
+  // put a fragment of a message (length bytes of msgLength, starting at
+  // fragOffset) at the end of the send window and add it to the batch
+  // going out next.  The message is gathered from the pieces in iov.  The
+  // caller makes sure there's room.
+  struct ABP_sendSlot *slot;
+  unsigned int sum = 0;
+  size_t skip = fragOffset;
+  int copied = 0;
+  int n;
+  int i;
+
+  // the next free slot follows the outstanding packets
+  slot = &s->sendSlots[(s->sendBaseIdx + s->sendCount) % s->windowSize];
+
+  // copy data into message buffer, skipping the pieces before the
+  // fragment.  The Internet checksum adds the data up on the way, so only
+  // the header is gone over again.
+  for (i = 0; i < iovcnt && copied < length; i++) {
+    if (skip >= iov[i].iov_len) {
+      skip -= iov[i].iov_len;
+      continue;
+    }
+    n = iov[i].iov_len - skip;
+    if (n > length - copied)
+      n = length - copied;
+    if (s->integrity == ABP_INTEGRITY_INET)
+      sum = inetSumAt (sum, inetCopySum (slot->msg->data + copied,
+					 (char *)iov[i].iov_base + skip, n, 0),
+		       copied);
+    else
+      memmove (slot->msg->data + copied, (char *)iov[i].iov_base + skip, n);
+    copied += n;
+    skip = 0;
+  }
+  slot->msg->versionType = ABP_VERSION_TYPE(ABP_TYPE_DATA);
+  slot->msg->integrity = s->integrity;
+  slot->msg->length = htons(length);
+  slot->msg->msgLength = htonl(msgLength);
+  slot->msg->fragOffset = htonl(fragOffset);
+  slot->msg->seqNum = s->nextSendSeqNum;
+  slot->msg->crc = 0;
+  if (s->integrity == ABP_INTEGRITY_INET) {
+    sum = inetSumAt (inetSum (0, slot->msg, ABP_DATA_HDR_SIZE), sum,
+		     ABP_DATA_HDR_SIZE);
+    slot->msg->crc = htonl (ntohs (~sum & 0xffff));
+  }
+  else
+    slot->msg->crc = ABP_calcCRC (s->integrity, slot->msg,
+				 ABP_DATA_HDR_SIZE + length);
+
+  if (s->ecc)
+    eccEncode (slot->msg, ABP_DATA_HDR_SIZE + length);
+
+  ABP_batchAdd (&s->sendBatch, s->sendDataSock, slot->msg,
+		ABP_wireSize (s, ABP_DATA_HDR_SIZE + length), &s->sendDataAddr);
+  ABP_fecAdd (s, slot->msg, ABP_DATA_HDR_SIZE + length);
+  ABP_count (&s->counters->packetsSent, 1);
+  ABP_count (&s->counters->bytesSent, length);
+
+  // no timeouts yet
+  slot->numTimeouts = 0;
+  slot->retransmitted = 0;
+  slot->fastRetransmitted = 0;
+  slot->gaveUp = 0;
+  slot->packetNum = s->packetsSent++;
+  slot->sentTime = ABP_now (s);
+  TR_EVENT (TR_SEND, 0, ntohs(s->sendDataAddr.sin_port), slot->packetNum,
+	    length, s->cwnd);
+  slot->acked = 0;
+
+  // the packet is now outstanding
+  s->sendCount++;
+  s->nextSendSeqNum = (s->nextSendSeqNum + 1) % ABP_SEQ_MODULUS(s);
+
+  // set timeout.  Go-Back-N only times the oldest outstanding packet.
+  if (s->windowMode == ABP_SELECTIVE_REPEAT || s->sendCount == 1)
+    ABP_setSendTimeout (s, slot);
+
+  return slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fragLength
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_fragLength (ABP_session *s, int msgLength, int fragOffset)
+{
+  // bytes of a message of msgLength bytes that go in the fragment starting
+  // at fragOffset: as many as both we and the receiver allow.  Repair
+  // packets and check words have to fit in a datagram too.
+  int length = msgLength - fragOffset;
+  int payload = s->payloadSize;
+  int limit = ABP_MAX_PAYLOAD_SIZE;
+
+  if (payload > s->peerPayload)
+    payload = s->peerPayload;
+  if (s->fecGroup)
+    limit -= ABP_REPAIR_HDR_SIZE;
+  if (s->ecc)
+    limit -= ECC_MAX_SIZE;
+  if (payload > limit)
+    payload = limit;
+  if (length > payload)
+    return payload;
+  return length > 0 ? length : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_wireSize
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_wireSize (ABP_session *s, int length)
+{
+  // bytes sent for a packet of length bytes, with its check words if any
+  return s->ecc ? length + eccSize (length) : length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_allocPackets
+//
+///////////////////////////////////////////////////////////////////////////////
+static char *ABP_allocPackets (ABP_session *s, size_t count)
+{
+  // allocate buffers for count packets of the session's payload size,
+  // and their check words.  Each is rounded up to 8 bytes so the next one
+  // is aligned.
+  s->packetBufSize = (ABP_DATA_HDR_SIZE + s->payloadSize +
+		      (s->ecc ? ECC_MAX_SIZE : 0) + 7) & ~7;
+  return malloc (count * s->packetBufSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_packetBuf
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_dataMsg *ABP_packetBuf (ABP_session *s, char *bufs,
+					  size_t i)
+{
+  // the i'th packet buffer allocated by ABP_allocPackets
+  return (struct ABP_dataMsg *)(bufs + i * s->packetBufSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_windowOpen
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_windowOpen (ABP_session *s)
+{
+  // nonzero if another packet may be sent: there's room in the send window
+  // and the congestion window, and the receiver has room for it.  One
+  // packet may always be outstanding, so a receiver that is full keeps
+  // being asked.
+  return s->sendCount < s->windowSize &&
+    (s->sendCount == 0 ||
+     (s->sendCount < s->sendWindow && s->sendCount < s->cwnd));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sendQueued
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_sendQueued (ABP_session *s)
+{
+  // move messages from ABP_sendAsync's queue into the send window while
+  // there's room, a fragment at a time.  They go out with the next batch.
+  struct ABP_sendRequest *req;
+  struct ABP_sendSlot *slot;
+  struct iovec iov;
+  int fragLength;
+
+  while (s->sendQueueHead != s->sendQueueTail && ABP_windowOpen (s)) {
+    req = &s->sendQueue[s->sendQueueHead & (s->sendQueueSize - 1)];
+    if (s->sendBatch.count == ABP_BATCH_SIZE)
+      ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+    fragLength = ABP_fragLength (s, req->length, req->sent);
+    iov.iov_base = req->buf;
+    iov.iov_len = req->length;
+    slot = ABP_newPacket (s, &iov, 1, fragLength, req->length, req->sent);
+    req->sent += fragLength;
+
+    // the last fragment leaves the window last, so it carries the
+    // completion
+    slot->async = req->sent >= req->length;
+    if (slot->async) {
+      slot->completion = req->completion;
+      s->sendQueueHead++;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_complete
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_complete (ABP_session *s, struct ABP_sendSlot *slot)
+{
+  // a packet is leaving the send window.  If it ends a message from
+  // ABP_sendAsync, pass its completion to the callback or put it where
+  // ABP_sendComplete will find it.  Packets leave in order, so the message
+  // failed if any of its fragments since the last one ended were given up
+  // on.
+  unsigned int tail;
+
+  if (slot->gaveUp)
+    s->msgGaveUp = 1;
+  if (ntohl(slot->msg->fragOffset) + ntohs(slot->msg->length) <
+      ntohl(slot->msg->msgLength))
+    return;
+  slot->completion.status = s->msgGaveUp ? -1 : 0;
+  s->msgGaveUp = 0;
+
+  if (!slot->async)
+    return;
+  slot->async = 0;
+
+  if (s->sendCallback) {
+    s->sendCallback (&slot->completion, s->sendCallbackArg);
+    __atomic_store_n (&s->asyncCollected, s->asyncCollected + 1,
+		      __ATOMIC_RELEASE);
+    return;
+  }
+
+  // ABP_sendAsync never lets more messages in than there's room for here
+  tail = s->completionTail;
+  s->completions[tail & (s->sendQueueSize - 1)] = slot->completion;
+  __atomic_store_n (&s->completionTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_advanceSendBase
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_advanceSendBase (ABP_session *s, int count)
+{
+  // slide the send window past count packets that need no more attention
+  int i;
+
+  for (i = 0; i < count; i++)
+    ABP_complete (s, &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize]);
+  s->sendBase = (s->sendBase + count) % ABP_SEQ_MODULUS(s);
+  s->sendBaseIdx = (s->sendBaseIdx + count) % s->windowSize;
+  s->sendCount -= count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_seqOffset
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_seqOffset (ABP_session *s, int seqNum, int base)
+{
+  // distance from base forward to seqNum in sequence number space
+  return (seqNum - base + ABP_SEQ_MODULUS(s)) % ABP_SEQ_MODULUS(s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_setSendTimeout
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_setSendTimeout (ABP_session *s, struct ABP_sendSlot *slot)
+{
+  // set the send timeout time to be the current time + rto
+
+  sigset_t oldsigset;
+
+  // first, block SIGALRM and SIGIO so the timer and asynchronous input
+  // can't happen while we're playing with the timeout structures
+  ABP_blockSignals (s, &oldsigset);
+
+  // add the retransmission timeout to the current time to get the time
+  // the timeout expires
+  slot->timeout = ABP_now (s) + s->rto;
+
+  // the timeout is now set
+  slot->timeoutSet = 1;
+  ABP_armTimer (s);
+
+  // restore signal mask
+  ABP_restoreSignals (s, &oldsigset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_clearSendTimeout
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_clearSendTimeout (ABP_session *s, struct ABP_sendSlot *slot)
+{
+  // clear the send timeout
+
+  sigset_t oldsigset;
+
+  // first, block SIGALRM and SIGIO so the timer and asynchronous input
+  // can't happen while we're playing with the timeout structures
+  ABP_blockSignals (s, &oldsigset);
+
+  // the timeout is not set anymore
+  slot->timeoutSet = 0;
+  ABP_armTimer (s);
+
+  // restore signal mask
+  ABP_restoreSignals (s, &oldsigset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_armTimer
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_armTimer (ABP_session *s)
+{
+  // set the session's timerfd, or the interval timer shared by all
+  // sessions using signals, to go off when the earliest timeout expires, or
+  // stop it if no timeout is set.  Called with SIGALRM blocked.
+  struct itimerval timeVal;
+  struct itimerspec timerSpec;
+  ABP_session *other;
+  long long deadline;
+  long long otherDeadline;
+  long long delay;
+
+  // a link's clock only moves on to the next timeout when the link's
+  // driver finds it
+  if (s->backend == ABP_BACKEND_VIRTUAL)
+    return;
+
+  if (s->backend == ABP_BACKEND_EPOLL) {
+    if (s->timerFd < 0)
+      return;
+    // the timerfd uses the same clock as ABP_now, so it can be set to the
+    // deadline itself
+    deadline = ABP_earliestTimeout (s);
+    memset (&timerSpec, 0, sizeof(timerSpec));
+    timerSpec.it_value.tv_sec = deadline / 1000000;
+    timerSpec.it_value.tv_nsec = (deadline % 1000000) * 1000;
+    if (timerfd_settime (s->timerFd,TFD_TIMER_ABSTIME,&timerSpec,0) < 0)
+      perror ("ABP_armTimer: timerfd_settime error");
+    return;
+  }
+
+  deadline = 0;
+  for (other = ABP_signalSessions; other; other = other->nextSignalSession) {
+    otherDeadline = ABP_earliestTimeout (other);
+    if (otherDeadline && (!deadline || otherDeadline < deadline))
+      deadline = otherDeadline;
+  }
+
+  memset (&timeVal, 0, sizeof(timeVal));
+  if (deadline) {
+    // a zero it_value would stop the timer, so fire at least 1 usec from now
+    delay = deadline - ABP_now (s);
+    if (delay < 1)
+      delay = 1;
+    timeVal.it_value.tv_sec = delay / 1000000;
+    timeVal.it_value.tv_usec = delay % 1000000;
+  }
+  if (setitimer (ITIMER_REAL,&timeVal,0) < 0)
+    perror ("ABP_armTimer: setitimer error");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_earliestTimeout
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long ABP_earliestTimeout (ABP_session *s)
+{
+  // time the session's next timeout expires, or 0 if none is set
+  struct ABP_sendSlot *slot;
+  long long deadline = 0;
+  long long due;
+  int i;
+
+  for (i = 0; i < s->sendCount; i++) {
+    slot = &s->sendSlots[(s->sendBaseIdx + i) % s->windowSize];
+    if (slot->timeoutSet && (!deadline || slot->timeout < deadline))
+      deadline = slot->timeout;
+  }
+
+  // the first delayed ack is the one due soonest
+  if (s->ackHead && (!deadline || s->ackHead->ackDeadline < deadline))
+    deadline = s->ackHead->ackDeadline;
+
+  // and so does the next packet the channel is holding back (on the same
+  // clock as ABP_now)
+  due = US_channelNextDue (s->channel);
+  if (due && (!deadline || due < deadline))
+    deadline = due;
+  return deadline;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_updateRtt
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_updateRtt (ABP_session *s, struct ABP_sendSlot *slot)
+{
+  // update the round trip time estimates from the ack of slot and compute
+  // a new retransmission timeout (Jacobson/Karels, RFC 6298)
+  long long rtt;
+
+  // an ack for a retransmitted packet may be for either copy
+  if (slot->retransmitted)
+    return;
+
+  rtt = ABP_now (s) - slot->sentTime;
+  if (rtt < 1)
+    rtt = 1;
+  ABP_countRtt (s, rtt);
+  if (!s->minRtt || rtt < s->minRtt)
+    s->minRtt = rtt;
+  if (ABP_congestionOps[s->congestion].rtt)
+    ABP_congestionOps[s->congestion].rtt (s, rtt);
+
+  if (s->srtt == 0) {
+    // first measurement
+    s->srtt = rtt << 3;
+    s->rttvar = rtt << 1;
+  }
+  else {
+    // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|,  srtt = 7/8 srtt + 1/8 rtt
+    rtt -= s->srtt >> 3;
+    s->srtt += rtt;
+    if (rtt < 0)
+      rtt = -rtt;
+    s->rttvar += rtt - (s->rttvar >> 2);
+  }
+
+  // rto = srtt + 4 rttvar, which also undoes any backoff
+  s->rto = (s->srtt >> 3) + s->rttvar;
+  if (s->rto < ABP_MIN_RTO_USECS)
+    s->rto = ABP_MIN_RTO_USECS;
+  if (s->rto > ABP_MAX_RTO_USECS)
+    s->rto = ABP_MAX_RTO_USECS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_congestionAcked
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_congestionAcked (ABP_session *s, int numAcked)
+{
+  // let the congestion control algorithm open the window.  It stays as it
+  // is while packets sent before the last loss are still outstanding.
+  if (numAcked == 0 || ABP_inRecovery (s) ||
+      !ABP_congestionOps[s->congestion].acked)
+    return;
+
+  ABP_congestionOps[s->congestion].acked (s, numAcked);
+  if (s->cwnd > s->windowSize)
+    s->cwnd = s->windowSize;
+  if (s->cwnd < 1)
+    s->cwnd = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_congestionLoss
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_congestionLoss (ABP_session *s, struct ABP_sendSlot *slot,
+				int timeout)
+{
+  // slot was lost.  Halve the window (RFC 5681), or after a timeout drop
+  // it to one packet and slow start back up to half.  A window of packets
+  // can lose several, but that's only one sign of congestion.
+  if (s->congestion == ABP_CONGESTION_NONE)
+    return;
+  if (!timeout && (int)(slot->packetNum - s->recoverPacket) < 0)
+    return;
+
+  s->ssthresh = s->sendCount / 2;
+  if (s->ssthresh < 2)
+    s->ssthresh = 2;
+  s->cwnd = timeout ? 1 : s->ssthresh;
+  s->cwndCount = 0;
+  s->recoverPacket = s->packetsSent;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_inRecovery
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_inRecovery (ABP_session *s)
+{
+  // nonzero while packets sent before the last loss are outstanding
+  return s->sendCount > 0 &&
+    (int)(s->sendSlots[s->sendBaseIdx].packetNum - s->recoverPacket) < 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_renoAcked
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_renoAcked (ABP_session *s, int numAcked)
+{
+  // slow start grows the window by a packet for every packet acknowledged,
+  // doubling it every round trip.  Congestion avoidance grows it by one
+  // packet a round trip.
+  if (s->cwnd < s->ssthresh) {
+    s->cwnd += numAcked;
+    return;
+  }
+
+  s->cwndCount += numAcked;
+  while (s->cwndCount >= s->cwnd) {
+    s->cwndCount -= s->cwnd;
+    s->cwnd++;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_delayAcked
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_delayAcked (ABP_session *s, int numAcked)
+{
+  // once a round, estimate how many of our packets are sitting in queues:
+  // cwnd packets take roundMinRtt instead of minRtt, so
+  // cwnd * (roundMinRtt - minRtt) / roundMinRtt of them are waiting.  Grow
+  // the window while that's below alpha, shrink it when it's above beta.
+  long long queued;
+
+  if (s->cwnd < s->ssthresh)
+    s->cwnd += numAcked;
+
+  // the round isn't over until its packets have all been acknowledged
+  if (s->sendCount > 0 &&
+      (int)(s->sendSlots[s->sendBaseIdx].packetNum - s->roundEnd) < 0)
+    return;
+
+  if (s->roundMinRtt && s->minRtt) {
+    queued = s->cwnd * (s->roundMinRtt - s->minRtt) / s->roundMinRtt;
+    if (s->cwnd < s->ssthresh) {
+      // leave slow start before the queue grows
+      if (queued > ABP_DELAY_GAMMA)
+	s->ssthresh = s->cwnd;
+    }
+    else if (queued < ABP_DELAY_ALPHA)
+      s->cwnd++;
+    else if (queued > ABP_DELAY_BETA && s->cwnd > 2)
+      s->cwnd--;
+  }
+
+  // the next round is the packets sent from now on
+  s->roundEnd = s->packetsSent;
+  s->roundMinRtt = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_delayRtt
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_delayRtt (ABP_session *s, long long rtt)
+{
+  if (!s->roundMinRtt || rtt < s->roundMinRtt)
+    s->roundMinRtt = rtt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecAdd (ABP_session *s, struct ABP_dataMsg *msg, int length)
+{
+  // add a new packet (length bytes, header and all) to its group's repair
+  // packets, and send them once the group is complete
+  struct ABP_repairMsg **repairs;
+  int j;
+
+  if (!s->fecGroup)
+    return;
+  if (s->fecCount == 0)
+    ABP_fecStart (s, msg->seqNum);
+  repairs = s->fecRepairs[s->fecSet];
+
+  // shorter packets count as if padded with zeros, so the sums so far are
+  // padded too
+  if (length > s->fecLength) {
+    for (j = 0; j < s->fecRepair; j++)
+      memset (repairs[j]->data + s->fecLength, 0, length - s->fecLength);
+    s->fecLength = length;
+  }
+  for (j = 0; j < s->fecRepair; j++)
+    fecMulAdd (repairs[j]->data, msg, length, fecCoefficient (j, s->fecCount));
+
+  if (++s->fecCount == s->fecGroup)
+    ABP_fecFinish (s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecStart
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecStart (ABP_session *s, int seqNum)
+{
+  // start a group with packet seqNum.  Its repair packets are summed in
+  // the set the group before last used, which may still be waiting to go.
+  unsigned int sent, lost;
+  int sample;
+  int repair;
+
+  s->fecSet ^= 1;
+  if (s->sendBatch.flushes == s->fecQueued[s->fecSet] &&
+      s->sendBatch.count > 0)
+    ABP_batchFlush (&s->sendBatch, s->sendDataSock);
+
+  // average the fraction of packets lost since the last group started, and
+  // send about twice as many repair packets as that would need
+  sent = s->packetsSent - s->fecLastSent;
+  lost = s->packetsLost - s->fecLastLost;
+  if (sent > 0) {
+    sample = lost >= sent ? 65536 : (int)(((unsigned long long)lost << 16) /
+					  sent);
+    s->lossRate += (sample - s->lossRate) / 8;
+  }
+  s->fecLastSent = s->packetsSent;
+  s->fecLastLost = s->packetsLost;
+
+  repair = (2 * s->lossRate * s->fecGroup + 65535) >> 16;
+  if (repair < s->fecMinRepair)
+    repair = s->fecMinRepair;
+  if (repair > s->fecMaxRepair)
+    repair = s->fecMaxRepair;
+  s->fecRepair = repair;
+
+  s->fecBase = seqNum;
+  s->fecLength = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecFinish
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecFinish (ABP_session *s)
+{
+  // add the repair packets of the packets in the group so far to the
+  // batch going out next, and end the group
+  struct ABP_repairMsg *repair;
+  int j;
+
+  if (s->fecCount == 0)
+    return;
+
+  for (j = 0; j < s->fecRepair; j++) {
+    repair = s->fecRepairs[s->fecSet][j];
+    repair->versionType = ABP_VERSION_TYPE(ABP_TYPE_REPAIR);
+    repair->integrity = s->integrity;
+    repair->groupBase = s->fecBase;
+    repair->groupSize = s->fecCount;
+    repair->repairIdx = j;
+    repair->length = htons(s->fecLength);
+    repair->crc = 0;
+    repair->crc = ABP_calcCRC (s->integrity, repair,
+			       ABP_REPAIR_HDR_SIZE + s->fecLength);
+    if (s->ecc)
+      eccEncode (repair, ABP_REPAIR_HDR_SIZE + s->fecLength);
+    ABP_batchAdd (&s->sendBatch, s->sendDataSock, repair,
+		  ABP_wireSize (s, ABP_REPAIR_HDR_SIZE + s->fecLength),
+		  &s->sendDataAddr);
+  }
+  s->fecQueued[s->fecSet] = s->sendBatch.flushes;
+  s->fecCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecPacketNum
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ABP_fecPacketNum (ABP_session *s, struct ABP_peer *peer,
+				      int seqNum)
+{
+  // the number of peer's packet with sequence number seqNum: whichever is
+  // nearest the next one expected
+  int offset = ABP_seqOffset (s, seqNum, peer->nextRecvSeqNum);
+
+  if (offset >= ABP_SEQ_MODULUS(s) / 2)
+    offset -= ABP_SEQ_MODULUS(s);
+  return peer->nextRecvNum + offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecKeep
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_fecKeep (ABP_session *s, struct ABP_peer *peer,
+			struct ABP_dataMsg *msg, int length,
+			unsigned int packetNum)
+{
+  // keep a copy of packet packetNum (length bytes, as it was sent) in case
+  // it's needed to rebuild another.  Returns 0 if it was already kept.
+  struct ABP_fecSlot *slot;
+
+  slot = &peer->fecSlots[packetNum & (s->fecRingSize - 1)];
+  if (slot->valid && slot->packetNum == packetNum)
+    return 0;
+  memmove (slot->msg, msg, length);
+  slot->packetNum = packetNum;
+  slot->valid = 1;
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecPacket
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_dataMsg *ABP_fecPacket (ABP_session *s,
+					  struct ABP_peer *peer,
+					  unsigned int packetNum)
+{
+  // the kept copy of packet packetNum, or 0
+  struct ABP_fecSlot *slot;
+
+  if (!peer->fecSlots)
+    return 0;
+  slot = &peer->fecSlots[packetNum & (s->fecRingSize - 1)];
+  if (!slot->valid || slot->packetNum != packetNum)
+    return 0;
+  return slot->msg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecKeepRepair
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecKeepRepair (struct ABP_peer *peer,
+			       struct ABP_repairMsg *msg, int length,
+			       unsigned int groupBase)
+{
+  // keep a repair packet for the group starting at packet groupBase until
+  // the group's lost packets are rebuilt.  Groups that have been passed on
+  // make way first, then the oldest.
+  struct ABP_fecRepair *repair, *use = 0;
+  int i;
+
+  for (i = 0; i < ABP_FEC_REPAIR_SLOTS; i++) {
+    repair = &peer->fecRepairs[i];
+    if (repair->valid &&
+	(int)(repair->groupBase + repair->msg->groupSize -
+	      peer->nextRecvNum) <= 0)
+      repair->valid = 0;
+    if (!repair->valid) {
+      if (!use || use->valid)
+	use = repair;
+      continue;
+    }
+    if (repair->groupBase == groupBase &&
+	repair->msg->repairIdx == msg->repairIdx)
+      return;
+    if (!use || (use->valid &&
+		 (int)(repair->groupBase - use->groupBase) < 0))
+      use = repair;
+  }
+
+  memmove (use->msg, msg, length);
+  use->groupBase = groupBase;
+  use->valid = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecRecover
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecRecover (ABP_session *s, struct ABP_peer *peer,
+			    unsigned int packetNum)
+{
+  // packet packetNum has arrived.  If there are repair packets for its
+  // group, see whether they can rebuild the rest of it now.
+  struct ABP_fecRepair *repair;
+  int i;
+
+  for (i = 0; i < ABP_FEC_REPAIR_SLOTS; i++) {
+    repair = &peer->fecRepairs[i];
+    if (repair->valid &&
+	packetNum - repair->groupBase < repair->msg->groupSize) {
+      ABP_fecDecode (s, peer, repair->groupBase, repair->msg->groupSize);
+      return;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecDecode
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecDecode (ABP_session *s, struct ABP_peer *peer,
+			   unsigned int groupBase, int groupSize)
+{
+  // rebuild the lost packets of the group of groupSize packets starting at
+  // packet groupBase, if there are as many repair packets as lost ones,
+  // and process them as if they had arrived.  The group's repair packets
+  // are used up doing so.
+  unsigned char *out[ABP_FEC_MAX_REPAIR], *sums[ABP_FEC_MAX_REPAIR];
+  int index[ABP_FEC_MAX_REPAIR], repairIdx[ABP_FEC_MAX_REPAIR];
+  struct ABP_fecRepair *repair;
+  struct ABP_fecSlot *slot;
+  struct ABP_dataMsg *pkt;
+  unsigned int num, crc;
+  int numLost = 0, numRepair = 0;
+  int length = 0;
+  int i, j, n;
+
+  for (i = 0; i < groupSize; i++)
+    if (!ABP_fecPacket (s, peer, groupBase + i)) {
+      if (numLost == ABP_FEC_MAX_REPAIR)
+	return;
+      index[numLost++] = i;
+    }
+  if (numLost == 0) {
+    ABP_fecDrop (peer, groupBase);
+    return;
+  }
+
+  for (i = 0; i < ABP_FEC_REPAIR_SLOTS && numRepair < numLost; i++) {
+    repair = &peer->fecRepairs[i];
+    if (!repair->valid || repair->groupBase != groupBase ||
+	repair->msg->groupSize != groupSize)
+      continue;
+    if (numRepair == 0)
+      length = ntohs(repair->msg->length);
+    else if (ntohs(repair->msg->length) != length)
+      continue;
+    sums[numRepair] = repair->msg->data;
+    repairIdx[numRepair++] = repair->msg->repairIdx;
+  }
+  if (numRepair < numLost)
+    return;
+
+  // take the packets that did arrive out of the sums, leaving the lost ones
+  for (i = 0; i < groupSize; i++) {
+    pkt = ABP_fecPacket (s, peer, groupBase + i);
+    if (!pkt)
+      continue;
+    n = ABP_DATA_HDR_SIZE + ntohs(pkt->length);
+    if (n > length) {
+      // not the group the repair packets were made from
+      ABP_fecDrop (peer, groupBase);
+      return;
+    }
+    for (j = 0; j < numRepair; j++)
+      fecMulAdd (sums[j], pkt, n, fecCoefficient (repairIdx[j], i));
+  }
+
+  // and solve for them in their slots
+  for (j = 0; j < numLost; j++) {
+    slot = &peer->fecSlots[(groupBase + index[j]) & (s->fecRingSize - 1)];
+    slot->valid = 0;
+    out[j] = (unsigned char *)slot->msg;
+  }
+  i = fecSolve (out, sums, repairIdx, index, numLost, length);
+  ABP_fecDrop (peer, groupBase);
+  if (i < 0)
+    return;
+
+  // the crcs say whether they came out right
+  for (j = 0; j < numLost; j++) {
+    num = groupBase + index[j];
+    pkt = (struct ABP_dataMsg *)out[j];
+    n = ABP_DATA_HDR_SIZE + ntohs(pkt->length);
+    if (n > length || pkt->versionType != ABP_VERSION_TYPE(ABP_TYPE_DATA) ||
+	pkt->integrity > ABP_LAST_INTEGRITY ||
+	pkt->seqNum != num % ABP_SEQ_MODULUS(s))
+      continue;
+    crc = pkt->crc;
+    pkt->crc = 0;
+    if (ABP_calcCRC (pkt->integrity, pkt, n) != crc)
+      continue;
+    pkt->crc = crc;
+
+    slot = &peer->fecSlots[num & (s->fecRingSize - 1)];
+    slot->packetNum = num;
+    slot->valid = 1;
+    if ((int)(num - peer->nextRecvNum) >= 0) {
+      peer->recovered++;
+      ABP_processData (s, pkt, n, &peer->addr);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fecDrop
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_fecDrop (struct ABP_peer *peer, unsigned int groupBase)
+{
+  // forget the repair packets of the group starting at packet groupBase
+  int i;
+
+  for (i = 0; i < ABP_FEC_REPAIR_SLOTS; i++)
+    if (peer->fecRepairs[i].groupBase == groupBase)
+      peer->fecRepairs[i].valid = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_harqCombine
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_harqCombine (ABP_session *s, char *packet, int size,
+			    struct sockaddr_in *fromAddr)
+{
+  // a datagram of size bytes arrived damaged.  Try putting it together with
+  // the damaged copies the peer sent before that are the same size: by
+  // majority vote with the two nearest to it, or else by flipping bits it
+  // differs from one of them in.  Returns the length of the packet put
+  // right in harqScratch, or keeps the datagram in place of the peer's
+  // oldest copy and returns -1.
+  struct ABP_harqCopy *near[2] = {0, 0};
+  struct ABP_harqCopy *copy;
+  struct ABP_peer *peer;
+  int dist[2] = {0, 0};
+  int length;
+  int d, i;
+
+  // the check words (which can't be trusted anyway) aren't combined
+  length = s->ecc ? eccLength (size) : size;
+  if (length <= 0 || size > (int)ABP_REPAIR_BUF_SIZE (s))
+    return -1;
+  peer = ABP_findPeer (s, fromAddr);
+  if (!peer)
+    return -1;
+
+  // find the nearest.  Copies of other packets differ from it in about
+  // half their bits.
+  for (i = 0; i < s->harqCopies; i++) {
+    copy = &peer->harqCopies[i];
+    if (!copy->valid || copy->size != size)
+      continue;
+    d = ABP_harqDistance (packet, copy->buf, length);
+    if (!near[0] || d < dist[0]) {
+      near[1] = near[0];
+      dist[1] = dist[0];
+      near[0] = copy;
+      dist[0] = d;
+    }
+    else if (!near[1] || d < dist[1]) {
+      near[1] = copy;
+      dist[1] = d;
+    }
+  }
+
+  if (near[1] &&
+      ABP_harqVote (s, packet, near[0]->buf, near[1]->buf, length)) {
+    near[0]->valid = 0;
+    near[1]->valid = 0;
+    return length;
+  }
+  for (i = 0; i < 2 && near[i]; i++)
+    if (dist[i] <= ABP_HARQ_MAX_FLIPS &&
+	ABP_harqFlip (s, packet, near[i]->buf, length)) {
+      near[i]->valid = 0;
+      return length;
+    }
+
+  // keep it, in the first free slot or over the oldest copy
+  copy = &peer->harqCopies[0];
+  for (i = 1; i < s->harqCopies && copy->valid; i++)
+    if (!peer->harqCopies[i].valid ||
+	(int)(peer->harqCopies[i].age - copy->age) < 0)
+      copy = &peer->harqCopies[i];
+  memcpy (copy->buf, packet, size);
+  copy->size = size;
+  copy->age = s->harqAge++;
+  copy->valid = 1;
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_harqVote
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_harqVote (ABP_session *s, const char *a, const char *b,
+			 const char *c, int length)
+{
+  // each bit is what at least two of the three copies say, which is right
+  // wherever only one of them was damaged.  Returns whether that gives a
+  // packet with a good crc.
+  char *out = s->harqScratch;
+  int i;
+
+  for (i = 0; i < length; i++)
+    out[i] = (a[i] & b[i]) | (a[i] & c[i]) | (b[i] & c[i]);
+  return ABP_harqValid (out, length, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_harqFlip
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_harqFlip (ABP_session *s, const char *packet,
+			 const char *other, int length)
+{
+  // where two copies differ one of them was damaged, so if no bit was
+  // damaged in both, the packet is packet with some of those bits
+  // flipped.  Try every choice in Gray code order, which flips one more
+  // bit each time.  Returns whether one gives a packet with a good crc.
+  char *out = s->harqScratch;
+  int bits[ABP_HARQ_MAX_FLIPS];
+  unsigned int choice;
+  unsigned char diff;
+  int numBits = 0;
+  int i, b;
+
+  for (i = 0; i < length; i++) {
+    diff = packet[i] ^ other[i];
+    for (b = 0; diff; b++, diff >>= 1)
+      if (diff & 1) {
+	if (numBits == ABP_HARQ_MAX_FLIPS)
+	  return 0;
+	bits[numBits++] = 8 * i + b;
+      }
+  }
+
+  memcpy (out, packet, length);
+  for (choice = 1; choice < 1u << numBits; choice++) {
+    b = bits[__builtin_ctz (choice)];
+    out[b >> 3] ^= 1 << (b & 7);
+    if (ABP_harqValid (out, length, 1))
+      return 1;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_harqValid
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_harqValid (char *packet, int length, int strong)
+{
+  // whether length bytes at packet are a whole data or repair packet whose
+  // crc comes out right.  A packet picked out of many (strong is set) has
+  // to have a CRC32C, as the shorter checks would pass a wrong one too
+  // often.
+  struct ABP_dataMsg *msg = (struct ABP_dataMsg *)packet;
+  struct ABP_repairMsg *repair = (struct ABP_repairMsg *)packet;
+  unsigned int crc, zero = 0;
+  size_t offset;
+  int ok;
+
+  if (msg->integrity > ABP_LAST_INTEGRITY ||
+      (strong && msg->integrity != ABP_INTEGRITY_CRC32C))
+    return 0;
+  if (msg->versionType == ABP_VERSION_TYPE(ABP_TYPE_DATA) &&
+      length >= (int)ABP_DATA_HDR_SIZE &&
+      length == (int)ABP_DATA_HDR_SIZE + ntohs(msg->length))
+    offset = offsetof(struct ABP_dataMsg, crc);
+  else if (msg->versionType == ABP_VERSION_TYPE(ABP_TYPE_REPAIR) &&
+	   length >= (int)ABP_REPAIR_HDR_SIZE &&
+	   length == (int)ABP_REPAIR_HDR_SIZE + ntohs(repair->length))
+    offset = offsetof(struct ABP_repairMsg, crc);
+  else
+    return 0;
+
+  // the crc covers the packet with it set to 0
+  memcpy (&crc, packet + offset, sizeof(crc));
+  memcpy (packet + offset, &zero, sizeof(zero));
+  ok = ABP_calcCRC (msg->integrity, packet, length) == crc;
+  memcpy (packet + offset, &crc, sizeof(crc));
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_harqDistance
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_harqDistance (const char *a, const char *b, int length)
+{
+  // the number of bits two copies differ in
+  unsigned long long x, y;
+  int d = 0;
+  int i;
+
+  for (i = 0; i + 8 <= length; i += 8) {
+    memcpy (&x, a + i, 8);
+    memcpy (&y, b + i, 8);
+    d += __builtin_popcountll (x ^ y);
+  }
+  for (; i < length; i++)
+    d += __builtin_popcount ((unsigned char)(a[i] ^ b[i]));
+  return d;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_calcCRC
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ABP_calcCRC (int integrity, void *packet, int size)
+{
+  // returns packet's crc, calculated the way integrity says, in network
+  // byte order.  The caller has checked integrity is one we know.
+  switch (integrity) {
+  case ABP_INTEGRITY_CHECKSUM:
+    return calcChecksum (packet, size);
+  case ABP_INTEGRITY_CRC8:
+    return htonl (calcCRC8 (0, packet, size));
+  case ABP_INTEGRITY_CRC16:
+    return htonl (calcCRC16 (0, packet, size));
+  case ABP_INTEGRITY_INET:
+    return htonl (ntohs (inetChecksum (packet, size)));
+  default:
+    return htonl (calcCRC32C (0, packet, size));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_now
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long ABP_now (ABP_session *s)
+{
+  // current time in usecs from a clock that never goes backwards, or the
+  // link's clock with the virtual backend
+  struct timespec ts;
+
+  if (s->link)
+    return VL_now (s->link);
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_count
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_count (unsigned long long *counter, unsigned long long n)
+{
+  // add n to one of a session's counts.  Only the protocol adds to them,
+  // so there's no need for a locked add, but readers in other threads or
+  // processes mustn't see half a count.
+  __atomic_store_n (counter, __atomic_load_n (counter, __ATOMIC_RELAXED) + n,
+		    __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_countRtt
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_countRtt (ABP_session *s, long long rtt)
+{
+  // count a round trip time (usecs) in its power of 2 bucket
+  int bucket = 0;
+
+  while (rtt >= 2 && bucket < ABP_RTT_BUCKETS - 1) {
+    rtt >>= 1;
+    bucket++;
+  }
+  ABP_count (&s->counters->rttHistogram[bucket], 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_traceAck
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_traceAck (ABP_session *s, int offset, int window)
+{
+  // trace an ack for the packet offset from the oldest outstanding one.
+  // Outstanding packets are numbered in order, so its number follows from
+  // the oldest's, or from the next to be sent if none are outstanding.
+  unsigned int packetNum;
+  int detail = TR_ACK_NEW;
+
+  packetNum = (s->sendCount > 0 ? s->sendSlots[s->sendBaseIdx].packetNum :
+	       s->packetsSent) + offset;
+  if (offset >= s->sendCount) {
+    packetNum -= ABP_SEQ_MODULUS(s);
+    detail = offset == ABP_SEQ_MODULUS(s) - 1 ? TR_ACK_DUPLICATE :
+      TR_ACK_STALE;
+  }
+  TR_record (TR_ACK, detail, ntohs(s->sendDataAddr.sin_port), packetNum, 0,
+	     window);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_traceData
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_traceData (ABP_session *s, struct ABP_peer *peer, int offset,
+			   int length)
+{
+  // trace a data packet offset from the one peer is expected to send next
+  unsigned int packetNum = peer->nextRecvNum + offset;
+  int detail = TR_RECV_WINDOW;
+
+  if (offset >= ABP_SEQ_MODULUS(s) - s->windowSize) {
+    packetNum -= ABP_SEQ_MODULUS(s);
+    detail = TR_RECV_DUPLICATE;
+  }
+  else if (offset >= s->windowSize)
+    detail = TR_RECV_BEYOND;
+  TR_record (TR_RECV, detail, ntohs(s->recvDataAddr.sin_port), packetNum,
+	     length, ntohs(peer->addr.sin_port));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionRecvInit
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionRecvInit (ABP_session *s, short portNum)
+{
+  unsigned int numBuckets;
+  unsigned int queueSize;
+  size_t numSlots;
+  int one = 1;
+  size_t i;
+
+  if (s->recvSlots) {
+    printf ("recvInit: session already initialized\n");
+    return -1;
+  }
+  if (s->fecGroup && s->windowSize == 1) {
+    printf ("recvInit: FEC needs a window of more than 1\n");
+    return -1;
+  }
+
+  // allocate a receive window for every peer we might hear from, and a
+  // hash table with at least twice as many buckets
+  for (numBuckets = 1; numBuckets < 2 * (unsigned int)s->maxPeers;
+       numBuckets <<= 1)
+    ;
+  numSlots = (size_t)s->maxPeers * s->windowSize;
+  s->peers = calloc (s->maxPeers, sizeof(struct ABP_peer));
+  s->recvSlots = calloc (numSlots, sizeof(struct ABP_recvSlot));
+  s->recvSlotBufs = ABP_allocPackets (s, numSlots);
+  s->peerHash = calloc (numBuckets, sizeof(struct ABP_peer *));
+
+  // and the queue for ABP_recv, rounded up to a power of 2 so positions
+  // can be masked
+  for (queueSize = 1; queueSize < s->recvQueueSize; queueSize <<= 1)
+    ;
+  s->recvQueueSize = queueSize;
+  s->recvQueue = malloc ((size_t)queueSize * sizeof(struct ABP_queueSlot));
+  s->recvQueueBufs = ABP_allocPackets (s, queueSize);
+
+  if (!s->peers || !s->recvSlots || !s->recvSlotBufs || !s->peerHash ||
+      !s->recvQueue || !s->recvQueueBufs) {
+    perror ("recvInit: calloc");
+    return -1;
+  }
+  for (i = 0; i < numSlots; i++)
+    s->recvSlots[i].msg = ABP_packetBuf (s, s->recvSlotBufs, i);
+  for (i = 0; i < queueSize; i++)
+    s->recvQueue[i].msg = ABP_packetBuf (s, s->recvQueueBufs, i);
+  s->peerHashMask = numBuckets - 1;
+  s->recvHead = 0;
+  s->recvTail = 0;
+
+  // we're waiting for data from anyone
+  s->freePeers = 0;
+  for (i = s->maxPeers; i-- > 0; ) {
+    s->peers[i].recvSlots = &s->recvSlots[i * s->windowSize];
+    s->peers[i].hashNext = s->freePeers;
+    s->freePeers = &s->peers[i];
+  }
+
+  // with forward error correction, every peer also keeps its packets from
+  // a window back to a group ahead (rounded up to a power of 2 so packet
+  // numbers can be masked), and repair packets for a few groups
+  if (s->fecGroup) {
+    for (s->fecRingSize = 1;
+	 s->fecRingSize < (unsigned int)(s->windowSize + ABP_FEC_MAX_GROUP);
+	 s->fecRingSize <<= 1)
+      ;
+    numSlots = (size_t)s->maxPeers * s->fecRingSize;
+    s->fecSlots = calloc (numSlots, sizeof(struct ABP_fecSlot));
+    s->fecSlotBufs = ABP_allocPackets (s, numSlots);
+    s->fecRepairSlots = calloc ((size_t)s->maxPeers * ABP_FEC_REPAIR_SLOTS,
+				sizeof(struct ABP_fecRepair));
+    s->fecRepairBufs = malloc ((size_t)s->maxPeers * ABP_FEC_REPAIR_SLOTS *
+			       ABP_REPAIR_BUF_SIZE (s));
+    if (!s->fecSlots || !s->fecSlotBufs || !s->fecRepairSlots ||
+	!s->fecRepairBufs) {
+      perror ("recvInit: calloc");
+      return -1;
+    }
+    for (i = 0; i < numSlots; i++)
+      s->fecSlots[i].msg = ABP_packetBuf (s, s->fecSlotBufs, i);
+    for (i = 0; i < (size_t)s->maxPeers * ABP_FEC_REPAIR_SLOTS; i++)
+      s->fecRepairSlots[i].msg = (struct ABP_repairMsg *)
+	(s->fecRepairBufs + i * ABP_REPAIR_BUF_SIZE (s));
+    for (i = 0; i < (size_t)s->maxPeers; i++) {
+      s->peers[i].fecSlots = &s->fecSlots[i * s->fecRingSize];
+      s->peers[i].fecRepairs = &s->fecRepairSlots[i * ABP_FEC_REPAIR_SLOTS];
+    }
+  }
+
+  // with hybrid ARQ, every peer keeps a few damaged packets, in buffers
+  // that take repair packets too, and there's one more to combine them in
+  if (s->harqCopies) {
+    numSlots = (size_t)s->maxPeers * s->harqCopies;
+    s->harqSlots = calloc (numSlots, sizeof(struct ABP_harqCopy));
+    s->harqBufs = malloc ((numSlots + 1) * ABP_REPAIR_BUF_SIZE (s));
+    if (!s->harqSlots || !s->harqBufs) {
+      perror ("recvInit: calloc");
+      return -1;
+    }
+    for (i = 0; i < numSlots; i++)
+      s->harqSlots[i].buf = s->harqBufs + i * ABP_REPAIR_BUF_SIZE (s);
+    s->harqScratch = s->harqBufs + numSlots * ABP_REPAIR_BUF_SIZE (s);
+    for (i = 0; i < (size_t)s->maxPeers; i++)
+      s->peers[i].harqCopies = &s->harqSlots[i * s->harqCopies];
+  }
+
+  // build address data structures
+  memset (&s->recvDataAddr, 0, sizeof(s->recvDataAddr));
+  s->recvDataAddr.sin_family = AF_INET;
+  s->recvDataAddr.sin_addr.s_addr = INADDR_ANY;
+  s->recvDataAddr.sin_port = htons(portNum);
+
+  // create socket for receiving data and bind it to port, on the link with
+  // the virtual backend
+  if (s->link)
+    s->recvDataSock = VL_socket (s->link);
+  else
+    s->recvDataSock = socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
+  if (s->recvDataSock < 0){
+    perror("recvInit:socket");
+    return -1;
+  }
+
+  // have the kernel hand over runs of packets from a sender together (UDP
+  // GRO) if it can.  ABP_recvData splits them up again.
+  if (!s->link &&
+      setsockopt (s->recvDataSock,SOL_UDP,UDP_GRO,&one,sizeof(one)) == 0)
+    s->recvBatchBufSize = ABP_GRO_BUFFER_SIZE;
+  else
+    s->recvBatchBufSize = s->packetBufSize +
+      (s->fecGroup ? ABP_REPAIR_HDR_SIZE : 0);
+  s->recvBatchBufs = malloc ((size_t)ABP_BATCH_SIZE * s->recvBatchBufSize);
+  if (!s->recvBatchBufs) {
+    perror("recvInit:malloc");
+    return -1;
+  }
+
+  // let other sockets bind the same port; the kernel then spreads senders
+  // across them
+  if (s->reusePort && !s->link &&
+      setsockopt (s->recvDataSock,SOL_SOCKET,SO_REUSEPORT,
+		  &s->reusePort,sizeof(s->reusePort)) < 0){
+    perror("recvInit:setsockopt");
+    return -1;
+  }
+
+  if ((s->link ?
+       VL_bind (s->link,s->recvDataSock,&s->recvDataAddr) :
+       bind (s->recvDataSock,(struct sockaddr *)&s->recvDataAddr,
+	     sizeof(s->recvDataAddr))) < 0){
+    perror("recvInit:bind");
+    return -1;
+  }
+
+  // wait for data
+  return ABP_backendInit (s, s->recvDataSock, ABP_EVENT_DATA);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionRecvFrom
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_sessionRecvFrom (ABP_session *s, char *buf, int *length,
+			  struct sockaddr_in *fromAddr)
+{
+  // the caller's buffer only has to hold a default packet's worth, so
+  // longer messages are cut short
+  int size = ABP_DEFAULT_PAYLOAD_SIZE;
+
+  *length = ABP_reassemble (s, &buf, &size, 0, 1, fromAddr);
+  if (*length > ABP_DEFAULT_PAYLOAD_SIZE)
+    *length = ABP_DEFAULT_PAYLOAD_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionRecvMessage
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionRecvMessage (ABP_session *s, char **buf, int *bufSize,
+			    struct sockaddr_in *fromAddr)
+{
+  if (!s->recvQueue) {
+    printf ("recvMessage: session not initialized\n");
+    return -1;
+  }
+  return ABP_reassemble (s, buf, bufSize, 1, 1, fromAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionTryRecvMessage
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionTryRecvMessage (ABP_session *s, char **buf, int *bufSize,
+			       struct sockaddr_in *fromAddr)
+{
+  if (!s->recvQueue) {
+    printf ("tryRecvMessage: session not initialized\n");
+    return -1;
+  }
+  return ABP_reassemble (s, buf, bufSize, 1, 0, fromAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionRecvReady
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_sessionRecvReady (ABP_session *s)
+{
+  // a message is ready if one was set aside whole, or the queue holds the
+  // fragment that ends one (the rest of it came first).  Only the protocol
+  // adds to the queue, so if there's a message now it will still be there.
+  unsigned int tail = __atomic_load_n (&s->recvTail, __ATOMIC_ACQUIRE);
+  struct ABP_queueSlot *slot;
+  unsigned int i;
+
+  if (ABP_findAssembly (s, 0, 1))
+    return 1;
+  for (i = s->recvHead; i != tail; i++) {
+    slot = &s->recvQueue[i & (s->recvQueueSize - 1)];
+    if (ntohl(slot->msg->fragOffset) + ntohs(slot->msg->length) ==
+	ntohl(slot->msg->msgLength))
+      return 1;
+  }
+
+  // nothing ends yet.  If the queue is filling up with a message too long
+  // for it, make room by setting the fragments aside.
+  if ((tail - s->recvHead) * 2 > s->recvQueueSize)
+    while (s->recvHead != tail) {
+      ABP_setAside (s, &s->recvQueue[s->recvHead & (s->recvQueueSize - 1)]);
+      ABP_queueRelease (s);
+    }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sessionRecv
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_sessionRecv (ABP_session *s, char *buf, int *length)
+{
+  ABP_sessionRecvFrom (s, buf, length, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_recvData
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_recvData (ABP_session *s)
+{
+  // read and process up to a batch of data datagrams, then send their acks
+  // together.  Returns the number read; a negative value indicates there
+  // was nothing to read.
+  char *buf;
+  int length, segSize, size;
+  int numMsgs;
+  int i;
+
+  if (s->recvDataSock < 0)
+    return -1;
+
+  numMsgs = ABP_recvBatch (s, s->recvDataSock, s->recvBatchBufs,
+			   s->recvBatchBufSize);
+  for (i = 0; i < numMsgs; i++) {
+    // a datagram put together by GRO holds packets of segSize bytes, the
+    // last one maybe shorter
+    buf = s->recvBatchBufs + (size_t)i * s->recvBatchBufSize;
+    length = s->recvBatchHdrs[i].msg_len;
+    segSize = ABP_segmentSize (&s->recvBatchHdrs[i].msg_hdr);
+    if (segSize <= 0 || segSize > length)
+      segSize = length;
+    do {
+      // put small errors right first.  A packet with more is thrown away,
+      // as it would be without error correction, unless it can be put
+      // together with damaged copies that arrived before.
+      size = s->ecc ? eccDecode (buf, segSize, 0) : segSize;
+      if (size < 0) {
+	ABP_count (&s->counters->checksumFailures, 1);
+	TR_EVENT (TR_CHECKSUM, TR_PACKET_DATA, ntohs(s->recvDataAddr.sin_port),
+		  0, segSize, 0);
+      }
+      if ((size < 0 ||
+	   ABP_processPacket (s, buf, size, &s->recvBatchAddrs[i]) < 0) &&
+	  s->harqCopies) {
+	size = ABP_harqCombine (s, buf, segSize, &s->recvBatchAddrs[i]);
+	if (size >= 0)
+	  ABP_processPacket (s, s->harqScratch, size, &s->recvBatchAddrs[i]);
+      }
+      buf += segSize;
+      length -= segSize;
+      if (segSize > length)
+	segSize = length;
+    } while (length > 0);
+  }
+  ABP_batchFlush (&s->ackBatch, s->recvDataSock);
+  return numMsgs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_processPacket
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_processPacket (ABP_session *s, char *packet, int size,
+			      struct sockaddr_in *fromAddr)
+{
+  // pass a data or repair packet of size bytes on.  Returns -1 if it was
+  // damaged in transmission.
+  if (size > 0 && packet[0] == ABP_VERSION_TYPE(ABP_TYPE_REPAIR))
+    return ABP_processRepair (s, (struct ABP_repairMsg *)packet, size,
+			      fromAddr);
+  return ABP_processData (s, (struct ABP_dataMsg *)packet, size, fromAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_processData
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_processData (ABP_session *s, struct ABP_dataMsg *msg,
+			    int dataSize, struct sockaddr_in *fromAddr)
+{
+  // returns -1 if the packet was damaged in transmission, and 0 otherwise
+  unsigned int crc;
+  int ok;
+  unsigned int packetNum;
+  int offset;
+  int advanced;
+  int kept;
+  struct ABP_recvSlot *slot;
+  struct ABP_peer *peer;
+
+  // discard data if it's not the expected size or version.  The packet
+  // must hold a header and exactly as much data as the header says.
+  if (dataSize < (int)ABP_DATA_HDR_SIZE ||
+      dataSize != (int)ABP_DATA_HDR_SIZE + ntohs(msg->length) ||
+      ntohs(msg->length) > s->payloadSize ||
+      msg->versionType != ABP_VERSION_TYPE(ABP_TYPE_DATA) ||
+      msg->integrity > ABP_LAST_INTEGRITY) {
+    ABP_count (&s->counters->malformed, 1);
+    return -1;
+  }
+
+  // discard data if error in transmission
+  crc = msg->crc;
+  msg->crc = 0;
+  ok = ABP_calcCRC (msg->integrity, msg, dataSize) == crc;
+  msg->crc = crc;
+  if (!ok) {
+    ABP_count (&s->counters->checksumFailures, 1);
+    TR_EVENT (TR_CHECKSUM, TR_PACKET_DATA, ntohs(s->recvDataAddr.sin_port), 0,
+	      dataSize, 0);
+    return -1;
+  }
+
+  // and fragments that don't fit in their message, or of messages longer
+  // than we take
+  if (ntohl(msg->msgLength) > (unsigned int)s->maxMessage ||
+      (unsigned long long)ntohl(msg->fragOffset) + ntohs(msg->length) >
+      ntohl(msg->msgLength)) {
+    ABP_count (&s->counters->malformed, 1);
+    return 0;
+  }
+  ABP_count (&s->counters->packetsReceived, 1);
+  ABP_count (&s->counters->bytesReceived, ntohs(msg->length));
+
+  // find the sender's receive window.  If we're already keeping state for
+  // as many peers as we can, the packet isn't acknowledged and the sender
+  // will try again later.
+  peer = ABP_findPeer (s, fromAddr);
+  if (!peer) {
+    ABP_count (&s->counters->peersRefused, 1);
+    return 0;
+  }
+
+  offset = ABP_seqOffset (s, msg->seqNum, peer->nextRecvSeqNum);
+  if (TR_active)
+    ABP_traceData (s, peer, offset, ntohs(msg->length));
+
+  // acknowledge duplicates of packets that were already received right
+  // away, in case the ack was lost
+  if (offset >= ABP_SEQ_MODULUS(s) - s->windowSize) {
+    ABP_count (&s->counters->duplicatePackets, 1);
+    ABP_sendAck (s, peer);
+    return 0;
+  }
+
+  // ignore data packet if we weren't expecting it
+  if (offset >= s->windowSize) {
+    if (s->windowMode == ABP_GO_BACK_N)
+      ABP_sendAck (s, peer);
+    return 0;
+  }
+
+  // with forward error correction, keep a copy of anything in the window
+  // for rebuilding the rest of its group
+  packetNum = peer->nextRecvNum + offset;
+  kept = peer->fecSlots && ABP_fecKeep (s, peer, msg, dataSize, packetNum);
+
+  // Go-Back-N only accepts packets in order, but repeats its ack so the
+  // sender learns of the gap.  A copy kept for FEC may fill the gap once
+  // the packet before it is rebuilt.
+  if (s->windowMode == ABP_GO_BACK_N && offset != 0) {
+    ABP_sendAck (s, peer);
+    if (kept)
+      ABP_fecRecover (s, peer, packetNum);
+    return 0;
+  }
+
+  // packets in order go straight to ABP_recv's queue if there's room, along
+  // with anything after them that was waiting for them.  Everything else
+  // waits in the peer's receive window.
+  slot = ABP_recvSlot (s, peer, msg->seqNum);
+  if (offset == 0 && ABP_queueFree (s) > 0) {
+    ABP_queuePush (s, peer, msg);
+    slot->valid = 0;
+    ABP_advanceRecv (s, peer);
+    advanced = 1 + ABP_deliver (s, peer);
+  }
+  else {
+    if (!slot->valid) {
+      memmove (slot->msg, msg, dataSize);
+      slot->valid = 1;
+    }
+    if (offset == 0) {
+      ABP_count (&s->counters->overruns, 1);
+      TR_EVENT (TR_OVERRUN, 0, ntohs(s->recvDataAddr.sin_port),
+		peer->nextRecvNum, ntohs(msg->length), ntohs(peer->addr.sin_port));
+    }
+    advanced = 0;
+  }
+
+  // packets out of order, packets that fill a gap and packets there's no
+  // room for are acknowledged right away so the sender can tell what's
+  // missing and how much room there is.  Packets in order can wait for a
+  // few more.
+  if (offset != 0 || advanced != 1)
+    ABP_sendAck (s, peer);
+  else
+    ABP_delayAck (s, peer);
+
+  // the packet may complete what's needed to rebuild others of its group
+  if (kept)
+    ABP_fecRecover (s, peer, packetNum);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_processRepair
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_processRepair (ABP_session *s, struct ABP_repairMsg *msg,
+			      int repairSize, struct sockaddr_in *fromAddr)
+{
+  // keep a repair packet for a group with packets still to come or
+  // missing, and rebuild them if it can.  Receivers without FEC ignore them.
+  // Returns -1 if it was damaged in transmission, and 0 otherwise.
+  unsigned int crc;
+  unsigned int groupBase;
+  int length;
+  int ok;
+  struct ABP_peer *peer;
+
+  if (!s->fecSlots)
+    return 0;
+
+  // discard it if it's not the expected size or version
+  length = repairSize >= (int)ABP_REPAIR_HDR_SIZE ? ntohs(msg->length) : 0;
+  if (repairSize < (int)ABP_REPAIR_HDR_SIZE ||
+      repairSize != (int)ABP_REPAIR_HDR_SIZE + length ||
+      length < (int)ABP_DATA_HDR_SIZE || length > s->packetBufSize ||
+      msg->versionType != ABP_VERSION_TYPE(ABP_TYPE_REPAIR) ||
+      msg->integrity > ABP_LAST_INTEGRITY || msg->groupSize < 1 ||
+      msg->groupSize > ABP_FEC_MAX_GROUP ||
+      msg->repairIdx >= ABP_FEC_MAX_REPAIR) {
+    ABP_count (&s->counters->malformed, 1);
+    return -1;
+  }
+
+  // discard it if error in transmission
+  crc = msg->crc;
+  msg->crc = 0;
+  ok = ABP_calcCRC (msg->integrity, msg, repairSize) == crc;
+  msg->crc = crc;
+  if (!ok) {
+    ABP_count (&s->counters->checksumFailures, 1);
+    TR_EVENT (TR_CHECKSUM, TR_PACKET_REPAIR, ntohs(s->recvDataAddr.sin_port),
+	      0, repairSize, 0);
+    return -1;
+  }
+
+  peer = ABP_findPeer (s, fromAddr);
+  if (!peer) {
+    ABP_count (&s->counters->peersRefused, 1);
+    return 0;
+  }
+
+  // ignore it if the whole group has been passed on already, or it's past
+  // the window
+  groupBase = ABP_fecPacketNum (s, peer, msg->groupBase);
+  if ((int)(groupBase + msg->groupSize - peer->nextRecvNum) <= 0 ||
+      (int)(groupBase - peer->nextRecvNum) >= s->windowSize)
+    return 0;
+
+  ABP_fecKeepRepair (peer, msg, repairSize, groupBase);
+  ABP_fecDecode (s, peer, groupBase, msg->groupSize);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_recvSlot
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_recvSlot *ABP_recvSlot (ABP_session *s,
+					  struct ABP_peer *peer, int seqNum)
+{
+  // find the slot of peer's receive window that holds seqNum, or return 0
+  // if it's past the end of the window
+  int offset = ABP_seqOffset (s, seqNum, peer->nextRecvSeqNum);
+
+  if (offset >= s->windowSize)
+    return 0;
+  return &peer->recvSlots[(peer->nextRecvIdx + offset) % s->windowSize];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_findPeer
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_peer *ABP_findPeer (ABP_session *s,
+				      struct sockaddr_in *addr)
+{
+  // find the receive window for the peer sending from addr, starting a new
+  // one if this is the first we've heard from it.  Returns 0 if there's no
+  // room for another peer.
+  struct ABP_peer **bucket;
+  struct ABP_peer *peer;
+  long long currTime;
+
+  currTime = ABP_now (s);
+
+  bucket = ABP_peerBucket (s, addr);
+
+  for (peer = *bucket; peer; peer = peer->hashNext)
+    if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+	peer->addr.sin_port == addr->sin_port)
+      break;
+
+  if (peer) {
+    // move it to the end of the idle list
+    if (peer != s->idleTail) {
+      if (peer->idlePrev)
+	peer->idlePrev->idleNext = peer->idleNext;
+      else
+	s->idleHead = peer->idleNext;
+      peer->idleNext->idlePrev = peer->idlePrev;
+      peer->idlePrev = s->idleTail;
+      peer->idleNext = 0;
+      s->idleTail->idleNext = peer;
+      s->idleTail = peer;
+    }
+    peer->lastHeard = currTime;
+    return peer;
+  }
+
+  // a new peer.  Make room by forgetting peers that have gone quiet.
+  ABP_expirePeers (s, currTime);
+  if (!s->freePeers)
+    return 0;
+  peer = s->freePeers;
+  s->freePeers = peer->hashNext;
+
+  // its receive window starts empty at sequence number 0
+  peer->addr = *addr;
+  peer->nextRecvSeqNum = 0;
+  peer->nextRecvIdx = 0;
+  peer->nextRecvNum = 0;
+  peer->recovered = 0;
+  peer->lastHeard = currTime;
+  peer->windowClosed = 0;
+  peer->unackedCount = 0;
+  peer->ackPending = 0;
+  s->numPeers++;
+
+  peer->hashNext = *bucket;
+  *bucket = peer;
+
+  peer->idlePrev = s->idleTail;
+  peer->idleNext = 0;
+  if (s->idleTail)
+    s->idleTail->idleNext = peer;
+  else
+    s->idleHead = peer;
+  s->idleTail = peer;
+
+  return peer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_peerBucket
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_peer **ABP_peerBucket (ABP_session *s,
+					 struct sockaddr_in *addr)
+{
+  // find the hash bucket for addr.  Mix the address and port so
+  // neighbouring hosts and ports spread out.
+  unsigned int hash;
+
+  hash = (unsigned int)addr->sin_addr.s_addr * 2654435761u;
+  hash ^= (unsigned int)addr->sin_port * 40503u;
+  hash ^= hash >> 16;
+  return &s->peerHash[hash & s->peerHashMask];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_expirePeers
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_expirePeers (ABP_session *s, long long currTime)
+{
+  // forget peers that haven't sent anything for the idle timeout.  Peers
+  // with an ack still to be sent or waiting to hear there's room are kept,
+  // and so is everyone heard from more recently than them.
+  struct ABP_peer **link;
+  struct ABP_peer *peer;
+  int i;
+
+  while ((peer = s->idleHead) && !peer->ackPending && !peer->windowClosed &&
+	 currTime - peer->lastHeard >= s->peerTimeout) {
+    // take it off the idle list
+    s->idleHead = peer->idleNext;
+    if (s->idleHead)
+      s->idleHead->idlePrev = 0;
+    else
+      s->idleTail = 0;
+
+    // and out of its hash bucket
+    for (link = ABP_peerBucket (s, &peer->addr); *link != peer;
+	 link = &(*link)->hashNext)
+      ;
+    *link = peer->hashNext;
+
+    // drop anything received out of order, then put it back on the free list
+    for (i = 0; i < s->windowSize; i++)
+      peer->recvSlots[i].valid = 0;
+    if (peer->fecSlots) {
+      for (i = 0; i < (int)s->fecRingSize; i++)
+	peer->fecSlots[i].valid = 0;
+      for (i = 0; i < ABP_FEC_REPAIR_SLOTS; i++)
+	peer->fecRepairs[i].valid = 0;
+    }
+    for (i = 0; i < s->harqCopies; i++)
+      peer->harqCopies[i].valid = 0;
+    peer->hashNext = s->freePeers;
+    s->freePeers = peer;
+    s->numPeers--;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_deliver
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_deliver (ABP_session *s, struct ABP_peer *peer)
+{
+  // move packets waiting in peer's receive window that are now in order to
+  // ABP_recv's queue, as long as there's room.  Returns the number moved.
+  // Packets kept or rebuilt for FEC are in order too.
+  struct ABP_recvSlot *slot;
+  struct ABP_dataMsg *msg;
+  int count = 0;
+
+  while (ABP_queueFree (s) > 0) {
+    slot = &peer->recvSlots[peer->nextRecvIdx];
+    msg = slot->valid ? slot->msg : ABP_fecPacket (s, peer,
+						   peer->nextRecvNum);
+    if (!msg)
+      break;
+    ABP_queuePush (s, peer, msg);
+    slot->valid = 0;
+    ABP_advanceRecv (s, peer);
+    count++;
+  }
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_advanceRecv
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_advanceRecv (ABP_session *s, struct ABP_peer *peer)
+{
+  // the next packet from peer has been passed on and needs acknowledging
+  peer->nextRecvSeqNum = (peer->nextRecvSeqNum + 1) % ABP_SEQ_MODULUS(s);
+  peer->nextRecvIdx = (peer->nextRecvIdx + 1) % s->windowSize;
+  peer->nextRecvNum++;
+  peer->unackedCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_queueFree
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ABP_queueFree (ABP_session *s)
+{
+  // number of messages that can be added to ABP_recv's queue.  The acquire
+  // makes sure ABP_recv is done with a slot before it's reused.
+  return s->recvQueueSize -
+    (s->recvTail - __atomic_load_n (&s->recvHead, __ATOMIC_ACQUIRE));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_queuePush
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_queuePush (ABP_session *s, struct ABP_peer *peer,
+			   struct ABP_dataMsg *msg)
+{
+  // add a message from peer to the end of ABP_recv's queue, which must have
+  // room.  The release makes the message visible before the new tail.
+  struct ABP_queueSlot *slot;
+
+  slot = &s->recvQueue[s->recvTail & (s->recvQueueSize - 1)];
+  slot->addr = peer->addr;
+  memmove (slot->msg, msg, ABP_DATA_HDR_SIZE + ntohs(msg->length));
+  __atomic_store_n (&s->recvTail, s->recvTail + 1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_queuePeek
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_queueSlot *ABP_queuePeek (ABP_session *s, int block)
+{
+  // wait for a message to come in from any peer and return the oldest one,
+  // which stays in the queue until ABP_queueRelease, or 0 if none can come
+  // (or none has, unless block is set).  Block SIGIO first so the message
+  // can't arrive between testing for it and waiting.
+  sigset_t oldsigset;
+  unsigned int head = s->recvHead;
+  int result = 0;
+
+  if (__atomic_load_n (&s->recvTail, __ATOMIC_ACQUIRE) == head) {
+    if (!block)
+      return 0;
+    ABP_blockSignals (s, &oldsigset);
+    while (result == 0 &&
+	   __atomic_load_n (&s->recvTail, __ATOMIC_ACQUIRE) == head)
+      result = ABP_wait (s, &oldsigset);
+    ABP_restoreSignals (s, &oldsigset);
+    if (result < 0)
+      return 0;
+  }
+  return &s->recvQueue[head & (s->recvQueueSize - 1)];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_queueRelease
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_queueRelease (ABP_session *s)
+{
+  // ABP_recv is done with the oldest message.  The protocol won't reuse
+  // its slot until recvHead moves past it.
+  __atomic_store_n (&s->recvHead, s->recvHead + 1, __ATOMIC_RELEASE);
+
+  // once there's a reasonable amount of room, tell peers that were turned
+  // away that they can send again
+  if (__atomic_load_n (&s->windowUpdate, __ATOMIC_RELAXED) &&
+      ABP_queueFree (s) * 2 >= s->recvQueueSize)
+    ABP_sendWindowUpdates (s);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_reassemble
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_reassemble (ABP_session *s, char **buf, int *bufSize,
+			   int grow, int block, struct sockaddr_in *fromAddr)
+{
+  // put the next whole message together in *buf, reallocating it to fit if
+  // grow is set.  The message's fragments are copied straight from the
+  // queue; fragments of other peers' messages that come in between are
+  // set aside, and those messages are returned next.  Returns the length
+  // of the message, which is more than *bufSize if it was cut short, or -1
+  // if there wasn't memory for it or it can't arrive (or hasn't, unless
+  // block is set).
+  struct ABP_queueSlot *slot;
+  struct ABP_assembly *a;
+  struct sockaddr_in from;
+  int building = 0;
+  int failed = 0;
+  int msgLength = 0, received = 0, size = 0;
+  int fragOffset, length;
+
+  for (;;) {
+    // messages that were set aside whole go first.  Hand the buffer over
+    // rather than copying it if the caller's is too small anyway.
+    if (!building && (a = ABP_findAssembly (s, 0, 1))) {
+      msgLength = a->msgLength;
+      if (grow && *bufSize < msgLength) {
+	free (*buf);
+	*buf = a->buf;
+	*bufSize = msgLength;
+	a->buf = 0;
+      }
+      else
+	memmove (*buf, a->buf, msgLength < *bufSize ? msgLength : *bufSize);
+      if (fromAddr)
+	*fromAddr = a->addr;
+      ABP_freeAssembly (s, a);
+      return msgLength;
+    }
+
+    // if nothing more can arrive, or we aren't to wait for it, set aside
+    // what we have of the message so the next call carries on with it
+    slot = ABP_queuePeek (s, block);
+    if (!slot) {
+      if (building && !failed && received <= size &&
+	  (a = ABP_newAssembly (s, &from, msgLength))) {
+	memmove (a->buf, *buf, received);
+	a->received = received;
+      }
+      return -1;
+    }
+    fragOffset = ntohl(slot->msg->fragOffset);
+    length = ntohs(slot->msg->length);
+
+    // keep other peers' fragments for later
+    if (building && (slot->addr.sin_addr.s_addr != from.sin_addr.s_addr ||
+		     slot->addr.sin_port != from.sin_port)) {
+      ABP_setAside (s, slot);
+      ABP_queueRelease (s);
+      continue;
+    }
+
+    // if a fragment is missing (the sender gave up on it) the message
+    // can't be completed, so start again
+    if (building && (fragOffset != received ||
+		     (int)ntohl(slot->msg->msgLength) != msgLength))
+      building = 0;
+
+    if (!building) {
+      // carry on with this peer's message if part of it was set aside,
+      // otherwise this has to be the start of a new one
+      a = ABP_findAssembly (s, &slot->addr, 0);
+      if (a && fragOffset == a->received &&
+	  (int)ntohl(slot->msg->msgLength) == a->msgLength) {
+	msgLength = a->msgLength;
+	received = a->received;
+	size = ABP_fitBuffer (buf, bufSize, grow, msgLength);
+	if (size < 0) {
+	  failed = 1;
+	  size = *bufSize;
+	}
+	memmove (*buf, a->buf, received < size ? received : size);
+	ABP_freeAssembly (s, a);
+      }
+      else {
+	if (a)
+	  ABP_freeAssembly (s, a);
+	if (fragOffset != 0) {
+	  ABP_queueRelease (s);
+	  continue;
+	}
+	msgLength = ntohl(slot->msg->msgLength);
+	received = 0;
+	size = ABP_fitBuffer (buf, bufSize, grow, msgLength);
+	if (size < 0) {
+	  failed = 1;
+	  size = *bufSize;
+	}
+      }
+      from = slot->addr;
+      building = 1;
+    }
+
+    // the fragment follows on from what we have
+    if (received < size)
+      memmove (*buf + received, slot->msg->data,
+	       length < size - received ? length : size - received);
+    received += length;
+    ABP_queueRelease (s);
+
+    if (received >= msgLength) {
+      if (fromAddr)
+	*fromAddr = from;
+      return failed ? -1 : msgLength;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_fitBuffer
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_fitBuffer (char **buf, int *bufSize, int grow, int size)
+{
+  // make *buf hold at least size bytes if grow is set.  Returns how many
+  // bytes it holds, or -1 if it couldn't be made big enough.
+  char *newBuf;
+
+  if (!grow || *bufSize >= size)
+    return *bufSize;
+  newBuf = realloc (*buf, size);
+  if (!newBuf) {
+    perror ("recvMessage: realloc");
+    return -1;
+  }
+  *buf = newBuf;
+  *bufSize = size;
+  return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_setAside
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_setAside (ABP_session *s, struct ABP_queueSlot *slot)
+{
+  // add a fragment taken from the queue to what has arrived of its
+  // message, starting a new assembly at the first fragment.  A fragment
+  // that doesn't follow on (the sender gave up on one in between) is
+  // dropped along with the rest of its message.
+  struct ABP_assembly *a;
+  int fragOffset = ntohl(slot->msg->fragOffset);
+  int msgLength = ntohl(slot->msg->msgLength);
+  int length = ntohs(slot->msg->length);
+
+  a = ABP_findAssembly (s, &slot->addr, 0);
+  if (a && (fragOffset != a->received || msgLength != a->msgLength)) {
+    ABP_freeAssembly (s, a);
+    a = 0;
+  }
+
+  if (!a) {
+    if (fragOffset != 0)
+      return;
+    a = ABP_newAssembly (s, &slot->addr, msgLength);
+    if (!a)
+      return;
+  }
+
+  memmove (a->buf + a->received, slot->msg->data, length);
+  a->received += length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_newAssembly
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_assembly *ABP_newAssembly (ABP_session *s,
+					     struct sockaddr_in *addr,
+					     int msgLength)
+{
+  // start putting together a message of msgLength bytes from addr, after
+  // the messages already being put together.  Returns 0 if there wasn't
+  // memory for it.
+  struct ABP_assembly *a, **link;
+
+  a = malloc (sizeof(*a));
+  if (a)
+    a->buf = malloc (msgLength > 0 ? msgLength : 1);
+  if (!a || !a->buf) {
+    perror ("recv: malloc");
+    free (a);
+    return 0;
+  }
+  a->addr = *addr;
+  a->msgLength = msgLength;
+  a->received = 0;
+  a->next = 0;
+  for (link = &s->assemblies; *link; link = &(*link)->next)
+    ;
+  *link = a;
+  return a;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_findAssembly
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct ABP_assembly *ABP_findAssembly (ABP_session *s,
+					      struct sockaddr_in *addr,
+					      int complete)
+{
+  // find the oldest whole message set aside if complete is set, otherwise
+  // the one addr is part way through.  addr is 0 to look at every peer.
+  struct ABP_assembly *a;
+
+  for (a = s->assemblies; a; a = a->next)
+    if ((a->received == a->msgLength) == complete &&
+	(!addr || (a->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+		   a->addr.sin_port == addr->sin_port)))
+      return a;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_freeAssembly
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_freeAssembly (ABP_session *s, struct ABP_assembly *a)
+{
+  struct ABP_assembly **link;
+
+  for (link = &s->assemblies; *link != a; link = &(*link)->next)
+    ;
+  *link = a->next;
+  free (a->buf);
+  free (a);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_recvWindow
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_recvWindow (ABP_session *s)
+{
+  // packets a peer may send beyond what it has had acknowledged.  The room
+  // in the queue is shared between the peers we know of, and no sender has
+  // more than a window outstanding anyway.
+  int window;
+
+  window = ABP_queueFree (s) / (s->numPeers > 0 ? s->numPeers : 1);
+  if (window > s->windowSize)
+    window = s->windowSize;
+  return window;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sendWindowUpdates
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_sendWindowUpdates (ABP_session *s)
+{
+  // ABP_recv has made room in the queue.  Pass on what peers that were
+  // turned away have waiting, and tell them how much room there is now.
+  // Blocking the signals makes us the protocol for a moment.
+  sigset_t oldsigset;
+  struct ABP_peer *peer;
+
+  ABP_blockSignals (s, &oldsigset);
+  __atomic_store_n (&s->windowUpdate, 0, __ATOMIC_RELAXED);
+  for (peer = s->idleHead; peer; peer = peer->idleNext)
+    if (peer->windowClosed) {
+      ABP_deliver (s, peer);
+      ABP_sendAck (s, peer);
+    }
+  ABP_batchFlush (&s->ackBatch, s->recvDataSock);
+  ABP_restoreSignals (s, &oldsigset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_sendAck
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_sendAck (ABP_session *s, struct ABP_peer *peer)
+{
+  // queue an ack for everything peer has sent so far to go out with the
+  // others for the current batch
+  struct ABP_ackMsg *ackMsg;
+  struct ABP_recvSlot *slot;
+  int seqNum;
+  int sackLen;
+  int i;
+
+  ABP_removeAckPending (s, peer);
+  peer->unackedCount = 0;
+  ABP_count (&s->counters->acksSent, 1);
+
+  if (s->ackBatch.count == ABP_BATCH_SIZE)
+    ABP_batchFlush (&s->ackBatch, s->recvDataSock);
+  ackMsg = &s->ackBatchMsgs[s->ackBatch.count];
+  s->ackBatchAddrs[s->ackBatch.count] = peer->addr;
+
+  ackMsg->versionType = ABP_VERSION_TYPE(ABP_TYPE_ACK);
+  ackMsg->ackNum = (peer->nextRecvSeqNum + ABP_SEQ_MODULUS(s) - 1) %
+    ABP_SEQ_MODULUS(s);
+
+  // a peer told there's no room waits for ABP_recv to say there is
+  ackMsg->window = htons(ABP_recvWindow (s));
+  ackMsg->maxPayload = htons(s->payloadSize);
+  ackMsg->recovered = htons(peer->recovered);
+  peer->windowClosed = (ackMsg->window == 0);
+  TR_EVENT (TR_ACK_SENT, 0, ntohs(s->recvDataAddr.sin_port),
+	    peer->nextRecvNum - 1, 0, ntohs(ackMsg->window));
+  if (peer->windowClosed)
+    __atomic_store_n (&s->windowUpdate, 1, __ATOMIC_RELAXED);
+
+  // selective repeat also reports what arrived after the first missing
+  // packet.  Go-Back-N throws those away, so its acks have no sack bits.
+  sackLen = 0;
+  if (s->windowMode == ABP_SELECTIVE_REPEAT) {
+    memset (ackMsg->sack, 0, sizeof(ackMsg->sack));
+    for (i = 0; i < ABP_MAX_SACK_BYTES * 8; i++) {
+      seqNum = (peer->nextRecvSeqNum + 1 + i) % ABP_SEQ_MODULUS(s);
+      slot = ABP_recvSlot (s, peer, seqNum);
+      if (!slot)
+	break;
+      if (slot->valid) {
+	ackMsg->sack[i / 8] |= 1 << (i % 8);
+	sackLen = i / 8 + 1;
+      }
+    }
+  }
+  ackMsg->sackLen = sackLen;
+
+  ackMsg->integrity = s->integrity;
+  ackMsg->crc = 0;
+  ackMsg->crc = ABP_calcCRC (s->integrity, ackMsg, ABP_ACK_HDR_SIZE + sackLen);
+
+  ABP_batchAdd (&s->ackBatch, s->recvDataSock, ackMsg,
+		ABP_ACK_HDR_SIZE + sackLen,
+		&s->ackBatchAddrs[s->ackBatch.count]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_delayAck
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_delayAck (ABP_session *s, struct ABP_peer *peer)
+{
+  // wait for more packets from peer before acknowledging them, unless
+  // enough have arrived already.  The deadline is set by the first packet
+  // waiting for an ack.
+  if (peer->unackedCount >= s->ackEvery || s->ackDelay == 0) {
+    ABP_sendAck (s, peer);
+    return;
+  }
+  if (peer->ackPending)
+    return;
+
+  // every peer waits as long, so adding to the end keeps the list in
+  // deadline order
+  peer->ackDeadline = ABP_now (s) + s->ackDelay;
+  peer->ackPending = 1;
+  peer->ackNext = 0;
+  peer->ackPrev = s->ackTail;
+  if (s->ackTail)
+    s->ackTail->ackNext = peer;
+  else {
+    s->ackHead = peer;
+    // the timer may need to go off sooner
+    ABP_armTimer (s);
+  }
+  s->ackTail = peer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_removeAckPending
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_removeAckPending (ABP_session *s, struct ABP_peer *peer)
+{
+  // take peer off the delayed ack list
+  if (!peer->ackPending)
+    return;
+
+  if (peer->ackPrev)
+    peer->ackPrev->ackNext = peer->ackNext;
+  else
+    s->ackHead = peer->ackNext;
+  if (peer->ackNext)
+    peer->ackNext->ackPrev = peer->ackPrev;
+  else
+    s->ackTail = peer->ackPrev;
+  peer->ackPending = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_recvBatch
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_recvBatch (ABP_session *s, int sock, void *bufs, int size)
+{
+  // read up to a batch of datagrams of at most size bytes from sock into
+  // the array bufs.  Their lengths and senders are left in recvBatchHdrs
+  // and recvBatchAddrs, along with the packet size of GRO datagrams.
+  // Returns the number read, or -1 if there weren't any.
+  int numMsgs;
+  int i;
+
+  for (i = 0; i < ABP_BATCH_SIZE; i++) {
+    s->recvBatchIov[i].iov_base = (char *)bufs + (size_t)i * size;
+    s->recvBatchIov[i].iov_len = size;
+    memset (&s->recvBatchHdrs[i], 0, sizeof(s->recvBatchHdrs[i]));
+    s->recvBatchHdrs[i].msg_hdr.msg_name = &s->recvBatchAddrs[i];
+    s->recvBatchHdrs[i].msg_hdr.msg_namelen = sizeof(s->recvBatchAddrs[i]);
+    s->recvBatchHdrs[i].msg_hdr.msg_iov = &s->recvBatchIov[i];
+    s->recvBatchHdrs[i].msg_hdr.msg_iovlen = 1;
+    s->recvBatchHdrs[i].msg_hdr.msg_control = s->recvBatchControl[i];
+    s->recvBatchHdrs[i].msg_hdr.msg_controllen =
+      sizeof(s->recvBatchControl[i]);
+  }
+
+  if (s->link)
+    numMsgs = VL_recvmmsg (s->link, sock, s->recvBatchHdrs, ABP_BATCH_SIZE);
+  else
+    numMsgs = recvmmsg (sock, s->recvBatchHdrs, ABP_BATCH_SIZE, MSG_DONTWAIT,
+			0);
+
+  // datagrams too big for their buffer are reported as empty, so they fail
+  // the size checks
+  for (i = 0; i < numMsgs; i++)
+    if (s->recvBatchHdrs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      s->recvBatchHdrs[i].msg_len = 0;
+  return numMsgs;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_segmentSize
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_segmentSize (struct msghdr *hdr)
+{
+  // the size of the packets a datagram read with GRO is made of, or 0 if
+  // the kernel didn't say (it's a single packet)
+  struct cmsghdr *cmsg;
+  int size;
+
+  for (cmsg = CMSG_FIRSTHDR (hdr); cmsg; cmsg = CMSG_NXTHDR (hdr, cmsg))
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      memcpy (&size, CMSG_DATA (cmsg), sizeof(size));
+      return size;
+    }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_batchAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_batchAdd (struct ABP_sendBatch *batch, int sock, void *buf,
+			  int len, struct sockaddr_in *toAddr)
+{
+  // add a datagram to batch, sending the batch first if it's full.  buf
+  // and toAddr must stay put until the batch is sent.  With GSO, a packet
+  // joins the last datagram if it's going to the same place and isn't
+  // bigger than the packets already in it.  The last datagram's iovecs are
+  // always the last ones used.
+  struct mmsghdr *hdr;
+
+  if (batch->gsoSize && len <= batch->gsoSize &&
+      batch->numIov < ABP_BATCH_PACKETS &&
+      batch->gsoBytes + len <= ABP_MAX_DATAGRAM) {
+    hdr = &batch->hdrs[batch->count - 1];
+    if (hdr->msg_hdr.msg_name == toAddr &&
+	hdr->msg_hdr.msg_iovlen < ABP_GSO_MAX_SEGMENTS) {
+      batch->iov[batch->numIov].iov_base = buf;
+      batch->iov[batch->numIov].iov_len = len;
+      batch->numIov++;
+      hdr->msg_hdr.msg_iovlen++;
+      batch->gsoBytes += len;
+
+      // only the last packet may be short
+      if (len < batch->gsoSize)
+	batch->gsoSize = 0;
+      return;
+    }
+  }
+
+  if (batch->count == ABP_BATCH_SIZE || batch->numIov == ABP_BATCH_PACKETS)
+    ABP_batchFlush (batch, sock);
+
+  batch->iov[batch->numIov].iov_base = buf;
+  batch->iov[batch->numIov].iov_len = len;
+  hdr = &batch->hdrs[batch->count];
+  memset (hdr, 0, sizeof(*hdr));
+  hdr->msg_hdr.msg_name = toAddr;
+  hdr->msg_hdr.msg_namelen = sizeof(*toAddr);
+  hdr->msg_hdr.msg_iov = &batch->iov[batch->numIov];
+  hdr->msg_hdr.msg_iovlen = 1;
+  batch->count++;
+  batch->numIov++;
+  batch->gsoSize = len <= batch->maxSegment ? len : 0;
+  batch->gsoBytes = len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_batchFlush
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_batchFlush (struct ABP_sendBatch *batch, int sock)
+{
+  // send everything in batch with one system call.  Datagrams of several
+  // packets tell the kernel how big the packets are for GSO.  If it won't
+  // do GSO after all (not every device can, and the path's MTU may have
+  // shrunk) it's turned off, and the packets are sent again one by one;
+  // any that did get through are duplicates the receiver ignores.
+  struct ABP_sendBatch retry;
+  struct msghdr *msg;
+  struct cmsghdr *cmsg;
+  unsigned short size;
+  int gso = 0;
+  int i, j;
+
+  for (i = 0; i < batch->count; i++) {
+    msg = &batch->hdrs[i].msg_hdr;
+    if (msg->msg_iovlen < 2)
+      continue;
+    msg->msg_control = batch->control[i];
+    msg->msg_controllen = sizeof(batch->control[i]);
+    cmsg = CMSG_FIRSTHDR (msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN (sizeof(size));
+    size = msg->msg_iov[0].iov_len;
+    memcpy (CMSG_DATA (cmsg), &size, sizeof(size));
+    gso = 1;
+  }
+
+  if (batch->count > 0 &&
+      US_channelSendmmsg (batch->session->channel, sock, batch->hdrs,
+			  batch->count, 0) < 0 && gso &&
+      (errno == EIO || errno == EINVAL || errno == EMSGSIZE)) {
+    retry = *batch;
+    batch->count = 0;
+    batch->numIov = 0;
+    batch->gsoSize = 0;
+    batch->maxSegment = 0;
+    for (i = 0; i < retry.count; i++) {
+      msg = &retry.hdrs[i].msg_hdr;
+      for (j = 0; j < (int)msg->msg_iovlen; j++)
+	ABP_batchAdd (batch, sock,
+		      retry.iov[msg->msg_iov - batch->iov + j].iov_base,
+		      retry.iov[msg->msg_iov - batch->iov + j].iov_len,
+		      msg->msg_name);
+    }
+    ABP_batchFlush (batch, sock);
+    return;
+  }
+
+  // packets the channel holds back are sent when the timer goes off
+  if (batch->count > 0 && US_channelNextDue (batch->session->channel))
+    ABP_armTimer (batch->session);
+  batch->count = 0;
+  batch->numIov = 0;
+  batch->gsoSize = 0;
+  batch->flushes++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_maxSegment
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_maxSegment (ABP_session *s)
+{
+  // the largest packet we can send to the receiver with GSO, or 0 if the
+  // kernel can't do GSO.  The kernel won't split packets any further, so
+  // they have to fit the path's MTU; connecting a socket finds out what
+  // that is.
+  int zero = 0;
+  int mtu = 0;
+  socklen_t len = sizeof(mtu);
+  int sock;
+
+  if (setsockopt (s->sendDataSock,SOL_UDP,UDP_SEGMENT,&zero,sizeof(zero)) < 0)
+    return 0;
+  if ((sock = socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP)) < 0)
+    return 0;
+  if (connect (sock,(struct sockaddr *)&s->sendDataAddr,
+	       sizeof(s->sendDataAddr)) < 0 ||
+      getsockopt (sock,IPPROTO_IP,IP_MTU,&mtu,&len) < 0)
+    mtu = 0;
+  close (sock);
+
+  // less the IP and UDP headers
+  mtu -= 28;
+  return mtu > 0 ? mtu : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_backendInit
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_backendInit (ABP_session *s, int sock, int event)
+{
+  // arrange for the session's backend to process packets arriving on sock
+  sigset_t oldsigset;
+
+  if (s->backend == ABP_BACKEND_VIRTUAL) {
+    // packets go over the link through the session's channel, which only
+    // passes them on unless the caller gave it one
+    if (!s->channel) {
+      if (!(s->channel = US_open (0)))
+	return -1;
+      s->ownChannel = 1;
+    }
+    if (US_channelSetLink (s->channel, s->link) < 0)
+      return -1;
+
+    // let ABP_linkProcess see the session
+    if (!s->onLinkList) {
+      s->nextLinkSession = ABP_linkSessions;
+      ABP_linkSessions = s;
+      s->onLinkList = 1;
+    }
+    return 0;
+  }
+
+  if (s->backend == ABP_BACKEND_EPOLL) {
+    // the epoll backend also needs a timerfd for timeouts
+    if (s->timerFd < 0) {
+      if ((s->timerFd = timerfd_create (CLOCK_MONOTONIC,
+					TFD_NONBLOCK|TFD_CLOEXEC)) < 0){
+	perror("backendInit:timerfd_create ");
+	return -1;
+      }
+      if (ABP_epollAdd (s, s->timerFd, ABP_EVENT_TIMER) < 0)
+	return -1;
+    }
+
+    // wait for the socket with epoll
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0){
+      perror("backendInit:fcntl ");
+      return -1;
+    }
+    return ABP_epollAdd (s, sock, event);
+  }
+
+  // set up the SIGIO and SIGALRM handlers
+  if (ABP_installHandlers () < 0)
+    return -1;
+
+  if (fcntl(sock, F_SETOWN, getpid()) < 0){
+    perror("backendInit:fcntl1 ");
+    return -1;
+  }
+  if (fcntl(sock, F_SETFL, O_NONBLOCK|FASYNC) < 0){
+    perror("backendInit:fcntl2 ");
+    return -1;
+  }
+
+  // let the handlers see the session
+  ABP_blockSignals (s, &oldsigset);
+  if (!s->onSignalList) {
+    s->nextSignalSession = ABP_signalSessions;
+    ABP_signalSessions = s;
+    s->onSignalList = 1;
+  }
+  ABP_restoreSignals (s, &oldsigset);
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_installHandlers
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_installHandlers ()
+{
+  // install the SIGIO and SIGALRM handlers shared by all sessions using
+  // signals
+  struct sigaction handler1;
+  struct sigaction handler2;
+
+  if (ABP_handlersInstalled)
+    return 0;
+
+  // set up SIGIO handler for received acks and data
+  handler1.sa_handler = ABP_SIGIO;
+  if (sigfillset (&handler1.sa_mask) < 0){
+    printf ("installHandlers: sigfillset1 error\n");
+    return -1;
+  }
+  handler1.sa_flags = 0;
+  if (sigaction(SIGIO, &handler1, 0) < 0){
+    printf ("installHandlers: sigaction1 error\n");
+    return -1;
+  }
+
+  // set up timer handler.  The timer is armed whenever a timeout is set.
+  handler2.sa_handler = ABP_sendTimer;
+  if (sigfillset (&handler2.sa_mask) < 0){
+    printf ("installHandlers: sigfillset2 error\n");
+    return -1;
+  }
+  handler2.sa_flags = 0;
+  if (sigaction(SIGALRM, &handler2, 0) < 0){
+    printf ("installHandlers: sigaction2 error\n");
+    return -1;
+  }
+
+  ABP_handlersInstalled = 1;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_epollAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_epollAdd (ABP_session *s, int fd, int event)
+{
+  // wait for fd to become readable in ABP_sessionProcess.  The session's
+  // epoll descriptor is created by the first call.
+  struct epoll_event ev;
+
+  if (s->epollFd < 0 && (s->epollFd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+    perror ("ABP_epollAdd: epoll_create1");
+    return -1;
+  }
+
+  memset (&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = event;
+  if (epoll_ctl (s->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror ("ABP_epollAdd: epoll_ctl");
+    return -1;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_blockSignals
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_blockSignals (ABP_session *s, sigset_t *oldsigset)
+{
+  // block SIGIO and SIGALRM, saving the old mask in oldsigset.  Nothing
+  // runs asynchronously with the epoll backend, so there is nothing to do.
+  sigset_t sigset;
+
+  if (s->backend != ABP_BACKEND_SIGNAL)
+    return;
+
+  sigemptyset (&sigset);
+  sigaddset (&sigset,SIGALRM);
+  sigaddset (&sigset,SIGIO);
+  sigprocmask (SIG_BLOCK,&sigset,oldsigset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_restoreSignals
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_restoreSignals (ABP_session *s, sigset_t *oldsigset)
+{
+  // restore the signal mask saved by ABP_blockSignals
+  if (s->backend == ABP_BACKEND_SIGNAL)
+    sigprocmask (SIG_SETMASK,oldsigset,0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_wait
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_wait (ABP_session *s, sigset_t *oldsigset)
+{
+  // wait for something to happen, either by letting a signal in or by
+  // running the session's event loop ourselves.  Nothing else will move a
+  // link's clock on, so if nothing more can happen on the link we'd wait
+  // forever; return -1 instead, and leave it to the caller.
+  if (s->backend == ABP_BACKEND_SIGNAL)
+    sigsuspend (oldsigset);
+  else if (s->backend == ABP_BACKEND_EPOLL)
+    ABP_sessionProcess (s, -1);
+  else if (ABP_linkProcess (s, -1) == 0) {
+    printf ("ABP_wait: nothing more can happen on the link\n");
+    return -1;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_linkProcess
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_linkProcess (ABP_session *s, int timeoutMsecs)
+{
+  // process every session on s's link, as the signal handlers do the
+  // sessions using signals: read the packets that have arrived by now, and
+  // handle the timeouts that have expired.  If there weren't any, move the
+  // link's clock on to the next arrival or timeout, as long as that's
+  // within timeoutMsecs on it, and try again.  Returns the number of
+  // events handled, which is 0 if the time ran out or nothing more can
+  // happen.
+  VL_link *link = s->link;
+  ABP_session *other;
+  long long limit, next, deadline;
+  int numEvents, n;
+
+  limit = timeoutMsecs < 0 ? 0 :
+    VL_now (link) + (long long)timeoutMsecs * 1000;
+  for (;;) {
+    numEvents = 0;
+    for (other = ABP_linkSessions; other; other = other->nextLinkSession) {
+      if (other->link != link)
+	continue;
+      while ((n = ABP_recvAcks (other)) > 0)
+	numEvents += n;
+      while ((n = ABP_recvData (other)) > 0)
+	numEvents += n;
+      deadline = ABP_earliestTimeout (other);
+      if (deadline && deadline <= VL_now (link)) {
+	ABP_checkTimeouts (other);
+	numEvents++;
+      }
+    }
+    if (numEvents || timeoutMsecs == 0)
+      return numEvents;
+
+    // nothing happened, so skip to the next thing that will.  Packets that
+    // have arrived for sockets other than the sessions' won't be read, so
+    // they don't count.
+    next = VL_nextArrival (link);
+    for (other = ABP_linkSessions; other; other = other->nextLinkSession) {
+      deadline = other->link == link ? ABP_earliestTimeout (other) : 0;
+      if (deadline && (!next || deadline < next))
+	next = deadline;
+    }
+    if (!next || next <= VL_now (link))
+      return 0;
+    if (limit && next > limit) {
+      VL_advance (link, limit);
+      return 0;
+    }
+    VL_advance (link, next);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Default session
+//
+// The original interface runs on a single session created on first use.
+//
+///////////////////////////////////////////////////////////////////////////////
+static ABP_session *ABP_default ()
+{
+  if (!ABP_defaultSession)
+    ABP_defaultSession = ABP_open ();
+  return ABP_defaultSession;
+}
+
+int ABP_setWindow (int windowSize, int mode)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetWindow (ABP_defaultSession, windowSize, mode);
+}
+
+int ABP_setPeers (int maxPeers, int idleTimeoutMsecs)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetPeers (ABP_defaultSession, maxPeers, idleTimeoutMsecs);
+}
+
+int ABP_setDelayedAck (int everyPackets, int maxDelayUsecs)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetDelayedAck (ABP_defaultSession, everyPackets,
+				   maxDelayUsecs);
+}
+
+int ABP_setIntegrity (int integrity)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetIntegrity (ABP_defaultSession, integrity);
+}
+
+int ABP_setCongestion (int algorithm)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetCongestion (ABP_defaultSession, algorithm);
+}
+
+int ABP_setSendQueue (int numMessages, int highWater)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetSendQueue (ABP_defaultSession, numMessages, highWater);
+}
+
+int ABP_setSendCallback (ABP_sendCallback callback, void *arg)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetSendCallback (ABP_defaultSession, callback, arg);
+}
+
+int ABP_setRecvQueue (int numMessages)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetRecvQueue (ABP_defaultSession, numMessages);
+}
+
+int ABP_setMaxMessage (int length)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetMaxMessage (ABP_defaultSession, length);
+}
+
+int ABP_setPayloadSize (int size)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetPayloadSize (ABP_defaultSession, size);
+}
+
+int ABP_setEcc (int ecc)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetEcc (ABP_defaultSession, ecc);
+}
+
+int ABP_setHarq (int copies)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetHarq (ABP_defaultSession, copies);
+}
+
+int ABP_setFec (int groupSize, int minRepair, int maxRepair)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetFec (ABP_defaultSession, groupSize, minRepair,
+			    maxRepair);
+}
+
+int ABP_setBackend (int backend)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetBackend (ABP_defaultSession, backend);
+}
+
+int ABP_getFd (void)
+{
+  if (!ABP_defaultSession)
+    return -1;
+  return ABP_sessionGetFd (ABP_defaultSession);
+}
+
+int ABP_getStats (struct ABP_stats *stats)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_getStats: not initialized\n");
+    return -1;
+  }
+  ABP_sessionGetStats (ABP_defaultSession, stats);
+  return 0;
+}
+
+int ABP_getCounters (struct ABP_counters *counters)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_getCounters: not initialized\n");
+    return -1;
+  }
+  ABP_sessionGetCounters (ABP_defaultSession, counters);
+  return 0;
+}
+
+int ABP_setSharedCounters (const char *name)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSetSharedCounters (ABP_defaultSession, name);
+}
+
+int ABP_process (int timeoutMsecs)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_process: epoll backend not initialized\n");
+    return -1;
+  }
+  return ABP_sessionProcess (ABP_defaultSession, timeoutMsecs);
+}
+
+int ABP_sendInit (char *hostname, short portNum)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSendInit (ABP_defaultSession, hostname, portNum);
+}
+
+void ABP_send (char *buf, int length)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_send: not initialized\n");
+    return;
+  }
+  ABP_sessionSend (ABP_defaultSession, buf, length);
+}
+
+void ABP_sendv (const struct iovec *iov, int iovcnt)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_sendv: not initialized\n");
+    return;
+  }
+  ABP_sessionSendv (ABP_defaultSession, iov, iovcnt);
+}
+
+int ABP_sendAsync (char *buf, int length, int flags, void *context)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionSendAsync (ABP_defaultSession, buf, length, flags,
+			       context);
+}
+
+int ABP_sendComplete (struct ABP_sendCompletion *completion)
+{
+  if (!ABP_default ())
+    return 0;
+  return ABP_sessionSendComplete (ABP_defaultSession, completion);
+}
+
+void ABP_flush (void)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_flush: not initialized\n");
+    return;
+  }
+  ABP_sessionFlush (ABP_defaultSession);
+}
+
+int ABP_recvInit (short portNum)
+{
+  if (!ABP_default ())
+    return -1;
+  return ABP_sessionRecvInit (ABP_defaultSession, portNum);
+}
 
-  // copy message to buffer
-  ABP_recvMsg = tempMsg;
+void ABP_recv (char *buf, int *length)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_recv: not initialized\n");
+    *length = -1;
+    return;
+  }
+  ABP_sessionRecv (ABP_defaultSession, buf, length);
+}
 
-  // increment sequence number
-  ABP_nextRecvSeqNum = (ABP_nextRecvSeqNum+1) & 0x1;
+void ABP_recvFrom (char *buf, int *length, struct sockaddr_in *fromAddr)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_recvFrom: not initialized\n");
+    *length = -1;
+    return;
+  }
+  ABP_sessionRecvFrom (ABP_defaultSession, buf, length, fromAddr);
+}
 
-  // we're no longer waiting for the ack
-  ABP_recvWait = 0;
+int ABP_recvMessage (char **buf, int *bufSize, struct sockaddr_in *fromAddr)
+{
+  if (!ABP_defaultSession) {
+    printf ("ABP_recvMessage: not initialized\n");
+    return -1;
+  }
+  return ABP_sessionRecvMessage (ABP_defaultSession, buf, bufSize, fromAddr);
 }
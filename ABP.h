@@ -7,17 +7,398 @@
 // that uses the alternating bit protocol (i.e., stop and wait algorithm.  
 // UDP datagrams are used to send data packets and acknowledgements.
 //
+// A sliding window may be selected with ABP_setWindow, in which case
+// several packets can be outstanding at once and either Go-Back-N or
+// Selective Repeat is used to recover from losses.  A window size of 1 is
+// the original alternating bit protocol.
+//
+// By default the protocol runs in SIGIO and SIGALRM handlers.  Selecting the
+// epoll backend with ABP_setBackend instead runs it from an event loop,
+// either inside the blocking calls or from ABP_process when the application
+// drives its own loop.  A session given a link simulated in memory with
+// ABP_sessionSetLink runs over it, on the link's clock, so a transfer of
+// thousands of round trips takes as long as its packets take to process.
+//
+// Each flow's state is kept in an ABP_session, so one process can run many
+// independent flows by opening a session for each.  The ABP_session*
+// functions take the session as their first argument and otherwise work
+// like the functions of the same name without "session", which use a single
+// default session.
+//
+// A receiver keeps separate state for every sender (peer), so several
+// senders can send to the same port.  Messages from different peers are
+// passed on in the order they become ready; ABP_recvFrom also returns the
+// address of the peer that sent each one.
+//
+// Acks are cumulative.  With Selective Repeat they also say which packets
+// arrived after a missing one, and a sender resends a packet that later
+// packets have overtaken without waiting for it to time out.  A receiver
+// may wait for a few packets before acknowledging them (ABP_setDelayedAck).
+//
+// Every packet carries a CRC-32C, so errors are very unlikely to get
+// through.  ABP_setIntegrity selects a weaker check instead; each packet
+// says which check it carries, so the two ends don't have to agree.
+//
+// Senders limit how many packets they have outstanding to what the path
+// seems able to carry (congestion control), as TCP does: ABP_setCongestion
+// selects how.
+//
+// Messages received in order wait in a queue until the application calls
+// ABP_recv.  Acks tell the sender how much room is left in it, and senders
+// don't send more than that, so a receiver that falls behind slows its
+// senders down instead of throwing their packets away.
+//
+// Messages longer than a packet (1024 bytes) are split into fragments and
+// put back together by the receiver, which passes on the whole message at
+// once.  ABP_recvMessage returns messages of any length; ABP_recv only
+// returns the first 1024 bytes of a longer one.
+//
+// ABP_setPayloadSize lets packets carry up to nearly 64 KB, and senders
+// use the largest packets their receiver takes.  Where the kernel supports
+// it, runs of packets are handed to it with one UDP GSO send and read back
+// with UDP GRO, so a system call moves many packets.
+//
+// ABP_setFec adds repair packets to every group of data packets, from
+// which the receiver rebuilds lost packets without waiting for them to be
+// sent again.  The sender sends more repair packets as more are lost.
+// ABP_setEcc adds check words to every packet instead, so the receiver can
+// put a few flipped bits right without losing the packet at all.
+// ABP_setHarq has the receiver keep packets that arrive damaged and put
+// them together with the copies sent again, which may be damaged too.
+//
 // The following functions are defined:
+//    ABP_open (void)
+//    ABP_close (ABP_session *s)
+//    ABP_sessionSetWindow, ABP_sessionSetPeers, ABP_sessionSetBackend,
+//    ABP_sessionGetFd, ABP_sessionProcess, ABP_sessionSendInit,
+//    ABP_sessionSend, ABP_sessionFlush, ABP_sessionRecvInit,
+//    ABP_sessionRecv, ABP_sessionRecvFrom, ABP_sessionRecvReady,
+//    ABP_sessionTryRecvMessage, ABP_sessionSetReusePort,
+//    ABP_sessionSetDelayedAck,
+//    ABP_sessionSetRecvQueue, ABP_sessionSetSendQueue,
+//    ABP_sessionSetSendCallback, ABP_sessionSendAsync,
+//    ABP_sessionSendComplete, ABP_sessionSetIntegrity,
+//    ABP_sessionSetCongestion, ABP_sessionGetStats,
+//    ABP_sessionRecvMessage, ABP_sessionSendv, ABP_sessionSetPayloadSize,
+//    ABP_sessionSetFec, ABP_sessionSetEcc, ABP_sessionSetHarq,
+//    ABP_sessionSetChannel, ABP_sessionSetLink, ABP_sessionGetCounters,
+//    ABP_sessionSetSharedCounters, ABP_sessionSetMaxMessage
+//
+//    ABP_setWindow (int windowSize, int mode)
+//    ABP_setPeers (int maxPeers, int idleTimeoutMsecs)
+//    ABP_setDelayedAck (int everyPackets, int maxDelayUsecs)
+//    ABP_setRecvQueue (int numMessages)
+//    ABP_setMaxMessage (int length)
+//    ABP_setPayloadSize (int size)
+//    ABP_setFec (int groupSize, int minRepair, int maxRepair)
+//    ABP_setEcc (int ecc)
+//    ABP_setHarq (int copies)
+//    ABP_setIntegrity (int integrity)
+//    ABP_setCongestion (int algorithm)
+//    ABP_getStats (struct ABP_stats *stats)
+//    ABP_getCounters (struct ABP_counters *counters)
+//    ABP_setSharedCounters (const char *name)
+//    ABP_readSharedCounters (const char *name, struct ABP_counters *counters)
+//    ABP_setBackend (int backend)
+//    ABP_getFd (void)
+//    ABP_process (int timeoutMsecs)
+//
 //    ABP_sendInit (char *hostname,int portNum)
 //    ABP_send (char *buf, int length)
+//    ABP_sendv (const struct iovec *iov, int iovcnt)
 //    ABP_flush(void)
+//    ABP_setSendQueue (int numMessages, int highWater)
+//    ABP_setSendCallback (ABP_sendCallback callback, void *arg)
+//    ABP_sendAsync (char *buf, int length, int flags, void *context)
+//    ABP_sendComplete (struct ABP_sendCompletion *completion)
 //
 //    ABP_recvInit (int portNum)
 //    ABP_recv (char *buf, int *length)
+//    ABP_recvFrom (char *buf, int *length, struct sockaddr_in *fromAddr)
+//    ABP_recvMessage (char **buf, int *bufSize, struct sockaddr_in *fromAddr)
 
 #ifndef _ABP_H_
 #define _ABP_H_
 
+#include <netinet/in.h>   // struct sockaddr_in
+#include <sys/uio.h>      // struct iovec
+
+// sliding window modes
+#define ABP_GO_BACK_N        0
+#define ABP_SELECTIVE_REPEAT 1
+
+// largest window that may be used.  Sequence numbers are 8 bits, so
+// selective repeat can have at most half of the sequence space outstanding.
+#define ABP_MAX_WINDOW_SIZE 128
+
+int ABP_setWindow (int windowSize, int mode);
+// selects the window size and recovery mode used by subsequent calls to
+// ABP_sendInit and ABP_recvInit.  windowSize is the number of packets that
+// may be outstanding at once; the default of 1 is the alternating bit
+// protocol, and mode is then irrelevant.  Larger windows use 8 bit sequence
+// numbers and mode is either ABP_GO_BACK_N or ABP_SELECTIVE_REPEAT.  The
+// sender and receiver must use the same window size and mode.
+//
+// A negative return value indicates an error.
+
+int ABP_setPeers (int maxPeers, int idleTimeoutMsecs);
+// sets how many senders a subsequent call to ABP_recvInit can keep state
+// for (16 by default), and how long a sender must be quiet before its state
+// is discarded to make room for a new one (30 seconds by default).  State
+// for every peer is allocated by ABP_recvInit.  Packets from new senders
+// are ignored while the receiver is full, so they retry later.
+//
+// A negative return value indicates an error.
+
+int ABP_setDelayedAck (int everyPackets, int maxDelayUsecs);
+// makes a subsequent call to ABP_recvInit acknowledge packets received in
+// order once everyPackets of them have arrived, or maxDelayUsecs after the
+// first of them if that's sooner.  Packets out of order or repeated are
+// still acknowledged right away.  By default every packet is acknowledged
+// as soon as it arrives.  Keep maxDelayUsecs well below the sender's
+// retransmission timeout (at least 1 msec) to avoid needless resends.
+//
+// A negative return value indicates an error.
+
+int ABP_setRecvQueue (int numMessages);
+// sets how many received messages a subsequent call to ABP_recvInit keeps
+// for ABP_recv (256 by default, rounded up to a power of 2, at most 32768).
+// The room is shared by every sender.  ABP_recv takes messages from the
+// queue without blocking SIGIO and SIGALRM.
+//
+// A negative return value indicates an error.
+
+int ABP_setMaxMessage (int length);
+// sets the longest message (bytes) a subsequent call to ABP_recvInit
+// takes, 16 MB by default.  The first fragment of a message says how long
+// the whole message is, and a buffer that size is allocated for it, so
+// this bounds what a sender, or a forged packet, can make the receiver
+// allocate.  Fragments of longer messages are counted as malformed and
+// never acknowledged, so the sender gives up on them.
+//
+// A negative return value indicates an error.
+
+// largest payload a packet can carry: a UDP datagram less ABP's header
+#define ABP_MAX_PAYLOAD_SIZE 65490
+
+int ABP_setPayloadSize (int size);
+// sets the most data (bytes) a packet carries for subsequent calls to
+// ABP_sendInit and ABP_recvInit, from 1024 (the default) up to
+// ABP_MAX_PAYLOAD_SIZE.  Receivers say in every ack how big a packet they
+// take, and senders send the smaller of that and their own size, using
+// 1024 until they hear; so the two ends don't have to agree, but both must
+// be set for large packets.  Fewer, larger packets cost fewer system calls
+// and acks per byte.  Packets bigger than the path's MTU are fragmented by
+// IP, so losing any fragment loses the whole packet.
+//
+// Buffers for a window of packets per peer and for the receive queue are
+// allocated up front at this size, so large packets need a lot of memory
+// with large windows or queues.
+//
+// A negative return value indicates an error.
+
+// largest groups of data packets and most repair packets per group
+#define ABP_FEC_MAX_GROUP  32
+#define ABP_FEC_MAX_REPAIR 8
+
+int ABP_setFec (int groupSize, int minRepair, int maxRepair);
+// turns on forward error correction for subsequent calls to ABP_sendInit
+// and ABP_recvInit (a groupSize of 0, the default, turns it off).  A
+// sender follows every groupSize data packets with between minRepair and
+// maxRepair repair packets, and the receiver rebuilds up to that many lost
+// packets of the group from whichever repair packets arrive.  One repair
+// packet is the group XORed together; more are Reed-Solomon sums.  The
+// sender starts with minRepair and sends about twice as many as the
+// fraction of packets being lost would need, so a clean path costs little.
+// ABP_flush sends the repair packets for a group that isn't full yet.
+//
+// Receivers only need a groupSize, which may be anything from 1, and then
+// rebuild any sender's groups; receivers without FEC ignore repair packets.
+// A receiver keeps another ABP_FEC_MAX_GROUP packets and
+// 2 * ABP_FEC_MAX_REPAIR repair packets per peer.  FEC needs a window of
+// more than one packet, and a sender's group can't be larger than its
+// window.  Packets carry slightly less data to leave room for the repair
+// packet header.
+//
+// A negative return value indicates an error.
+
+int ABP_setEcc (int ecc);
+// turns on error correction for subsequent calls to ABP_sendInit and
+// ABP_recvInit if ecc is nonzero (it's off by default).  Every data packet
+// (and repair packet) is followed by check words (72 bytes for a 1024
+// byte payload, up to 120 for the largest), and the receiver corrects bit
+// errors with them before checking the crc.  Up to 64 flipped bits are put
+// right as long as no two are at the same place in different 64 bit words
+// of the packet, so a few scattered bits nearly always are; packets with
+// bursts of errors are thrown away and resent, as without error
+// correction.  Acks are short and cumulative, so they don't
+// carry check words.  The sender and receiver must both turn it on.
+//
+// A negative return value indicates an error.
+
+// most damaged copies of packets ABP_setHarq keeps per peer
+#define ABP_MAX_HARQ_COPIES 8
+
+int ABP_setHarq (int copies);
+// has a subsequent call to ABP_recvInit keep up to copies packets per
+// peer that arrive damaged (0, the default, keeps none), for hybrid ARQ.
+// When another damaged packet of the same size arrives from the peer, the
+// receiver tries combining it with the copies nearest it: with two
+// copies, each bit is taken from whichever two of the three agree; with
+// one, it tries flipping the bits where the two differ (if there are no
+// more than 6).  A result whose crc comes out right is accepted as if the
+// packet had arrived intact, and the copies used are dropped.  Bit flips
+// are only tried on packets with a CRC32C.  With ABP_setEcc, packets the
+// check words couldn't put right are kept too.  Only the receiver needs
+// to turn it on.
+//
+// A negative return value indicates an error.
+
+// checks for transmission errors
+#define ABP_INTEGRITY_CHECKSUM 0   // the original 8 bit checksum
+#define ABP_INTEGRITY_CRC8     1
+#define ABP_INTEGRITY_CRC16    2
+#define ABP_INTEGRITY_CRC32C   3   // the default
+#define ABP_INTEGRITY_INET     4   // the 16 bit Internet checksum
+
+int ABP_setIntegrity (int integrity);
+// selects how packets sent from now on are checked for transmission
+// errors.  See calcCRC.h for the CRCs and inetChecksum.h for the Internet
+// checksum.  Packets are accepted with any of
+// the checks, whatever this is set to.
+//
+// A negative return value indicates an error.
+
+// congestion control algorithms
+#define ABP_CONGESTION_NONE  0   // always send a full window
+#define ABP_CONGESTION_RENO  1   // slow start and AIMD on loss (the default)
+#define ABP_CONGESTION_DELAY 2   // also backs off as round trip times grow
+
+int ABP_setCongestion (int algorithm);
+// selects how a subsequent call to ABP_sendInit decides how many packets
+// may be outstanding, up to the window size.  ABP_CONGESTION_RENO starts
+// with 10 packets, doubles that every round trip (slow start) until the
+// first loss, then adds a packet every round trip and halves the window
+// whenever packets are lost; a timeout starts again from one packet.
+// ABP_CONGESTION_DELAY reacts to losses the same way, but also compares
+// round trip times with the smallest seen and stops growing once packets
+// start to queue along the path (TCP Vegas), so it often avoids causing
+// losses at all.
+//
+// A negative return value indicates an error.
+
+// what a sender knows about the path, from ABP_getStats
+struct ABP_stats {
+  int cwnd;                 // packets that may be outstanding
+  int ssthresh;             // where slow start ends (packets)
+  long long srttUsecs;      // smoothed round trip time
+  long long minRttUsecs;    // smallest round trip time seen
+  long long rtoUsecs;       // current retransmission timeout
+  unsigned int packetsSent; // new data packets sent, not counting resends
+  unsigned int packetsLost; // packets resent or rebuilt by FEC
+  int fecRepair;            // repair packets per FEC group
+};
+
+int ABP_getStats (struct ABP_stats *stats);
+// copies the sender's current state to stats.  Times are 0 until an ack
+// has been timed.
+//
+// A negative return value indicates an error.
+
+// round trip times are counted in ABP_RTT_BUCKETS buckets: bucket 0 holds
+// those under 2 usecs, bucket i those from 2^i to 2^(i+1) usecs, and the
+// last bucket anything longer
+#define ABP_RTT_BUCKETS 24
+
+// everything a session has done, from ABP_getCounters.  The counts only
+// ever grow.
+struct ABP_counters {
+  unsigned long long packetsSent;      // data packets, resends included
+  unsigned long long bytesSent;        // and the data in them
+  unsigned long long packetsReceived;  // data packets that arrived intact
+  unsigned long long bytesReceived;    // and the data in them
+  unsigned long long acksSent;
+  unsigned long long acksReceived;     // that arrived intact
+  unsigned long long retransmissions;  // data packets resent
+  unsigned long long timeouts;         // retransmission timeouts
+  unsigned long long gaveUp;           // packets given up on
+  unsigned long long checksumFailures; // packets damaged in transmission
+  unsigned long long malformed;        // of the wrong size or version
+  unsigned long long duplicateAcks;    // repeating the last cumulative ack
+  unsigned long long staleAcks;        // older acks that arrived late
+  unsigned long long duplicatePackets; // data that had been received before
+  unsigned long long overruns;         // data with no room in the queue
+  unsigned long long peersRefused;     // packets from one peer too many
+  unsigned long long rttHistogram[ABP_RTT_BUCKETS];
+};
+
+int ABP_getCounters (struct ABP_counters *counters);
+// copies the counts of everything the session has done to counters.  The
+// protocol only reports trouble with packets it receives through these
+// counts, without printing anything.
+//
+// A negative return value indicates an error.
+
+// how a session's counts are laid out in shared memory
+#define ABP_COUNTERS_MAGIC 0x41425043   // "ABPC"
+
+struct ABP_sharedCounters {
+  unsigned int magic;                 // ABP_COUNTERS_MAGIC
+  unsigned int size;                  // sizeof(struct ABP_sharedCounters)
+  int pid;                            // process counting
+  struct ABP_counters counters;
+};
+
+int ABP_setSharedCounters (const char *name);
+// keeps the session's counts in the POSIX shared memory object name (see
+// shm_open, e.g. "/abp-sender"), created for the purpose, so another
+// process can follow them with ABP_readSharedCounters while this one runs.
+// Counts are added without locks and read one at a time, so a reader never
+// stops the protocol but may see counts of the same moment a packet apart.
+// The object is removed when the session is closed; a process that exits
+// without closing it leaves its last counts behind.  It must be called
+// before the session is initialized.
+//
+// A negative return value indicates an error.
+
+int ABP_readSharedCounters (const char *name, struct ABP_counters *counters);
+// copies the counts a session is keeping in the shared memory object name
+// to counters.  It may be called from any process.
+//
+// A negative return value indicates an error.
+
+// backends that drive the protocol
+#define ABP_BACKEND_SIGNAL  0
+#define ABP_BACKEND_EPOLL   1
+#define ABP_BACKEND_VIRTUAL 2   // set by ABP_sessionSetLink
+
+int ABP_setBackend (int backend);
+// selects how subsequent calls to ABP_sendInit and ABP_recvInit are driven.
+// ABP_BACKEND_SIGNAL (the default) processes packets and timeouts in SIGIO
+// and SIGALRM handlers.  ABP_BACKEND_EPOLL uses no signals; packets and
+// timeouts are processed by ABP_process, which the blocking calls below
+// also run while they wait.  ABP_BACKEND_VIRTUAL is for sessions on a
+// simulated link (see ABP_sessionSetLink).
+//
+// A negative return value indicates an error.
+
+int ABP_getFd (void);
+// returns a descriptor that becomes readable when ABP_process has work to
+// do, so it can be added to the application's own poll or epoll set.
+// Returns -1 unless the epoll backend has been initialized (a link has no
+// descriptors).
+
+int ABP_process (int timeoutMsecs);
+// processes received packets and expired timeouts, waiting up to
+// timeoutMsecs for something to happen (0 doesn't wait, -1 waits
+// indefinitely).  Only used with the epoll and virtual backends.  With the
+// virtual backend it processes every session on the link, and rather than
+// waiting it moves the link's clock on to the next packet or timeout, up
+// to timeoutMsecs on that clock; it returns 0 without waiting if nothing
+// more can happen on the link.
+//
+// Returns the number of events handled, or a negative value on error.
+
 int ABP_sendInit (char *hostname, short portNum);
 // initializes the ABP protocol so that messags subsequently sent using
 // ABP_send will be sent to the ABP protocol running on hostname using UDP
@@ -29,13 +410,80 @@ void ABP_send (char *buf, int length);
 // sends a message to the host specified when ABP_sendInit was called. length
 // bytes will be sent, starting at buf.  ABP_send may return before the 
 // message is sent, but ABP_send will make a copy of the message so the caller
-// can change the buffer.  Currently there is no way for the caller to verify
-// that the message was successfully sent.
+// can change the buffer.  ABP_send only blocks when the send window is
+// full.  Messages longer than a packet are sent as several packets, so
+// ABP_send may wait for the window to open part way through.  To find out
+// whether a message got through, send it with ABP_sendAsync instead and
+// check its completion.
+
+void ABP_sendv (const struct iovec *iov, int iovcnt);
+// same as ABP_send for a message made of iovcnt pieces, like writev(2).
+// The pieces are copied straight into packets, so a header and data kept
+// apart (e.g. in a file mapped with mmap) don't have to be put together
+// first.
 
 void ABP_flush(void);
 // does not return until all previously sent messages have been successfully
 // received.
 
+// flags for ABP_sendAsync
+#define ABP_SEND_NOCOPY 1   // hand the buffer over instead of copying it
+
+// ABP_sendAsync's return value when it can't take another message yet
+#define ABP_SEND_QUEUE_FULL 1
+
+// what became of a message sent with ABP_sendAsync
+struct ABP_sendCompletion {
+  void *context;            // as passed to ABP_sendAsync
+  char *buf;                // the buffer handed over with ABP_SEND_NOCOPY
+  int status;               // 0 if acknowledged, -1 if the sender gave up
+};
+
+typedef void (*ABP_sendCallback) (struct ABP_sendCompletion *completion,
+				  void *arg);
+// called with every completion instead of queueing it for
+// ABP_sendComplete.  It runs in the SIGIO or SIGALRM handler with the signal
+// backend, and inside the ABP call that processed the ack with the epoll
+// backend, so it must be quick and mustn't call ABP functions for the
+// session.
+
+int ABP_setSendQueue (int numMessages, int highWater);
+// sets how many messages sent with ABP_sendAsync may be waiting for an ack
+// or for their completion to be collected (64 by default, rounded up to a
+// power of 2, at most 32768), and how many of them may be waiting for room
+// in the send window before ABP_sendAsync pushes back (all of them by
+// default).  Call before ABP_sendInit.
+//
+// A negative return value indicates an error.
+
+int ABP_setSendCallback (ABP_sendCallback callback, void *arg);
+// makes completions go to callback, called with arg, instead of being
+// collected with ABP_sendComplete.  Call before ABP_sendInit.
+//
+// A negative return value indicates an error.
+
+int ABP_sendAsync (char *buf, int length, int flags, void *context);
+// queues a message for the host specified when ABP_sendInit was called
+// and returns without waiting for room in the send window.  The message
+// is copied unless flags includes ABP_SEND_NOCOPY, in which case the caller
+// must leave buf alone until the message's completion hands it back.
+// context is passed back in the completion.  Messages from ABP_send and
+// ABP_sendAsync are sent in the order they were passed in.  Messages
+// longer than 1024 bytes must be sent with ABP_SEND_NOCOPY; the completion
+// comes once every fragment has been acknowledged.
+//
+// Returns 0 if the message was queued, or ABP_SEND_QUEUE_FULL if the queue
+// is at its high-water mark or too many completions haven't been collected;
+// try again once some have.  A negative return value indicates an error.
+
+int ABP_sendComplete (struct ABP_sendCompletion *completion);
+// copies the completion of the oldest message sent with ABP_sendAsync that
+// has been acknowledged (or given up on) to completion.  It never waits:
+// use ABP_process, or ABP_getFd with the epoll backend, to wait for acks.
+// Completions are only collected here when no callback is set.
+//
+// Returns 1 if there was a completion, 0 if not.
+
 int ABP_recvInit (short portNum);
 // initializes the ABP protocol to receive messages on UDP port portnum.
 //
@@ -44,5 +492,131 @@ int ABP_recvInit (short portNum);
 void ABP_recv (char *buf, int *length);
 // receive a message using the ABP protocol.  On entry, buf is a pointer to
 // a buffer of at least length bytes.  On return length contains the number
-// of bytes actually read.
+// of bytes actually read, or -1 if the protocol wasn't initialized.
+
+void ABP_recvFrom (char *buf, int *length, struct sockaddr_in *fromAddr);
+// same as ABP_recv, and also copies the address and port of the peer that
+// sent the message to fromAddr.  Messages from one peer are always passed
+// on in the order it sent them.  Only the first 1024 bytes of a longer
+// message are returned; the rest is discarded.
+
+int ABP_recvMessage (char **buf, int *bufSize, struct sockaddr_in *fromAddr);
+// receives a whole message of any length, like getline(3): *buf is a
+// buffer of *bufSize bytes allocated with malloc (or 0, with *bufSize 0),
+// and is made bigger with realloc, updating both, if the message doesn't
+// fit.  The caller frees *buf when done.  fromAddr may be 0; otherwise the
+// sender's address is copied to it.  A message's fragments are copied
+// straight from the receive queue into *buf.
+//
+// Returns the length of the message.  A negative return value indicates an
+// error; if there wasn't memory for the message it is discarded.
+
+// the state of one flow
+typedef struct ABP_session ABP_session;
+
+ABP_session *ABP_open (void);
+// creates a session with a window size of 1 and the signal backend.
+// Configure it with ABP_sessionSetWindow and ABP_sessionSetBackend, then
+// initialize it with ABP_sessionSendInit and/or ABP_sessionRecvInit.
+//
+// Returns 0 on error.
+
+void ABP_close (ABP_session *s);
+// closes the session's sockets and frees it.  Unacknowledged data is
+// discarded, so call ABP_sessionFlush first if it matters.
+
+int ABP_sessionSetWindow (ABP_session *s, int windowSize, int mode);
+int ABP_sessionSetPeers (ABP_session *s, int maxPeers, int idleTimeoutMsecs);
+int ABP_sessionSetDelayedAck (ABP_session *s, int everyPackets,
+			      int maxDelayUsecs);
+int ABP_sessionSetRecvQueue (ABP_session *s, int numMessages);
+int ABP_sessionSetMaxMessage (ABP_session *s, int length);
+int ABP_sessionSetPayloadSize (ABP_session *s, int size);
+int ABP_sessionSetFec (ABP_session *s, int groupSize, int minRepair,
+		       int maxRepair);
+int ABP_sessionSetEcc (ABP_session *s, int ecc);
+int ABP_sessionSetHarq (ABP_session *s, int copies);
+int ABP_sessionSetIntegrity (ABP_session *s, int integrity);
+int ABP_sessionSetCongestion (ABP_session *s, int algorithm);
+void ABP_sessionGetStats (ABP_session *s, struct ABP_stats *stats);
+void ABP_sessionGetCounters (ABP_session *s, struct ABP_counters *counters);
+int ABP_sessionSetSharedCounters (ABP_session *s, const char *name);
+int ABP_sessionSetSendQueue (ABP_session *s, int numMessages, int highWater);
+int ABP_sessionSetSendCallback (ABP_session *s, ABP_sendCallback callback,
+				void *arg);
+int ABP_sessionSendAsync (ABP_session *s, char *buf, int length, int flags,
+			  void *context);
+int ABP_sessionSendComplete (ABP_session *s,
+			     struct ABP_sendCompletion *completion);
+int ABP_sessionSetBackend (ABP_session *s, int backend);
+int ABP_sessionGetFd (ABP_session *s);
+int ABP_sessionProcess (ABP_session *s, int timeoutMsecs);
+int ABP_sessionSendInit (ABP_session *s, char *hostname, short portNum);
+int ABP_sessionSend (ABP_session *s, char *buf, int length);
+int ABP_sessionSendv (ABP_session *s, const struct iovec *iov, int iovcnt);
+int ABP_sessionFlush (ABP_session *s);
+int ABP_sessionRecvInit (ABP_session *s, short portNum);
+void ABP_sessionRecv (ABP_session *s, char *buf, int *length);
+void ABP_sessionRecvFrom (ABP_session *s, char *buf, int *length,
+			  struct sockaddr_in *fromAddr);
+int ABP_sessionRecvMessage (ABP_session *s, char **buf, int *bufSize,
+			    struct sockaddr_in *fromAddr);
+// same as the functions above, for session s.  Sessions using the epoll
+// backend each have their own descriptor for ABP_sessionGetFd, and the
+// blocking calls only process their own session while they wait, so a
+// process with several such sessions should either give each its own thread
+// or drive them all with ABP_sessionProcess.  Sessions using the signal
+// backend share the process's SIGIO and SIGALRM handlers and are all
+// processed whenever a signal arrives.
+
+int ABP_sessionRecvReady (ABP_session *s);
+// returns nonzero if a whole message has arrived.  ABP_sessionRecv may
+// still wait: for the rest of another peer's message whose first fragment
+// came before it, or for the next message if the sender gave up on one of
+// its fragments.
+
+int ABP_sessionTryRecvMessage (ABP_session *s, char **buf, int *bufSize,
+			       struct sockaddr_in *fromAddr);
+// same as ABP_sessionRecvMessage, but never waits: once the receive queue
+// is empty, what has arrived of the message is set aside for a later call
+// and -1 is returned.  Messages that came in between, which
+// ABP_sessionRecvReady may have reported, are set aside whole and returned
+// by the next calls.
+
+int ABP_sessionSetReusePort (ABP_session *s, int reusePort);
+// if reusePort is nonzero, ABP_sessionRecvInit binds the session's socket
+// with SO_REUSEPORT so several sessions can receive on the same port.  The
+// kernel sends all packets from one sender to the same socket.
+//
+// A negative return value indicates an error.
+
+struct US_channel;
+int ABP_sessionSetChannel (ABP_session *s, struct US_channel *channel);
+// has session s send its packets through channel (see unreliableSend.h)
+// instead of the default channel US_SetFailureProb configures, so each
+// session can have a network of its own, with its own seed.  Packets the
+// channel delays are sent from the session's timer.  It must be called
+// before the session is initialized.
+//
+// A negative return value indicates an error.
+
+struct VL_link;
+int ABP_sessionSetLink (ABP_session *s, struct VL_link *link);
+// runs session s over link (see virtualLink.h) with the virtual backend:
+// its sockets are the link's, its packets go through its channel (one
+// that passes everything, unless ABP_sessionSetChannel gave it another)
+// over the link, and its timeouts are on the link's clock.  The sending
+// and receiving sessions are all in one process, usually one thread, and
+// whichever is waiting or calls ABP_sessionProcess processes them all.  A
+// blocking call that waits for something that can no longer happen (e.g.
+// ABP_sessionRecv when every sender is done) prints a message and fails:
+// ABP_sessionSend, ABP_sessionSendv, ABP_sessionFlush and
+// ABP_sessionRecvMessage return -1, and ABP_sessionRecv and
+// ABP_sessionRecvFrom set *length to -1.  A message may have been partly
+// sent.  Nothing is discarded, so the call can be made again once the
+// caller has done something else on the link (e.g. received from the
+// session the sender was waiting for).  A link of 0 goes back to the
+// signal backend.  It must be called before the session is initialized.
+//
+// A negative return value indicates an error.
 #endif
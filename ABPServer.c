@@ -0,0 +1,325 @@
+//
+// File: ABPServer.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the sharded receiver defined in ABPServer.h.
+//
+// Every worker thread waits on its own epoll descriptor for its session's
+// descriptor and for the server's stop eventfd.  Nothing on the receive
+// path is shared between workers: each sends its acks through its own copy
+// of the default unreliable channel, and the statistics are written only
+// by their worker and padded out to a cache line so workers don't slow
+// each other down.
+//
+
+#define _GNU_SOURCE     // pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ABP.h"
+#include "ABPServer.h"
+#include "unreliableSend.h"
+
+// how long a worker waits before looking for work anyway (msecs)
+#define ABP_SERVER_WAIT_MSECS 100
+
+// events a worker waits for
+#define ABP_SERVER_EVENT_SESSION 0
+#define ABP_SERVER_EVENT_STOP    1
+
+#define ABP_CACHE_LINE 64
+
+// one worker and the session it owns
+struct ABP_shard {
+  struct ABP_shardStats stats;
+  ABP_session *session;
+  US_channel *channel;          // the session's, so no other thread uses it
+  int epollFd;
+  int index;
+  int started;
+  pthread_t thread;
+  struct ABP_server *server;
+} __attribute__ ((aligned (ABP_CACHE_LINE)));
+
+struct ABP_server {
+  int numWorkers;
+  ABP_serverHandler handler;
+  void *arg;
+  int stopFd;                   // readable once the workers should stop
+  struct ABP_shard *shards;
+};
+
+// define prototypes for local routines
+static void *ABP_serverWorker (void *arg);
+static int ABP_shardInit (struct ABP_shard *shard, short portNum,
+			  int windowSize, int mode);
+static void ABP_statAdd (unsigned long long *stat, unsigned long long n);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_serverStart
+//
+///////////////////////////////////////////////////////////////////////////////
+ABP_server *ABP_serverStart (short portNum, int numWorkers, int windowSize,
+			     int mode, ABP_serverHandler handler, void *arg)
+{
+  ABP_server *server;
+  void *shards;
+  int i;
+
+  // one worker per CPU unless told otherwise
+  if (numWorkers == 0)
+    numWorkers = sysconf (_SC_NPROCESSORS_ONLN);
+  if (numWorkers < 1) {
+    printf ("serverStart: need at least one worker\n");
+    return 0;
+  }
+
+  server = calloc (1, sizeof(*server));
+  if (!server) {
+    perror ("serverStart: calloc");
+    return 0;
+  }
+  server->handler = handler;
+  server->arg = arg;
+
+  if (posix_memalign (&shards, ABP_CACHE_LINE,
+		      numWorkers * sizeof(struct ABP_shard)) != 0) {
+    printf ("serverStart: posix_memalign error\n");
+    free (server);
+    return 0;
+  }
+  memset (shards, 0, numWorkers * sizeof(struct ABP_shard));
+  server->shards = shards;
+  server->numWorkers = numWorkers;
+  for (i = 0; i < numWorkers; i++)
+    server->shards[i].epollFd = -1;
+
+  if ((server->stopFd = eventfd (0, EFD_CLOEXEC)) < 0) {
+    perror ("serverStart: eventfd");
+    ABP_serverStop (server);
+    return 0;
+  }
+
+  // open every worker's socket before starting any of them, so a port
+  // that's in use is reported here
+  for (i = 0; i < numWorkers; i++) {
+    server->shards[i].server = server;
+    server->shards[i].index = i;
+    if (ABP_shardInit (&server->shards[i], portNum, windowSize, mode) < 0) {
+      ABP_serverStop (server);
+      return 0;
+    }
+  }
+
+  for (i = 0; i < numWorkers; i++) {
+    if (pthread_create (&server->shards[i].thread, 0, ABP_serverWorker,
+			&server->shards[i]) != 0) {
+      printf ("serverStart: pthread_create error\n");
+      ABP_serverStop (server);
+      return 0;
+    }
+    server->shards[i].started = 1;
+  }
+
+  return server;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_serverStop
+//
+///////////////////////////////////////////////////////////////////////////////
+void ABP_serverStop (ABP_server *server)
+{
+  unsigned long long one = 1;
+  int i;
+
+  if (!server)
+    return;
+
+  // the eventfd stays readable, so every worker sees it
+  if (server->stopFd >= 0 &&
+      write (server->stopFd, &one, sizeof(one)) != sizeof(one))
+    perror ("serverStop: write");
+
+  for (i = 0; i < server->numWorkers; i++) {
+    if (server->shards[i].started)
+      pthread_join (server->shards[i].thread, 0);
+    ABP_close (server->shards[i].session);
+    US_close (server->shards[i].channel);
+    if (server->shards[i].epollFd >= 0)
+      close (server->shards[i].epollFd);
+  }
+
+  if (server->stopFd >= 0)
+    close (server->stopFd);
+  free (server->shards);
+  free (server);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_serverNumWorkers
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_serverNumWorkers (ABP_server *server)
+{
+  return server->numWorkers;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_serverGetStats
+//
+///////////////////////////////////////////////////////////////////////////////
+int ABP_serverGetStats (ABP_server *server, int worker,
+			struct ABP_shardStats *stats)
+{
+  struct ABP_shardStats *shardStats;
+
+  if (worker < 0 || worker >= server->numWorkers) {
+    printf ("serverGetStats: no such worker\n");
+    return -1;
+  }
+
+  shardStats = &server->shards[worker].stats;
+  stats->messages = __atomic_load_n (&shardStats->messages, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n (&shardStats->bytes, __ATOMIC_RELAXED);
+  stats->wakeups = __atomic_load_n (&shardStats->wakeups, __ATOMIC_RELAXED);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_shardInit
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ABP_shardInit (struct ABP_shard *shard, short portNum,
+			  int windowSize, int mode)
+{
+  // open the worker's session, with its own channel set up like the
+  // default one, and the epoll descriptor it waits on
+  struct epoll_event ev;
+
+  shard->session = ABP_open ();
+  shard->channel = US_clone (0);
+  if (!shard->session || !shard->channel)
+    return -1;
+  if (ABP_sessionSetChannel (shard->session, shard->channel) < 0 ||
+      ABP_sessionSetWindow (shard->session, windowSize, mode) < 0 ||
+      ABP_sessionSetBackend (shard->session, ABP_BACKEND_EPOLL) < 0 ||
+      ABP_sessionSetReusePort (shard->session, 1) < 0 ||
+      ABP_sessionRecvInit (shard->session, portNum) < 0)
+    return -1;
+
+  if ((shard->epollFd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+    perror ("shardInit: epoll_create1");
+    return -1;
+  }
+
+  memset (&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = ABP_SERVER_EVENT_SESSION;
+  if (epoll_ctl (shard->epollFd, EPOLL_CTL_ADD,
+		 ABP_sessionGetFd (shard->session), &ev) < 0) {
+    perror ("shardInit: epoll_ctl");
+    return -1;
+  }
+
+  ev.data.u32 = ABP_SERVER_EVENT_STOP;
+  if (epoll_ctl (shard->epollFd, EPOLL_CTL_ADD,
+		 shard->server->stopFd, &ev) < 0) {
+    perror ("shardInit: epoll_ctl");
+    return -1;
+  }
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_serverWorker
+//
+///////////////////////////////////////////////////////////////////////////////
+static void *ABP_serverWorker (void *arg)
+{
+  // process the shard's packets and pass its messages to the handler until
+  // the server stops
+  struct ABP_shard *shard = arg;
+  struct ABP_server *server = shard->server;
+  struct epoll_event events[2];
+  struct sockaddr_in fromAddr;
+  char *buf = 0;      // grown by ABP_sessionRecvMessage to fit messages
+  int bufSize = 0;
+  cpu_set_t cpus;
+  long numCpus;
+  int numEvents;
+  int length;
+  int i;
+
+  // stay on one CPU so the shard's state stays in that CPU's cache
+  numCpus = sysconf (_SC_NPROCESSORS_ONLN);
+  if (numCpus > 0) {
+    CPU_ZERO (&cpus);
+    CPU_SET (shard->index % numCpus, &cpus);
+    if (pthread_setaffinity_np (pthread_self (), sizeof(cpus), &cpus) != 0)
+      printf ("serverWorker: can't pin worker %d\n", shard->index);
+  }
+
+  for (;;) {
+    numEvents = epoll_wait (shard->epollFd, events, 2, ABP_SERVER_WAIT_MSECS);
+    if (numEvents < 0) {
+      if (errno == EINTR)
+	continue;
+      perror ("serverWorker: epoll_wait");
+      break;
+    }
+
+    for (i = 0; i < numEvents; i++)
+      if (events[i].data.u32 == ABP_SERVER_EVENT_STOP) {
+	free (buf);
+	return 0;
+      }
+
+    // the session also has timeouts to handle when nothing arrives
+    ABP_sessionProcess (shard->session, 0);
+    ABP_statAdd (&shard->stats.wakeups, 1);
+
+    while (ABP_sessionRecvReady (shard->session)) {
+      // don't wait for the rest of a message: the stop eventfd wouldn't be
+      // seen, and its sender may have gone
+      length = ABP_sessionTryRecvMessage (shard->session, &buf, &bufSize,
+					  &fromAddr);
+      if (length < 0)
+	continue;
+      ABP_statAdd (&shard->stats.messages, 1);
+      ABP_statAdd (&shard->stats.bytes, length);
+      if (server->handler)
+	server->handler (shard->index, buf, length, &fromAddr, server->arg);
+    }
+  }
+
+  free (buf);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ABP_statAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ABP_statAdd (unsigned long long *stat, unsigned long long n)
+{
+  // only the worker writes its counts, so a plain load and store will do;
+  // being atomic keeps readers on other threads from seeing torn values
+  __atomic_store_n (stat, __atomic_load_n (stat, __ATOMIC_RELAXED) + n,
+		    __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+//
+// File: ABPServer.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: A receiver that spreads its senders across several worker
+// threads.  Each worker owns an ABP session bound to the same UDP port with
+// SO_REUSEPORT, so the kernel picks a worker for every sender and the
+// workers never share any protocol state.  Workers are pinned to a CPU
+// each and pass received messages to a handler on their own thread.
+//
+// The following functions are defined:
+//    ABP_serverStart (short portNum, int numWorkers, int windowSize,
+//                     int mode, ABP_serverHandler handler, void *arg)
+//    ABP_serverStop (ABP_server *server)
+//    ABP_serverNumWorkers (ABP_server *server)
+//    ABP_serverGetStats (ABP_server *server, int worker,
+//                        struct ABP_shardStats *stats)
+
+#ifndef _ABPSERVER_H_
+#define _ABPSERVER_H_
+
+#include <netinet/in.h>   // struct sockaddr_in
+
+// a running server
+typedef struct ABP_server ABP_server;
+
+// counts kept by each worker
+struct ABP_shardStats {
+  unsigned long long messages;  // messages passed to the handler
+  unsigned long long bytes;     // bytes in those messages
+  unsigned long long wakeups;   // times the worker woke up to process packets
+};
+
+typedef void (*ABP_serverHandler) (int worker, char *buf, int length,
+				   struct sockaddr_in *fromAddr, void *arg);
+// called on worker's thread with every message it receives.  Messages from
+// one sender always go to the same worker, in the order they were sent.
+
+ABP_server *ABP_serverStart (short portNum, int numWorkers, int windowSize,
+			     int mode, ABP_serverHandler handler, void *arg);
+// starts numWorkers worker threads receiving on UDP port portNum, or one
+// per online CPU if numWorkers is 0.  windowSize and mode are as for
+// ABP_setWindow, and must match the senders.  Each worker sends its acks
+// through a copy of the default unreliable channel (see unreliableSend.h)
+// made here, so set that up first.
+//
+// Returns 0 on error.
+
+void ABP_serverStop (ABP_server *server);
+// stops the workers, closes their sessions and frees the server.  Messages
+// not yet passed to the handler are discarded.
+
+int ABP_serverNumWorkers (ABP_server *server);
+// returns the number of worker threads.
+
+int ABP_serverGetStats (ABP_server *server, int worker,
+			struct ABP_shardStats *stats);
+// copies worker's counts to stats.  The counts may be read while the server
+// is running.
+//
+// A negative return value indicates an error.
+#endif
@@ -0,0 +1,109 @@
+//
+// File: abpstat.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: prints the counts an ABP session keeps in shared memory
+// (see ABP_setSharedCounters), such as those of "sender -C /abp-sender".
+// With an interval, the counts are printed again every interval seconds,
+// with how much each grew, until the session goes away.  Reading them
+// never stops the process being watched.
+//
+// usage: abpstat name [intervalSecs]
+//
+
+#include <stdio.h>
+#include <stdlib.h>     // atof
+#include <string.h>     // memset
+#include <unistd.h>     // usleep
+#include "ABP.h"
+
+// define prototypes for local routines
+static void printCounters (struct ABP_counters *now,
+			   struct ABP_counters *before);
+static void printCount (const char *name, unsigned long long now,
+			unsigned long long before);
+
+int main (int argc, char *argv[])
+{
+  struct ABP_counters now, before;
+  double interval = 0;
+
+  if (argc < 2 || argc > 3) {
+    printf ("usage: abpstat name [intervalSecs]\n");
+    return 1;
+  }
+  if (argc == 3)
+    interval = atof (argv[2]);
+
+  memset (&before, 0, sizeof(before));
+  for (;;) {
+    if (ABP_readSharedCounters (argv[1], &now) < 0)
+      return 1;
+    printCounters (&now, &before);
+    if (interval <= 0)
+      return 0;
+    before = now;
+    usleep ((useconds_t)(interval * 1e6));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// printCounters
+//
+///////////////////////////////////////////////////////////////////////////////
+static void printCounters (struct ABP_counters *now,
+			   struct ABP_counters *before)
+{
+  // every count and how much it grew, then the round trip times that have
+  // been seen, bucket by bucket
+  int i;
+
+  printCount ("packets sent", now->packetsSent, before->packetsSent);
+  printCount ("bytes sent", now->bytesSent, before->bytesSent);
+  printCount ("packets received", now->packetsReceived,
+	      before->packetsReceived);
+  printCount ("bytes received", now->bytesReceived, before->bytesReceived);
+  printCount ("acks sent", now->acksSent, before->acksSent);
+  printCount ("acks received", now->acksReceived, before->acksReceived);
+  printCount ("retransmissions", now->retransmissions,
+	      before->retransmissions);
+  printCount ("timeouts", now->timeouts, before->timeouts);
+  printCount ("packets given up on", now->gaveUp, before->gaveUp);
+  printCount ("checksum failures", now->checksumFailures,
+	      before->checksumFailures);
+  printCount ("malformed packets", now->malformed, before->malformed);
+  printCount ("duplicate acks", now->duplicateAcks, before->duplicateAcks);
+  printCount ("stale acks", now->staleAcks, before->staleAcks);
+  printCount ("duplicate packets", now->duplicatePackets,
+	      before->duplicatePackets);
+  printCount ("receive queue overruns", now->overruns, before->overruns);
+  printCount ("peers refused", now->peersRefused, before->peersRefused);
+
+  printf ("round trip times:\n");
+  for (i = 0; i < ABP_RTT_BUCKETS; i++) {
+    if (!now->rttHistogram[i])
+      continue;
+    if (i == 0)
+      printf ("  %10s < %-10d", "", 2);
+    else if (i == ABP_RTT_BUCKETS - 1)
+      printf ("  %10s >= %-9lld", "", 1LL << i);
+    else
+      printf ("  %10lld - %-10lld", 1LL << i, (1LL << (i + 1)) - 1);
+    printf (" usecs %12llu\n", now->rttHistogram[i]);
+  }
+  printf ("\n");
+  fflush (stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// printCount
+//
+///////////////////////////////////////////////////////////////////////////////
+static void printCount (const char *name, unsigned long long now,
+			unsigned long long before)
+{
+  printf ("%-24s %14llu %+12lld\n", name, now, (long long)(now - before));
+}
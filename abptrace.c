@@ -0,0 +1,709 @@
+//
+// File: abptrace.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: makes sense of trace files recorded with trace.h (such as
+// those of "sender -T file" and "receiver -T file").  The traces of both
+// ends of a transfer can be given together; their events are put in order
+// of time, and packets are matched up by flow (the port the data goes to)
+// and number, so each flow should have a single sender.
+//
+// usage: abptrace summary trace...
+//        abptrace latency trace...
+//        abptrace tsg [-f flow] trace...
+//        abptrace pcap out.pcapng trace...
+//
+// summary counts the events and, for every flow, how many packets were
+// resent, the goodput, the one-way and ack latencies of the packets and
+// how long was spent waiting for timeouts.  latency lists every packet:
+// when it was first and last sent, arrived and was acknowledged, in usecs
+// from the first event.  tsg prints a time-sequence graph for gnuplot: the
+// packet numbers sent, resent, received and acknowledged against time, as
+// four data sets, e.g. (on one line)
+//
+//    plot 'tsg' index 0 title 'send', '' index 1 title 'resend',
+//         '' index 2 title 'recv', '' index 3 title 'ack'
+//
+// pcap writes the events to a pcap-ng file, an interface for each trace,
+// so they can be looked through with Wireshark and the like.  Each event
+// is a packet of link type USER0 holding its struct TR_event, with a
+// comment saying what it was.
+//
+
+#include <stdio.h>
+#include <stdlib.h>     // calloc, qsort, realloc
+#include <string.h>
+#include <unistd.h>     // getopt
+#include "trace.h"
+
+// pcap-ng blocks and options, and the link type used for events
+#define AT_PCAP_SECTION    0x0A0D0D0A
+#define AT_PCAP_INTERFACE  0x00000001
+#define AT_PCAP_PACKET     0x00000006
+#define AT_PCAP_BYTE_ORDER 0x1A2B3C4D
+#define AT_PCAP_END_OPT    0
+#define AT_PCAP_COMMENT    1
+#define AT_PCAP_IF_NAME    2
+#define AT_PCAP_IF_TSRESOL 9
+#define AT_LINKTYPE_USER0  147
+
+// an event, and which trace it came from
+struct AT_event {
+  struct TR_event e;
+  int trace;
+  long long order;          // its place in the traces, to keep ties stable
+};
+
+// all the events, in order of time
+struct AT_trace {
+  struct AT_event *events;
+  long long numEvents;
+  long long *realtimeOffsets;   // for each trace
+  char **paths;
+  int numTraces;
+};
+
+// what happened to one packet, in nsecs (0 for never)
+struct AT_packet {
+  unsigned short flow;
+  unsigned int packetNum;
+  int used;
+  int sends;
+  int length;
+  long long firstSend, lastSend;
+  long long recv;
+  long long acked;
+};
+
+// packets, found by flow and number
+struct AT_packets {
+  struct AT_packet *table;
+  unsigned long long size;      // a power of 2
+  unsigned long long count;
+};
+
+// a flow's totals
+struct AT_flow {
+  unsigned short flow;
+  long long packets, resent, timeouts;
+  long long bytes;
+  long long start, end;
+  long long timeoutWait;        // nsecs between a packet going out and
+				// timing out
+  unsigned int nextUnacked;
+  int acksSeen;
+};
+
+#define AT_MAX_FLOWS 64
+
+// define prototypes for local routines
+static int AT_load (struct AT_trace *t, char **paths, int numPaths);
+static int AT_compare (const void *a, const void *b);
+static int AT_build (struct AT_trace *t, struct AT_packets *p,
+		     struct AT_flow *flows, int *numFlows);
+static struct AT_flow *AT_findFlow (struct AT_flow *flows, int *numFlows,
+				    unsigned short flow);
+static struct AT_packet *AT_findPacket (struct AT_packets *p,
+					unsigned short flow,
+					unsigned int packetNum, int add);
+static void AT_summary (struct AT_trace *t);
+static void AT_latency (struct AT_trace *t);
+static void AT_tsg (struct AT_trace *t, int flow);
+static int AT_pcap (struct AT_trace *t, const char *path);
+static void AT_pcapBlock (FILE *fp, unsigned int type, const void *body,
+			  int bodyLength, const char *comment);
+static void AT_describe (struct TR_event *e, char *buf, int size);
+static void AT_percentiles (const char *name, long long *values, long long n);
+static int AT_compareLong (const void *a, const void *b);
+
+int main (int argc, char *argv[])
+{
+  struct AT_trace t;
+  char *command;
+  int flow = -1;
+  int opt;
+
+  if (argc < 3) {
+    printf ("usage: abptrace summary trace...\n"
+	    "       abptrace latency trace...\n"
+	    "       abptrace tsg [-f flow] trace...\n"
+	    "       abptrace pcap out.pcapng trace...\n");
+    return 1;
+  }
+  command = argv[1];
+  argv++;
+  argc--;
+  while ((opt = getopt (argc, argv, "f:")) != -1) {
+    if (opt == 'f')
+      flow = atoi (optarg);
+    else
+      return 1;
+  }
+  argv += optind;
+  argc -= optind;
+
+  if (!strcmp (command, "pcap")) {
+    if (argc < 2 || AT_load (&t, argv + 1, argc - 1) < 0)
+      return 1;
+    return AT_pcap (&t, argv[0]) < 0;
+  }
+  if (argc < 1 || AT_load (&t, argv, argc) < 0)
+    return 1;
+  if (!strcmp (command, "summary"))
+    AT_summary (&t);
+  else if (!strcmp (command, "latency"))
+    AT_latency (&t);
+  else if (!strcmp (command, "tsg"))
+    AT_tsg (&t, flow);
+  else {
+    printf ("abptrace: unknown command %s\n", command);
+    return 1;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_load
+//
+///////////////////////////////////////////////////////////////////////////////
+static int AT_load (struct AT_trace *t, char **paths, int numPaths)
+{
+  // read every trace and put their events in order of time.  Returns -1 if
+  // a trace couldn't be read.
+  TR_reader *r;
+  struct AT_event *events;
+  long long size = 0;
+  int i;
+
+  memset (t, 0, sizeof(*t));
+  t->realtimeOffsets = calloc (numPaths, sizeof(long long));
+  t->paths = paths;
+  t->numTraces = numPaths;
+  if (!t->realtimeOffsets) {
+    perror ("abptrace: calloc");
+    return -1;
+  }
+
+  for (i = 0; i < numPaths; i++) {
+    r = TR_readOpen (paths[i]);
+    if (!r)
+      return -1;
+    t->realtimeOffsets[i] = TR_readRealtimeOffset (r);
+    for (;;) {
+      if (t->numEvents == size) {
+	size = size ? size * 2 : 65536;
+	events = realloc (t->events, size * sizeof(struct AT_event));
+	if (!events) {
+	  perror ("abptrace: realloc");
+	  return -1;
+	}
+	t->events = events;
+      }
+      if (!TR_read (r, &t->events[t->numEvents].e))
+	break;
+      t->events[t->numEvents].trace = i;
+      t->events[t->numEvents].order = t->numEvents;
+      t->numEvents++;
+    }
+    TR_readClose (r);
+  }
+  qsort (t->events, t->numEvents, sizeof(struct AT_event), AT_compare);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_compare
+//
+///////////////////////////////////////////////////////////////////////////////
+static int AT_compare (const void *a, const void *b)
+{
+  const struct AT_event *x = a, *y = b;
+
+  if (x->e.time != y->e.time)
+    return x->e.time < y->e.time ? -1 : 1;
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_build
+//
+///////////////////////////////////////////////////////////////////////////////
+static int AT_build (struct AT_trace *t, struct AT_packets *p,
+		     struct AT_flow *flows, int *numFlows)
+{
+  // follow every packet through the events, and total up every flow.
+  // Returns -1 if there wasn't memory.
+  struct TR_event *e;
+  struct AT_packet *packet;
+  struct AT_flow *flow;
+  long long i;
+
+  p->size = 1024;
+  while (p->size < (unsigned long long)t->numEvents)
+    p->size <<= 1;
+  p->size <<= 1;
+  p->count = 0;
+  p->table = calloc (p->size, sizeof(struct AT_packet));
+  if (!p->table) {
+    perror ("abptrace: calloc");
+    return -1;
+  }
+  *numFlows = 0;
+
+  for (i = 0; i < t->numEvents; i++) {
+    e = &t->events[i].e;
+    if (e->type == TR_GARBLE || e->type == TR_CHECKSUM)
+      continue;
+    flow = AT_findFlow (flows, numFlows, e->flow);
+    if (!flow)
+      continue;
+
+    switch (e->type) {
+    case TR_SEND:
+    case TR_RETRANSMIT:
+      packet = AT_findPacket (p, e->flow, e->packetNum, 1);
+      if (!packet->firstSend) {
+	packet->firstSend = e->time;
+	packet->length = e->length;
+	flow->packets++;
+	flow->bytes += e->length;
+      }
+      else if (packet->sends == 1)
+	flow->resent++;
+      packet->lastSend = e->time;
+      packet->sends++;
+      if (!flow->start)
+	flow->start = e->time;
+      break;
+    case TR_TIMEOUT:
+      flow->timeouts++;
+      packet = AT_findPacket (p, e->flow, e->packetNum, 0);
+      if (packet && packet->lastSend)
+	flow->timeoutWait += e->time - packet->lastSend;
+      break;
+    case TR_RECV:
+      packet = AT_findPacket (p, e->flow, e->packetNum, 1);
+      if (!packet->recv && e->detail == TR_RECV_WINDOW)
+	packet->recv = e->time;
+      break;
+    case TR_ACK:
+      // everything up to packetNum has been received
+      if (!flow->acksSeen) {
+	flow->acksSeen = 1;
+	flow->nextUnacked = 0;
+      }
+      while ((int)(e->packetNum + 1 - flow->nextUnacked) > 0) {
+	packet = AT_findPacket (p, e->flow, flow->nextUnacked, 0);
+	if (packet && !packet->acked)
+	  packet->acked = e->time;
+	flow->nextUnacked++;
+	flow->end = e->time;
+      }
+      break;
+    }
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_findFlow
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct AT_flow *AT_findFlow (struct AT_flow *flows, int *numFlows,
+				    unsigned short flow)
+{
+  int i;
+
+  for (i = 0; i < *numFlows; i++)
+    if (flows[i].flow == flow)
+      return &flows[i];
+  if (*numFlows == AT_MAX_FLOWS)
+    return 0;
+  memset (&flows[*numFlows], 0, sizeof(flows[0]));
+  flows[*numFlows].flow = flow;
+  return &flows[(*numFlows)++];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_findPacket
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct AT_packet *AT_findPacket (struct AT_packets *p,
+					unsigned short flow,
+					unsigned int packetNum, int add)
+{
+  // open addressing; the table has at least twice as many slots as there
+  // are events, so it never fills
+  unsigned long long i;
+
+  i = ((unsigned long long)flow << 32 | packetNum) * 0x9E3779B97F4A7C15ULL;
+  for (i >>= 20; ; i++) {
+    i &= p->size - 1;
+    if (!p->table[i].used)
+      break;
+    if (p->table[i].flow == flow && p->table[i].packetNum == packetNum)
+      return &p->table[i];
+  }
+  if (!add)
+    return 0;
+  p->table[i].used = 1;
+  p->table[i].flow = flow;
+  p->table[i].packetNum = packetNum;
+  p->count++;
+  return &p->table[i];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_summary
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_summary (struct AT_trace *t)
+{
+  struct AT_packets p;
+  struct AT_flow flows[AT_MAX_FLOWS];
+  struct AT_packet *packet;
+  struct TR_event *e;
+  long long counts[TR_NUM_TYPES][4];
+  long long *oneWay, *ackLatency;
+  long long numOneWay, numAck;
+  long long duration;
+  unsigned long long j;
+  long long i;
+  int numFlows;
+  int k;
+
+  if (t->numEvents == 0) {
+    printf ("no events\n");
+    return;
+  }
+  memset (counts, 0, sizeof(counts));
+  for (i = 0; i < t->numEvents; i++) {
+    e = &t->events[i].e;
+    if (e->type < TR_NUM_TYPES)
+      counts[e->type][e->detail < 4 ? e->detail : 3]++;
+  }
+
+  printf ("%lld events from %d traces over %.6f seconds\n", t->numEvents,
+	  t->numTraces,
+	  (t->events[t->numEvents - 1].e.time - t->events[0].e.time) / 1e9);
+  for (k = 0; k < TR_NUM_TYPES; k++)
+    printf ("  %-12s %10lld\n", TR_typeName (k),
+	    counts[k][0] + counts[k][1] + counts[k][2] + counts[k][3]);
+  printf ("acks: %lld new, %lld duplicate, %lld stale\n",
+	  counts[TR_ACK][TR_ACK_NEW], counts[TR_ACK][TR_ACK_DUPLICATE],
+	  counts[TR_ACK][TR_ACK_STALE]);
+  printf ("received: %lld in the window, %lld duplicate, %lld beyond it\n",
+	  counts[TR_RECV][TR_RECV_WINDOW], counts[TR_RECV][TR_RECV_DUPLICATE],
+	  counts[TR_RECV][TR_RECV_BEYOND]);
+  printf ("damaged: %lld data, %lld acks, %lld repair\n",
+	  counts[TR_CHECKSUM][TR_PACKET_DATA],
+	  counts[TR_CHECKSUM][TR_PACKET_ACK],
+	  counts[TR_CHECKSUM][TR_PACKET_REPAIR]);
+  printf ("network: %lld dropped, %lld burst errors, %lld bit errors\n",
+	  counts[TR_GARBLE][TR_GARBLE_DROP], counts[TR_GARBLE][TR_GARBLE_BURST],
+	  counts[TR_GARBLE][TR_GARBLE_BITS]);
+
+  if (AT_build (t, &p, flows, &numFlows) < 0)
+    return;
+  oneWay = malloc ((p.count + 1) * sizeof(long long));
+  ackLatency = malloc ((p.count + 1) * sizeof(long long));
+  if (!oneWay || !ackLatency) {
+    perror ("abptrace: malloc");
+    return;
+  }
+
+  for (k = 0; k < numFlows; k++) {
+    if (!flows[k].packets)
+      continue;
+    duration = flows[k].end > flows[k].start ?
+      flows[k].end - flows[k].start : 0;
+    printf ("\nflow %d: %lld packets, %lld resent (%.2f%%), %lld timeouts\n",
+	    flows[k].flow, flows[k].packets, flows[k].resent,
+	    100.0 * flows[k].resent / flows[k].packets, flows[k].timeouts);
+    if (duration > 0)
+      printf ("  %lld bytes acknowledged in %.6f seconds: %.3f Mb/s\n",
+	      flows[k].bytes, duration / 1e9,
+	      flows[k].bytes * 8 / (duration / 1e9) / 1e6);
+    printf ("  waiting for timeouts: %.6f seconds\n",
+	    flows[k].timeoutWait / 1e9);
+
+    numOneWay = numAck = 0;
+    for (j = 0; j < p.size; j++) {
+      packet = &p.table[j];
+      if (!packet->used || packet->flow != flows[k].flow ||
+	  !packet->firstSend)
+	continue;
+      if (packet->recv)
+	oneWay[numOneWay++] = packet->recv - packet->firstSend;
+      if (packet->acked)
+	ackLatency[numAck++] = packet->acked - packet->firstSend;
+    }
+    AT_percentiles ("one-way latency", oneWay, numOneWay);
+    AT_percentiles ("ack latency", ackLatency, numAck);
+  }
+  free (oneWay);
+  free (ackLatency);
+  free (p.table);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_latency
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_latency (struct AT_trace *t)
+{
+  // every packet's times, in order of flow and number
+  struct AT_packets p;
+  struct AT_flow flows[AT_MAX_FLOWS];
+  struct AT_packet *packet;
+  long long start;
+  unsigned int n;
+  int numFlows;
+  int k;
+
+  if (t->numEvents == 0 || AT_build (t, &p, flows, &numFlows) < 0)
+    return;
+  start = t->events[0].e.time;
+
+  printf ("# flow packet length sends firstSend lastSend recv acked "
+	  "oneWay ackLatency (usecs; -1 is never)\n");
+  for (k = 0; k < numFlows; k++)
+    for (n = 0; n < flows[k].packets; n++) {
+      packet = AT_findPacket (&p, flows[k].flow, n, 0);
+      if (!packet || !packet->firstSend)
+	continue;
+      printf ("%d %u %d %d %.3f %.3f %.3f %.3f %.3f %.3f\n",
+	      packet->flow, packet->packetNum, packet->length, packet->sends,
+	      (packet->firstSend - start) / 1e3,
+	      (packet->lastSend - start) / 1e3,
+	      packet->recv ? (packet->recv - start) / 1e3 : -1,
+	      packet->acked ? (packet->acked - start) / 1e3 : -1,
+	      packet->recv ? (packet->recv - packet->firstSend) / 1e3 : -1,
+	      packet->acked ? (packet->acked - packet->firstSend) / 1e3 : -1);
+    }
+  free (p.table);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_tsg
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_tsg (struct AT_trace *t, int flow)
+{
+  // a data set of (seconds, packet number) pairs for each kind of event,
+  // separated by two blank lines as gnuplot's index expects
+  static const int types[] = { TR_SEND, TR_RETRANSMIT, TR_RECV, TR_ACK };
+  struct TR_event *e;
+  long long start;
+  long long i;
+  int k;
+
+  if (t->numEvents == 0)
+    return;
+  start = t->events[0].e.time;
+
+  for (k = 0; k < 4; k++) {
+    if (k > 0)
+      printf ("\n\n");
+    printf ("# %s\n", TR_typeName (types[k]));
+    for (i = 0; i < t->numEvents; i++) {
+      e = &t->events[i].e;
+      if (e->type != types[k] || (flow >= 0 && e->flow != flow))
+	continue;
+      if (e->type == TR_ACK && e->detail != TR_ACK_NEW)
+	continue;
+      printf ("%.9f %u\n", (e->time - start) / 1e9, e->packetNum);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_pcap
+//
+///////////////////////////////////////////////////////////////////////////////
+static int AT_pcap (struct AT_trace *t, const char *path)
+{
+  // a section header, an interface for each trace, and a packet for each
+  // event.  Returns -1 if the file couldn't be written.
+  struct {
+    unsigned int byteOrder;
+    unsigned short major, minor;
+    long long sectionLength;
+  } section = { AT_PCAP_BYTE_ORDER, 1, 0, -1 };
+  struct {
+    unsigned short linkType, reserved;
+    unsigned int snapLength;
+    unsigned short resolCode, resolLength;
+    unsigned char resol, pad[3];
+  } interface = { AT_LINKTYPE_USER0, 0, sizeof(struct TR_event),
+		  AT_PCAP_IF_TSRESOL, 1, 9, { 0, 0, 0 } };
+  unsigned int header[5];       // interface, time (high and low words),
+				// and length captured and original
+  unsigned char packet[sizeof(header) + sizeof(struct TR_event)];
+  char comment[128];
+  unsigned long long when;
+  FILE *fp;
+  long long i;
+  int k;
+
+  fp = fopen (path, "wb");
+  if (!fp) {
+    perror (path);
+    return -1;
+  }
+  AT_pcapBlock (fp, AT_PCAP_SECTION, &section, sizeof(section), 0);
+  for (k = 0; k < t->numTraces; k++)
+    AT_pcapBlock (fp, AT_PCAP_INTERFACE, &interface, sizeof(interface),
+		  t->paths[k]);
+
+  // times are nsecs since the epoch (if_tsresol 9)
+  for (i = 0; i < t->numEvents; i++) {
+    when = t->events[i].e.time + t->realtimeOffsets[t->events[i].trace];
+    header[0] = t->events[i].trace;
+    header[1] = when >> 32;
+    header[2] = when & 0xffffffff;
+    header[3] = header[4] = sizeof(struct TR_event);
+    memcpy (packet, header, sizeof(header));
+    memcpy (packet + sizeof(header), &t->events[i].e, sizeof(struct TR_event));
+    AT_describe (&t->events[i].e, comment, sizeof(comment));
+    AT_pcapBlock (fp, AT_PCAP_PACKET, packet, sizeof(packet), comment);
+  }
+  if (fclose (fp) != 0) {
+    perror (path);
+    return -1;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_pcapBlock
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_pcapBlock (FILE *fp, unsigned int type, const void *body,
+			  int bodyLength, const char *comment)
+{
+  // write a block: its type and length, body (whose length is a multiple
+  // of 4), options and length again.  An interface's option is its name,
+  // and a packet's a comment.
+  static const char zeros[4];
+  unsigned short option[2];
+  unsigned int length;
+  int optLength = 0;
+
+  if (comment) {
+    optLength = strlen (comment);
+    if (optLength > 65535)
+      optLength = 65535;
+  }
+  length = 12 + bodyLength + (comment ? 4 + ((optLength + 3) & ~3) + 4 : 0);
+  fwrite (&type, 4, 1, fp);
+  fwrite (&length, 4, 1, fp);
+  fwrite (body, bodyLength, 1, fp);
+  if (comment) {
+    option[0] = type == AT_PCAP_INTERFACE ? AT_PCAP_IF_NAME : AT_PCAP_COMMENT;
+    option[1] = optLength;
+    fwrite (option, 4, 1, fp);
+    fwrite (comment, optLength, 1, fp);
+    fwrite (zeros, (4 - optLength % 4) % 4, 1, fp);
+    option[0] = AT_PCAP_END_OPT;
+    option[1] = 0;
+    fwrite (option, 4, 1, fp);
+  }
+  fwrite (&length, 4, 1, fp);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_describe
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_describe (struct TR_event *e, char *buf, int size)
+{
+  static const char *acks[] = { "new", "duplicate", "stale" };
+  static const char *recvs[] = { "in window", "duplicate", "beyond window" };
+  static const char *packets[] = { "data", "ack", "repair" };
+  static const char *garbles[] = { "dropped", "burst error", "bit errors" };
+
+  switch (e->type) {
+  case TR_SEND:
+  case TR_RETRANSMIT:
+    snprintf (buf, size, "%s flow %d packet %u, %d bytes, cwnd %u",
+	      TR_typeName (e->type), e->flow, e->packetNum, e->length,
+	      e->value);
+    break;
+  case TR_ACK:
+  case TR_ACK_SENT:
+    snprintf (buf, size, "%s flow %d up to packet %u (%s), room for %u",
+	      TR_typeName (e->type), e->flow, e->packetNum,
+	      e->type == TR_ACK && e->detail < 3 ? acks[e->detail] : "sent",
+	      e->value);
+    break;
+  case TR_TIMEOUT:
+    snprintf (buf, size, "timeout flow %d packet %u, rto %u usecs", e->flow,
+	      e->packetNum, e->value);
+    break;
+  case TR_CHECKSUM:
+    snprintf (buf, size, "damaged %s packet flow %d, %d bytes",
+	      e->detail < 3 ? packets[e->detail] : "unknown", e->flow,
+	      e->length);
+    break;
+  case TR_RECV:
+    snprintf (buf, size, "recv flow %d packet %u (%s), %d bytes from port %u",
+	      e->flow, e->packetNum,
+	      e->detail < 3 ? recvs[e->detail] : "unknown", e->length,
+	      e->value);
+    break;
+  case TR_OVERRUN:
+    snprintf (buf, size, "overrun flow %d packet %u from port %u", e->flow,
+	      e->packetNum, e->value);
+    break;
+  case TR_GARBLE:
+    snprintf (buf, size, "network %s packet of %d bytes (%u)",
+	      e->detail < 3 ? garbles[e->detail] : "unknown", e->length,
+	      e->value);
+    break;
+  default:
+    snprintf (buf, size, "unknown event %d", e->type);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_percentiles
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AT_percentiles (const char *name, long long *values, long long n)
+{
+  // values are nsecs; they're printed in usecs
+  if (n == 0) {
+    printf ("  %s: none\n", name);
+    return;
+  }
+  qsort (values, n, sizeof(long long), AT_compareLong);
+  printf ("  %s (usecs): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", name,
+	  values[(n - 1) * 500 / 1000] / 1e3, values[(n - 1) * 990 / 1000] / 1e3,
+	  values[(n - 1) * 999 / 1000] / 1e3, values[n - 1] / 1e3);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// AT_compareLong
+//
+///////////////////////////////////////////////////////////////////////////////
+static int AT_compareLong (const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+
+  return x < y ? -1 : x > y;
+}
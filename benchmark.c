@@ -0,0 +1,765 @@
+//
+// File: benchmark.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: measures ABP from end to end.  For every combination of
+// the message sizes, message counts, loss rates and windows and modes
+// given, a sender sends the messages to a receiver, and the run's
+// goodput, packets per second, retransmission ratio and message latencies
+// (50th, 99th and 99.9th percentiles) are printed in a table, and
+// optionally written as JSON and CSV to chart and compare builds with.
+//
+// By default the receiver is a child process and the messages go over
+// loopback, with US_SetFailureProb losing (and garbling) that percentage
+// of the packets each way.  With -V both ends run in this process over a
+// link simulated in memory (see virtualLink.h) instead, on the link's
+// clock, so a run takes only as long as processing its packets does and
+// comes out the same every time.
+//
+// A message's latency runs from when the sender hands it to ABP until
+// the receiver gets it, both on CLOCK_MONOTONIC (or the link's clock):
+// every message starts with the time it was sent and its number.  A run
+// takes from the first message being sent until the last is acknowledged.
+// Goodput counts the messages' bytes, packets per second the data packets
+// sent (not counting resends), and the retransmission ratio is the
+// packets lost for every data packet sent.
+//
+// usage: benchmark [-V] [-s sizes] [-n counts] [-l losses] [-w windows]
+//                  [-m modes] [-b bitsPerSec] [-d delayUsecs]
+//                  [-q queueBytes] [-S seed] [-p port] [-t label]
+//                  [-j jsonFile] [-c csvFile]
+//
+// The lists are comma separated.  modes are gbn and sr; a window of 1 is
+// the alternating bit protocol, whatever the mode.  -b, -d and -q set up
+// the virtual link's path (100 Mb/s, 1 msec and 128 KB by default).
+// label is copied into the JSON and CSV, to tell builds apart.
+//
+// On the virtual link nothing is lost but what -l loses, so a run there
+// with no loss that resends packets is reported as a failure, and the
+// exit status is 2 ("make check" runs such a sweep).
+//
+
+#define _GNU_SOURCE     // strdup
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>     // atoi, qsort, strtoull
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // fork, getopt, pipe
+#include "ABP.h"
+#include "unreliableSend.h"
+#include "virtualLink.h"
+
+// most values in a list given on the command line
+#define BM_MAX_LIST 16
+
+// every message starts with when it was sent (usecs) and its number.  The
+// sender follows the messages with one numbered BM_END, so the receiver
+// knows when it's done even if the sender gave up on some.
+#define BM_END -1
+
+struct BM_header {
+  long long sentUsecs;
+  int num;
+};
+
+// messages can't be shorter than their header
+#define BM_MIN_SIZE ((int)sizeof(struct BM_header))
+
+// how long the sender waits for the receiver's results once it's done,
+// in msecs
+#define BM_REPORT_TIMEOUT 10000
+
+// what the receiver found
+struct BM_report {
+  int delivered;            // messages received
+  int errors;               // out of order, repeated or the wrong length
+  double p50, p99, p999;    // latency percentiles (usecs)
+};
+
+// one run and its results
+struct BM_run {
+  int virtual;
+  int window, mode;
+  int size, count;
+  int loss;                 // percent
+  double seconds;
+  unsigned int packetsSent, packetsLost;
+  struct BM_report report;
+};
+
+// the messages a receiver has taken so far
+struct BM_tally {
+  long long *latencies;     // of each message delivered, in usecs
+  int delivered;
+  int errors;
+  int next;                 // number of the message expected next
+};
+
+// the command line
+struct BM_config {
+  int virtual;
+  int sizes[BM_MAX_LIST], numSizes;
+  int counts[BM_MAX_LIST], numCounts;
+  int losses[BM_MAX_LIST], numLosses;
+  int windows[BM_MAX_LIST], numWindows;
+  int modes[BM_MAX_LIST], numModes;
+  long long bitsPerSec;
+  int delayUsecs, queueBytes;
+  unsigned long long seed;
+  int port;
+  char *label;
+};
+
+// define prototypes for local routines
+static int BM_parseList (char *arg, int *values, int *count);
+static int BM_parseModes (char *arg, int *modes, int *count);
+static int BM_runLoopback (struct BM_config *config, struct BM_run *run);
+static void BM_receiver (struct BM_config *config, struct BM_run *run,
+			 int fd);
+static int BM_runVirtual (struct BM_config *config, struct BM_run *run);
+static ABP_session *BM_session (struct BM_run *run);
+static void BM_stamp (char *msg, long long now, int num);
+static int BM_take (struct BM_run *run, struct BM_tally *tally, char *msg,
+		    int length, long long now);
+static void BM_report (struct BM_tally *tally, struct BM_report *report);
+static int BM_compare (const void *a, const void *b);
+static const char *BM_modeName (struct BM_run *run);
+static void BM_print (struct BM_run *run);
+static void BM_writeJson (FILE *fp, struct BM_config *config,
+			  struct BM_run *runs, int numRuns);
+static void BM_writeCsv (FILE *fp, struct BM_config *config,
+			 struct BM_run *runs, int numRuns);
+static long long BM_now (void);
+
+int main (int argc, char *argv[])
+{
+  struct BM_config config;
+  struct BM_run *runs;
+  struct BM_run *run;
+  char *jsonFile = 0, *csvFile = 0;
+  FILE *fp;
+  int numRuns = 0;
+  int failed = 0;
+  int opt;
+  int a, b, c, d, e;
+
+  // one size, count and window each way, with and without loss, unless
+  // told otherwise
+  memset (&config, 0, sizeof(config));
+  config.sizes[config.numSizes++] = 1024;
+  config.counts[config.numCounts++] = 1000;
+  config.losses[config.numLosses++] = 0;
+  config.losses[config.numLosses++] = 5;
+  config.windows[config.numWindows++] = 1;
+  config.windows[config.numWindows++] = 32;
+  config.modes[config.numModes++] = ABP_GO_BACK_N;
+  config.modes[config.numModes++] = ABP_SELECTIVE_REPEAT;
+  config.bitsPerSec = 100000000;
+  config.delayUsecs = 1000;
+  config.queueBytes = 131072;
+  config.seed = 1;
+  config.port = 50100;
+  config.label = "";
+
+  while ((opt = getopt (argc, argv, "Vs:n:l:w:m:b:d:q:S:p:t:j:c:")) != -1) {
+    if (opt == 'V')
+      config.virtual = 1;
+    else if (opt == 's' &&
+	     BM_parseList (optarg, config.sizes, &config.numSizes) == 0)
+      ;
+    else if (opt == 'n' &&
+	     BM_parseList (optarg, config.counts, &config.numCounts) == 0)
+      ;
+    else if (opt == 'l' &&
+	     BM_parseList (optarg, config.losses, &config.numLosses) == 0)
+      ;
+    else if (opt == 'w' &&
+	     BM_parseList (optarg, config.windows, &config.numWindows) == 0)
+      ;
+    else if (opt == 'm' &&
+	     BM_parseModes (optarg, config.modes, &config.numModes) == 0)
+      ;
+    else if (opt == 'b')
+      config.bitsPerSec = atoll (optarg);
+    else if (opt == 'd')
+      config.delayUsecs = atoi (optarg);
+    else if (opt == 'q')
+      config.queueBytes = atoi (optarg);
+    else if (opt == 'S')
+      config.seed = strtoull (optarg, 0, 0);
+    else if (opt == 'p')
+      config.port = atoi (optarg);
+    else if (opt == 't')
+      config.label = optarg;
+    else if (opt == 'j')
+      jsonFile = optarg;
+    else if (opt == 'c')
+      csvFile = optarg;
+    else {
+      printf ("usage: benchmark [-V] [-s sizes] [-n counts] [-l losses] "
+	      "[-w windows]\n"
+	      "                 [-m modes] [-b bitsPerSec] [-d delayUsecs] "
+	      "[-q queueBytes]\n"
+	      "                 [-S seed] [-p port] [-t label] [-j jsonFile] "
+	      "[-c csvFile]\n");
+      return 1;
+    }
+  }
+
+  runs = calloc ((size_t)config.numSizes * config.numCounts *
+		 config.numLosses * config.numWindows * config.numModes,
+		 sizeof(struct BM_run));
+  if (!runs) {
+    perror ("benchmark: calloc");
+    return 1;
+  }
+
+  // every combination, except that a window of 1 has no mode
+  printf ("%-8s %6s %4s %6s %7s %4s %9s %10s %10s %7s %9s %9s %9s %9s\n",
+	  "link", "window", "mode", "size", "count", "loss", "seconds",
+	  "Mb/s", "pkts/s", "retx", "p50(us)", "p99(us)", "p999(us)",
+	  "received");
+  for (a = 0; a < config.numSizes; a++)
+    for (b = 0; b < config.numCounts; b++)
+      for (c = 0; c < config.numLosses; c++)
+	for (d = 0; d < config.numWindows; d++)
+	  for (e = 0; e < config.numModes; e++) {
+	    if (config.windows[d] == 1 && e > 0)
+	      continue;
+	    run = &runs[numRuns];
+	    run->virtual = config.virtual;
+	    run->size = config.sizes[a];
+	    run->count = config.counts[b];
+	    run->loss = config.losses[c];
+	    run->window = config.windows[d];
+	    run->mode = config.modes[e];
+	    if ((config.virtual ? BM_runVirtual (&config, run) :
+		 BM_runLoopback (&config, run)) < 0)
+	      return 1;
+	    BM_print (run);
+	    if (run->virtual && run->loss == 0 && run->packetsLost > 0) {
+	      printf ("benchmark: %s window %d resent packets on a link that "
+		      "loses none\n", BM_modeName (run), run->window);
+	      failed = 1;
+	    }
+	    numRuns++;
+	  }
+
+  if (jsonFile) {
+    if (!(fp = fopen (jsonFile, "w"))) {
+      perror (jsonFile);
+      return 1;
+    }
+    BM_writeJson (fp, &config, runs, numRuns);
+    fclose (fp);
+  }
+  if (csvFile) {
+    if (!(fp = fopen (csvFile, "w"))) {
+      perror (csvFile);
+      return 1;
+    }
+    BM_writeCsv (fp, &config, runs, numRuns);
+    fclose (fp);
+  }
+  free (runs);
+  return failed ? 2 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_parseList
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_parseList (char *arg, int *values, int *count)
+{
+  // read a comma separated list of numbers over the defaults.  Returns -1
+  // if there are too many, or any is negative.
+  char *token;
+
+  *count = 0;
+  for (token = strtok (arg, ","); token; token = strtok (0, ",")) {
+    if (*count == BM_MAX_LIST || atoi (token) < 0)
+      return -1;
+    values[(*count)++] = atoi (token);
+  }
+  return *count > 0 ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_parseModes
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_parseModes (char *arg, int *modes, int *count)
+{
+  char *token;
+
+  *count = 0;
+  for (token = strtok (arg, ","); token; token = strtok (0, ",")) {
+    if (*count == BM_MAX_LIST)
+      return -1;
+    if (!strcmp (token, "gbn"))
+      modes[(*count)++] = ABP_GO_BACK_N;
+    else if (!strcmp (token, "sr"))
+      modes[(*count)++] = ABP_SELECTIVE_REPEAT;
+    else
+      return -1;
+  }
+  return *count > 0 ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_runLoopback
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_runLoopback (struct BM_config *config, struct BM_run *run)
+{
+  // start a receiver in a child process, send it the messages and the end
+  // marker, and collect what it found.  Returns -1 if the run couldn't be
+  // set up.
+  struct ABP_stats stats;
+  struct pollfd pfd;
+  ABP_session *s;
+  char *msg;
+  char ready;
+  long long start;
+  int fds[2];
+  pid_t pid;
+  int i;
+
+  if (pipe (fds) < 0) {
+    perror ("benchmark: pipe");
+    return -1;
+  }
+  pid = fork ();
+  if (pid < 0) {
+    perror ("benchmark: fork");
+    return -1;
+  }
+  if (pid == 0) {
+    close (fds[0]);
+    BM_receiver (config, run, fds[1]);
+    _exit (1);
+  }
+  close (fds[1]);
+
+  // send once the receiver is listening
+  s = BM_session (run);
+  msg = calloc (1, run->size);
+  if (read (fds[0], &ready, 1) != 1 || !s || !msg ||
+      ABP_sessionSendInit (s, "localhost", config->port) < 0) {
+    printf ("benchmark: couldn't start the run\n");
+    kill (pid, SIGKILL);
+    waitpid (pid, 0, 0);
+    return -1;
+  }
+  US_SetSeed (config->seed);
+  US_SetFailureProb (run->loss);
+
+  start = BM_now ();
+  for (i = 0; i < run->count; i++) {
+    BM_stamp (msg, BM_now (), i);
+    ABP_sessionSend (s, msg, run->size);
+  }
+  ABP_sessionFlush (s);
+  run->seconds = (BM_now () - start) / 1e6;
+  ABP_sessionGetStats (s, &stats);
+  run->packetsSent = stats.packetsSent;
+  run->packetsLost = stats.packetsLost;
+
+  BM_stamp (msg, BM_now (), BM_END);
+  ABP_sessionSend (s, msg, run->size);
+  ABP_sessionFlush (s);
+
+  // the receiver keeps acknowledging until it's killed, in case its last
+  // ack was lost
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  while (poll (&pfd, 1, BM_REPORT_TIMEOUT) < 0 && errno == EINTR)
+    ;
+  if (!(pfd.revents & POLLIN) ||
+      read (fds[0], &run->report, sizeof(run->report)) !=
+      sizeof(run->report)) {
+    printf ("benchmark: the receiver didn't report\n");
+    run->report.delivered = -1;
+  }
+  kill (pid, SIGKILL);
+  waitpid (pid, 0, 0);
+  close (fds[0]);
+  ABP_close (s);
+  free (msg);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_receiver
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_receiver (struct BM_config *config, struct BM_run *run,
+			 int fd)
+{
+  // the child's side of a loopback run: tell the parent when we're
+  // listening, take messages until the end marker, and write what we found
+  // to fd
+  struct BM_report report;
+  struct BM_tally tally;
+  ABP_session *s;
+  char *buf = 0;
+  int bufSize = 0;
+  int length;
+
+  memset (&tally, 0, sizeof(tally));
+  s = BM_session (run);
+  tally.latencies = malloc (run->count * sizeof(long long));
+  if (!s || !tally.latencies || ABP_sessionRecvInit (s, config->port) < 0)
+    return;
+  US_SetSeed (config->seed + 1);
+  US_SetFailureProb (run->loss);
+  if (write (fd, "r", 1) != 1)
+    return;
+
+  do
+    length = ABP_sessionRecvMessage (s, &buf, &bufSize, 0);
+  while (length < 0 ||
+	 BM_take (run, &tally, buf, length, BM_now ()) != BM_END);
+  BM_report (&tally, &report);
+  if (write (fd, &report, sizeof(report)) != sizeof(report))
+    return;
+  for (;;)
+    pause ();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_runVirtual
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_runVirtual (struct BM_config *config, struct BM_run *run)
+{
+  // run both ends over a virtual link.  Messages are handed over with
+  // ABP_sessionSendAsync, and the receiver takes what has arrived every
+  // time the link's clock moves on, so latencies are exact.  Returns -1 if
+  // the run couldn't be set up.
+  struct ABP_sendCompletion completion;
+  struct ABP_stats stats;
+  US_channel *sendChannel, *recvChannel;
+  ABP_session *sender, *receiver;
+  VL_link *link;
+  struct BM_tally tally;
+  char **bufs;
+  char *buf = 0;
+  int bufSize = 0;
+  int numFree, numBufs = 64;
+  int submitted = 0, completed = 0;
+  int length, result;
+  long long start;
+  int i;
+
+  link = VL_open ();
+  sender = BM_session (run);
+  receiver = BM_session (run);
+  sendChannel = US_open (config->seed);
+  recvChannel = US_open (config->seed + 1);
+  memset (&tally, 0, sizeof(tally));
+  tally.latencies = malloc (run->count * sizeof(long long));
+  bufs = calloc (numBufs, sizeof(char *));
+  if (!link || !sender || !receiver || !sendChannel || !recvChannel ||
+      !tally.latencies || !bufs) {
+    printf ("benchmark: couldn't start the run\n");
+    return -1;
+  }
+  for (i = 0; i < numBufs; i++)
+    if (!(bufs[i] = calloc (1, run->size))) {
+      printf ("benchmark: couldn't start the run\n");
+      return -1;
+    }
+  numFree = numBufs;
+
+  if (VL_setPath (link, config->bitsPerSec, config->delayUsecs,
+		  config->queueBytes) < 0 ||
+      US_channelSetFailureProb (sendChannel, run->loss) < 0 ||
+      US_channelSetFailureProb (recvChannel, run->loss) < 0 ||
+      ABP_sessionSetLink (sender, link) < 0 ||
+      ABP_sessionSetLink (receiver, link) < 0 ||
+      ABP_sessionSetChannel (sender, sendChannel) < 0 ||
+      ABP_sessionSetChannel (receiver, recvChannel) < 0 ||
+      ABP_sessionSetSendQueue (sender, numBufs, numBufs) < 0 ||
+      ABP_sessionRecvInit (receiver, config->port) < 0 ||
+      ABP_sessionSendInit (sender, "localhost", config->port) < 0) {
+    printf ("benchmark: couldn't start the run\n");
+    return -1;
+  }
+
+  start = VL_now (link);
+  for (;;) {
+    // hand over as many messages as there are buffers and room for
+    while (submitted < run->count && numFree > 0) {
+      BM_stamp (bufs[numFree - 1], VL_now (link), submitted);
+      result = ABP_sessionSendAsync (sender, bufs[numFree - 1], run->size,
+				     ABP_SEND_NOCOPY, 0);
+      if (result == ABP_SEND_QUEUE_FULL)
+	break;
+      if (result < 0)
+	return -1;
+      numFree--;
+      submitted++;
+    }
+    while (ABP_sessionSendComplete (sender, &completion)) {
+      bufs[numFree++] = completion.buf;
+      completed++;
+    }
+
+    while (ABP_sessionRecvReady (receiver)) {
+      length = ABP_sessionRecvMessage (receiver, &buf, &bufSize, 0);
+      if (length >= 0)
+	BM_take (run, &tally, buf, length, VL_now (link));
+    }
+    if (completed == run->count || ABP_sessionProcess (sender, -1) == 0)
+      break;
+  }
+  run->seconds = (VL_now (link) - start) / 1e6;
+  ABP_sessionGetStats (sender, &stats);
+  run->packetsSent = stats.packetsSent;
+  run->packetsLost = stats.packetsLost;
+
+  BM_report (&tally, &run->report);
+
+  ABP_close (sender);
+  ABP_close (receiver);
+  US_close (sendChannel);
+  US_close (recvChannel);
+  VL_close (link);
+  for (i = 0; i < numBufs; i++)
+    free (bufs[i]);
+  free (bufs);
+  free (buf);
+  free (tally.latencies);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_session
+//
+///////////////////////////////////////////////////////////////////////////////
+static ABP_session *BM_session (struct BM_run *run)
+{
+  // a session for one end of run.  Packets are as big as the messages, so
+  // each goes in one if it can.
+  ABP_session *s = ABP_open ();
+  int payload = run->size;
+
+  if (payload < 1024)
+    payload = 1024;
+  if (payload > ABP_MAX_PAYLOAD_SIZE)
+    payload = ABP_MAX_PAYLOAD_SIZE;
+  if (s && (ABP_sessionSetWindow (s, run->window, run->mode) < 0 ||
+	    ABP_sessionSetPayloadSize (s, payload) < 0)) {
+    ABP_close (s);
+    return 0;
+  }
+  return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_stamp
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_stamp (char *msg, long long now, int num)
+{
+  struct BM_header header;
+
+  header.sentUsecs = now;
+  header.num = num;
+  memcpy (msg, &header, sizeof(header));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_take
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_take (struct BM_run *run, struct BM_tally *tally, char *msg,
+		    int length, long long now)
+{
+  // note a message received at now.  Messages come in order, though the
+  // sender may have given up on some in between, so one numbered before
+  // the one expected, or of the wrong length, is an error.  Returns the
+  // message's number.
+  struct BM_header header;
+
+  if (length < BM_MIN_SIZE) {
+    tally->errors++;
+    return 0;
+  }
+  memcpy (&header, msg, sizeof(header));
+  if (header.num == BM_END)
+    return BM_END;
+  if (length != run->size || header.num < tally->next ||
+      header.num >= run->count) {
+    tally->errors++;
+    return header.num;
+  }
+  tally->latencies[tally->delivered++] = now - header.sentUsecs;
+  tally->next = header.num + 1;
+  return header.num;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_report
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_report (struct BM_tally *tally, struct BM_report *report)
+{
+  // sum up a receiver's tally; sorting the latencies gives the percentiles
+  int n = tally->delivered;
+
+  memset (report, 0, sizeof(*report));
+  report->delivered = n;
+  report->errors = tally->errors;
+  if (n == 0)
+    return;
+  qsort (tally->latencies, n, sizeof(long long), BM_compare);
+  report->p50 = tally->latencies[(long long)(n - 1) * 500 / 1000];
+  report->p99 = tally->latencies[(long long)(n - 1) * 990 / 1000];
+  report->p999 = tally->latencies[(long long)(n - 1) * 999 / 1000];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_compare
+//
+///////////////////////////////////////////////////////////////////////////////
+static int BM_compare (const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_modeName
+//
+///////////////////////////////////////////////////////////////////////////////
+static const char *BM_modeName (struct BM_run *run)
+{
+  if (run->window == 1)
+    return "abp";
+  return run->mode == ABP_SELECTIVE_REPEAT ? "sr" : "gbn";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_print
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_print (struct BM_run *run)
+{
+  double seconds = run->seconds > 0 ? run->seconds : 1e-9;
+
+  printf ("%-8s %6d %4s %6d %7d %4d %9.3f %10.2f %10.0f %7.4f "
+	  "%9.0f %9.0f %9.0f %9d\n",
+	  run->virtual ? "virtual" : "loopback", run->window,
+	  BM_modeName (run), run->size, run->count, run->loss, run->seconds,
+	  (double)run->report.delivered * run->size * 8 / seconds / 1e6,
+	  run->packetsSent / seconds,
+	  run->packetsSent ? (double)run->packetsLost / run->packetsSent : 0,
+	  run->report.p50, run->report.p99, run->report.p999,
+	  run->report.delivered);
+  fflush (stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_writeJson
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_writeJson (FILE *fp, struct BM_config *config,
+			  struct BM_run *runs, int numRuns)
+{
+  // the label is written as it was given, so it mustn't need escaping
+  struct BM_run *run;
+  double seconds;
+  int i;
+
+  fprintf (fp, "{\n  \"label\": \"%s\",\n  \"runs\": [\n", config->label);
+  for (i = 0; i < numRuns; i++) {
+    run = &runs[i];
+    seconds = run->seconds > 0 ? run->seconds : 1e-9;
+    fprintf (fp, "    {\"link\": \"%s\", \"window\": %d, \"mode\": \"%s\", "
+	     "\"size\": %d, \"count\": %d, \"loss\": %d,\n"
+	     "     \"seconds\": %.6f, \"goodputMbps\": %.3f, "
+	     "\"packetsPerSec\": %.1f,\n"
+	     "     \"packetsSent\": %u, \"packetsLost\": %u, "
+	     "\"retransmitRatio\": %.6f,\n"
+	     "     \"latencyUsecs\": {\"p50\": %.0f, \"p99\": %.0f, "
+	     "\"p999\": %.0f},\n"
+	     "     \"delivered\": %d, \"errors\": %d}%s\n",
+	     run->virtual ? "virtual" : "loopback", run->window,
+	     BM_modeName (run), run->size, run->count, run->loss,
+	     run->seconds,
+	     (double)run->report.delivered * run->size * 8 / seconds / 1e6,
+	     run->packetsSent / seconds, run->packetsSent, run->packetsLost,
+	     run->packetsSent ? (double)run->packetsLost / run->packetsSent : 0,
+	     run->report.p50, run->report.p99, run->report.p999,
+	     run->report.delivered, run->report.errors,
+	     i + 1 < numRuns ? "," : "");
+  }
+  fprintf (fp, "  ]\n}\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_writeCsv
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BM_writeCsv (FILE *fp, struct BM_config *config,
+			 struct BM_run *runs, int numRuns)
+{
+  struct BM_run *run;
+  double seconds;
+  int i;
+
+  fprintf (fp, "label,link,window,mode,size,count,loss,seconds,goodput_mbps,"
+	   "packets_per_sec,packets_sent,packets_lost,retransmit_ratio,"
+	   "p50_usecs,p99_usecs,p999_usecs,delivered,errors\n");
+  for (i = 0; i < numRuns; i++) {
+    run = &runs[i];
+    seconds = run->seconds > 0 ? run->seconds : 1e-9;
+    fprintf (fp, "%s,%s,%d,%s,%d,%d,%d,%.6f,%.3f,%.1f,%u,%u,%.6f,"
+	     "%.0f,%.0f,%.0f,%d,%d\n",
+	     config->label, run->virtual ? "virtual" : "loopback",
+	     run->window, BM_modeName (run), run->size, run->count,
+	     run->loss, run->seconds,
+	     (double)run->report.delivered * run->size * 8 / seconds / 1e6,
+	     run->packetsSent / seconds, run->packetsSent, run->packetsLost,
+	     run->packetsSent ? (double)run->packetsLost / run->packetsSent : 0,
+	     run->report.p50, run->report.p99, run->report.p999,
+	     run->report.delivered, run->report.errors);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// BM_now
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long BM_now (void)
+{
+  // current time in usecs from a clock that never goes backwards, the
+  // same in every process
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,305 @@
+//
+// File: calcCRC.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the CRCs defined in calcCRC.h.
+//
+// Slicing-by-8: table k holds the CRC of each byte value followed by k
+// zero bytes, so the CRC of 8 bytes is the xor of one lookup per byte
+// instead of 8 lookups that each depend on the last one.
+//
+// The crc32 instruction calculates CRC-32C 8 bytes at a time, but each
+// one has to wait for the one before it.  Three independent streams keep
+// the processor busy, and PCLMULQDQ combines their CRCs: shifting a CRC
+// over n zero bytes is a multiplication by x^(8n) mod P.
+//
+
+#include <stddef.h>
+#include "calcCRC.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>  // _mm_crc32_*
+#include <wmmintrin.h>  // _mm_clmulepi64_si128
+#define CRC_X86 1
+#endif
+
+#define CRC8_POLY   0x07
+#define CRC16_POLY  0x1021
+#define CRC32C_POLY 0x82f63b78   // reflected
+
+// the longest part (in 8 byte words) the three stream version gives each
+// stream, and the shortest buffer (in bytes) it's worth using for
+#define CRC_MAX_STREAM_WORDS 128
+#define CRC_MIN_STREAM_BYTES 384
+
+static unsigned char CRC_table8[8][256];
+static unsigned short CRC_table16[8][256];
+static unsigned int CRC_table32c[8][256];
+
+// CRC_shift32c[j] is x^(64j - 33) mod P, for shifting a CRC over 8j bytes
+static unsigned int CRC_shift32c[2 * CRC_MAX_STREAM_WORDS + 1];
+
+// define prototypes for local routines
+static void CRC_init (void) __attribute__ ((constructor));
+static unsigned int CRC_slice32c (unsigned int reg, const unsigned char *buf,
+				  size_t length);
+#ifdef CRC_X86
+static unsigned int CRC_sse42 (unsigned int reg, const unsigned char *buf,
+			       size_t length);
+static unsigned int CRC_pclmul (unsigned int reg, const unsigned char *buf,
+				size_t length);
+#endif
+
+// the CRC-32C version picked by CRC_init.  It works on the CRC register
+// without the initial value and final xor.
+static unsigned int (*CRC_calc32c) (unsigned int reg, const unsigned char *buf,
+				    size_t length) = CRC_slice32c;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// calcCRC
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int calcCRC (int algorithm, const void *buf, int length)
+{
+  switch (algorithm) {
+  case CRC_8:
+    return calcCRC8 (0, buf, length);
+  case CRC_16:
+    return calcCRC16 (0, buf, length);
+  case CRC_32C:
+    return calcCRC32C (0, buf, length);
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// calcCRC8
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int calcCRC8 (unsigned int crc, const void *buf, int length)
+{
+  const unsigned char *p = buf;
+  unsigned int reg = crc & 0xff;
+
+  while (length >= 8) {
+    reg = CRC_table8[7][p[0] ^ reg] ^ CRC_table8[6][p[1]] ^
+      CRC_table8[5][p[2]] ^ CRC_table8[4][p[3]] ^
+      CRC_table8[3][p[4]] ^ CRC_table8[2][p[5]] ^
+      CRC_table8[1][p[6]] ^ CRC_table8[0][p[7]];
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    reg = CRC_table8[0][reg ^ *p++];
+
+  return reg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// calcCRC16
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int calcCRC16 (unsigned int crc, const void *buf, int length)
+{
+  // the CRC isn't reflected, so the first byte goes with the register's
+  // high byte
+  const unsigned char *p = buf;
+  unsigned int reg = (crc ^ 0xffff) & 0xffff;
+
+  while (length >= 8) {
+    reg = CRC_table16[7][p[0] ^ (reg >> 8)] ^ CRC_table16[6][p[1] ^ (reg & 0xff)] ^
+      CRC_table16[5][p[2]] ^ CRC_table16[4][p[3]] ^
+      CRC_table16[3][p[4]] ^ CRC_table16[2][p[5]] ^
+      CRC_table16[1][p[6]] ^ CRC_table16[0][p[7]];
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    reg = ((reg << 8) ^ CRC_table16[0][(reg >> 8) ^ *p++]) & 0xffff;
+
+  return reg ^ 0xffff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// calcCRC32C
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int calcCRC32C (unsigned int crc, const void *buf, int length)
+{
+  if (length <= 0)
+    return crc;
+  return ~CRC_calc32c (~crc, buf, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// CRC_init
+//
+///////////////////////////////////////////////////////////////////////////////
+static void CRC_init (void)
+{
+  // build the tables and pick the CRC-32C version before main runs, so
+  // threads never see them half done
+  unsigned int c8, c16, c32;
+  unsigned int power;
+  int i, j, k;
+
+  for (i = 0; i < 256; i++) {
+    c8 = i;
+    c16 = i << 8;
+    c32 = i;
+    for (j = 0; j < 8; j++) {
+      c8 = (c8 & 0x80) ? (c8 << 1) ^ CRC8_POLY : c8 << 1;
+      c16 = (c16 & 0x8000) ? (c16 << 1) ^ CRC16_POLY : c16 << 1;
+      c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32C_POLY : c32 >> 1;
+    }
+    CRC_table8[0][i] = c8;
+    CRC_table16[0][i] = c16;
+    CRC_table32c[0][i] = c32;
+  }
+
+  // each table is the one before it followed by one more zero byte
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++) {
+      c8 = CRC_table8[k-1][i];
+      c16 = CRC_table16[k-1][i];
+      c32 = CRC_table32c[k-1][i];
+      CRC_table8[k][i] = CRC_table8[0][c8];
+      CRC_table16[k][i] = (c16 << 8) ^ CRC_table16[0][c16 >> 8];
+      CRC_table32c[k][i] = (c32 >> 8) ^ CRC_table32c[0][c32 & 0xff];
+    }
+
+  // in a reflected register the low bit is the x^31 term, so multiplying
+  // by x is a shift right.  Start at x^31 and step by x^64.
+  power = 1;
+  for (j = 1; j <= 2 * CRC_MAX_STREAM_WORDS; j++) {
+    CRC_shift32c[j] = power;
+    for (k = 0; k < 64; k++)
+      power = (power & 1) ? (power >> 1) ^ CRC32C_POLY : power >> 1;
+  }
+
+#ifdef CRC_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse4.2")) {
+    if (__builtin_cpu_supports ("pclmul"))
+      CRC_calc32c = CRC_pclmul;
+    else
+      CRC_calc32c = CRC_sse42;
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// CRC_slice32c
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int CRC_slice32c (unsigned int reg, const unsigned char *buf,
+				  size_t length)
+{
+  // the CRC is reflected, so the register's low byte goes with the first
+  // byte
+  unsigned int lo, hi;
+
+  while (length >= 8) {
+    lo = reg ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (unsigned int)buf[3] << 24);
+    hi = buf[4] | buf[5] << 8 | buf[6] << 16 | (unsigned int)buf[7] << 24;
+    reg = CRC_table32c[7][lo & 0xff] ^ CRC_table32c[6][(lo >> 8) & 0xff] ^
+      CRC_table32c[5][(lo >> 16) & 0xff] ^ CRC_table32c[4][lo >> 24] ^
+      CRC_table32c[3][hi & 0xff] ^ CRC_table32c[2][(hi >> 8) & 0xff] ^
+      CRC_table32c[1][(hi >> 16) & 0xff] ^ CRC_table32c[0][hi >> 24];
+    buf += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    reg = (reg >> 8) ^ CRC_table32c[0][(reg ^ *buf++) & 0xff];
+
+  return reg;
+}
+
+#ifdef CRC_X86
+///////////////////////////////////////////////////////////////////////////////
+//
+// CRC_sse42
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("sse4.2")))
+static unsigned int CRC_sse42 (unsigned int reg, const unsigned char *buf,
+			       size_t length)
+{
+  unsigned long long word;
+  unsigned long long reg64 = reg;
+
+  while (length >= 8) {
+    __builtin_memcpy (&word, buf, 8);
+    reg64 = _mm_crc32_u64 (reg64, word);
+    buf += 8;
+    length -= 8;
+  }
+  reg = reg64;
+  while (length-- > 0)
+    reg = _mm_crc32_u8 (reg, *buf++);
+
+  return reg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// CRC_pclmul
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("sse4.2,pclmul")))
+static unsigned int CRC_pclmul (unsigned int reg, const unsigned char *buf,
+				size_t length)
+{
+  // run three streams over the next 3 * words words, then shift the first
+  // two over the bytes that follow them.  Multiplying the two reflected 32
+  // bit values gives a product times x, and crc32 of it times x^32, so the
+  // constant for n bytes is x^(8n - 33).
+  unsigned long long a, b, c;
+  unsigned long long w0, w1, w2;
+  const unsigned char *p;
+  size_t words;
+  size_t i;
+  __m128i product;
+
+  while (length >= CRC_MIN_STREAM_BYTES) {
+    words = length / 24;
+    if (words > CRC_MAX_STREAM_WORDS)
+      words = CRC_MAX_STREAM_WORDS;
+
+    a = reg;
+    b = 0;
+    c = 0;
+    p = buf;
+    for (i = 0; i < words; i++) {
+      __builtin_memcpy (&w0, p, 8);
+      __builtin_memcpy (&w1, p + words * 8, 8);
+      __builtin_memcpy (&w2, p + words * 16, 8);
+      a = _mm_crc32_u64 (a, w0);
+      b = _mm_crc32_u64 (b, w1);
+      c = _mm_crc32_u64 (c, w2);
+      p += 8;
+    }
+
+    product = _mm_clmulepi64_si128 (_mm_cvtsi32_si128 (a),
+				    _mm_cvtsi32_si128 (CRC_shift32c[2 * words]),
+				    0);
+    c ^= _mm_crc32_u64 (0, _mm_cvtsi128_si64 (product));
+    product = _mm_clmulepi64_si128 (_mm_cvtsi32_si128 (b),
+				    _mm_cvtsi32_si128 (CRC_shift32c[words]), 0);
+    c ^= _mm_crc32_u64 (0, _mm_cvtsi128_si64 (product));
+    reg = c;
+
+    buf += words * 24;
+    length -= words * 24;
+  }
+
+  return CRC_sse42 (reg, buf, length);
+}
+#endif
@@ -0,0 +1,44 @@
+//
+// File: calcCRC.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: functions to calculate cyclic redundancy checks.  Three
+// CRCs are provided:
+//
+//    CRC-8      polynomial 0x07, initial value 0, no final xor
+//    CRC-16     CCITT polynomial 0x1021, initial value and final xor 0xffff
+//    CRC-32C    Castagnoli polynomial 0x1edc6f41, bits reflected, initial
+//               value and final xor 0xffffffff (as used by iSCSI and SCTP)
+//
+// The following functions are defined:
+//    calcCRC (int algorithm, const void *buf, int length)
+//    calcCRC8 (unsigned int crc, const void *buf, int length)
+//    calcCRC16 (unsigned int crc, const void *buf, int length)
+//    calcCRC32C (unsigned int crc, const void *buf, int length)
+//
+// All of them process 8 bytes at a time with slicing-by-8 tables.  On x86
+// processors with SSE4.2, CRC-32C uses the crc32 instruction instead, and
+// with PCLMULQDQ as well, longer buffers are split into three parts whose
+// CRCs are calculated at the same time and then combined.  The fastest
+// version is picked when the program starts.
+//
+#ifndef _CALCCRC_H
+#define _CALCCRC_H
+
+// algorithms for calcCRC
+#define CRC_8   1
+#define CRC_16  2
+#define CRC_32C 3
+
+unsigned int calcCRC (int algorithm, const void *buf, int length);
+// returns the CRC of length bytes starting at buf, calculated with
+// algorithm, or 0 if algorithm is unknown.
+
+unsigned int calcCRC8 (unsigned int crc, const void *buf, int length);
+unsigned int calcCRC16 (unsigned int crc, const void *buf, int length);
+unsigned int calcCRC32C (unsigned int crc, const void *buf, int length);
+// return the CRC of length bytes starting at buf.  crc is 0 to start a
+// new CRC, or the CRC of the bytes before buf to continue one, so a CRC
+// can be calculated a piece at a time.
+#endif
@@ -22,8 +22,8 @@
 #include <unistd.h>     /* for close() */
 #include <netdb.h>
 
-// #include the checksum calculator file here.
-#include "calcChecksum.h"
+// #include the CRC calculator file here.
+#include "calcCRC.h"
 
 #define ECHOMAX 255     /* Longest string to echo */
 #define BUF_SIZE 16
@@ -85,8 +85,8 @@ int main(int argc, char *argv[])
   // copy the string to the message
   strncpy (message.data,echoString,BUF_SIZE);
 
-  // Cacluate the CRC.  Here's where you need to call calcCRC and place the
-  // result in message.crc
+  // Cacluate the CRC of the word and place it in message.crc
+  message.crc = htonl (calcCRC (CRC_8, message.data, BUF_SIZE));
 
   // now send the message to the server
   if (sendto(sock,&message,sizeof(message), 0, (struct sockaddr *)
@@ -0,0 +1,253 @@
+//
+// File: ecc.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the error correcting code defined in ecc.h.
+//
+// The packet's words are numbered with the positions that aren't powers
+// of 2, starting from 3, and check word k is the XOR of the words with bit
+// k set in their position.  Check word k itself has position 2^k, so when
+// a bit flips, the check words that come out wrong spell the position of
+// the word it flipped in.  The last check word is the XOR of all the
+// others and every word of the packet, which tells one flipped bit (which
+// changes it) from two (which don't).  The last word of the packet is
+// padded with zeros.
+//
+// Check words 0 to 2 depend on the position within each run of 8, which
+// is the same for every run, so a whole run goes into them with a fixed
+// pattern of XORs.  The rest are the same for all 8 words of a run, and
+// are worked out from the XOR of everything before each run, once a run.
+//
+
+#include <stdint.h>
+#include <string.h>     // memcpy, memset
+#include "ecc.h"
+
+// most check words, as for ECC_MAX_SIZE
+#define ECC_MAX_WORDS (ECC_MAX_SIZE / 8)
+
+// define prototypes for local routines
+static int ECC_numChecks (int numWords);
+static int ECC_checkWords (const unsigned char *packet, int length,
+			   uint64_t *check);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// eccSize
+//
+///////////////////////////////////////////////////////////////////////////////
+int eccSize (int length)
+{
+  return 8 * (ECC_numChecks ((length + 7) / 8) + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// eccEncode
+//
+///////////////////////////////////////////////////////////////////////////////
+void eccEncode (void *packet, int length)
+{
+  uint64_t check[ECC_MAX_WORDS];
+  int numChecks;
+  int k;
+
+  // the last word covers the others too
+  numChecks = ECC_checkWords (packet, length, check);
+  for (k = 0; k < numChecks; k++)
+    check[numChecks] ^= check[k];
+  memcpy ((unsigned char *)packet + length, check, 8 * (numChecks + 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// eccDecode
+//
+///////////////////////////////////////////////////////////////////////////////
+int eccDecode (void *packet, int size, int *corrected)
+{
+  // work out the check words again from what arrived.  Where they differ
+  // from the ones that arrived (the syndrome), bit b says what happened to
+  // codeword b.
+  uint64_t check[ECC_MAX_WORDS], sent[ECC_MAX_WORDS];
+  uint64_t errors, parity, word;
+  unsigned char bytes[8];
+  unsigned char *buf = packet;
+  int numChecks, length;
+  int position, index, n;
+  int b, k;
+
+  if (corrected)
+    *corrected = 0;
+
+  length = eccLength (size);
+  if (length < 0)
+    return -1;
+  numChecks = ECC_checkWords (buf, length, check);
+  memcpy (sent, buf + length, 8 * (numChecks + 1));
+  errors = 0;
+  parity = check[numChecks] ^ sent[numChecks];
+  for (k = 0; k < numChecks; k++) {
+    check[k] ^= sent[k];
+    errors |= check[k];
+    parity ^= sent[k];
+  }
+  if (!(errors | parity))
+    return length;
+
+  // a codeword with a bad parity has one bit flipped, at the position its
+  // syndrome spells (a check word if that's 0 or a power of 2).  A good
+  // parity with a syndrome means two.
+  errors |= parity;
+  for (b = 0; b < 64; b++) {
+    if (!(errors >> b & 1))
+      continue;
+    if (!(parity >> b & 1))
+      return -1;
+    position = 0;
+    for (k = 0; k < numChecks; k++)
+      position |= (int)(check[k] >> b & 1) << k;
+    // a flipped check bit needn't be put right, but it was corrected
+    if (!(position & (position - 1))) {
+      if (corrected)
+	(*corrected)++;
+      continue;
+    }
+
+    // positions skip the powers of 2 below them, which is one per bit
+    index = position - 1;
+    for (k = position; k > 0; k >>= 1)
+      index--;
+    if (8 * index >= length)
+      return -1;
+
+    // flip it, unless that's in the padding after the last byte, which
+    // can't have been sent wrong
+    n = length - 8 * index < 8 ? length - 8 * index : 8;
+    memset (bytes, 0, sizeof(bytes));
+    memcpy (bytes, buf + 8 * index, n);
+    memcpy (&word, bytes, 8);
+    word ^= (uint64_t)1 << b;
+    memcpy (bytes, &word, 8);
+    for (k = n; k < 8; k++)
+      if (bytes[k])
+	return -1;
+    memcpy (buf + 8 * index, bytes, n);
+    if (corrected)
+      (*corrected)++;
+  }
+  return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// eccLength
+//
+///////////////////////////////////////////////////////////////////////////////
+int eccLength (int size)
+{
+  // only one length gives a packet of size bytes with its check words
+  int numChecks, length;
+
+  for (numChecks = 2; numChecks < ECC_MAX_WORDS; numChecks++) {
+    length = size - 8 * (numChecks + 1);
+    if (length > 0 && eccSize (length) == 8 * (numChecks + 1))
+      return length;
+  }
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ECC_numChecks
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ECC_numChecks (int numWords)
+{
+  // k check words give 2^k - 1 positions, k of them their own
+  int k;
+
+  for (k = 2; (1 << k) - 1 - k < numWords; k++)
+    ;
+  return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ECC_checkWords
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ECC_checkWords (const unsigned char *packet, int length,
+			   uint64_t *check)
+{
+  // work out the check words of length bytes starting at packet, and the
+  // XOR of all its words after them.  Returns the number of check words.
+  uint64_t w[8], run, all = 0;
+  uint64_t low[3] = {0, 0, 0};
+  int numWords = (length + 7) / 8;
+  int whole = length / 8;
+  int numChecks;
+  int position = 3, end = 0, last = 0;
+  int i, j, k, n;
+
+  numChecks = ECC_numChecks (numWords);
+  memset (check, 0, 8 * (numChecks + 1));
+
+  for (i = 0; i < numWords; ) {
+    // starting a run of 8 positions: all is the XOR of the words before it
+    j = position >> 3;
+    if (j != last) {
+      for (k = 3; !(j & ((1 << (k - 3)) - 1)); k++)
+	check[k] ^= all;
+      last = j;
+    }
+
+    // the whole run at once if it's all there, less any positions before
+    // this one (which can only be the power of 2 it starts at)
+    n = 8 - (position & 7);
+    if (n >= 7 && i + n <= whole) {
+      w[0] = 0;
+      if (n == 8)
+	memcpy (w, packet + 8 * i, 64);
+      else
+	memcpy (w + 1, packet + 8 * i, 56);
+      low[0] ^= w[1] ^ w[3] ^ w[5] ^ w[7];
+      low[1] ^= w[2] ^ w[3] ^ w[6] ^ w[7];
+      low[2] ^= w[4] ^ w[5] ^ w[6] ^ w[7];
+      run = w[0] ^ w[1] ^ w[2] ^ w[3] ^ w[4] ^ w[5] ^ w[6] ^ w[7];
+      all ^= run;
+      i += n;
+      position += n;
+    }
+    else {
+      // otherwise a word at a time, the last one padded with zeros
+      w[0] = 0;
+      memcpy (w, packet + 8 * i, i < whole ? 8 : length - 8 * i);
+      all ^= w[0];
+      for (k = 0; k < 3; k++)
+	if (position & 1 << k)
+	  low[k] ^= w[0];
+      i++;
+      position++;
+    }
+    end = position;
+
+    // the check words have the powers of 2
+    while (!(position & (position - 1)))
+      position++;
+  }
+
+  // so far check[k] (from 3) is the XOR of the words before each multiple
+  // of 2^k.  Bit k of a position is whether there's an odd number of
+  // multiples of 2^k up to it, so check[k] should be the XOR of the words
+  // from each multiple on: that's all of them once for every multiple,
+  // with what's there already taken out.
+  for (k = 3; k < numChecks; k++)
+    if ((end - 1) >> k & 1)
+      check[k] ^= all;
+  for (k = 0; k < 3 && k < numChecks; k++)
+    check[k] = low[k];
+  check[numChecks] = all;
+  return numChecks;
+}
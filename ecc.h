@@ -0,0 +1,52 @@
+//
+// File: ecc.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: an error correcting code for packets.  Check words added
+// to the end of a packet let the receiver put right a few flipped bits
+// anywhere in it, the check words included, and tell when there are too
+// many to put right.  The following functions are defined:
+//
+//    eccSize (int length)
+//    eccEncode (void *packet, int length)
+//    eccDecode (void *packet, int size, int *corrected)
+//    eccLength (int size)
+//
+// The packet is taken 64 bits at a time, and bit b of every word belongs
+// to codeword b, so there are 64 interleaved codewords (extended Hamming
+// codes: single error correcting, double error detecting).  Bits flipped
+// in different codewords are all corrected; two in the same codeword are
+// detected, as are most bursts.  The codes are worked out for all 64 at
+// once with XORs of whole words.
+//
+#ifndef _ECC_H
+#define _ECC_H
+
+// most bytes eccSize returns for a packet of up to 64 KB
+#define ECC_MAX_SIZE 128
+
+int eccSize (int length);
+// returns the number of bytes of check words eccEncode adds to a packet of
+// length bytes: 8 bytes for each doubling of the packet's length, and 8
+// more.
+
+void eccEncode (void *packet, int length);
+// puts the check words for length bytes starting at packet right after
+// them, so there must be room for eccSize (length) more bytes.
+
+int eccDecode (void *packet, int size, int *corrected);
+// puts right the errors in a packet of size bytes, check words and all,
+// from eccEncode.  Returns the length of the packet without its check
+// words, and sets *corrected (if corrected isn't 0) to the number of bits
+// corrected, in the data or its check words, which may be 0.
+//
+// A negative return value indicates the errors couldn't be corrected, or
+// size isn't one eccEncode makes.
+
+int eccLength (int size);
+// returns the length of a packet that is size bytes with its check words,
+// without correcting it.
+//
+// A negative return value indicates size isn't one eccEncode makes.
+#endif
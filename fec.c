@@ -0,0 +1,356 @@
+//
+// File: fec.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the erasure code defined in fec.h.
+//
+// GF(2^8) is built on the polynomial x^8 + x^4 + x^3 + x^2 + 1, which has
+// 2 as a generator.  The coefficients are a Cauchy matrix, 1 / (x_r + y_i)
+// with x_r = r and y_i = FEC_MAX_REPAIR + i, with each column multiplied
+// by y_i so repair symbol 0 is plain parity.  Every square submatrix of a
+// Cauchy matrix is invertible, and scaling columns doesn't change that, so
+// any set of lost symbols can be solved for with as many repair symbols.
+//
+// Multiplying a run of bytes by c in GF(2^8) is the XOR of c times each
+// byte's low nibble and c times its high nibble, so two 16 entry tables
+// do it, and pshufb looks up 16 bytes in such a table at once.
+//
+
+#include <stddef.h>
+#include <string.h>     // memcpy, memset
+#include "fec.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FEC_X86 1
+#endif
+
+// x^8 + x^4 + x^3 + x^2 + 1
+#define FEC_POLY 0x11d
+
+static unsigned char FEC_exp[512];
+static unsigned char FEC_log[256];
+static unsigned char FEC_mul[256][256];
+
+// FEC_nibbles[c][0][n] is c times n, and FEC_nibbles[c][1][n] is c times
+// n << 4
+static unsigned char FEC_nibbles[256][2][16];
+
+// define prototypes for local routines
+static void FEC_init (void) __attribute__ ((constructor));
+static unsigned int FEC_inverse (unsigned int a);
+static void FEC_xor (unsigned char *dst, const unsigned char *src,
+		     size_t length);
+static void FEC_mulAdd (unsigned char *dst, const unsigned char *src,
+			size_t length, unsigned int coef);
+#ifdef FEC_X86
+static void FEC_xorSse2 (unsigned char *dst, const unsigned char *src,
+			 size_t length);
+static void FEC_xorAvx2 (unsigned char *dst, const unsigned char *src,
+			 size_t length);
+static void FEC_mulAddSsse3 (unsigned char *dst, const unsigned char *src,
+			     size_t length, unsigned int coef);
+static void FEC_mulAddAvx2 (unsigned char *dst, const unsigned char *src,
+			    size_t length, unsigned int coef);
+#endif
+
+// the versions picked by FEC_init
+static void (*FEC_calcXor) (unsigned char *dst, const unsigned char *src,
+			    size_t length) = FEC_xor;
+static void (*FEC_calcMulAdd) (unsigned char *dst, const unsigned char *src,
+			       size_t length, unsigned int coef) = FEC_mulAdd;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fecCoefficient
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int fecCoefficient (int repair, int index)
+{
+  unsigned int y = FEC_MAX_REPAIR + index;
+
+  return FEC_mul[y][FEC_inverse (repair ^ y)];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fecMulAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+void fecMulAdd (void *dst, const void *src, int length, unsigned int coef)
+{
+  if (length <= 0 || coef == 0)
+    return;
+  if (coef == 1)
+    FEC_calcXor (dst, src, length);
+  else
+    FEC_calcMulAdd (dst, src, length, coef & 0xff);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fecSolve
+//
+///////////////////////////////////////////////////////////////////////////////
+int fecSolve (unsigned char **out, unsigned char **sums, const int *repair,
+	      const int *index, int count, int length)
+{
+  // sums[j] is the sum over k of fecCoefficient (repair[j], index[k])
+  // times out[k], so invert that matrix (Gauss-Jordan) and multiply the
+  // sums by it
+  unsigned char a[FEC_MAX_REPAIR][FEC_MAX_REPAIR];
+  unsigned char inv[FEC_MAX_REPAIR][FEC_MAX_REPAIR];
+  unsigned char row[FEC_MAX_REPAIR];
+  unsigned int scale;
+  int i, j, k;
+
+  if (count < 1 || count > FEC_MAX_REPAIR)
+    return -1;
+
+  for (j = 0; j < count; j++)
+    for (k = 0; k < count; k++) {
+      a[j][k] = fecCoefficient (repair[j], index[k]);
+      inv[j][k] = j == k;
+    }
+
+  for (k = 0; k < count; k++) {
+    // bring a row with a nonzero entry in column k up to row k
+    for (j = k; j < count && !a[j][k]; j++)
+      ;
+    if (j == count)
+      return -1;
+    if (j != k) {
+      memcpy (row, a[j], count);
+      memcpy (a[j], a[k], count);
+      memcpy (a[k], row, count);
+      memcpy (row, inv[j], count);
+      memcpy (inv[j], inv[k], count);
+      memcpy (inv[k], row, count);
+    }
+
+    // make the entry 1, and clear column k from every other row
+    scale = FEC_inverse (a[k][k]);
+    for (i = 0; i < count; i++) {
+      a[k][i] = FEC_mul[scale][a[k][i]];
+      inv[k][i] = FEC_mul[scale][inv[k][i]];
+    }
+    for (j = 0; j < count; j++) {
+      if (j == k || !a[j][k])
+	continue;
+      scale = a[j][k];
+      for (i = 0; i < count; i++) {
+	a[j][i] ^= FEC_mul[scale][a[k][i]];
+	inv[j][i] ^= FEC_mul[scale][inv[k][i]];
+      }
+    }
+  }
+
+  for (k = 0; k < count; k++) {
+    memset (out[k], 0, length);
+    for (j = 0; j < count; j++)
+      fecMulAdd (out[k], sums[j], length, inv[k][j]);
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_init
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FEC_init (void)
+{
+  // every nonzero element is a power of 2.  Repeating the exp table saves
+  // reducing the sum of two logs modulo 255.
+  unsigned int x = 1;
+  int a, b;
+
+  for (a = 0; a < 255; a++) {
+    FEC_exp[a] = x;
+    FEC_exp[a + 255] = x;
+    FEC_log[x] = a;
+    x <<= 1;
+    if (x & 0x100)
+      x ^= FEC_POLY;
+  }
+  for (a = 1; a < 256; a++)
+    for (b = 1; b < 256; b++)
+      FEC_mul[a][b] = FEC_exp[FEC_log[a] + FEC_log[b]];
+  for (a = 0; a < 256; a++)
+    for (b = 0; b < 16; b++) {
+      FEC_nibbles[a][0][b] = FEC_mul[a][b];
+      FEC_nibbles[a][1][b] = FEC_mul[a][b << 4];
+    }
+
+  // every x86-64 processor has SSE2, but not necessarily SSSE3
+#ifdef FEC_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) {
+    FEC_calcXor = FEC_xorAvx2;
+    FEC_calcMulAdd = FEC_mulAddAvx2;
+  }
+  else {
+    FEC_calcXor = FEC_xorSse2;
+    if (__builtin_cpu_supports ("ssse3"))
+      FEC_calcMulAdd = FEC_mulAddSsse3;
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_inverse
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int FEC_inverse (unsigned int a)
+{
+  // a must not be 0
+  return FEC_exp[255 - FEC_log[a]];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_xor
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FEC_xor (unsigned char *dst, const unsigned char *src,
+		     size_t length)
+{
+  unsigned long long a, b;
+
+  while (length >= 8) {
+    memcpy (&a, dst, 8);
+    memcpy (&b, src, 8);
+    a ^= b;
+    memcpy (dst, &a, 8);
+    dst += 8;
+    src += 8;
+    length -= 8;
+  }
+  while (length--)
+    *dst++ ^= *src++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_mulAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FEC_mulAdd (unsigned char *dst, const unsigned char *src,
+			size_t length, unsigned int coef)
+{
+  const unsigned char *product = FEC_mul[coef];
+
+  while (length--)
+    *dst++ ^= product[*src++];
+}
+
+#ifdef FEC_X86
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_xorSse2
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FEC_xorSse2 (unsigned char *dst, const unsigned char *src,
+			 size_t length)
+{
+  __m128i data;
+
+  while (length >= 16) {
+    data = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *)dst),
+			  _mm_loadu_si128 ((const __m128i *)src));
+    _mm_storeu_si128 ((__m128i *)dst, data);
+    dst += 16;
+    src += 16;
+    length -= 16;
+  }
+  FEC_xor (dst, src, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_xorAvx2
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("avx2")))
+static void FEC_xorAvx2 (unsigned char *dst, const unsigned char *src,
+			 size_t length)
+{
+  __m256i data;
+
+  while (length >= 32) {
+    data = _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i *)dst),
+			     _mm256_loadu_si256 ((const __m256i *)src));
+    _mm256_storeu_si256 ((__m256i *)dst, data);
+    dst += 32;
+    src += 32;
+    length -= 32;
+  }
+  FEC_xor (dst, src, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_mulAddSsse3
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("ssse3")))
+static void FEC_mulAddSsse3 (unsigned char *dst, const unsigned char *src,
+			     size_t length, unsigned int coef)
+{
+  __m128i low = _mm_loadu_si128 ((const __m128i *)FEC_nibbles[coef][0]);
+  __m128i high = _mm_loadu_si128 ((const __m128i *)FEC_nibbles[coef][1]);
+  __m128i mask = _mm_set1_epi8 (0x0f);
+  __m128i data, product;
+
+  while (length >= 16) {
+    data = _mm_loadu_si128 ((const __m128i *)src);
+    product = _mm_xor_si128
+      (_mm_shuffle_epi8 (low, _mm_and_si128 (data, mask)),
+       _mm_shuffle_epi8 (high, _mm_and_si128 (_mm_srli_epi64 (data, 4),
+					      mask)));
+    product = _mm_xor_si128 (product, _mm_loadu_si128 ((const __m128i *)dst));
+    _mm_storeu_si128 ((__m128i *)dst, product);
+    dst += 16;
+    src += 16;
+    length -= 16;
+  }
+  FEC_mulAdd (dst, src, length, coef);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FEC_mulAddAvx2
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("avx2")))
+static void FEC_mulAddAvx2 (unsigned char *dst, const unsigned char *src,
+			    size_t length, unsigned int coef)
+{
+  // vpshufb looks up each 128 bit lane separately, so both lanes get the
+  // tables
+  __m256i low = _mm256_broadcastsi128_si256
+    (_mm_loadu_si128 ((const __m128i *)FEC_nibbles[coef][0]));
+  __m256i high = _mm256_broadcastsi128_si256
+    (_mm_loadu_si128 ((const __m128i *)FEC_nibbles[coef][1]));
+  __m256i mask = _mm256_set1_epi8 (0x0f);
+  __m256i data, product;
+
+  while (length >= 32) {
+    data = _mm256_loadu_si256 ((const __m256i *)src);
+    product = _mm256_xor_si256
+      (_mm256_shuffle_epi8 (low, _mm256_and_si256 (data, mask)),
+       _mm256_shuffle_epi8 (high, _mm256_and_si256 (_mm256_srli_epi64 (data,
+								      4),
+						    mask)));
+    product = _mm256_xor_si256 (product,
+				_mm256_loadu_si256 ((const __m256i *)dst));
+    _mm256_storeu_si256 ((__m256i *)dst, product);
+    dst += 32;
+    src += 32;
+    length -= 32;
+  }
+  FEC_mulAdd (dst, src, length, coef);
+}
+#endif
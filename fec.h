@@ -0,0 +1,54 @@
+//
+// File: fec.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: an erasure code for forward error correction.  A group of
+// data symbols (equal length runs of bytes) is sent along with repair
+// symbols, each a different sum of the data symbols multiplied by
+// constants in GF(2^8).  Any lost data symbols can be rebuilt from as many
+// repair symbols, whichever ones arrive: the code is a Reed-Solomon code
+// built from a Cauchy matrix.  Repair symbol 0 of a group is its data
+// symbols XORed together (simple parity), so one repair symbol costs no
+// multiplications.  The following functions are defined:
+//
+//    fecCoefficient (int repair, int index)
+//    fecMulAdd (void *dst, const void *src, int length, unsigned int coef)
+//    fecSolve (unsigned char **out, unsigned char **sums,
+//              const int *repair, const int *index, int count, int length)
+//
+// Repair symbol r of a group is the sum, for each data symbol i, of
+// fecCoefficient (r, i) times symbol i, built up with fecMulAdd.  Symbols
+// shorter than the others count as if padded with zeros.
+//
+// On x86 processors the multiplications are done 16 or 32 bytes at a time
+// with SSSE3 or AVX2, whichever the processor has; elsewhere they're done
+// with a table a byte at a time.
+//
+#ifndef _FEC_H
+#define _FEC_H
+
+// most repair symbols and data symbols a group can have
+#define FEC_MAX_REPAIR 16
+#define FEC_MAX_DATA   (256 - FEC_MAX_REPAIR)
+
+unsigned int fecCoefficient (int repair, int index);
+// returns what data symbol index (0 to FEC_MAX_DATA - 1) is multiplied by
+// in repair symbol repair (0 to FEC_MAX_REPAIR - 1).  It's 1 for repair
+// symbol 0.
+
+void fecMulAdd (void *dst, const void *src, int length, unsigned int coef);
+// adds coef times length bytes starting at src to the bytes at dst.
+// Adding is XOR in GF(2^8), so adding the same thing twice takes it out
+// again.  src and dst mustn't overlap.
+
+int fecSolve (unsigned char **out, unsigned char **sums, const int *repair,
+	      const int *index, int count, int length);
+// rebuilds count lost data symbols, numbered index[0..count-1] in their
+// group, into the buffers out[0..count-1].  sums[j] is repair symbol
+// repair[j] of the group with every data symbol that did arrive taken out
+// again with fecMulAdd, so it only holds the lost ones.  Every symbol is
+// length bytes.  The repair symbols must all be different.
+//
+// A negative return value indicates an error.
+#endif
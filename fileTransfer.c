@@ -0,0 +1,325 @@
+//
+// File: fileTransfer.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the file transfer defined in fileTransfer.h.
+//
+// ABP passes on each sender's messages in order, so chunks arrive one
+// after another from wherever the transfer started.  A chunk that doesn't
+// start where the last one ended means ABP gave up on one in between;
+// everything after it is ignored so the receiver's file never has a hole
+// in it, and its length is always where to resume from.
+//
+
+#define _GNU_SOURCE     // fallocate, sync_file_range
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>  // htonl
+#include <endian.h>     // htobe64
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ABP.h"
+#include "calcCRC.h"
+#include "fileTransfer.h"
+
+// bytes of file data in a chunk.  ABP splits each chunk into packets.
+#define FT_CHUNK_SIZE (64 * 1024)
+
+// bytes of the file the sender maps at a time, which must be a multiple of
+// the page size.  The receiver starts writing each window out to disk once
+// it has arrived.
+#define FT_WINDOW_SIZE (16 * 1024 * 1024)
+
+// bytes the receiver reads at a time to find the CRC of the part of the
+// file it already has when resuming
+#define FT_READ_SIZE (1024 * 1024)
+
+// message types
+#define FT_START 1
+#define FT_DATA  2
+#define FT_END   3
+
+// every message starts with a header, and chunks (FT_DATA) are followed by
+// their data.  Fields are in network byte order.
+struct FT_header {
+  unsigned char type;
+  unsigned long long offset;     // where the transfer or chunk starts
+  unsigned long long fileSize;   // length of the whole file
+  unsigned int digest;           // CRC-32C of the whole file (FT_END)
+} __attribute__ ((packed));
+
+// define prototypes for local routines
+static int FT_openFile (const char *path, long long offset,
+			long long fileSize, unsigned int *digest);
+static int FT_write (int fd, char *buf, int length, long long offset);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FT_sendFile
+//
+///////////////////////////////////////////////////////////////////////////////
+int FT_sendFile (const char *path, long long offset)
+{
+  struct FT_header hdr;
+  struct iovec iov[2];
+  struct stat st;
+  long long fileSize;
+  long long windowStart, windowSize, pos;
+  unsigned int digest = 0;
+  char *window;
+  int chunk;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0) {
+    perror ("sendFile: open");
+    return -1;
+  }
+  if (fstat (fd, &st) < 0) {
+    perror ("sendFile: fstat");
+    close (fd);
+    return -1;
+  }
+  fileSize = st.st_size;
+  if (offset < 0 || offset > fileSize) {
+    printf ("sendFile: %s has no offset %lld\n", path, offset);
+    close (fd);
+    return -1;
+  }
+
+  // tell the receiver what's coming
+  memset (&hdr, 0, sizeof(hdr));
+  hdr.type = FT_START;
+  hdr.offset = htobe64 (offset);
+  hdr.fileSize = htobe64 (fileSize);
+  ABP_send ((char *)&hdr, sizeof(hdr));
+
+  // send the chunks with their headers in front, straight out of the
+  // mapping.  The part before offset is only read for the digest.
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  hdr.type = FT_DATA;
+  for (windowStart = 0; windowStart < fileSize;
+       windowStart += FT_WINDOW_SIZE) {
+    windowSize = fileSize - windowStart;
+    if (windowSize > FT_WINDOW_SIZE)
+      windowSize = FT_WINDOW_SIZE;
+    window = mmap (0, windowSize, PROT_READ, MAP_SHARED, fd, windowStart);
+    if (window == MAP_FAILED) {
+      perror ("sendFile: mmap");
+      close (fd);
+      return -1;
+    }
+    madvise (window, windowSize, MADV_SEQUENTIAL);
+
+    for (pos = windowStart; pos < windowStart + windowSize; pos += chunk) {
+      chunk = windowStart + windowSize - pos;
+      if (chunk > FT_CHUNK_SIZE)
+	chunk = FT_CHUNK_SIZE;
+      if (pos < offset && pos + chunk > offset)
+	chunk = offset - pos;
+      digest = calcCRC32C (digest, window + (pos - windowStart), chunk);
+      if (pos < offset)
+	continue;
+
+      hdr.offset = htobe64 (pos);
+      iov[1].iov_base = window + (pos - windowStart);
+      iov[1].iov_len = chunk;
+      ABP_sendv (iov, 2);
+    }
+    munmap (window, windowSize);
+  }
+  close (fd);
+
+  // finish with the digest, and wait for it all to arrive
+  hdr.type = FT_END;
+  hdr.offset = htobe64 (fileSize);
+  hdr.digest = htonl (digest);
+  ABP_send ((char *)&hdr, sizeof(hdr));
+  ABP_flush ();
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FT_recvFile
+//
+///////////////////////////////////////////////////////////////////////////////
+int FT_recvFile (const char *path)
+{
+  struct FT_header hdr;
+  char *buf = 0;
+  int bufSize = 0;
+  int length;
+  long long next = 0, fileSize = 0;
+  long long synced = 0;
+  unsigned int digest = 0;
+  int missing = 0;
+  int result = -1;
+  int fd = -1;
+
+  for (;;) {
+    length = ABP_recvMessage (&buf, &bufSize, 0);
+    if (length < (int)sizeof(hdr)) {
+      printf ("recvFile: message too short\n");
+      continue;
+    }
+    memcpy (&hdr, buf, sizeof(hdr));
+
+    // a new transfer replaces any that was going on
+    if (hdr.type == FT_START) {
+      if (fd >= 0)
+	close (fd);
+      next = be64toh (hdr.offset);
+      synced = next;
+      fileSize = be64toh (hdr.fileSize);
+      missing = 0;
+      fd = FT_openFile (path, next, fileSize, &digest);
+      if (fd < 0)
+	break;
+      continue;
+    }
+    if (fd < 0) {
+      printf ("recvFile: no transfer started\n");
+      continue;
+    }
+
+    if (hdr.type == FT_DATA && !missing) {
+      if ((long long)be64toh (hdr.offset) != next) {
+	printf ("recvFile: data missing at offset %lld\n", next);
+	missing = 1;
+	continue;
+      }
+      length -= sizeof(hdr);
+      if (FT_write (fd, buf + sizeof(hdr), length, next) < 0)
+	break;
+      digest = calcCRC32C (digest, buf + sizeof(hdr), length);
+      next += length;
+
+      // start writing each window out once it has arrived, so dirty pages
+      // don't pile up in memory
+      if (next - synced >= FT_WINDOW_SIZE) {
+	sync_file_range (fd, synced, next - synced, SYNC_FILE_RANGE_WRITE);
+	synced = next;
+      }
+    }
+    else if (hdr.type == FT_END) {
+      if (next != fileSize)
+	printf ("recvFile: %lld of %lld bytes received\n", next, fileSize);
+      else if (ntohl (hdr.digest) != digest)
+	printf ("recvFile: %s doesn't match the sender's CRC\n", path);
+      else
+	result = 0;
+      break;
+    }
+  }
+
+  if (fd >= 0 && fsync (fd) < 0)
+    perror ("recvFile: fsync");
+  if (fd >= 0)
+    close (fd);
+  if (result < 0 && fd >= 0 && next < fileSize)
+    printf ("recvFile: resume the transfer from offset %lld\n", next);
+  free (buf);
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FT_openFile
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FT_openFile (const char *path, long long offset,
+			long long fileSize, unsigned int *digest)
+{
+  // open path to receive a file starting at offset, and find the CRC of
+  // the part of it that's already there.  Returns the descriptor, or -1.
+  struct stat st;
+  char *buf;
+  long long pos;
+  int length;
+  int fd;
+
+  fd = open (path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror ("recvFile: open");
+    return -1;
+  }
+  if (fstat (fd, &st) < 0) {
+    perror ("recvFile: fstat");
+    close (fd);
+    return -1;
+  }
+  if (offset > st.st_size) {
+    printf ("recvFile: %s only has %lld bytes, can't resume from %lld\n",
+	    path, (long long)st.st_size, offset);
+    close (fd);
+    return -1;
+  }
+
+  // throw away anything after where the sender starts, and reserve room
+  // for the rest so the file isn't fragmented (not every file system can)
+  if (ftruncate (fd, offset) < 0) {
+    perror ("recvFile: ftruncate");
+    close (fd);
+    return -1;
+  }
+  if (fileSize > offset)
+    fallocate (fd, FALLOC_FL_KEEP_SIZE, offset, fileSize - offset);
+
+  *digest = 0;
+  if (offset == 0)
+    return fd;
+  buf = malloc (FT_READ_SIZE);
+  if (!buf) {
+    perror ("recvFile: malloc");
+    close (fd);
+    return -1;
+  }
+  for (pos = 0; pos < offset; pos += length) {
+    length = offset - pos < FT_READ_SIZE ? offset - pos : FT_READ_SIZE;
+    length = pread (fd, buf, length, pos);
+    if (length <= 0) {
+      perror ("recvFile: pread");
+      free (buf);
+      close (fd);
+      return -1;
+    }
+    *digest = calcCRC32C (*digest, buf, length);
+  }
+  free (buf);
+  return fd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FT_write
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FT_write (int fd, char *buf, int length, long long offset)
+{
+  // write length bytes at offset, carrying on after partial writes and
+  // signals (SIGIO and SIGALRM arrive all the time)
+  int written;
+
+  while (length > 0) {
+    written = pwrite (fd, buf, length, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+	continue;
+      perror ("recvFile: pwrite");
+      return -1;
+    }
+    buf += written;
+    length -= written;
+    offset += written;
+  }
+  return 0;
+}
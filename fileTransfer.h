@@ -0,0 +1,42 @@
+//
+// File: fileTransfer.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: functions to copy a file from one host to another over
+// ABP.  They use the default session, so call ABP_sendInit or ABP_recvInit
+// first.  The following functions are defined:
+//
+//    FT_sendFile (const char *path, long long offset)
+//    FT_recvFile (const char *path)
+//
+// The file is sent as a start message, then its data in chunks that each
+// say where they go in the file, then an end message with the CRC-32C of
+// the whole file.  The sender maps the file a window at a time and ABP
+// copies the data straight from the mapping into packets; the receiver
+// writes each chunk in place with pwrite.  Neither needs more memory for
+// a larger file.
+//
+// A transfer that stops part way can be picked up where it left off: the
+// receiver's file holds everything up to the first chunk that didn't
+// arrive, so the sender starts again from the length of that file.
+//
+#ifndef _FILETRANSFER_H
+#define _FILETRANSFER_H
+
+int FT_sendFile (const char *path, long long offset);
+// sends the file at path, starting offset bytes into it: 0 sends the
+// whole file, and the length of the receiver's copy resumes a transfer.
+// Returns once the receiver has acknowledged everything.
+//
+// A negative return value indicates an error.
+
+int FT_recvFile (const char *path);
+// receives a file sent with FT_sendFile and writes it to path, which is
+// created if it doesn't exist.  A transfer starting at offset 0 replaces
+// the file; one starting further in keeps the part before it.
+//
+// Returns 0 if the whole file arrived and matches the sender's CRC.  A
+// negative return value indicates an error; the length of the file at path
+// is then where the sender should resume from.
+#endif
@@ -0,0 +1,350 @@
+//
+// File: inetChecksum.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the Internet checksum defined in inetChecksum.h.
+//
+// Adding 32 bit words into a 64 bit total and folding the carries back in
+// at the end gives the same one's complement sum as adding 16 bit words one
+// at a time, because 2^16 is 1 modulo 2^16 - 1.  The vector versions do
+// the same with each 32 bit lane of the data going into its own 64 bit
+// total.
+//
+
+#include <stddef.h>
+#include <string.h>     // memcpy
+#include "inetChecksum.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define INET_X86 1
+#endif
+
+// define prototypes for local routines
+static void INET_init (void) __attribute__ ((constructor));
+static unsigned long long INET_add (unsigned long long total,
+				    const unsigned char *buf, size_t length);
+static unsigned long long INET_copyAdd (unsigned long long total,
+					unsigned char *dst,
+					const unsigned char *src,
+					size_t length);
+static unsigned long long INET_tail (unsigned long long total,
+				     const unsigned char *buf, size_t length);
+static unsigned int INET_fold (unsigned long long total);
+#ifdef INET_X86
+static unsigned long long INET_addSse2 (unsigned long long total,
+					const unsigned char *buf,
+					size_t length);
+static unsigned long long INET_copyAddSse2 (unsigned long long total,
+					    unsigned char *dst,
+					    const unsigned char *src,
+					    size_t length);
+static unsigned long long INET_addAvx2 (unsigned long long total,
+					const unsigned char *buf,
+					size_t length);
+static unsigned long long INET_copyAddAvx2 (unsigned long long total,
+					    unsigned char *dst,
+					    const unsigned char *src,
+					    size_t length);
+#endif
+
+// the versions picked by INET_init
+static unsigned long long (*INET_calcAdd) (unsigned long long total,
+					   const unsigned char *buf,
+					   size_t length) = INET_add;
+static unsigned long long (*INET_calcCopyAdd) (unsigned long long total,
+					       unsigned char *dst,
+					       const unsigned char *src,
+					       size_t length) = INET_copyAdd;
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// inetChecksum
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int inetChecksum (const void *buf, int length)
+{
+  return ~inetSum (0, buf, length) & 0xffff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// inetSum
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int inetSum (unsigned int sum, const void *buf, int length)
+{
+  if (length <= 0)
+    return INET_fold (sum);
+  return INET_fold (INET_calcAdd (sum, buf, length));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// inetCopySum
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int inetCopySum (void *dst, const void *src, int length,
+			  unsigned int sum)
+{
+  if (length <= 0)
+    return INET_fold (sum);
+  return INET_fold (INET_calcCopyAdd (sum, dst, src, length));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// inetSumAt
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int inetSumAt (unsigned int sum, unsigned int partSum, int offset)
+{
+  // bytes at odd offsets were added as the other half of their words
+  partSum = INET_fold (partSum);
+  if (offset & 1)
+    partSum = (partSum >> 8 | partSum << 8) & 0xffff;
+  return INET_fold ((unsigned long long)sum + partSum);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// inetChecksumUpdate
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int inetChecksumUpdate (unsigned int check, unsigned int oldWord,
+				 unsigned int newWord)
+{
+  // RFC 1624 equation 3: HC' = ~(~HC + ~m + m')
+  unsigned long long total;
+
+  total = (~check & 0xffff) + (~oldWord & 0xffff) + (newWord & 0xffff);
+  return ~INET_fold (total) & 0xffff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_init
+//
+///////////////////////////////////////////////////////////////////////////////
+static void INET_init (void)
+{
+  // every x86-64 processor has SSE2
+#ifdef INET_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) {
+    INET_calcAdd = INET_addAvx2;
+    INET_calcCopyAdd = INET_copyAddAvx2;
+  }
+  else {
+    INET_calcAdd = INET_addSse2;
+    INET_calcCopyAdd = INET_copyAddSse2;
+  }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_add
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long INET_add (unsigned long long total,
+				    const unsigned char *buf, size_t length)
+{
+  unsigned int word;
+
+  while (length >= 4) {
+    memcpy (&word, buf, 4);
+    total += word;
+    buf += 4;
+    length -= 4;
+  }
+  return INET_tail (total, buf, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_copyAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long INET_copyAdd (unsigned long long total,
+					unsigned char *dst,
+					const unsigned char *src,
+					size_t length)
+{
+  unsigned int word;
+
+  while (length >= 4) {
+    memcpy (&word, src, 4);
+    memcpy (dst, &word, 4);
+    total += word;
+    src += 4;
+    dst += 4;
+    length -= 4;
+  }
+  memcpy (dst, src, length);
+  return INET_tail (total, src, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_tail
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long INET_tail (unsigned long long total,
+				     const unsigned char *buf, size_t length)
+{
+  // add the last 0 to 3 bytes.  An odd byte at the end is padded with a
+  // zero byte after it.
+  unsigned short word;
+
+  if (length >= 2) {
+    memcpy (&word, buf, 2);
+    total += word;
+    buf += 2;
+    length -= 2;
+  }
+  if (length) {
+    word = 0;
+    memcpy (&word, buf, 1);
+    total += word;
+  }
+  return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_fold
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int INET_fold (unsigned long long total)
+{
+  // add the carries back in until the sum fits in 16 bits
+  while (total >> 16)
+    total = (total & 0xffff) + (total >> 16);
+  return total;
+}
+
+#ifdef INET_X86
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_addSse2
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long INET_addSse2 (unsigned long long total,
+					const unsigned char *buf,
+					size_t length)
+{
+  // widen each 32 bit lane to 64 bits so the totals can't overflow
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i sums = zero;
+  __m128i data;
+  unsigned long long lanes[2];
+
+  while (length >= 16) {
+    data = _mm_loadu_si128 ((const __m128i *)buf);
+    sums = _mm_add_epi64 (sums, _mm_unpacklo_epi32 (data, zero));
+    sums = _mm_add_epi64 (sums, _mm_unpackhi_epi32 (data, zero));
+    buf += 16;
+    length -= 16;
+  }
+  _mm_storeu_si128 ((__m128i *)lanes, sums);
+
+  // each total is below 2^63, so folding one first keeps the sum in range
+  total = INET_fold (total) + (unsigned long long)INET_fold (lanes[0]) +
+    INET_fold (lanes[1]);
+  return INET_add (total, buf, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_copyAddSse2
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long INET_copyAddSse2 (unsigned long long total,
+					    unsigned char *dst,
+					    const unsigned char *src,
+					    size_t length)
+{
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i sums = zero;
+  __m128i data;
+  unsigned long long lanes[2];
+
+  while (length >= 16) {
+    data = _mm_loadu_si128 ((const __m128i *)src);
+    _mm_storeu_si128 ((__m128i *)dst, data);
+    sums = _mm_add_epi64 (sums, _mm_unpacklo_epi32 (data, zero));
+    sums = _mm_add_epi64 (sums, _mm_unpackhi_epi32 (data, zero));
+    src += 16;
+    dst += 16;
+    length -= 16;
+  }
+  _mm_storeu_si128 ((__m128i *)lanes, sums);
+
+  total = INET_fold (total) + (unsigned long long)INET_fold (lanes[0]) +
+    INET_fold (lanes[1]);
+  return INET_copyAdd (total, dst, src, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_addAvx2
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("avx2")))
+static unsigned long long INET_addAvx2 (unsigned long long total,
+					const unsigned char *buf,
+					size_t length)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i sums = zero;
+  __m256i data;
+  unsigned long long lanes[4];
+
+  while (length >= 32) {
+    data = _mm256_loadu_si256 ((const __m256i *)buf);
+    sums = _mm256_add_epi64 (sums, _mm256_unpacklo_epi32 (data, zero));
+    sums = _mm256_add_epi64 (sums, _mm256_unpackhi_epi32 (data, zero));
+    buf += 32;
+    length -= 32;
+  }
+  _mm256_storeu_si256 ((__m256i *)lanes, sums);
+
+  total = INET_fold (total) + (unsigned long long)INET_fold (lanes[0]) +
+    INET_fold (lanes[1]) + INET_fold (lanes[2]) + INET_fold (lanes[3]);
+  return INET_add (total, buf, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// INET_copyAddAvx2
+//
+///////////////////////////////////////////////////////////////////////////////
+__attribute__ ((target ("avx2")))
+static unsigned long long INET_copyAddAvx2 (unsigned long long total,
+					    unsigned char *dst,
+					    const unsigned char *src,
+					    size_t length)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i sums = zero;
+  __m256i data;
+  unsigned long long lanes[4];
+
+  while (length >= 32) {
+    data = _mm256_loadu_si256 ((const __m256i *)src);
+    _mm256_storeu_si256 ((__m256i *)dst, data);
+    sums = _mm256_add_epi64 (sums, _mm256_unpacklo_epi32 (data, zero));
+    sums = _mm256_add_epi64 (sums, _mm256_unpackhi_epi32 (data, zero));
+    src += 32;
+    dst += 32;
+    length -= 32;
+  }
+  _mm256_storeu_si256 ((__m256i *)lanes, sums);
+
+  total = INET_fold (total) + (unsigned long long)INET_fold (lanes[0]) +
+    INET_fold (lanes[1]) + INET_fold (lanes[2]) + INET_fold (lanes[3]);
+  return INET_copyAdd (total, dst, src, length);
+}
+#endif
@@ -0,0 +1,52 @@
+//
+// File: inetChecksum.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: functions to calculate the 16 bit Internet checksum (RFC
+// 1071): the one's complement of the one's complement sum of the data
+// taken 16 bits at a time.  The following functions are defined:
+//
+//    inetChecksum (const void *buf, int length)
+//    inetSum (unsigned int sum, const void *buf, int length)
+//    inetCopySum (void *dst, const void *src, int length, unsigned int sum)
+//    inetSumAt (unsigned int sum, unsigned int partSum, int offset)
+//    inetChecksumUpdate (unsigned int check, unsigned int oldWord,
+//                        unsigned int newWord)
+//
+// The sum doesn't depend on byte order as long as everything is done in
+// the same one, so 16 bit values here are as they are in memory: store a
+// checksum with memcpy rather than htons, and read the words passed to
+// inetChecksumUpdate the same way.
+//
+// On x86 processors the data is added up 16 or 32 bytes at a time with SSE2
+// or AVX2, whichever the processor has; elsewhere it's added 4 bytes at a
+// time.
+//
+#ifndef _INETCHECKSUM_H
+#define _INETCHECKSUM_H
+
+unsigned int inetChecksum (const void *buf, int length);
+// returns the checksum of length bytes starting at buf.
+
+unsigned int inetSum (unsigned int sum, const void *buf, int length);
+// returns the sum of length bytes starting at buf added to sum, which is 0
+// or the sum of the bytes before buf.  Those must be an even number of
+// bytes; inetSumAt adds sums of pieces that start at odd offsets.  The
+// checksum is ~sum & 0xffff once everything has been added.
+
+unsigned int inetCopySum (void *dst, const void *src, int length,
+			  unsigned int sum);
+// copies length bytes from src to dst and returns their sum added to sum,
+// as for inetSum, in one pass over the data.  src and dst mustn't overlap.
+
+unsigned int inetSumAt (unsigned int sum, unsigned int partSum, int offset);
+// returns sum with partSum added, where partSum is the sum of bytes that
+// start offset bytes into the data.
+
+unsigned int inetChecksumUpdate (unsigned int check, unsigned int oldWord,
+				 unsigned int newWord);
+// returns check, the checksum of some data, updated for one 16 bit word
+// of the data changing from oldWord to newWord (RFC 1624), without looking
+// at the rest of the data.  The word must start at an even offset.
+#endif
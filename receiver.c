@@ -8,23 +8,173 @@
 #include "ABP.h"
 #include "unreliableSend.h"
 #include <stdbool.h>
+#include <stdlib.h>  // atoi, strtoull
+#include <string.h>
+#include <unistd.h>  // getopt
+#include <signal.h>  // sigwait
+#include <pthread.h> // pthread_sigmask
+#include <arpa/inet.h>  // inet_ntoa
+#include "fileTransfer.h"
+#include "trace.h"
+#include "ABPServer.h"
 
 #define MAX_LINE 1024
 
 #define MAX_PENDING 5
 #define SERVER_PORT 50000
+
+// called on a worker's thread with each message: every byte of a sender's
+// test pattern message is the same, 1 or 0
+void checkMessage (int worker, char *buf, int length,
+		   struct sockaddr_in *fromAddr, void *arg) {
+  for (int i = 0; i < length; i++) {
+    if (buf[i] != buf[0] || (buf[0] != 0 && buf[0] != 1)) {
+      printf ("Error in message from %s:%d\n", inet_ntoa (fromAddr->sin_addr),
+	      ntohs (fromAddr->sin_port));
+      return;
+    }
+  }
+}
+
+// receive from any number of senders at once, spread across numWorkers
+// threads (0 for one per CPU), until interrupted.  Then print what each
+// worker received.
+int serve (int numWorkers, int windowSize, int mode) {
+  ABP_server *server;
+  struct ABP_shardStats stats;
+  sigset_t stop;
+  int sig;
+
+  // the workers inherit the blocked signals, so only sigwait sees them
+  sigemptyset (&stop);
+  sigaddset (&stop, SIGINT);
+  sigaddset (&stop, SIGTERM);
+  pthread_sigmask (SIG_BLOCK, &stop, 0);
+
+  server = ABP_serverStart (SERVER_PORT, numWorkers, windowSize, mode,
+			    checkMessage, 0);
+  if (!server)
+    return 1;
+  printf ("receiving with %d workers; Control C stops\n",
+	  ABP_serverNumWorkers (server));
+  sigwait (&stop, &sig);
+
+  for (int i = 0; i < ABP_serverNumWorkers (server); i++) {
+    if (ABP_serverGetStats (server, i, &stats) < 0)
+      continue;
+    printf ("worker %d: %llu messages, %llu bytes, %llu wakeups\n", i,
+	    stats.messages, stats.bytes, stats.wakeups);
+  }
+  ABP_serverStop (server);
+  return 0;
+}
+
 int main (int argc, char *argv[]) {
   char buf[MAX_LINE];
   int len;
   int packetPlace = 1;
   bool correctRec = true;
+  char *file = 0;
+  int workers = -1;
+  bool tuned = false;
+  bool fec = false;
+  int opt;
+
+  // -f receives a file from "sender -f" instead of the test pattern.  -s
+  // takes packets with up to that many bytes of data.  -F rebuilds lost
+  // packets from the repair packets of senders using -F, and -E corrects
+  // bit errors in packets from senders using -E.  -H keeps damaged packets
+  // to combine with the copies resent.  -S seeds the unreliable network, so
+  // it loses the same acks each run.  -C keeps the protocol's counts in that
+  // shared memory object, for abpstat to watch.  -T records what happens to
+  // every packet in that trace file, for abptrace.  -w receives from many
+  // senders at once with that many worker threads (0 for one per CPU).
+  while ((opt = getopt (argc, argv, "f:s:FEHS:C:T:w:")) != -1) {
+    if (strchr ("sFEHC", opt))
+      tuned = true;
+    if (opt == 'f')
+      file = optarg;
+    else if (opt == 's') {
+      if (ABP_setPayloadSize (atoi (optarg)) < 0)
+	return 1;
+    }
+    else if (opt == 'F') {
+      fec = true;
+      if (ABP_setFec (ABP_FEC_MAX_GROUP, 1, 1) < 0)
+	return 1;
+    }
+    else if (opt == 'E') {
+      if (ABP_setEcc (1) < 0)
+	return 1;
+    }
+    else if (opt == 'H') {
+      if (ABP_setHarq (ABP_MAX_HARQ_COPIES) < 0)
+	return 1;
+    }
+    else if (opt == 'S')
+      US_SetSeed (strtoull (optarg, 0, 0));
+    else if (opt == 'C') {
+      if (ABP_setSharedCounters (optarg) < 0)
+	return 1;
+    }
+    else if (opt == 'T') {
+      if (TR_open (optarg, 0) < 0)
+	return 1;
+      atexit (TR_close);
+    }
+    else if (opt == 'w')
+      workers = atoi (optarg);
+    else {
+      printf ("usage: receiver [-f file] [-s payloadSize] [-F] [-E] [-H] "
+	      "[-S seed] [-C name] [-T traceFile] [-w workers] "
+	      "[windowSize [gbn|sr]]\n");
+      return 1;
+    }
+  }
+  argv += optind - 1;
+  argc -= optind - 1;
+
+  // the workers' sessions only take a window size and mode
+  if (workers >= 0) {
+    if (file || tuned) {
+      printf ("receiver: -w can't be used with -f, -s, -F, -E, -H or -C\n");
+      return 1;
+    }
+    US_SetFailureProb (5);
+    return serve (workers, argc>=2 ? atoi(argv[1]) : 1,
+		  argc>=3 && !strcmp(argv[2],"sr") ?
+		  ABP_SELECTIVE_REPEAT : ABP_GO_BACK_N);
+  }
+
+  // repair packets only come with a sliding window
+  if (fec && (argc < 2 || atoi (argv[1]) <= 1)) {
+    printf ("receiver: -F needs a window size of more than 1\n");
+    return 1;
+  }
+
+  // optionally use a sliding window instead of the alternating bit protocol
+  // (must match the sender)
+  if (argc>=2 && ABP_setWindow(atoi(argv[1]),
+			       argc>=3 && !strcmp(argv[2],"sr") ?
+			       ABP_SELECTIVE_REPEAT : ABP_GO_BACK_N)<0)
+    return 1;
+
   // intialize reveiver
-  if(ABP_recvInit(SERVER_PORT)<0)
+  if(ABP_recvInit(SERVER_PORT)<0) {
     printf ("recvinit failed\n");
+    return 1;
+  }
 
   // set failure probability for acks
   US_SetFailureProb (5);
 
+  if (file) {
+    if (FT_recvFile (file) < 0)
+      return 1;
+    printf ("%s received\n", file);
+    return 0;
+  }
+
   // wait for message  and print text
   while (packetPlace <= 1024) {
     printf ("\n");
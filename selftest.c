@@ -0,0 +1,607 @@
+//
+// File: selftest.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: checks the CRC, Internet checksum, erasure code and error
+// correcting code.  calcCRC.c, inetChecksum.c and fec.c pick between
+// versions of their kernels when the program starts, so a mistake in a
+// version this processor doesn't pick, or one only other processors run,
+// could go unnoticed; this includes their sources so it can call every
+// version directly, and compares each one against straightforward code
+// working a bit or a byte at a time.  Versions the processor can't run
+// are skipped.  Then the public functions are checked: the CRCs' check
+// values, sums of pieces and checksum updates, rebuilding lost symbols
+// from repair symbols, and correcting and detecting flipped bits.
+//
+// usage: selftest
+//
+// It prints what it checked and exits with status 1 if anything was
+// wrong.  "make check" runs it.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "calcCRC.c"
+#include "inetChecksum.c"
+#include "fec.c"
+#include "ecc.h"
+
+// longest buffer checked, and how far into a buffer the checks start, so
+// every alignment is tried
+#define ST_MAX_LENGTH 9000
+#define ST_MAX_OFFSET 32
+
+static unsigned char ST_data[ST_MAX_LENGTH + ST_MAX_OFFSET];
+static unsigned char ST_copy[ST_MAX_LENGTH + ST_MAX_OFFSET];
+static unsigned char ST_other[ST_MAX_LENGTH + ST_MAX_OFFSET];
+static unsigned long long ST_state = 0x9e3779b97f4a7c15ULL;
+static int ST_failures;
+
+// define prototypes for local routines
+static void ST_checkCrc (void);
+static void ST_checkCrc32c (const char *name,
+			    unsigned int (*kernel) (unsigned int reg,
+						    const unsigned char *buf,
+						    size_t length));
+static void ST_checkInet (void);
+static void ST_checkInetAdd (const char *name,
+			     unsigned long long (*add)
+			     (unsigned long long total,
+			      const unsigned char *buf, size_t length),
+			     unsigned long long (*copyAdd)
+			     (unsigned long long total, unsigned char *dst,
+			      const unsigned char *src, size_t length));
+static void ST_checkFec (void);
+static void ST_checkFecKernels (const char *name,
+				void (*addXor) (unsigned char *dst,
+					     const unsigned char *src,
+					     size_t length),
+				void (*mulAdd) (unsigned char *dst,
+						const unsigned char *src,
+						size_t length,
+						unsigned int coef));
+static void ST_checkEcc (void);
+static int ST_eccBit (int length, int size, int b);
+static unsigned int ST_crc8 (const unsigned char *buf, int length);
+static unsigned int ST_crc16 (const unsigned char *buf, int length);
+static unsigned int ST_crc32c (unsigned int reg, const unsigned char *buf,
+			       int length);
+static unsigned int ST_inetSum (const unsigned char *buf, int length);
+static unsigned int ST_gfMul (unsigned int a, unsigned int b);
+static void ST_report (const char *name, int ok);
+static unsigned int ST_random (void);
+static void ST_fill (unsigned char *buf, int length);
+
+int main (void)
+{
+  ST_fill (ST_data, sizeof(ST_data));
+  ST_checkCrc ();
+  ST_checkInet ();
+  ST_checkFec ();
+  ST_checkEcc ();
+
+  if (ST_failures) {
+    printf ("%d checks failed\n", ST_failures);
+    return 1;
+  }
+  printf ("all checks passed\n");
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkCrc
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkCrc (void)
+{
+  // the standard check values, every version of CRC-32C, and the public
+  // functions against the bitwise CRCs, whole and in two pieces
+  const unsigned char *check = (const unsigned char *)"123456789";
+  const unsigned char *p;
+  int ok = 1;
+  int length, offset, split;
+
+  ST_report ("crc check values",
+	     calcCRC (CRC_8, check, 9) == 0xf4 &&
+	     calcCRC (CRC_16, check, 9) == 0xd64e &&
+	     calcCRC (CRC_32C, check, 9) == 0xe3069283);
+
+  ST_checkCrc32c ("crc32c portable", CRC_slice32c);
+#ifdef CRC_X86
+  if (__builtin_cpu_supports ("sse4.2"))
+    ST_checkCrc32c ("crc32c sse4.2", CRC_sse42);
+  else
+    printf ("%-28s skipped\n", "crc32c sse4.2");
+  if (__builtin_cpu_supports ("sse4.2") && __builtin_cpu_supports ("pclmul"))
+    ST_checkCrc32c ("crc32c pclmul", CRC_pclmul);
+  else
+    printf ("%-28s skipped\n", "crc32c pclmul");
+#endif
+
+  for (length = 0; length <= 1100 && ok; length++)
+    for (offset = 0; offset < 8 && ok; offset++) {
+      p = ST_data + offset;
+      split = length / 3;
+      ok = calcCRC8 (0, p, length) == ST_crc8 (p, length) &&
+	calcCRC16 (0, p, length) == ST_crc16 (p, length) &&
+	calcCRC32C (0, p, length) == ~ST_crc32c (~0u, p, length) &&
+	calcCRC8 (calcCRC8 (0, p, split), p + split, length - split) ==
+	calcCRC8 (0, p, length) &&
+	calcCRC16 (calcCRC16 (0, p, split), p + split, length - split) ==
+	calcCRC16 (0, p, length) &&
+	calcCRC32C (calcCRC32C (0, p, split), p + split, length - split) ==
+	calcCRC32C (0, p, length);
+    }
+  ST_report ("crc public functions", ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkCrc32c
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkCrc32c (const char *name,
+			    unsigned int (*kernel) (unsigned int reg,
+						    const unsigned char *buf,
+						    size_t length))
+{
+  // every length up to past where the three stream version starts, every
+  // alignment, and some long buffers
+  static const int longer[] = { 2048, 3072, 4096, 6151, ST_MAX_LENGTH };
+  unsigned int reg;
+  int ok = 1;
+  int length, offset, i;
+
+  for (length = 1; length <= 1100 && ok; length++)
+    for (offset = 0; offset < 8 && ok; offset++) {
+      reg = ST_random ();
+      ok = kernel (reg, ST_data + offset, length) ==
+	ST_crc32c (reg, ST_data + offset, length);
+    }
+  for (i = 0; i < 5 && ok; i++)
+    for (offset = 0; offset < ST_MAX_OFFSET && ok; offset++)
+      ok = kernel (~0u, ST_data + offset, longer[i]) ==
+	ST_crc32c (~0u, ST_data + offset, longer[i]);
+  ST_report (name, ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkInet
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkInet (void)
+{
+  // every version of the sums, then sums of pieces and checksum updates
+  unsigned int sum, check, oldWord, newWord;
+  unsigned short word;
+  int ok = 1;
+  int length, split, at;
+
+  ST_checkInetAdd ("inet portable", INET_add, INET_copyAdd);
+#ifdef INET_X86
+  ST_checkInetAdd ("inet sse2", INET_addSse2, INET_copyAddSse2);
+  if (__builtin_cpu_supports ("avx2"))
+    ST_checkInetAdd ("inet avx2", INET_addAvx2, INET_copyAddAvx2);
+  else
+    printf ("%-28s skipped\n", "inet avx2");
+#endif
+
+  for (length = 1; length <= 1100 && ok; length++) {
+    ok = inetSum (0, ST_data, length) == ST_inetSum (ST_data, length) &&
+      inetChecksum (ST_data, length) ==
+      (~ST_inetSum (ST_data, length) & 0xffff) &&
+      inetCopySum (ST_copy, ST_data, length, 0) ==
+      ST_inetSum (ST_data, length) &&
+      !memcmp (ST_copy, ST_data, length);
+
+    // the second piece can start at an odd offset
+    for (split = 0; split <= length && ok; split += 1 + split / 8) {
+      sum = inetSum (0, ST_data, split);
+      sum = inetSumAt (sum, inetSum (0, ST_data + split, length - split),
+		       split);
+      ok = sum == ST_inetSum (ST_data, length);
+    }
+  }
+  ST_report ("inet sums of pieces", ok);
+
+  // change a word and update the checksum instead of adding it all up
+  // again.  0 and 0xffff are the same in one's complement.
+  ok = 1;
+  memcpy (ST_copy, ST_data, ST_MAX_LENGTH);
+  for (length = 2; length <= 1100 && ok; length += 2) {
+    at = 2 * (ST_random () % (length / 2));
+    check = inetChecksum (ST_copy, length);
+    memcpy (&word, ST_copy + at, 2);
+    oldWord = word;
+    newWord = ST_random () & 0xffff;
+    word = newWord;
+    memcpy (ST_copy + at, &word, 2);
+    ok = inetChecksumUpdate (check, oldWord, newWord) % 0xffff ==
+      inetChecksum (ST_copy, length) % 0xffff;
+  }
+  ST_report ("inet checksum updates", ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkInetAdd
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkInetAdd (const char *name,
+			     unsigned long long (*add)
+			     (unsigned long long total,
+			      const unsigned char *buf, size_t length),
+			     unsigned long long (*copyAdd)
+			     (unsigned long long total, unsigned char *dst,
+			      const unsigned char *src, size_t length))
+{
+  // every length and alignment of the source and destination
+  unsigned int sum;
+  int ok = 1;
+  int length, offset, to;
+
+  for (length = 1; length <= 600 && ok; length++)
+    for (offset = 0; offset < ST_MAX_OFFSET && ok; offset++) {
+      to = (offset * 7) % ST_MAX_OFFSET;
+      sum = ST_inetSum (ST_data + offset, length);
+      memset (ST_copy, 0, length + ST_MAX_OFFSET);
+      ok = INET_fold (add (0, ST_data + offset, length)) == sum &&
+	INET_fold (copyAdd (0, ST_copy + to, ST_data + offset, length)) ==
+	sum && !memcmp (ST_copy + to, ST_data + offset, length) &&
+	!ST_copy[to + length];
+    }
+  for (offset = 0; offset < ST_MAX_OFFSET && ok; offset++)
+    ok = INET_fold (add (0, ST_data + offset, ST_MAX_LENGTH)) ==
+      ST_inetSum (ST_data + offset, ST_MAX_LENGTH) &&
+      INET_fold (copyAdd (0, ST_copy, ST_data + offset, ST_MAX_LENGTH)) ==
+      ST_inetSum (ST_data + offset, ST_MAX_LENGTH);
+  ST_report (name, ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkFec
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkFec (void)
+{
+  // every version of the kernels, then lose up to FEC_MAX_REPAIR symbols
+  // of groups and rebuild them from as many repair symbols, picked at
+  // random
+  enum { numData = 20, length = 300 };
+  static unsigned char data[numData][length];
+  static unsigned char repairs[FEC_MAX_REPAIR][length];
+  static unsigned char sums[FEC_MAX_REPAIR][length];
+  static unsigned char rebuilt[FEC_MAX_REPAIR][length];
+  unsigned char *out[FEC_MAX_REPAIR], *in[FEC_MAX_REPAIR];
+  int lost[numData];
+  int index[FEC_MAX_REPAIR], repair[FEC_MAX_REPAIR];
+  int count, trial;
+  int ok = 1;
+  int i, j, k;
+
+  ST_checkFecKernels ("fec portable", FEC_xor, FEC_mulAdd);
+#ifdef FEC_X86
+  ST_checkFecKernels ("fec sse2/ssse3", FEC_xorSse2,
+		      __builtin_cpu_supports ("ssse3") ?
+		      FEC_mulAddSsse3 : FEC_mulAdd);
+  if (__builtin_cpu_supports ("avx2"))
+    ST_checkFecKernels ("fec avx2", FEC_xorAvx2, FEC_mulAddAvx2);
+  else
+    printf ("%-28s skipped\n", "fec avx2");
+#endif
+
+  ok = fecCoefficient (0, 0) == 1;
+  for (i = 0; i < numData && ok; i++)
+    ok = fecCoefficient (0, i) == 1;
+  ST_report ("fec parity coefficients", ok);
+
+  for (i = 0; i < numData; i++)
+    ST_fill (data[i], length);
+  memset (repairs, 0, sizeof(repairs));
+  for (j = 0; j < FEC_MAX_REPAIR; j++)
+    for (i = 0; i < numData; i++)
+      fecMulAdd (repairs[j], data[i], length, fecCoefficient (j, i));
+
+  for (trial = 0; trial < 2000 && ok; trial++) {
+    count = 1 + ST_random () % FEC_MAX_REPAIR;
+
+    // which data symbols are lost, and which repair symbols arrived
+    memset (lost, 0, sizeof(lost));
+    for (k = 0; k < count; ) {
+      i = ST_random () % numData;
+      if (!lost[i]) {
+	lost[i] = 1;
+	index[k++] = i;
+      }
+    }
+    for (k = 0; k < count; ) {
+      repair[k] = ST_random () % FEC_MAX_REPAIR;
+      for (j = 0; j < k && repair[j] != repair[k]; j++)
+	;
+      if (j == k)
+	k++;
+    }
+
+    // take the data that arrived back out of the repair symbols
+    for (k = 0; k < count; k++) {
+      memcpy (sums[k], repairs[repair[k]], length);
+      for (i = 0; i < numData; i++)
+	if (!lost[i])
+	  fecMulAdd (sums[k], data[i], length, fecCoefficient (repair[k], i));
+      in[k] = sums[k];
+      out[k] = rebuilt[k];
+    }
+    ok = fecSolve (out, in, repair, index, count, length) == 0;
+    for (k = 0; k < count && ok; k++)
+      ok = !memcmp (rebuilt[k], data[index[k]], length);
+  }
+  ST_report ("fec erasure recovery", ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkFecKernels
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkFecKernels (const char *name,
+				void (*addXor) (unsigned char *dst,
+					     const unsigned char *src,
+					     size_t length),
+				void (*mulAdd) (unsigned char *dst,
+						const unsigned char *src,
+						size_t length,
+						unsigned int coef))
+{
+  // every coefficient, and every length and alignment with a few of them
+  unsigned int coef;
+  int ok = 1;
+  int length, offset, i;
+
+  for (length = 1; length <= 300 && ok; length++)
+    for (offset = 0; offset < ST_MAX_OFFSET && ok; offset += 3) {
+      coef = length < 256 ? (unsigned int)length : ST_random () & 0xff;
+      ST_fill (ST_copy, length + ST_MAX_OFFSET);
+      memcpy (ST_other, ST_copy, length + ST_MAX_OFFSET);
+      mulAdd (ST_copy + 1, ST_data + offset, length, coef);
+      for (i = 0; i < length; i++)
+	ST_other[i + 1] ^= ST_gfMul (coef, ST_data[offset + i]);
+      ok = !memcmp (ST_copy, ST_other, length + ST_MAX_OFFSET);
+
+      addXor (ST_copy + 1, ST_data + offset, length);
+      for (i = 0; i < length; i++)
+	ST_other[i + 1] ^= ST_data[offset + i];
+      ok = ok && !memcmp (ST_copy, ST_other, length + ST_MAX_OFFSET);
+    }
+  for (coef = 0; coef < 256 && ok; coef++) {
+    memset (ST_copy, 0, 1500);
+    mulAdd (ST_copy, ST_data, 1500, coef);
+    for (i = 0; i < 1500 && ok; i++)
+      ok = ST_copy[i] == ST_gfMul (coef, ST_data[i]);
+  }
+  ST_report (name, ok);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_checkEcc
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_checkEcc (void)
+{
+  // a bit flipped in each of some codewords, check words included, is put
+  // right; two in one codeword are detected
+  static unsigned char packet[1500 + ECC_MAX_SIZE];
+  unsigned char flipped[64];
+  int corrected, numFlipped;
+  int length, size;
+  int trial, flips, b, at, at2, i;
+  int ok = 1, detected = 1;
+
+  for (trial = 0; trial < 3000 && ok; trial++) {
+    length = 1 + ST_random () % 1500;
+    size = length + eccSize (length);
+    ST_fill (packet, length);
+    eccEncode (packet, length);
+    memcpy (ST_copy, packet, size);
+
+    ok = eccLength (size) == length &&
+      eccDecode (packet, size, &corrected) == length && corrected == 0;
+
+    flips = ST_random () % 65;
+    numFlipped = 0;
+    memset (flipped, 0, sizeof(flipped));
+    for (i = 0; i < flips && ok; i++) {
+      b = ST_random () % 64;
+      at = ST_eccBit (length, size, b);
+      if (flipped[b] || at < 0)
+	continue;
+      flipped[b] = 1;
+      packet[at / 8] ^= 1 << (at % 8);
+      numFlipped++;
+    }
+    ok = ok && eccDecode (packet, size, &corrected) == length &&
+      corrected == numFlipped && !memcmp (packet, ST_copy, length);
+
+    // two in the same codeword.  The check words weren't put right.
+    memcpy (packet, ST_copy, size);
+    b = ST_random () % 64;
+    at = ST_eccBit (length, size, b);
+    at2 = ST_eccBit (length, size, b);
+    if (at >= 0 && at2 >= 0 && at != at2) {
+      packet[at / 8] ^= 1 << (at % 8);
+      packet[at2 / 8] ^= 1 << (at2 % 8);
+      if (eccDecode (packet, size, &corrected) >= 0)
+	detected = 0;
+    }
+  }
+  ST_report ("ecc corrects single errors", ok);
+  ST_report ("ecc detects double errors", detected);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_eccBit
+//
+///////////////////////////////////////////////////////////////////////////////
+static int ST_eccBit (int length, int size, int b)
+{
+  // a random bit of codeword b in a packet of length bytes, size with its
+  // check words, numbered from the start of the packet.  Bit b of every 64
+  // bit word of the data belongs to codeword b, and so does bit b of every
+  // check word, which start right after the data.  Returns -1 if the word
+  // picked doesn't reach that far.
+  int numWords = (length + 7) / 8;
+  int w, at;
+
+  w = ST_random () % (numWords + (size - length) / 8);
+  if (w < numWords)
+    at = 8 * (8 * w) + b;
+  else
+    at = 8 * (length + 8 * (w - numWords)) + b;
+  if (at / 8 >= (w < numWords ? length : size))
+    return -1;
+  return at;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_crc8
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_crc8 (const unsigned char *buf, int length)
+{
+  unsigned int reg = 0;
+  int i, j;
+
+  for (i = 0; i < length; i++) {
+    reg ^= buf[i];
+    for (j = 0; j < 8; j++)
+      reg = (reg & 0x80) ? ((reg << 1) ^ 0x07) & 0xff : (reg << 1) & 0xff;
+  }
+  return reg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_crc16
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_crc16 (const unsigned char *buf, int length)
+{
+  unsigned int reg = 0xffff;
+  int i, j;
+
+  for (i = 0; i < length; i++) {
+    reg ^= buf[i] << 8;
+    for (j = 0; j < 8; j++)
+      reg = (reg & 0x8000) ? ((reg << 1) ^ 0x1021) & 0xffff :
+	(reg << 1) & 0xffff;
+  }
+  return reg ^ 0xffff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_crc32c
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_crc32c (unsigned int reg, const unsigned char *buf,
+			       int length)
+{
+  // the register, without the initial value and final xor
+  int i, j;
+
+  for (i = 0; i < length; i++) {
+    reg ^= buf[i];
+    for (j = 0; j < 8; j++)
+      reg = (reg & 1) ? (reg >> 1) ^ 0x82f63b78 : reg >> 1;
+  }
+  return reg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_inetSum
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_inetSum (const unsigned char *buf, int length)
+{
+  // 16 bits at a time as they are in memory (little endian here), the
+  // last byte padded with a zero
+  unsigned int sum = 0;
+  int i;
+
+  for (i = 0; i + 1 < length; i += 2) {
+    sum += buf[i] | buf[i + 1] << 8;
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  if (length & 1) {
+    sum += buf[length - 1];
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_gfMul
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_gfMul (unsigned int a, unsigned int b)
+{
+  // shift and add, reducing by x^8 + x^4 + x^3 + x^2 + 1
+  unsigned int product = 0;
+
+  while (b) {
+    if (b & 1)
+      product ^= a;
+    b >>= 1;
+    a <<= 1;
+    if (a & 0x100)
+      a ^= 0x11d;
+  }
+  return product;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_report
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_report (const char *name, int ok)
+{
+  printf ("%-28s %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok)
+    ST_failures++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_random
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned int ST_random (void)
+{
+  // xorshift64*, with a fixed seed so every run checks the same things
+  ST_state ^= ST_state >> 12;
+  ST_state ^= ST_state << 25;
+  ST_state ^= ST_state >> 27;
+  return (ST_state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// ST_fill
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ST_fill (unsigned char *buf, int length)
+{
+  int i;
+
+  for (i = 0; i < length; i++)
+    buf[i] = ST_random ();
+}
@@ -6,14 +6,24 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <string.h>
-#include <stdlib.h>  // exit
-#include <time.h>    //time
+#include <stdlib.h>  // exit, strtoull
+#include <time.h>    // clock_gettime
+#include <unistd.h>  // getopt
 #include "ABP.h"
+#include "fileTransfer.h"
 #include "unreliableSend.h"
+#include "trace.h"
 
 #define SERVER_PORT 50000
 #define MAX_LINE 1024
 
+// seconds from a clock that never goes backwards, to time transfers with
+double monotonicSeconds (void){
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 char* readString (char *buf,int len){
   char *s;
   while ((s=fgets(buf,len,stdin))==0 && !feof(stdin));
@@ -30,16 +40,80 @@ int main (int argc, char *argv[]) {
   int packetPlace;
   int len;
   int ilen;
-  int startTime, endTime, totalTime;
+  double startTime, endTime, totalTime;
+  char *file = 0;
+  long long offset = 0;
+  int group = 0, minRepair, maxRepair;
+  int opt;
+
+  // -f sends a file instead of the test pattern, starting -o bytes into
+  // it to resume a transfer.  -s sends packets of up to that many bytes of
+  // data, if the receiver takes them.  -F adds repair packets to every
+  // group of that many packets (between minRepair, 1 by default, and
+  // maxRepair, minRepair by default) for a receiver started with -F.  -E
+  // adds check words to correct bit errors, for a receiver started with -E.
+  // -S seeds the unreliable network, so it loses the same packets each run.
+  // -C keeps the protocol's counts in that shared memory object, for
+  // abpstat to watch.  -T records what happens to every packet in that
+  // trace file, for abptrace.
+  while ((opt = getopt (argc, argv, "f:o:s:F:ES:C:T:")) != -1) {
+    if (opt == 'f')
+      file = optarg;
+    else if (opt == 'o')
+      offset = atoll (optarg);
+    else if (opt == 's') {
+      if (ABP_setPayloadSize (atoi (optarg)) < 0)
+	exit (1);
+    }
+    else if (opt == 'F') {
+      minRepair = 1;
+      maxRepair = 0;
+      if (sscanf (optarg, "%d,%d,%d", &group, &minRepair, &maxRepair) < 1) {
+	printf ("sender: -F takes group[,minRepair[,maxRepair]]\n");
+	exit (1);
+      }
+      if (maxRepair < minRepair)
+	maxRepair = minRepair;
+      if (ABP_setFec (group, minRepair, maxRepair) < 0)
+	exit (1);
+    }
+    else if (opt == 'E') {
+      if (ABP_setEcc (1) < 0)
+	exit (1);
+    }
+    else if (opt == 'S')
+      US_SetSeed (strtoull (optarg, 0, 0));
+    else if (opt == 'C') {
+      if (ABP_setSharedCounters (optarg) < 0)
+	exit (1);
+    }
+    else if (opt == 'T') {
+      if (TR_open (optarg, 0) < 0)
+	exit (1);
+      atexit (TR_close);
+    }
+    else
+      argc = 0;
+  }
+  argv += optind - 1;
+  argc -= optind - 1;
 
-  if (argc==2) {
+  if (argc>=2 && argc<=4) {
     host = argv[1];
   }
   else {
-    perror("usage: client <hostname>");
+    perror("usage: client [-f file [-o offset]] [-s payloadSize] "
+	   "[-F group[,minRepair[,maxRepair]]] [-E] [-S seed] [-C name] "
+	   "[-T traceFile] <hostname> [windowSize [gbn|sr]]");
     exit (1);
   }
 
+  // optionally use a sliding window instead of the alternating bit protocol
+  if (argc>=3 && ABP_setWindow(atoi(argv[2]),
+			       argc==4 && !strcmp(argv[3],"sr") ?
+			       ABP_SELECTIVE_REPEAT : ABP_GO_BACK_N)<0)
+    exit (1);
+
   // initialize stopwait send
   if(ABP_sendInit(host,SERVER_PORT)){
     printf("sendInit Failed\n");
@@ -49,7 +123,15 @@ int main (int argc, char *argv[]) {
   // set failure probability of outgoing packets
   US_SetFailureProb (5);
 
-  startTime = time(NULL); 
+  startTime = monotonicSeconds(); 
+
+  if (file) {
+    if (FT_sendFile (file, offset) < 0)
+      exit (1);
+    printf ("The transfer took %.3f seconds\n",
+	    monotonicSeconds() - startTime);
+    return 0;
+  }
 
   printf("Control D terminates \n");
   // main loop get and send lines of text
@@ -71,11 +153,11 @@ int main (int argc, char *argv[]) {
   // now wait for all mesages to arrive
   ABP_flush();
 
-  endTime = time(NULL);
+  endTime = monotonicSeconds();
   totalTime = endTime - startTime;
   
   printf ("All data has been successfully received!\n");
-  printf ("The transfer took %i seconds\n", totalTime );
+  printf ("The transfer took %.3f seconds\n", totalTime );
 
 }
 
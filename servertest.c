@@ -0,0 +1,262 @@
+//
+// File: servertest.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: checks that a sharded server (see ABPServer.h) hands over
+// messages whose fragments arrive interleaved with another sender's.  Two
+// senders with a window of 1 each send a message of several fragments to
+// a server with one worker over loopback, so the worker's queue holds a
+// fragment of one, then a fragment of the other, and so on.  Both messages
+// must reach the handler intact.  Then one sender goes away after its
+// first fragment, while the other's message arrives whole after it: that
+// message must still reach the handler, and the server must still stop.
+//
+// usage: servertest
+//
+// It prints what it checked and exits with status 1 if anything was
+// wrong, or if the server doesn't stop.  "make check" runs it.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // alarm
+#include "ABP.h"
+#include "ABPServer.h"
+
+// where the server listens
+#define SV_PORT 50010
+
+// the senders' messages are this many fragments long
+#define SV_FRAGMENTS 3
+#define SV_LENGTH (SV_FRAGMENTS * 1024 - 100)
+
+// how long a check waits for the handler (msecs), and for the whole
+// program before giving up on a server that won't stop (secs)
+#define SV_WAIT_MSECS  5000
+#define SV_ALARM_SECS  30
+
+// the senders, and what the handler got from each
+#define SV_SENDERS 2
+static ABP_session *SV_senders[SV_SENDERS];
+static int SV_received[SV_SENDERS];
+static int SV_damaged;
+static int SV_failures;
+
+// define prototypes for local routines
+static void SV_handler (int worker, char *buf, int length,
+			struct sockaddr_in *fromAddr, void *arg);
+static int SV_checkInterleaved (void);
+static int SV_checkAbandoned (void);
+static ABP_session *SV_open (void);
+static void SV_fill (char *buf, int length, int sender);
+static int SV_wait (int numMessages);
+static long long SV_now (void);
+static void SV_report (const char *name, int ok);
+
+int main (void)
+{
+  // a server that can't stop would hang "make check", so give up on it
+  alarm (SV_ALARM_SECS);
+
+  SV_report ("interleaved fragments", SV_checkInterleaved ());
+  SV_report ("sender gone part way", SV_checkAbandoned ());
+
+  if (SV_failures) {
+    printf ("%d checks failed\n", SV_failures);
+    return 1;
+  }
+  printf ("all checks passed\n");
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_checkInterleaved
+//
+///////////////////////////////////////////////////////////////////////////////
+static int SV_checkInterleaved (void)
+{
+  // both senders send a message, a fragment at a time, and wait until the
+  // handler has both
+  static char buf[SV_SENDERS][SV_LENGTH];
+  ABP_server *server;
+  int i, ok;
+
+  memset (SV_received, 0, sizeof(SV_received));
+  SV_damaged = 0;
+  server = ABP_serverStart (SV_PORT, 1, 1, ABP_GO_BACK_N, SV_handler, 0);
+  if (!server)
+    return 0;
+  for (i = 0; i < SV_SENDERS; i++) {
+    SV_senders[i] = SV_open ();
+    SV_fill (buf[i], SV_LENGTH, i);
+    if (!SV_senders[i] ||
+	ABP_sessionSendAsync (SV_senders[i], buf[i], SV_LENGTH,
+			      ABP_SEND_NOCOPY, 0) < 0) {
+      ABP_serverStop (server);
+      return 0;
+    }
+  }
+
+  ok = SV_wait (SV_SENDERS) && SV_received[0] == 1 && SV_received[1] == 1;
+  for (i = 0; i < SV_SENDERS; i++)
+    ABP_close (SV_senders[i]);
+  ABP_serverStop (server);
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_checkAbandoned
+//
+///////////////////////////////////////////////////////////////////////////////
+static int SV_checkAbandoned (void)
+{
+  // the first sender sends only its first fragment before it goes away,
+  // and the second sends a message of one packet after it.  The handler
+  // must get the second one without the rest of the first.
+  static char buf[SV_SENDERS][SV_LENGTH];
+  ABP_server *server;
+  int ok;
+
+  memset (SV_received, 0, sizeof(SV_received));
+  SV_damaged = 0;
+  server = ABP_serverStart (SV_PORT, 1, 1, ABP_GO_BACK_N, SV_handler, 0);
+  if (!server)
+    return 0;
+  SV_senders[0] = SV_open ();
+  SV_senders[1] = SV_open ();
+  SV_fill (buf[0], SV_LENGTH, 0);
+  SV_fill (buf[1], 100, 1);
+  if (!SV_senders[0] || !SV_senders[1] ||
+      ABP_sessionSendAsync (SV_senders[0], buf[0], SV_LENGTH,
+			    ABP_SEND_NOCOPY, 0) < 0 ||
+      ABP_sessionSendAsync (SV_senders[1], buf[1], 100, 0, 0) < 0) {
+    ABP_serverStop (server);
+    return 0;
+  }
+  ABP_close (SV_senders[0]);
+  SV_senders[0] = 0;
+
+  ok = SV_wait (1) && SV_received[0] == 0 && SV_received[1] == 1;
+  ABP_close (SV_senders[1]);
+  ABP_serverStop (server);
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_handler
+//
+///////////////////////////////////////////////////////////////////////////////
+static void SV_handler (int worker, char *buf, int length,
+			struct sockaddr_in *fromAddr, void *arg)
+{
+  // count the message for the sender it says it's from, if it's intact
+  static char expected[SV_LENGTH];
+  int sender = length > 0 ? buf[0] : -1;
+
+  (void)worker;
+  (void)fromAddr;
+  (void)arg;
+  if (sender < 0 || sender >= SV_SENDERS) {
+    __atomic_store_n (&SV_damaged, 1, __ATOMIC_RELEASE);
+    return;
+  }
+  SV_fill (expected, length, sender);
+  if (memcmp (buf, expected, length) != 0)
+    __atomic_store_n (&SV_damaged, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch (&SV_received[sender], 1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_open
+//
+///////////////////////////////////////////////////////////////////////////////
+static ABP_session *SV_open (void)
+{
+  // a sender with a window of 1, so its fragments go one at a time, driven
+  // by SV_wait
+  ABP_session *s = ABP_open ();
+
+  if (!s)
+    return 0;
+  if (ABP_sessionSetBackend (s, ABP_BACKEND_EPOLL) < 0 ||
+      ABP_sessionSendInit (s, "localhost", SV_PORT) < 0) {
+    ABP_close (s);
+    return 0;
+  }
+  return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_fill
+//
+///////////////////////////////////////////////////////////////////////////////
+static void SV_fill (char *buf, int length, int sender)
+{
+  // the first byte says which sender it's from, and the rest depend on it
+  int i;
+
+  for (i = 0; i < length; i++)
+    buf[i] = i == 0 ? sender : (char)(i * 7 + sender * 31);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_wait
+//
+///////////////////////////////////////////////////////////////////////////////
+static int SV_wait (int numMessages)
+{
+  // run the senders that are left until the handler has numMessages
+  // messages, or it's taking too long.  Returns nonzero if it has them
+  // all and they were intact.
+  long long deadline = SV_now () + SV_WAIT_MSECS;
+  int i, total;
+
+  for (;;) {
+    total = 0;
+    for (i = 0; i < SV_SENDERS; i++)
+      total += __atomic_load_n (&SV_received[i], __ATOMIC_ACQUIRE);
+    if (total >= numMessages)
+      return !__atomic_load_n (&SV_damaged, __ATOMIC_ACQUIRE);
+    if (SV_now () > deadline)
+      return 0;
+    for (i = 0; i < SV_SENDERS; i++)
+      if (SV_senders[i])
+	ABP_sessionProcess (SV_senders[i], 5);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_now
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long SV_now (void)
+{
+  // CLOCK_MONOTONIC in msecs
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SV_report
+//
+///////////////////////////////////////////////////////////////////////////////
+static void SV_report (const char *name, int ok)
+{
+  // flushed, so what was checked shows even if the alarm goes off later
+  printf ("%-28s %s\n", name, ok ? "ok" : "FAILED");
+  fflush (stdout);
+  if (!ok)
+    SV_failures++;
+}
@@ -0,0 +1,473 @@
+//
+// File: trace.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the packet event trace defined in trace.h.
+//
+// Each thread claims a ring the first time it records an event.  The
+// rings are set aside together when tracing starts, as one mapping whose
+// pages are only touched once they're used, so claiming one is a single
+// atomic add and works in a signal handler.  A ring has a single producer
+// (its thread) and a single consumer (the background thread), so neither
+// needs a lock.
+//
+// On x86 events are timed with the time stamp counter, which takes a few
+// nanoseconds to read where clock_gettime takes tens.  The background
+// thread turns counts into CLOCK_MONOTONIC nsecs as it writes the events
+// out, at the rate measured since tracing started.
+//
+
+#define _GNU_SOURCE     // MAP_NORESERVE
+#include <pthread.h>
+#include <signal.h>     // sigfillset
+#include <stdio.h>
+#include <stdlib.h>     // calloc, free
+#include <string.h>     // memcmp, memcpy
+#include <sys/mman.h>   // mmap
+#include <time.h>       // clock_gettime, nanosleep
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc
+#endif
+#include "trace.h"
+
+// events a ring holds unless TR_open says otherwise
+#define TR_DEFAULT_RING 65536
+
+// how often the background thread writes the rings out (msecs), and how
+// many events it copies out of a ring at a time
+#define TR_FLUSH_MSECS 10
+#define TR_FLUSH_BATCH 256
+
+// how long TR_open times the time stamp counter for (usecs), before the
+// background thread has had longer
+#define TR_CALIBRATE_USECS 2000
+
+// a trace file starts with a header, followed by the events
+#define TR_MAGIC "ABPTRACE"
+#define TR_VERSION 1
+
+struct TR_fileHeader {
+  char magic[8];                // TR_MAGIC
+  unsigned int version;         // TR_VERSION
+  unsigned int eventSize;       // sizeof(struct TR_event)
+  long long realtimeOffset;     // CLOCK_REALTIME - CLOCK_MONOTONIC (nsecs)
+};
+
+// one thread's events, from tail up to head.  Events in the ring hold the
+// clock's count in time, not nsecs.  Only the thread writes head, tailSeen
+// and lost, and only the background thread tail; they're kept on separate
+// cache lines so each doesn't slow the other down.
+struct TR_ring {
+  struct TR_event *events;
+  unsigned int head;
+  unsigned int tailSeen;        // the tail when the thread last looked, so
+				// it needn't look every event
+  unsigned long long lost;
+  unsigned int tail __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64)));
+
+struct TR_reader {
+  FILE *fp;
+  struct TR_fileHeader header;
+};
+
+// define state variables
+
+int TR_active;
+
+static struct TR_ring TR_rings[TR_MAX_THREADS];
+static struct TR_event *TR_ringEvents;
+static size_t TR_ringBytes;
+static unsigned int TR_ringSize;     // a power of 2
+
+// rings claimed so far.  TR_generation changes every time tracing starts,
+// so threads know to claim a new ring.
+static unsigned int TR_numRings;
+static unsigned int TR_generation;
+static unsigned long long TR_lostThreads;
+
+// the trace file and the background thread writing to it
+static FILE *TR_file;
+static pthread_t TR_flusher;
+static int TR_stopping;
+static unsigned long long TR_recorded;
+
+// the clock's count and CLOCK_MONOTONIC when tracing started, and how many
+// nsecs a count is
+static unsigned long long TR_startTicks;
+static long long TR_startNsecs;
+static double TR_nsecsPerTick;
+
+// the ring of the calling thread, and the generation it belongs to
+static __thread int TR_myRing = -1;
+static __thread unsigned int TR_myGeneration;
+
+static const char *TR_typeNames[TR_NUM_TYPES] = {
+  "send", "retransmit", "ack", "timeout", "checksum", "recv", "ack-sent",
+  "overrun", "garble",
+};
+
+// define prototypes for local routines
+static void *TR_flush (void *arg);
+static void TR_drain (void);
+static void TR_calibrate (void);
+static unsigned long long TR_ticks (void);
+static long long TR_nsecs (clockid_t clock);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_open
+//
+///////////////////////////////////////////////////////////////////////////////
+int TR_open (const char *path, int ringEvents)
+{
+  struct TR_fileHeader header;
+  struct timespec pause = { 0, TR_CALIBRATE_USECS * 1000 };
+  sigset_t blocked, mask;
+  int error;
+  int i;
+
+  if (TR_file) {
+    printf ("TR_open: already tracing\n");
+    return -1;
+  }
+  if (ringEvents < 0) {
+    printf ("TR_open: rings can't hold a negative number of events\n");
+    return -1;
+  }
+
+  // rings hold a power of 2 events so their indexes can wrap
+  if (ringEvents == 0)
+    ringEvents = TR_DEFAULT_RING;
+  for (TR_ringSize = 1; TR_ringSize < (unsigned int)ringEvents;
+       TR_ringSize <<= 1)
+    ;
+  TR_ringBytes = (size_t)TR_MAX_THREADS * TR_ringSize *
+    sizeof(struct TR_event);
+  TR_ringEvents = mmap (0, TR_ringBytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (TR_ringEvents == MAP_FAILED) {
+    perror ("TR_open: mmap");
+    return -1;
+  }
+  for (i = 0; i < TR_MAX_THREADS; i++) {
+    TR_rings[i].events = TR_ringEvents + (size_t)i * TR_ringSize;
+    TR_rings[i].head = TR_rings[i].tail = TR_rings[i].tailSeen = 0;
+    TR_rings[i].lost = 0;
+  }
+  TR_numRings = 0;
+  TR_lostThreads = 0;
+  TR_recorded = 0;
+
+  TR_file = fopen (path, "wb");
+  if (!TR_file) {
+    perror (path);
+    munmap (TR_ringEvents, TR_ringBytes);
+    return -1;
+  }
+
+  // time the clock for a moment, so the first events come out right
+  TR_startNsecs = TR_nsecs (CLOCK_MONOTONIC);
+  TR_startTicks = TR_ticks ();
+  TR_nsecsPerTick = 1;
+  nanosleep (&pause, 0);
+  TR_calibrate ();
+
+  memcpy (header.magic, TR_MAGIC, sizeof(header.magic));
+  header.version = TR_VERSION;
+  header.eventSize = sizeof(struct TR_event);
+  header.realtimeOffset = TR_nsecs (CLOCK_REALTIME) -
+    TR_nsecs (CLOCK_MONOTONIC);
+  if (fwrite (&header, sizeof(header), 1, TR_file) != 1) {
+    perror ("TR_open: fwrite");
+    fclose (TR_file);
+    TR_file = 0;
+    munmap (TR_ringEvents, TR_ringBytes);
+    return -1;
+  }
+
+  // the background thread starts with every signal blocked, so the
+  // protocol's SIGIO and SIGALRM are still handled by its own thread
+  TR_stopping = 0;
+  sigfillset (&blocked);
+  pthread_sigmask (SIG_SETMASK, &blocked, &mask);
+  error = pthread_create (&TR_flusher, 0, TR_flush, 0);
+  pthread_sigmask (SIG_SETMASK, &mask, 0);
+  if (error != 0) {
+    printf ("TR_open: pthread_create error\n");
+    fclose (TR_file);
+    TR_file = 0;
+    munmap (TR_ringEvents, TR_ringBytes);
+    return -1;
+  }
+
+  // threads that recorded events before claim new rings
+  __atomic_store_n (&TR_generation, TR_generation + 1, __ATOMIC_RELEASE);
+  __atomic_store_n (&TR_active, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_close
+//
+///////////////////////////////////////////////////////////////////////////////
+void TR_close (void)
+{
+  if (!TR_file)
+    return;
+
+  // stop the background thread and write out whatever it left
+  __atomic_store_n (&TR_active, 0, __ATOMIC_RELEASE);
+  __atomic_store_n (&TR_stopping, 1, __ATOMIC_RELEASE);
+  pthread_join (TR_flusher, 0);
+  TR_drain ();
+  fclose (TR_file);
+  TR_file = 0;
+  munmap (TR_ringEvents, TR_ringBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_record
+//
+///////////////////////////////////////////////////////////////////////////////
+void TR_record (int type, int detail, int flow, unsigned int packetNum,
+		int length, unsigned int value)
+{
+  struct TR_ring *ring;
+  struct TR_event *event;
+  unsigned int head;
+  unsigned int generation;
+
+  // claim a ring the first time, or the first time since tracing started
+  // again
+  generation = __atomic_load_n (&TR_generation, __ATOMIC_ACQUIRE);
+  if (TR_myGeneration != generation) {
+    TR_myRing = __atomic_fetch_add (&TR_numRings, 1, __ATOMIC_RELAXED);
+    TR_myGeneration = generation;
+  }
+  if (TR_myRing >= TR_MAX_THREADS) {
+    __atomic_fetch_add (&TR_lostThreads, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  ring = &TR_rings[TR_myRing];
+
+  head = ring->head;
+  if (head - ring->tailSeen >= TR_ringSize) {
+    ring->tailSeen = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - ring->tailSeen >= TR_ringSize) {
+      __atomic_store_n (&ring->lost, ring->lost + 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  event = &ring->events[head & (TR_ringSize - 1)];
+  event->time = TR_ticks ();
+  event->packetNum = packetNum;
+  event->value = value;
+  event->flow = flow;
+  event->length = length;
+  event->type = type;
+  event->detail = detail;
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_getStats
+//
+///////////////////////////////////////////////////////////////////////////////
+void TR_getStats (struct TR_stats *stats)
+{
+  unsigned int numRings;
+  unsigned int i;
+
+  stats->recorded = __atomic_load_n (&TR_recorded, __ATOMIC_RELAXED);
+  stats->lost = __atomic_load_n (&TR_lostThreads, __ATOMIC_RELAXED);
+  numRings = __atomic_load_n (&TR_numRings, __ATOMIC_RELAXED);
+  for (i = 0; i < numRings && i < TR_MAX_THREADS; i++)
+    stats->lost += __atomic_load_n (&TR_rings[i].lost, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_flush
+//
+///////////////////////////////////////////////////////////////////////////////
+static void *TR_flush (void *arg)
+{
+  // the background thread: write the rings out every few msecs until
+  // tracing stops
+  struct timespec pause = { 0, TR_FLUSH_MSECS * 1000000 };
+
+  (void)arg;
+  while (!__atomic_load_n (&TR_stopping, __ATOMIC_ACQUIRE)) {
+    nanosleep (&pause, 0);
+    TR_drain ();
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_drain
+//
+///////////////////////////////////////////////////////////////////////////////
+static void TR_drain (void)
+{
+  // write every ring's events out, turning their times into nsecs
+  struct TR_event batch[TR_FLUSH_BATCH];
+  struct TR_ring *ring;
+  unsigned int numRings;
+  unsigned int head, tail;
+  int n;
+  unsigned int i;
+
+  TR_calibrate ();
+  numRings = __atomic_load_n (&TR_numRings, __ATOMIC_RELAXED);
+  for (i = 0; i < numRings && i < TR_MAX_THREADS; i++) {
+    ring = &TR_rings[i];
+    head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+    while (tail != head) {
+      for (n = 0; n < TR_FLUSH_BATCH && tail != head; n++, tail++) {
+	batch[n] = ring->events[tail & (TR_ringSize - 1)];
+	batch[n].time = TR_startNsecs + (long long)
+	  ((double)(long long)(batch[n].time - TR_startTicks) *
+	   TR_nsecsPerTick);
+	batch[n].thread = i;
+      }
+      // the thread can reuse the slots once they've been copied
+      __atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+      if (fwrite (batch, sizeof(batch[0]), n, TR_file) != (size_t)n)
+	perror ("TR_drain: fwrite");
+      __atomic_store_n (&TR_recorded, TR_recorded + n, __ATOMIC_RELAXED);
+    }
+  }
+  fflush (TR_file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_calibrate
+//
+///////////////////////////////////////////////////////////////////////////////
+static void TR_calibrate (void)
+{
+  // measure the clock's rate over everything since tracing started.  The
+  // longer that is, the less reading the clocks a little apart matters.
+#if defined(__x86_64__) || defined(__i386__)
+  long long nsecs = TR_nsecs (CLOCK_MONOTONIC);
+  unsigned long long ticks = TR_ticks ();
+
+  if (ticks != TR_startTicks)
+    TR_nsecsPerTick = (double)(nsecs - TR_startNsecs) /
+      (double)(ticks - TR_startTicks);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_ticks
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long TR_ticks (void)
+{
+  // the time stamp counter where there is one, and nsecs where there isn't
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  return TR_nsecs (CLOCK_MONOTONIC);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_nsecs
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long TR_nsecs (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_readOpen
+//
+///////////////////////////////////////////////////////////////////////////////
+TR_reader *TR_readOpen (const char *path)
+{
+  TR_reader *r;
+
+  r = calloc (1, sizeof(*r));
+  if (!r) {
+    perror ("TR_readOpen: calloc");
+    return 0;
+  }
+  r->fp = fopen (path, "rb");
+  if (!r->fp) {
+    perror (path);
+    free (r);
+    return 0;
+  }
+  if (fread (&r->header, sizeof(r->header), 1, r->fp) != 1 ||
+      memcmp (r->header.magic, TR_MAGIC, sizeof(r->header.magic)) ||
+      r->header.version != TR_VERSION ||
+      r->header.eventSize != sizeof(struct TR_event)) {
+    printf ("TR_readOpen: %s isn't a trace file\n", path);
+    fclose (r->fp);
+    free (r);
+    return 0;
+  }
+  return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_read
+//
+///////////////////////////////////////////////////////////////////////////////
+int TR_read (TR_reader *r, struct TR_event *event)
+{
+  return fread (event, sizeof(*event), 1, r->fp) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_readRealtimeOffset
+//
+///////////////////////////////////////////////////////////////////////////////
+long long TR_readRealtimeOffset (TR_reader *r)
+{
+  return r->header.realtimeOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_readClose
+//
+///////////////////////////////////////////////////////////////////////////////
+void TR_readClose (TR_reader *r)
+{
+  if (!r)
+    return;
+  fclose (r->fp);
+  free (r);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TR_typeName
+//
+///////////////////////////////////////////////////////////////////////////////
+const char *TR_typeName (int type)
+{
+  if (type < 0 || type >= TR_NUM_TYPES)
+    return "unknown";
+  return TR_typeNames[type];
+}
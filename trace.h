@@ -0,0 +1,153 @@
+//
+// File: trace.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: records what happens to packets as it happens, cheaply
+// enough to leave on while measuring.  Each event (a packet sent or resent,
+// an ack received, a timeout, a packet found damaged, what the unreliable
+// network did to a packet, ...) is written with a nanosecond timestamp to
+// a ring belonging to the thread that recorded it, and a background thread
+// writes the rings out to a trace file.  Recording an event takes no locks
+// and no system calls; while tracing is off it costs a test of TR_active.
+// The following functions are defined:
+//
+//    TR_open (const char *path, int ringEvents)
+//    TR_close (void)
+//    TR_record (int type, int detail, int flow, unsigned int packetNum,
+//               int length, unsigned int value)
+//    TR_getStats (struct TR_stats *stats)
+//    TR_readOpen (const char *path)
+//    TR_read (TR_reader *r, struct TR_event *event)
+//    TR_readRealtimeOffset (TR_reader *r)
+//    TR_readClose (TR_reader *r)
+//    TR_typeName (int type)
+//
+// abptrace turns traces into pcap-ng files for Wireshark and the like,
+// time-sequence graphs and per-packet latencies.
+//
+// Programs using trace.o must also link with -lpthread.
+//
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// kinds of event.  packetNum is the sender's number for the packet (they
+// count from 0 from its first packet), and flow the port the data is sent
+// to, so a sender's and its receiver's traces can be matched up.
+#define TR_SEND         0   // a new data packet; value is the cwnd
+#define TR_RETRANSMIT   1   // a data packet resent; value is the cwnd
+#define TR_ACK          2   // an ack for packets before packetNum + 1;
+			    // value is the receiver's room (packets) and
+			    // detail one of TR_ACK_*
+#define TR_TIMEOUT      3   // packetNum timed out; value is the new rto
+			    // (usecs)
+#define TR_CHECKSUM     4   // a packet was damaged; detail says what kind
+#define TR_RECV         5   // a data packet arrived; detail is one of
+			    // TR_RECV_* and value the sender's port
+#define TR_ACK_SENT     6   // an ack for packets before packetNum + 1;
+			    // value is the room advertised
+#define TR_OVERRUN      7   // packetNum arrived with the queue full;
+			    // value is the sender's port
+#define TR_GARBLE       8   // the unreliable network did detail (one of
+			    // TR_GARBLE_*) to a packet of length bytes
+#define TR_NUM_TYPES    9
+
+// TR_ACK details
+#define TR_ACK_NEW       0   // acknowledges more than the last
+#define TR_ACK_DUPLICATE 1   // repeats the last
+#define TR_ACK_STALE     2   // older than the last; arrived late
+
+// TR_CHECKSUM details
+#define TR_PACKET_DATA   0
+#define TR_PACKET_ACK    1
+#define TR_PACKET_REPAIR 2
+
+// TR_RECV details
+#define TR_RECV_WINDOW    0  // in the receive window
+#define TR_RECV_DUPLICATE 1  // passed on already
+#define TR_RECV_BEYOND    2  // past the end of the window
+
+// TR_GARBLE details
+#define TR_GARBLE_DROP   0
+#define TR_GARBLE_BURST  1   // value bytes set to 1s
+#define TR_GARBLE_BITS   2   // value bits flipped
+
+// one event, as it's kept in a trace file
+struct TR_event {
+  unsigned long long time;  // nsecs on CLOCK_MONOTONIC
+  unsigned int packetNum;
+  unsigned int value;       // depends on the type
+  unsigned short flow;      // port the data is sent to
+  unsigned short length;    // bytes of data
+  unsigned char type;       // TR_*
+  unsigned char detail;     // depends on the type
+  unsigned short thread;    // which thread recorded it
+};
+
+// whether events are being recorded.  Only read it; it's here so checking
+// costs no more than a load.
+extern int TR_active;
+
+// record an event if tracing is on
+#define TR_EVENT(type, detail, flow, packetNum, length, value) \
+  do { \
+    if (TR_active) \
+      TR_record (type, detail, flow, packetNum, length, value); \
+  } while (0)
+
+int TR_open (const char *path, int ringEvents);
+// starts tracing to the file path.  Each thread that records events gets a
+// ring of ringEvents of them (rounded up to a power of 2; 0 means 65536),
+// which the background thread empties every few milliseconds.  Events
+// recorded while a thread's ring is full are lost, and counted.  Up to
+// TR_MAX_THREADS threads can record events.
+//
+// A negative return value indicates an error.
+
+#define TR_MAX_THREADS 64
+
+void TR_close (void);
+// stops tracing and writes out the events still in the rings.  Threads
+// recording events must be done before it's called.
+
+void TR_record (int type, int detail, int flow, unsigned int packetNum,
+		int length, unsigned int value);
+// records an event, with the time, in the calling thread's ring.  A thread
+// records its events one at a time: they mustn't be recorded from a signal
+// handler that may have interrupted the same thread recording another (the
+// protocol blocks its signals while it works, so it never does).
+
+// how tracing went
+struct TR_stats {
+  unsigned long long recorded;  // events written to the file
+  unsigned long long lost;      // events recorded while a ring was full,
+				// or by a thread one too many
+};
+
+void TR_getStats (struct TR_stats *stats);
+// copies the counts since TR_open to stats.
+
+// reading trace files back
+typedef struct TR_reader TR_reader;
+
+TR_reader *TR_readOpen (const char *path);
+// opens the trace file path for TR_read.
+//
+// A return value of 0 indicates an error.
+
+int TR_read (TR_reader *r, struct TR_event *event);
+// reads the next event from r.  Events are in order of time for each
+// thread, but the threads' events are interleaved only roughly.
+//
+// Returns 1 if an event was read and 0 at the end of the file.
+
+long long TR_readRealtimeOffset (TR_reader *r);
+// returns how far CLOCK_REALTIME was ahead of CLOCK_MONOTONIC when the
+// trace was made (nsecs), to turn its times into times of day.
+
+void TR_readClose (TR_reader *r);
+// closes r.
+
+const char *TR_typeName (int type);
+// returns the name of an event type, such as "send".
+#endif
@@ -6,30 +6,169 @@
 // Description: Implementation of functions that implement an unreliable
 // UDP connection.
 //
-#include <stdlib.h> // rand
+#define _GNU_SOURCE     // sendmmsg
+#include <stdlib.h> // calloc
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>  // UDP_SEGMENT
 #include "unreliableSend.h"
+#include "virtualLink.h"
+#include "trace.h"
 #include <time.h> 
 #include <stdio.h>
-#include <string.h>  // memmove
+#include <string.h>  // memcpy, memset
 
 // define state variables
 
-static int US_FailureProb = 0;  //prob of failure, initially 0
+// the default channel, used by US_send, US_sendto and US_sendmmsg.  It's
+// seeded from the time of day unless US_SetSeed has been called
+// (US_SeedChosen).
+static US_channel US_defaultChannel;
 static int US_RandSeeded = 0;   // not seeded initially
+static int US_SeedChosen = 0;
 
-// define probabilities of various errors.  This could be more general (i.e.,
-// allow the user to set these), but these should suffice for now. The
-// probabilities should add up to 100.
-#define US_DROP_PROB            20
-#define US_BURST_ERROR_PROB     20
-#define US_ONE_BIT_ERROR_PROB   20
-#define US_TWO_BIT_ERROR_PROB   20
-#define US_THREE_BIT_ERROR_PROB 20
+// what can happen to a packet that fails, and how likely each is to begin
+// with (the weights are relative)
+#define US_DROP            0
+#define US_BURST_ERROR     1
+#define US_ONE_BIT_ERROR   2
+#define US_TWO_BIT_ERROR   3
+#define US_THREE_BIT_ERROR 4
+#define US_NUM_ERRORS      5
+#define US_DEFAULT_WEIGHT  1
+
+// how much a delay queue holds unless US_channelSetQueue says otherwise
+#define US_DEFAULT_QUEUE_PACKETS 4096
+#define US_DEFAULT_QUEUE_BYTES   (4 << 20)
+
+// a garbled message isn't copied.  It's sent from iovecs that take the
+// undamaged parts from the caller's buffer, with the damaged bytes in
+// between: a burst of 1s from US_ones, or bytes with bits flipped.  That
+// takes at most US_DAMAGE_IOVS iovecs.
+#define US_MAX_BIT_ERRORS 3
+#define US_DAMAGE_IOVS (2 * US_MAX_BIT_ERRORS + 1)
+static unsigned char US_ones[65536];
+
+// most datagrams US_sendmmsg sends with one system call.  A GSO message
+// counts as one, unless it's split up because a segment was garbled.
+#define US_MAX_OUT 64
+
+// most segments in a GSO message (the kernel's limit)
+#define US_MAX_SEGMENTS 64
+
+// the bytes of a message US_garble damaged, in order
+struct US_patch {
+  int offset;
+  int length;
+  const unsigned char *bytes;
+  unsigned char flipped;          // the byte with bits flipped
+};
+
+struct US_damage {
+  int numPatches;
+  struct US_patch patches[US_MAX_BIT_ERRORS];
+};
+
+// a packet in a delay queue, damage and all, and where it's going.  Its
+// bytes are at offset in the queue's pool.  order keeps packets due at
+// the same time in the order they were sent.
+struct US_delayed {
+  long long due;                  // usecs
+  unsigned long long order;
+  int sock, flags;
+  struct sockaddr_storage to;
+  int toLen;
+  size_t offset;
+  int length;
+  int sent;
+};
+
+// an unreliable network.  Probabilities are fractions of 2^32, compared
+// with the top 32 bits of a random number.
+struct US_channel {
+  // xoshiro256** random number generator state
+  unsigned long long rng[4];
+
+  // packets fail with probability failure, and then weights[] decide
+  // what happens to them
+  unsigned long long failure;
+  int weights[US_NUM_ERRORS];
+  int totalWeight;
+
+  // with burstLoss set, packets fail with goodFailure or badFailure
+  // depending on the state (bad is set in the bad one), and the state
+  // changes with probability toBad or toGood before each packet
+  int burstLoss, bad;
+  unsigned long long toBad, toGood;
+  unsigned long long goodFailure, badFailure;
+
+  // delays (usecs), and how many packets are reordered or duplicated
+  long long delay, jitter, reorderDelay;
+  unsigned long long reorder, duplicate;
+
+  // delayed packets.  queue is a ring of queueSize packets, the oldest at
+  // queueTail, whose bytes are kept in the same order in pool (poolSize
+  // bytes, the next put at poolHead).  heap orders the ones not sent yet
+  // by when they're due.  A packet's room is only reused once the packets
+  // before it have gone too.
+  struct US_delayed *queue;
+  int queueSize, queueTail, queueCount;
+  int *heap;
+  int heapCount;
+  char *pool;
+  size_t poolSize, poolHead;
+  unsigned long long order;
+
+  // packets go over link, on its clock, if it's set
+  VL_link *link;
+
+  struct US_stats stats;
+};
 
 // prototypes for local functions
-static int US_garble (char *msg, int len);
+static void US_init (void) __attribute__ ((constructor));
+static US_channel *US_get (US_channel *c);
+static void US_seed (US_channel *c, unsigned long long seed);
+static unsigned long long US_random (US_channel *c);
+static int US_chance (US_channel *c, unsigned long long probability);
+static int US_below (US_channel *c, int n);
+static unsigned long long US_fraction (double percent);
+static int US_hit (US_channel *c);
+static int US_garble (US_channel *c, const char *msg, int len,
+		      struct US_damage *damage);
+static int US_damagedIov (const char *msg, int len, struct US_damage *damage,
+			  struct iovec *iov);
+static void US_delay (US_channel *c, int s, const char *msg, int len,
+		      int flags, struct sockaddr *to, int tolen,
+		      struct US_damage *damage);
+static int US_allocQueue (US_channel *c, int maxPackets, int maxBytes);
+static long long US_poolSpace (US_channel *c, int len);
+static void US_heapPush (US_channel *c, int index);
+static void US_heapPop (US_channel *c);
+static int US_before (US_channel *c, int a, int b);
+static long long US_now (US_channel *c);
+static int US_segmentSize (struct msghdr *hdr);
+static int US_sendmsg (US_channel *c, int s, struct msghdr *msg, int flags);
+static int US_sendAll (US_channel *c, int s, struct mmsghdr *msgs, int vlen,
+		       int flags);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_init
+//
+///////////////////////////////////////////////////////////////////////////////
+static void US_init (void)
+{
+  // fill the burst error bytes before main runs, so no one sees them half
+  // done.  The default channel garbles packets in every way equally often.
+  int i;
+
+  memset (US_ones, 0xff, sizeof(US_ones));
+  for (i = 0; i < US_NUM_ERRORS; i++)
+    US_defaultChannel.weights[i] = US_DEFAULT_WEIGHT;
+  US_defaultChannel.totalWeight = US_NUM_ERRORS * US_DEFAULT_WEIGHT;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -39,10 +178,22 @@ static int US_garble (char *msg, int len);
 void US_SetFailureProb (int newProb)
 {
   // set failure to newProb
-  US_FailureProb = newProb;
+  US_defaultChannel.failure = US_fraction (newProb);
 
-  // start a new random seed
-  srand (time(0));
+  // start a new random seed, unless the caller chose one
+  if (!US_SeedChosen)
+    US_seed (&US_defaultChannel, time (0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_SetSeed
+//
+///////////////////////////////////////////////////////////////////////////////
+void US_SetSeed (unsigned long long seed)
+{
+  US_seed (&US_defaultChannel, seed);
+  US_SeedChosen = 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -52,58 +203,586 @@ void US_SetFailureProb (int newProb)
 ///////////////////////////////////////////////////////////////////////////////
 int US_send(int s, const char *msg, int len, int flags)
 {
-  char garbledMsg[2048];
+  return US_channelSendto (0, s, msg, len, flags, 0, 0);
+}
 
-  if( !US_RandSeeded )
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_sendto
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_sendto(int s, const char *msg, int len, int flags,
+	       struct sockaddr *to, int tolen)
+{
+  return US_channelSendto (0, s, msg, len, flags, to, tolen);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_sendmmsg
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_sendmmsg(int s, struct mmsghdr *msgs, int vlen, int flags)
+{
+  return US_channelSendmmsg (0, s, msgs, vlen, flags);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_open
+//
+///////////////////////////////////////////////////////////////////////////////
+US_channel *US_open (unsigned long long seed)
+{
+  US_channel *c;
+  int i;
+
+  c = calloc (1, sizeof(*c));
+  if (!c)
   {
-    // seed the random number generator
-    srand( time(NULL) );
-    US_RandSeeded = 1;
+    perror ("US_open: calloc");
+    return 0;
+  }
+  US_seed (c, seed);
+  for (i = 0; i < US_NUM_ERRORS; i++)
+    c->weights[i] = US_DEFAULT_WEIGHT;
+  c->totalWeight = US_NUM_ERRORS * US_DEFAULT_WEIGHT;
+  return c;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_clone
+//
+///////////////////////////////////////////////////////////////////////////////
+US_channel *US_clone (US_channel *c)
+{
+  // copy c's settings, but not its random numbers, state, delayed packets
+  // or counts
+  US_channel *copy;
+
+  c = US_get (c);
+  copy = malloc (sizeof(*copy));
+  if (!copy)
+  {
+    perror ("US_clone: malloc");
+    return 0;
+  }
+  *copy = *c;
+  US_seed (copy, US_random (c));
+  copy->queue = 0;
+  copy->heap = 0;
+  copy->pool = 0;
+  copy->queueSize = 0;
+  copy->order = 0;
+  memset (&copy->stats, 0, sizeof(copy->stats));
+  if (c->queue && US_allocQueue (copy, c->queueSize, c->poolSize) < 0)
+  {
+    free (copy);
+    return 0;
+  }
+  return copy;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_close
+//
+///////////////////////////////////////////////////////////////////////////////
+void US_close (US_channel *c)
+{
+  if (!c || c == &US_defaultChannel)
+    return;
+  free (c->queue);
+  free (c->heap);
+  free (c->pool);
+  free (c);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetFailureProb
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetFailureProb (US_channel *c, double percent)
+{
+  if (percent < 0 || percent > 100)
+  {
+    printf ("setFailureProb: percent must be between 0 and 100\n");
+    return -1;
+  }
+
+  US_get (c)->failure = US_fraction (percent);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetErrorMix
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetErrorMix (US_channel *c, int drop, int burst, int oneBit,
+			   int twoBit, int threeBit)
+{
+  int weights[US_NUM_ERRORS];
+  int total = 0;
+  int i;
+
+  weights[US_DROP] = drop;
+  weights[US_BURST_ERROR] = burst;
+  weights[US_ONE_BIT_ERROR] = oneBit;
+  weights[US_TWO_BIT_ERROR] = twoBit;
+  weights[US_THREE_BIT_ERROR] = threeBit;
+  for (i = 0; i < US_NUM_ERRORS; i++)
+  {
+    if (weights[i] < 0 || weights[i] > 1000000)
+    {
+      printf ("setErrorMix: weights must be between 0 and 1000000\n");
+      return -1;
+    }
+    total += weights[i];
+  }
+  if (total == 0)
+  {
+    printf ("setErrorMix: some weight must be more than 0\n");
+    return -1;
+  }
+
+  c = US_get (c);
+  memcpy (c->weights, weights, sizeof(weights));
+  c->totalWeight = total;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetBurstLoss
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetBurstLoss (US_channel *c, double goodToBad,
+			    double badToGood, double goodPercent,
+			    double badPercent)
+{
+  if (goodToBad < 0 || goodToBad > 100 || badToGood < 0 ||
+      badToGood > 100 || goodPercent < 0 || goodPercent > 100 ||
+      badPercent < 0 || badPercent > 100)
+  {
+    printf ("setBurstLoss: percents must be between 0 and 100\n");
+    return -1;
+  }
+
+  // start in the good state
+  c = US_get (c);
+  c->burstLoss = goodToBad > 0;
+  c->bad = 0;
+  c->toBad = US_fraction (goodToBad);
+  c->toGood = US_fraction (badToGood);
+  c->goodFailure = US_fraction (goodPercent);
+  c->badFailure = US_fraction (badPercent);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetDelay
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetDelay (US_channel *c, int delayUsecs, int jitterUsecs)
+{
+  if (delayUsecs < 0 || jitterUsecs < 0)
+  {
+    printf ("setDelay: delays can't be negative\n");
+    return -1;
   }
-  
-  if (rand()%100 >= US_FailureProb)
-    // we're not causing an error in this packet so send it off normally
-    return send (s,msg,len,flags);
 
-  // copy the message to a temporary buffer, then garble it  and send it,
-  // unless it was completely dropped
-  memmove (&garbledMsg,msg,len);
-  if (US_garble(garbledMsg,len))
-    send (s,garbledMsg,len,flags);
+  c = US_get (c);
+  if ((delayUsecs || jitterUsecs) && !c->queue &&
+      US_allocQueue (c, US_DEFAULT_QUEUE_PACKETS, US_DEFAULT_QUEUE_BYTES) < 0)
+    return -1;
+  c->delay = delayUsecs;
+  c->jitter = jitterUsecs;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetReorder
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetReorder (US_channel *c, double percent, int extraUsecs)
+{
+  if (percent < 0 || percent > 100 || extraUsecs < 0)
+  {
+    printf ("setReorder: percent must be between 0 and 100, and the "
+	    "delay can't be negative\n");
+    return -1;
+  }
+
+  c = US_get (c);
+  if (percent > 0 && !c->queue &&
+      US_allocQueue (c, US_DEFAULT_QUEUE_PACKETS, US_DEFAULT_QUEUE_BYTES) < 0)
+    return -1;
+  c->reorder = US_fraction (percent);
+  c->reorderDelay = extraUsecs;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetDuplicate
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetDuplicate (US_channel *c, double percent)
+{
+  if (percent < 0 || percent > 100)
+  {
+    printf ("setDuplicate: percent must be between 0 and 100\n");
+    return -1;
+  }
+
+  US_get (c)->duplicate = US_fraction (percent);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetQueue
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetQueue (US_channel *c, int maxPackets, int maxBytes)
+{
+  if (maxPackets < 1 || maxBytes < 1)
+  {
+    printf ("setQueue: queue must hold at least a packet and a byte\n");
+    return -1;
+  }
+  c = US_get (c);
+  if (c->queueCount)
+  {
+    printf ("setQueue: queue isn't empty\n");
+    return -1;
+  }
+
+  return US_allocQueue (c, maxPackets, maxBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSetLink
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSetLink (US_channel *c, VL_link *link)
+{
+  c = US_get (c);
+  if (c == &US_defaultChannel && link)
+  {
+    printf ("setLink: the default channel can't use a link\n");
+    return -1;
+  }
+  if (c->heapCount)
+  {
+    printf ("setLink: queue isn't empty\n");
+    return -1;
+  }
+
+  c->link = link;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSend
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSend (US_channel *c, int s, const char *msg, int len,
+		    int flags)
+{
+  return US_channelSendto (c, s, msg, len, flags, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelSendto
+//
+///////////////////////////////////////////////////////////////////////////////
+int US_channelSendto (US_channel *c, int s, const char *msg, int len,
+		      int flags, struct sockaddr *to, int tolen)
+{
+  // send each copy of the message (there are two if it's duplicated)
+  // unless it's dropped, garbled if it was hit, and after its delay if
+  // there is one.  A message that wasn't hit returns what sendmsg does.
+  struct US_damage damage;
+  struct iovec iov[US_DAMAGE_IOVS];
+  struct msghdr hdr;
+  int copies;
+  int hit;
+  int ret = len;
+
+  c = US_get (c);
+  if (c->heapCount)
+    US_channelFlush (c);
+
+  copies = 1;
+  if (US_chance (c, c->duplicate))
+  {
+    copies = 2;
+    c->stats.duplicated++;
+  }
+
+  while (copies-- > 0)
+  {
+    c->stats.packets++;
+    damage.numPatches = 0;
+    hit = len > 0 && US_hit (c);
+    if (hit && !US_garble (c, msg, len, &damage))
+      continue;
+
+    if (c->delay || c->jitter || c->reorder)
+    {
+      US_delay (c, s, msg, len, flags, to, tolen, &damage);
+      continue;
+    }
+
+    memset (&hdr,0,sizeof(hdr));
+    hdr.msg_name = to;
+    hdr.msg_namelen = tolen;
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = US_damagedIov (msg,len,&damage,iov);
+    if (hit)
+      US_sendmsg (c,s,&hdr,flags);
+    else
+      ret = US_sendmsg (c,s,&hdr,flags);
+  }
 
   // return as if everything was sent off
-  return len;
+  return ret;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// US_sendto
+// US_channelSendmmsg
 //
 ///////////////////////////////////////////////////////////////////////////////
-int US_sendto(int s, const char *msg, int len, int flags,
-	       struct sockaddr *to, int tolen)
+int US_channelSendmmsg (US_channel *c, int s, struct mmsghdr *msgs, int vlen,
+			int flags)
 {
-  char garbledMsg[2048];
+  // the messages that survive are gathered into out, with garbled ones
+  // sent from iovecs in damagedIov, and sent in as few calls as possible.
+  // Each segment of a GSO message is a datagram of its own on the wire, so
+  // each is dropped or garbled on its own; if any of them is, they're all
+  // sent as messages of their own.  A channel that delays or duplicates
+  // packets sends each on its own with US_channelSendto.
+  struct mmsghdr out[US_MAX_OUT];
+  struct iovec damagedIov[US_MAX_OUT][US_DAMAGE_IOVS];
+  struct US_damage damage[US_MAX_OUT];
+  int hit[US_MAX_SEGMENTS];
+  struct msghdr *hdr;
+  struct iovec *iov;
+  int numOut = 0;
+  int numSegs, numHit;
+  int gso;
+  int i, j;
+
+  c = US_get (c);
+  if (c->heapCount)
+    US_channelFlush (c);
 
-  if( !US_RandSeeded )
+  for (i=0;i<vlen;i++)
   {
-    // seed the random number generator
-    srand( time(NULL) );
-    US_RandSeeded = 1;
+    hdr = &msgs[i].msg_hdr;
+    gso = US_segmentSize (hdr) > 0;
+    numSegs = gso ? (int)hdr->msg_iovlen : 1;
+    if (numSegs > US_MAX_SEGMENTS)
+      numSegs = US_MAX_SEGMENTS;
+
+    if (c->delay || c->jitter || c->reorder || c->duplicate)
+    {
+      for (j=0;j<numSegs;j++)
+	US_channelSendto (c,s,hdr->msg_iov[j].iov_base,
+			  hdr->msg_iov[j].iov_len,flags,
+			  hdr->msg_name,hdr->msg_namelen);
+      continue;
+    }
+
+    numHit = 0;
+    for (j=0;j<numSegs;j++)
+    {
+      hit[j] = US_hit (c);
+      numHit += hit[j];
+    }
+    c->stats.packets += numSegs;
+
+    // send what we have first if there's no room for this message
+    if (numOut + (numHit ? numSegs : 1) > US_MAX_OUT)
+    {
+      if (US_sendAll (c,s,out,numOut,flags) < 0)
+	return -1;
+      numOut = 0;
+    }
+
+    if (!numHit)
+    {
+      // we're not causing an error in this message so send it off normally
+      out[numOut++] = msgs[i];
+      continue;
+    }
+
+    // garble each segment that was hit and send it, unless it was
+    // completely dropped.  The rest go as they are.
+    for (j=0;j<numSegs;j++)
+    {
+      iov = &hdr->msg_iov[j];
+      out[numOut] = msgs[i];
+      out[numOut].msg_hdr.msg_iov = damagedIov[numOut];
+      if (gso)
+      {
+	out[numOut].msg_hdr.msg_control = 0;
+	out[numOut].msg_hdr.msg_controllen = 0;
+      }
+      if (!hit[j] || iov->iov_len == 0)
+      {
+	damagedIov[numOut][0] = *iov;
+	out[numOut].msg_hdr.msg_iovlen = 1;
+	numOut++;
+      }
+      else if (US_garble(c,iov->iov_base,iov->iov_len,&damage[numOut]))
+      {
+	out[numOut].msg_hdr.msg_iovlen =
+	  US_damagedIov (iov->iov_base,iov->iov_len,&damage[numOut],
+			 damagedIov[numOut]);
+	numOut++;
+      }
+    }
   }
-  
-  if (rand()%100 >= US_FailureProb)
-    // we're not causing an error in this packet so send it off normally
-    return sendto(s,msg,len,flags,to,tolen);
 
-  // copy the message to a temporary buffer, then garble it  and send it,
-  // unless it was completely dropped
-  memmove (&garbledMsg,msg,len);
-  if (US_garble(garbledMsg,len))
-    sendto (s,garbledMsg,len,flags,to,tolen);
+  if (US_sendAll (c,s,out,numOut,flags) < 0)
+    return -1;
 
   // return as if everything was sent off
-  return len;
+  return vlen;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelFlush
+//
+///////////////////////////////////////////////////////////////////////////////
+long long US_channelFlush (US_channel *c)
+{
+  // send the packets that are due, soonest first, then free the room of
+  // the ones at the tail of the queue that have all gone
+  struct US_delayed *d;
+  struct msghdr hdr;
+  struct iovec iov;
+  long long now;
+
+  c = US_get (c);
+  now = US_now (c);
+  while (c->heapCount && c->queue[c->heap[0]].due <= now)
+  {
+    d = &c->queue[c->heap[0]];
+    US_heapPop (c);
+    iov.iov_base = c->pool+d->offset;
+    iov.iov_len = d->length;
+    memset (&hdr,0,sizeof(hdr));
+    hdr.msg_name = d->toLen ? &d->to : 0;
+    hdr.msg_namelen = d->toLen;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    US_sendmsg (c,d->sock,&hdr,d->flags);
+    d->sent = 1;
+  }
+  while (c->queueCount && c->queue[c->queueTail].sent)
+  {
+    c->queueTail = (c->queueTail + 1) % c->queueSize;
+    c->queueCount--;
+  }
+  if (!c->queueCount)
+    c->poolHead = 0;
+
+  if (!c->heapCount)
+    return -1;
+  return c->queue[c->heap[0]].due - now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelNextDue
+//
+///////////////////////////////////////////////////////////////////////////////
+long long US_channelNextDue (US_channel *c)
+{
+  c = US_get (c);
+  return c->heapCount ? c->queue[c->heap[0]].due : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_channelGetStats
+//
+///////////////////////////////////////////////////////////////////////////////
+void US_channelGetStats (US_channel *c, struct US_stats *stats)
+{
+  *stats = US_get (c)->stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_sendmsg
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_sendmsg (US_channel *c, int s, struct msghdr *msg, int flags)
+{
+  // send a message with sendmsg, or over the channel's link
+  if (c->link)
+    return VL_sendmsg (c->link,s,msg,flags);
+  return sendmsg (s,msg,flags);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_sendAll
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_sendAll (US_channel *c, int s, struct mmsghdr *msgs, int vlen,
+		       int flags)
+{
+  // sendmmsg may stop part way through, so keep going until everything is
+  // sent.  Returns -1 if there's an error.
+  int sent;
+
+  while (vlen > 0)
+  {
+    if (c->link)
+      sent = VL_sendmmsg (c->link,s,msgs,vlen,flags);
+    else
+      sent = sendmmsg (s,msgs,vlen,flags);
+    if (sent <= 0)
+      return -1;
+    msgs += sent;
+    vlen -= sent;
+  }
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_segmentSize
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_segmentSize (struct msghdr *hdr)
+{
+  // the segment size of a GSO message, or 0 if it isn't one
+  struct cmsghdr *cmsg;
+  unsigned short size;
+
+  for (cmsg = CMSG_FIRSTHDR (hdr); cmsg; cmsg = CMSG_NXTHDR (hdr, cmsg))
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_SEGMENT)
+    {
+      memcpy (&size,CMSG_DATA (cmsg),sizeof(size));
+      return size;
+    }
+  return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -111,48 +790,61 @@ int US_sendto(int s, const char *msg, int len, int flags,
 // US_garble
 //
 ///////////////////////////////////////////////////////////////////////////////
-static int US_garble (char *msg, int len)
+static int US_garble (US_channel *c, const char *msg, int len,
+		      struct US_damage *damage)
 {
-  // garble the message.  Probabilities of various errors are defined
-  // by global constants.
+  // garble the message.  The channel's weights say how likely each error
+  // is.  The message itself is left alone; what was done to it is put in
+  // damage.
 
-  int randNum = rand()%100;
+  int randNum = US_below (c, c->totalWeight);
   int burstStart,burstEnd;
   int randByte,randBit;
   int numBits;
-  int i;
+  struct US_patch *patches = damage->patches;
+  int i,j,k;
+
+  damage->numPatches = 0;
 
   // dropped packet
-  if (randNum < US_DROP_PROB)
+  if (randNum < c->weights[US_DROP])
     {
       // simulate a dropped packet.  Return indication that nothing should
       // be sent out.
-      printf ("dropped packet\n");
+      c->stats.dropped++;
+      TR_EVENT (TR_GARBLE, TR_GARBLE_DROP, 0, 0, len, 0);
       return 0;
     }
-  randNum -= US_DROP_PROB;
+  randNum -= c->weights[US_DROP];
 
   // burst error
-  if (randNum < US_BURST_ERROR_PROB)
+  if (randNum < c->weights[US_BURST_ERROR])
     {
       // simulate a random length burst error.  All bits in the burst are
-      // set to 1
-      burstStart = rand()%len;
-      burstEnd = rand()%(len-burstStart)+burstStart+1;
-      for (i=burstStart;i<=burstEnd;i++)
-	msg[i] = 0xff;
-      printf ("burst error\n");
+      // set to 1, up to the end of the message.
+      burstStart = US_below (c, len);
+      burstEnd = US_below (c, len-burstStart)+burstStart+1;
+      if (burstEnd >= len)
+	burstEnd = len-1;
+      if (burstEnd-burstStart+1 > (int)sizeof(US_ones))
+	burstEnd = burstStart+sizeof(US_ones)-1;
+      patches[0].offset = burstStart;
+      patches[0].length = burstEnd-burstStart+1;
+      patches[0].bytes = US_ones;
+      damage->numPatches = 1;
+      c->stats.bursts++;
+      TR_EVENT (TR_GARBLE, TR_GARBLE_BURST, 0, 0, len, burstEnd-burstStart+1);
       return 1;
     }
-  randNum -= US_BURST_ERROR_PROB;
+  randNum -= c->weights[US_BURST_ERROR];
 
   // it must be a 1, 2, or 3 bit error
-  if (randNum < US_ONE_BIT_ERROR_PROB)
+  if (randNum < c->weights[US_ONE_BIT_ERROR])
     numBits = 1;
   else
     {
-      randNum -= US_ONE_BIT_ERROR_PROB;
-      if (randNum < US_TWO_BIT_ERROR_PROB)
+      randNum -= c->weights[US_ONE_BIT_ERROR];
+      if (randNum < c->weights[US_TWO_BIT_ERROR])
 	numBits = 2;
       else
 	numBits = 3;
@@ -160,10 +852,378 @@ static int US_garble (char *msg, int len)
 
   for (i=0;i<numBits;i++)
     {
-      randByte = rand()%len;
-      randBit = rand()%8;
-      msg[randByte] ^= (0x01 << randBit);
+      randByte = US_below (c, len);
+      randBit = US_below (c, 8);
+
+      // keep the damaged bytes in order, flipping bits of a byte that's
+      // already damaged in the same patch
+      for (j=0;j<damage->numPatches && patches[j].offset<randByte;j++)
+	;
+      if (j == damage->numPatches || patches[j].offset != randByte)
+	{
+	  for (k=damage->numPatches;k>j;k--)
+	    patches[k] = patches[k-1];
+	  patches[j].offset = randByte;
+	  patches[j].length = 1;
+	  patches[j].flipped = msg[randByte];
+	  damage->numPatches++;
+	}
+      patches[j].flipped ^= (0x01 << randBit);
     }
-  printf ("%d bit error\n",numBits);
+  for (j=0;j<damage->numPatches;j++)
+    patches[j].bytes = &patches[j].flipped;
+  c->stats.bitErrors++;
+  TR_EVENT (TR_GARBLE, TR_GARBLE_BITS, 0, 0, len, numBits);
   return 1;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_damagedIov
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_damagedIov (const char *msg, int len, struct US_damage *damage,
+			  struct iovec *iov)
+{
+  // fill in iovecs that send msg with damage in place of the bytes it
+  // covers.  Returns how many there are.
+  struct US_patch *patch;
+  int pos = 0;
+  int n = 0;
+  int j;
+
+  for (j=0;j<damage->numPatches;j++)
+    {
+      patch = &damage->patches[j];
+      if (patch->offset > pos)
+	{
+	  iov[n].iov_base = (char *)msg+pos;
+	  iov[n].iov_len = patch->offset-pos;
+	  n++;
+	}
+      iov[n].iov_base = (unsigned char *)patch->bytes;
+      iov[n].iov_len = patch->length;
+      n++;
+      pos = patch->offset+patch->length;
+    }
+  if (pos < len)
+    {
+      iov[n].iov_base = (char *)msg+pos;
+      iov[n].iov_len = len-pos;
+      n++;
+    }
+  return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_get
+//
+///////////////////////////////////////////////////////////////////////////////
+static US_channel *US_get (US_channel *c)
+{
+  // the channel to use for c, which is the default one if c is 0.  That's
+  // seeded from the time of day the first time it's used, unless it was
+  // seeded already.
+  if (c)
+    return c;
+  if (!US_RandSeeded)
+    US_seed (&US_defaultChannel, time (0));
+  return &US_defaultChannel;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_seed
+//
+///////////////////////////////////////////////////////////////////////////////
+static void US_seed (US_channel *c, unsigned long long seed)
+{
+  // fill the generator's state from seed with splitmix64, which never
+  // gives all zeros
+  unsigned long long z;
+  int i;
+
+  for (i = 0; i < 4; i++)
+  {
+    seed += 0x9e3779b97f4a7c15ull;
+    z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    c->rng[i] = z ^ (z >> 31);
+  }
+  c->bad = 0;
+  if (c == &US_defaultChannel)
+    US_RandSeeded = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_random
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long US_random (US_channel *c)
+{
+  // the next 64 random bits from xoshiro256**
+  unsigned long long *s = c->rng;
+  unsigned long long result, t;
+
+  result = s[1] * 5;
+  result = (result << 7 | result >> 57) * 9;
+  t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = s[3] << 45 | s[3] >> 19;
+  return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_chance
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_chance (US_channel *c, unsigned long long probability)
+{
+  // true with probability (a fraction of 2^32).  Nothing is drawn for a
+  // probability of 0.
+  return probability && (US_random (c) >> 32) < probability;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_below
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_below (US_channel *c, int n)
+{
+  // a random number from 0 to n - 1, scaled from 32 bits rather than
+  // taken modulo n
+  return (int)(((US_random (c) >> 32) * (unsigned long long)n) >> 32);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_fraction
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long US_fraction (double percent)
+{
+  // percent as a fraction of 2^32
+  if (percent <= 0)
+    return 0;
+  if (percent >= 100)
+    return 1ull << 32;
+  return (unsigned long long)(percent / 100 * 4294967296.0 + 0.5);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_hit
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_hit (US_channel *c)
+{
+  // whether the next packet fails.  With burst loss the channel may change
+  // state first, and the state says how likely failing is.
+  if (!c->burstLoss)
+    return US_chance (c, c->failure);
+  if (US_chance (c, c->bad ? c->toGood : c->toBad))
+    c->bad = !c->bad;
+  return US_chance (c, c->bad ? c->badFailure : c->goodFailure);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_delay
+//
+///////////////////////////////////////////////////////////////////////////////
+static void US_delay (US_channel *c, int s, const char *msg, int len,
+		      int flags, struct sockaddr *to, int tolen,
+		      struct US_damage *damage)
+{
+  // copy a packet, damage and all, into the delay queue, to be sent by
+  // US_channelFlush once its delay is up.  A packet there's no room for is
+  // lost.
+  struct US_delayed *d;
+  long long due;
+  long long offset;
+  int index;
+  int j;
+
+  due = US_now (c) + c->delay;
+  if (c->jitter)
+    due += US_below (c, c->jitter + 1);
+  if (US_chance (c, c->reorder))
+  {
+    due += c->reorderDelay;
+    c->stats.reordered++;
+  }
+
+  offset = c->queueCount < c->queueSize ? US_poolSpace (c, len) : -1;
+  if (offset < 0 || tolen > (int)sizeof(d->to))
+  {
+    c->stats.overflowed++;
+    return;
+  }
+  index = (c->queueTail + c->queueCount) % c->queueSize;
+  c->queueCount++;
+  c->poolHead = offset + len;
+
+  memcpy (c->pool+offset,msg,len);
+  for (j=0;j<damage->numPatches;j++)
+    memcpy (c->pool+offset+damage->patches[j].offset,
+	    damage->patches[j].bytes,damage->patches[j].length);
+
+  d = &c->queue[index];
+  d->due = due;
+  d->order = c->order++;
+  d->sock = s;
+  d->flags = flags;
+  d->toLen = to ? tolen : 0;
+  if (d->toLen)
+    memcpy (&d->to,to,tolen);
+  d->offset = offset;
+  d->length = len;
+  d->sent = 0;
+  US_heapPush (c, index);
+  c->stats.delayed++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_allocQueue
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_allocQueue (US_channel *c, int maxPackets, int maxBytes)
+{
+  // allocate an empty delay queue.  The packets are sent from signal
+  // handlers, which can't call malloc, so it's all done here.
+  free (c->queue);
+  free (c->heap);
+  free (c->pool);
+  c->queue = calloc (maxPackets, sizeof(struct US_delayed));
+  c->heap = malloc ((size_t)maxPackets * sizeof(int));
+  c->pool = malloc (maxBytes);
+  if (!c->queue || !c->heap || !c->pool)
+  {
+    perror ("US_allocQueue: malloc");
+    free (c->queue);
+    free (c->heap);
+    free (c->pool);
+    c->queue = 0;
+    c->heap = 0;
+    c->pool = 0;
+    c->queueSize = 0;
+    return -1;
+  }
+  c->queueSize = maxPackets;
+  c->queueTail = 0;
+  c->queueCount = 0;
+  c->heapCount = 0;
+  c->poolSize = maxBytes;
+  c->poolHead = 0;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_poolSpace
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long US_poolSpace (US_channel *c, int len)
+{
+  // where len bytes can go in the pool after the packets already there,
+  // wrapping around to the start if they don't fit at the end, or -1 if
+  // there's no room before the oldest packet
+  size_t tail;
+
+  if (!c->queueCount)
+    return (size_t)len <= c->poolSize ? 0 : -1;
+  tail = c->queue[c->queueTail].offset;
+  if (c->poolHead > tail)
+  {
+    if (c->poolHead + len <= c->poolSize)
+      return c->poolHead;
+    return (size_t)len <= tail ? 0 : -1;
+  }
+  return c->poolHead + len <= tail ? (long long)c->poolHead : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_heapPush
+//
+///////////////////////////////////////////////////////////////////////////////
+static void US_heapPush (US_channel *c, int index)
+{
+  // add queued packet index to the heap of packets not sent yet
+  int i = c->heapCount++;
+  int parent;
+
+  while (i > 0 && US_before (c, index, c->heap[parent = (i - 1) / 2]))
+  {
+    c->heap[i] = c->heap[parent];
+    i = parent;
+  }
+  c->heap[i] = index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_heapPop
+//
+///////////////////////////////////////////////////////////////////////////////
+static void US_heapPop (US_channel *c)
+{
+  // take the packet due soonest off the heap
+  int last = c->heap[--c->heapCount];
+  int i = 0;
+  int child;
+
+  while ((child = 2 * i + 1) < c->heapCount)
+  {
+    if (child + 1 < c->heapCount &&
+	US_before (c, c->heap[child + 1], c->heap[child]))
+      child++;
+    if (!US_before (c, c->heap[child], last))
+      break;
+    c->heap[i] = c->heap[child];
+    i = child;
+  }
+  c->heap[i] = last;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_before
+//
+///////////////////////////////////////////////////////////////////////////////
+static int US_before (US_channel *c, int a, int b)
+{
+  // whether queued packet a is due before b
+  struct US_delayed *x = &c->queue[a];
+  struct US_delayed *y = &c->queue[b];
+
+  return x->due < y->due || (x->due == y->due && x->order < y->order);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// US_now
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long US_now (US_channel *c)
+{
+  // current time in usecs from a clock that never goes backwards, or the
+  // channel's link's
+  struct timespec ts;
+
+  if (c->link)
+    return VL_now (c->link);
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -7,18 +7,158 @@
 // functions are defined:
 //
 //    US_SetFailureProb (int newProb)
+//    US_SetSeed (unsigned long long seed)
 //    US_send (int s,const char *msg,int len,int flags)
 //    US_sendto (int s, const char *msg, int len, int flags,
 //               struct sockaddr *to, int tolen)
+//    US_sendmmsg (int s, struct mmsghdr *msgs, int vlen, int flags)
+//
+//    US_open (unsigned long long seed)
+//    US_clone (US_channel *c)
+//    US_close (US_channel *c)
+//    US_channelSetFailureProb, US_channelSetErrorMix,
+//    US_channelSetBurstLoss, US_channelSetDelay, US_channelSetReorder,
+//    US_channelSetDuplicate, US_channelSetQueue, US_channelSetLink,
+//    US_channelSend, US_channelSendto, US_channelSendmmsg, US_channelFlush,
+//    US_channelNextDue, US_channelGetStats
 //
 // The behavior of US_send and US_sendto are identical to send and sendto
 // except that packets are randomly dropped.  These simulate unreilable links.
+// US_sendmmsg is the same for sendmmsg, with each message dropped or
+// garbled on its own.  Its messages must each have a single iovec, except
+// that a UDP GSO message (one with a UDP_SEGMENT control message) has one
+// per segment; its segments are dropped or garbled one at a time, as they
+// would be on the wire.  US_sendmmsg returns -1 if sendmmsg fails, so the
+// caller can tell when e.g. the kernel won't do GSO.
+//
+// Garbled messages aren't copied: they're sent from the caller's buffer
+// with the damaged bytes spliced in, so messages of any size can be
+// garbled.
+//
+// Each channel (US_channel) is an unreliable network of its own, with its
+// own random numbers, settings and delay queue, so different threads can
+// each use their own.  A channel seeded the same way does the same thing
+// to the same packets every time.  The US_channel* functions use the
+// default channel, the one US_send, US_sendto and US_sendmmsg use, if c
+// is 0.  Nothing is printed: what a channel did is counted in its
+// US_stats.
 //
 #ifndef _UNRELIABLE_SEND_H
 #define _UNRELIABLE_SEND_H
 
+typedef struct US_channel US_channel;
+
 void US_SetFailureProb (int newProb);
+// sets the percentage of packets the default channel drops or garbles.
+// Unless US_SetSeed was called, the random numbers start again from the
+// time of day.
+
+void US_SetSeed (unsigned long long seed);
+// starts the default channel's random numbers from seed, so it drops and
+// garbles the same packets every run.
+
 int US_send(int s, const char *msg, int len, int flags);
 int US_sendto(int s, const char *msg, int len, int flags,
 	      struct sockaddr *to, int tolen);
+
+struct mmsghdr;
+int US_sendmmsg(int s, struct mmsghdr *msgs, int vlen, int flags);
+
+US_channel *US_open (unsigned long long seed);
+// returns a new channel with its random numbers started from seed.  It
+// passes everything until configured otherwise, and garbles packets as
+// the default channel does.
+//
+// A return value of 0 indicates an error.
+
+US_channel *US_clone (US_channel *c);
+// returns a new channel set up like c (the default channel if c is 0),
+// for another thread to use instead.  Its random numbers are started from
+// c's next one, so the clones of a seeded channel do the same thing every
+// run, and its delay queue starts empty.
+//
+// A return value of 0 indicates an error.
+
+void US_close (US_channel *c);
+// frees the channel.  Packets still in its delay queue are lost.
+
+int US_channelSetFailureProb (US_channel *c, double percent);
+// sets the percentage of packets dropped or garbled.
+
+int US_channelSetErrorMix (US_channel *c, int drop, int burst, int oneBit,
+			   int twoBit, int threeBit);
+// sets what happens to a packet that fails, in proportion to the weights:
+// it's dropped, a random run of it is set to 1s, or 1, 2 or 3 random bits
+// are flipped.  The default is 1 each.  Weights of 1, 0, 0, 0, 0 make the
+// channel only lose packets.
+
+int US_channelSetBurstLoss (US_channel *c, double goodToBad,
+			    double badToGood, double goodPercent,
+			    double badPercent);
+// makes failures come in bursts (the Gilbert-Elliott model).  The channel
+// is in a good state or a bad one, and fails goodPercent or badPercent of
+// the packets sent in it; before each packet it moves from good to bad
+// with probability goodToBad percent, and back with badToGood percent.
+// Bursts average 100 / badToGood packets.  A goodToBad of 0 goes back to
+// failing packets independently, with the failure probability.
+
+int US_channelSetDelay (US_channel *c, int delayUsecs, int jitterUsecs);
+// delays every packet by delayUsecs plus up to jitterUsecs more, chosen at
+// random for each packet, so packets with jitter may arrive out of order.
+
+int US_channelSetReorder (US_channel *c, double percent, int extraUsecs);
+// delays percent of the packets by another extraUsecs, so the packets
+// sent after them arrive first.
+
+int US_channelSetDuplicate (US_channel *c, double percent);
+// sends percent of the packets twice.  Each copy may fail on its own.
+
+int US_channelSetQueue (US_channel *c, int maxPackets, int maxBytes);
+// sets how much the delay queue holds (4096 packets or 4 MB by default).
+// Packets that would overflow it are dropped, as by a router.  It can't be
+// changed while it holds packets.
+
+struct VL_link;
+int US_channelSetLink (US_channel *c, struct VL_link *link);
+// sends the channel's packets over link (see virtualLink.h) instead of the
+// network, on sockets from VL_socket, and delays them by the link's clock
+// instead of the wall clock.  A link of 0 goes back to the network.  It
+// can't be changed while the delay queue holds packets, and the default
+// channel can't use a link.
+//
+// A negative return value from any of the setters indicates an error.
+
+int US_channelSend (US_channel *c, int s, const char *msg, int len,
+		    int flags);
+int US_channelSendto (US_channel *c, int s, const char *msg, int len,
+		      int flags, struct sockaddr *to, int tolen);
+int US_channelSendmmsg (US_channel *c, int s, struct mmsghdr *msgs,
+			int vlen, int flags);
+// are US_send, US_sendto and US_sendmmsg on channel c.  Delayed packets
+// are copied into the delay queue and sent later by US_channelFlush,
+// which each of them calls first.  A channel that delays or duplicates
+// packets doesn't use GSO.
+
+long long US_channelFlush (US_channel *c);
+// sends the delayed packets that are due, and returns the number of usecs
+// until the next one is, or -1 if there are none.
+
+long long US_channelNextDue (US_channel *c);
+// returns when the next delayed packet is due, in usecs on the
+// CLOCK_MONOTONIC clock (or the link's), or 0 if there are none.
+
+// what a channel did to the packets sent through it
+struct US_stats {
+  unsigned long long packets;     // sent through the channel
+  unsigned long long dropped;
+  unsigned long long bursts;      // garbled with a run of 1s
+  unsigned long long bitErrors;   // garbled with bits flipped
+  unsigned long long duplicated;
+  unsigned long long delayed;
+  unsigned long long reordered;
+  unsigned long long overflowed;  // dropped by a full delay queue
+};
+
+void US_channelGetStats (US_channel *c, struct US_stats *stats);
+// copies the channel's counts to stats.
 #endif
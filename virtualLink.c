@@ -0,0 +1,471 @@
+//
+// File: virtualLink.c
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: Implements the simulated network defined in virtualLink.h.
+//
+// Times are kept in nsecs, so fast paths don't lose the fractions of a
+// usec each datagram takes to go out.  A path only needs to remember when
+// it will have finished sending what it has been given (busyUntil): a new
+// datagram goes out after that, and what's waiting is what the bandwidth
+// hasn't got through by now.  Every datagram to a socket takes the same
+// time after going out to arrive, so they arrive in the order they went
+// out, and each socket's datagrams on their way are kept in a list in
+// that order.
+//
+
+#define _GNU_SOURCE     // struct mmsghdr
+#include <errno.h>
+#include <stdlib.h>     // calloc, malloc, realloc, free
+#include <string.h>     // memcpy, memset
+#include <sys/socket.h>
+#include <arpa/inet.h>  // htonl, htons, ntohs
+#include "virtualLink.h"
+
+// the clock starts at 1 second
+#define VL_START_TIME 1000000000LL
+
+// bytes of IP and UDP header every datagram takes on a path
+#define VL_HEADER_BYTES 28
+
+// ports handed to sockets that send before they're bound
+#define VL_FIRST_PORT 49152
+
+// a datagram on its way to a socket
+struct VL_packet {
+  long long arrival;              // nsecs
+  struct sockaddr_in from;
+  int length;
+  struct VL_packet *next;
+  char data[];
+};
+
+// a socket, and the path leading to it.  port is 0 until it's bound.
+struct VL_socket {
+  int open;
+  unsigned short port;
+  long long busyUntil;            // nsecs
+  struct VL_packet *head, *tail;
+};
+
+struct VL_link {
+  long long now;                  // nsecs
+  long long bitsPerSec;
+  long long delay;                // nsecs
+  long long queueBytes;
+  struct VL_socket *sockets;
+  int numSockets;
+  unsigned short nextPort;
+  struct VL_stats stats;
+};
+
+// define prototypes for local routines
+static struct VL_socket *VL_find (VL_link *link, int sd);
+static struct VL_socket *VL_bound (VL_link *link, unsigned short port);
+static int VL_pickPort (VL_link *link, struct VL_socket *sock);
+static void VL_free (struct VL_socket *sock);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_open
+//
+///////////////////////////////////////////////////////////////////////////////
+VL_link *VL_open (void)
+{
+  VL_link *link;
+
+  link = calloc (1, sizeof(*link));
+  if (!link)
+    return 0;
+  link->now = VL_START_TIME;
+  link->nextPort = VL_FIRST_PORT;
+  return link;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_close
+//
+///////////////////////////////////////////////////////////////////////////////
+void VL_close (VL_link *link)
+{
+  int i;
+
+  if (!link)
+    return;
+  for (i = 0; i < link->numSockets; i++)
+    VL_free (&link->sockets[i]);
+  free (link->sockets);
+  free (link);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_setPath
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_setPath (VL_link *link, long long bitsPerSec, int delayUsecs,
+		int queueBytes)
+{
+  if (bitsPerSec < 0 || delayUsecs < 0 || queueBytes < 0)
+    return -1;
+
+  link->bitsPerSec = bitsPerSec;
+  link->delay = (long long)delayUsecs * 1000;
+  link->queueBytes = queueBytes;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_socket
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_socket (VL_link *link)
+{
+  // reuse a closed socket's descriptor if there is one
+  struct VL_socket *sockets;
+  int sd;
+
+  for (sd = 0; sd < link->numSockets; sd++)
+    if (!link->sockets[sd].open)
+      break;
+  if (sd == link->numSockets) {
+    sockets = realloc (link->sockets, (sd + 1) * sizeof(*sockets));
+    if (!sockets)
+      return -1;
+    link->sockets = sockets;
+    link->numSockets++;
+  }
+
+  memset (&link->sockets[sd], 0, sizeof(link->sockets[sd]));
+  link->sockets[sd].open = 1;
+  return sd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_bind
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_bind (VL_link *link, int sd, const struct sockaddr_in *addr)
+{
+  struct VL_socket *sock = VL_find (link, sd);
+  unsigned short port = ntohs (addr->sin_port);
+
+  if (!sock || sock->port) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!port)
+    return VL_pickPort (link, sock);
+  if (VL_bound (link, port)) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+  sock->port = port;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_closeSocket
+//
+///////////////////////////////////////////////////////////////////////////////
+void VL_closeSocket (VL_link *link, int sd)
+{
+  struct VL_socket *sock = VL_find (link, sd);
+
+  if (sock) {
+    VL_free (sock);
+    sock->open = 0;
+    sock->port = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_sendmsg
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_sendmsg (VL_link *link, int sd, const struct msghdr *msg, int flags)
+{
+  // copy the datagram and put it on the path to the socket it's for, after
+  // what that path is already sending, unless its queue is full
+  struct VL_socket *sock = VL_find (link, sd);
+  struct sockaddr_in *to = msg->msg_name;
+  struct VL_socket *dest;
+  struct VL_packet *packet;
+  long long start;
+  double waiting;
+  size_t length = 0;
+  size_t i;
+
+  // none of sendmsg's flags mean anything on the link
+  (void)flags;
+
+  if (!sock) {
+    errno = EBADF;
+    return -1;
+  }
+  if (!to || msg->msg_namelen < sizeof(*to)) {
+    errno = EDESTADDRREQ;
+    return -1;
+  }
+  if (!sock->port && VL_pickPort (link, sock) < 0)
+    return -1;
+  for (i = 0; i < msg->msg_iovlen; i++)
+    length += msg->msg_iov[i].iov_len;
+  if (length > 65507) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  dest = VL_bound (link, ntohs (to->sin_port));
+  if (!dest) {
+    link->stats.unreachable++;
+    return length;
+  }
+
+  // what the path hasn't sent yet is still queued
+  start = dest->busyUntil > link->now ? dest->busyUntil : link->now;
+  if (link->bitsPerSec && link->queueBytes) {
+    waiting = (double)(start - link->now) * link->bitsPerSec / 8e9;
+    if (waiting + length + VL_HEADER_BYTES > link->queueBytes) {
+      link->stats.overflowed++;
+      return length;
+    }
+  }
+
+  packet = malloc (sizeof(*packet) + length);
+  if (!packet) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  memset (&packet->from, 0, sizeof(packet->from));
+  packet->from.sin_family = AF_INET;
+  packet->from.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  packet->from.sin_port = htons (sock->port);
+  packet->length = length;
+  packet->next = 0;
+  length = 0;
+  for (i = 0; i < msg->msg_iovlen; i++) {
+    memcpy (packet->data + length, msg->msg_iov[i].iov_base,
+	    msg->msg_iov[i].iov_len);
+    length += msg->msg_iov[i].iov_len;
+  }
+
+  // it goes out once the path has sent everything before it, and arrives
+  // the path's delay later
+  if (link->bitsPerSec)
+    dest->busyUntil = start + ((long long)length + VL_HEADER_BYTES) *
+      8000000000LL / link->bitsPerSec;
+  else
+    dest->busyUntil = start;
+  packet->arrival = dest->busyUntil + link->delay;
+  if (dest->tail)
+    dest->tail->next = packet;
+  else
+    dest->head = packet;
+  dest->tail = packet;
+
+  link->stats.sent++;
+  link->stats.bytes += length;
+  return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_sendmmsg
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_sendmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen,
+		 int flags)
+{
+  int length;
+  int i;
+
+  for (i = 0; i < vlen; i++) {
+    length = VL_sendmsg (link, sd, &msgs[i].msg_hdr, flags);
+    if (length < 0)
+      return i > 0 ? i : -1;
+    msgs[i].msg_len = length;
+  }
+  return vlen;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_recvmmsg
+//
+///////////////////////////////////////////////////////////////////////////////
+int VL_recvmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen)
+{
+  // take the datagrams that have arrived off the front of the socket's list
+  struct VL_socket *sock = VL_find (link, sd);
+  struct VL_packet *packet;
+  struct msghdr *hdr;
+  size_t copied, n;
+  size_t j;
+  int i;
+
+  if (!sock) {
+    errno = EBADF;
+    return -1;
+  }
+
+  for (i = 0; i < vlen; i++) {
+    packet = sock->head;
+    if (!packet || packet->arrival > link->now)
+      break;
+    sock->head = packet->next;
+    if (!sock->head)
+      sock->tail = 0;
+
+    hdr = &msgs[i].msg_hdr;
+    copied = 0;
+    for (j = 0; j < hdr->msg_iovlen && copied < (size_t)packet->length; j++) {
+      n = packet->length - copied;
+      if (n > hdr->msg_iov[j].iov_len)
+	n = hdr->msg_iov[j].iov_len;
+      memcpy (hdr->msg_iov[j].iov_base, packet->data + copied, n);
+      copied += n;
+    }
+    hdr->msg_flags = copied < (size_t)packet->length ? MSG_TRUNC : 0;
+    hdr->msg_controllen = 0;
+    if (hdr->msg_name && hdr->msg_namelen >= sizeof(packet->from)) {
+      memcpy (hdr->msg_name, &packet->from, sizeof(packet->from));
+      hdr->msg_namelen = sizeof(packet->from);
+    }
+    msgs[i].msg_len = copied;
+    free (packet);
+  }
+
+  if (i == 0 && vlen > 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_now
+//
+///////////////////////////////////////////////////////////////////////////////
+long long VL_now (VL_link *link)
+{
+  return link->now / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_nextArrival
+//
+///////////////////////////////////////////////////////////////////////////////
+long long VL_nextArrival (VL_link *link)
+{
+  // the first datagram on the way to each socket arrives first.  Rounded up
+  // to a usec, so it has arrived once the clock is moved on to that.
+  long long next = 0;
+  int i;
+
+  for (i = 0; i < link->numSockets; i++)
+    if (link->sockets[i].head &&
+	(!next || link->sockets[i].head->arrival < next))
+      next = link->sockets[i].head->arrival;
+  return next ? (next + 999) / 1000 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_advance
+//
+///////////////////////////////////////////////////////////////////////////////
+void VL_advance (VL_link *link, long long time)
+{
+  if (time * 1000 > link->now)
+    link->now = time * 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_getStats
+//
+///////////////////////////////////////////////////////////////////////////////
+void VL_getStats (VL_link *link, struct VL_stats *stats)
+{
+  *stats = link->stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_find
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct VL_socket *VL_find (VL_link *link, int sd)
+{
+  // the open socket with descriptor sd, or 0 if there isn't one
+  if (sd < 0 || sd >= link->numSockets || !link->sockets[sd].open)
+    return 0;
+  return &link->sockets[sd];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_bound
+//
+///////////////////////////////////////////////////////////////////////////////
+static struct VL_socket *VL_bound (VL_link *link, unsigned short port)
+{
+  // the socket bound to port, or 0 if none is.  A link has few sockets.
+  int i;
+
+  for (i = 0; i < link->numSockets; i++)
+    if (link->sockets[i].open && link->sockets[i].port == port)
+      return &link->sockets[i];
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_pickPort
+//
+///////////////////////////////////////////////////////////////////////////////
+static int VL_pickPort (VL_link *link, struct VL_socket *sock)
+{
+  // bind sock to the next port nobody has, as the kernel does for sockets
+  // that send without binding
+  int tries;
+
+  for (tries = 0; tries < 65536 - VL_FIRST_PORT; tries++) {
+    if (link->nextPort < VL_FIRST_PORT)
+      link->nextPort = VL_FIRST_PORT;
+    if (!VL_bound (link, link->nextPort)) {
+      sock->port = link->nextPort++;
+      return 0;
+    }
+    link->nextPort++;
+  }
+  errno = EADDRINUSE;
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// VL_free
+//
+///////////////////////////////////////////////////////////////////////////////
+static void VL_free (struct VL_socket *sock)
+{
+  // free the datagrams on their way to sock
+  struct VL_packet *packet;
+
+  while (sock->head) {
+    packet = sock->head;
+    sock->head = packet->next;
+    free (packet);
+  }
+  sock->tail = 0;
+}
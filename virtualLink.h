@@ -0,0 +1,118 @@
+//
+// File: virtualLink.h
+//
+// Author: Hamza Sultan Khan Niazi
+//
+// Description: a network simulated in memory, with a clock of its own.
+// Sockets on a link send each other UDP datagrams over paths with a
+// bandwidth, a propagation delay and a queue of limited size, and a
+// datagram arrives when the link's clock says it would have, not the
+// clock on the wall.  Nothing ever waits: whoever drives the link moves
+// its clock straight on to the next arrival with VL_advance, so thousands
+// of round trips take only as long as their packets take to process, and
+// the same run always comes out the same.  The following functions are
+// defined:
+//
+//    VL_open (void)
+//    VL_close (VL_link *link)
+//    VL_setPath (VL_link *link, long long bitsPerSec, int delayUsecs,
+//                int queueBytes)
+//    VL_socket (VL_link *link)
+//    VL_bind (VL_link *link, int sd, const struct sockaddr_in *addr)
+//    VL_closeSocket (VL_link *link, int sd)
+//    VL_sendmsg (VL_link *link, int sd, const struct msghdr *msg, int flags)
+//    VL_sendmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen,
+//                 int flags)
+//    VL_recvmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen)
+//    VL_now (VL_link *link)
+//    VL_nextArrival (VL_link *link)
+//    VL_advance (VL_link *link, long long time)
+//    VL_getStats (VL_link *link, struct VL_stats *stats)
+//
+// The socket functions work like the system calls of the same names on a
+// link's own descriptors, which aren't file descriptors.  Sockets are
+// told apart by port alone, and everything is sent from 127.0.0.1.  A
+// socket that sends before it's bound gets a port of its own, from 49152
+// up.  Datagrams aren't split up with GSO or put together with GRO.
+//
+// A link isn't thread safe: one thread drives it.
+//
+#ifndef _VIRTUAL_LINK_H
+#define _VIRTUAL_LINK_H
+
+#include <netinet/in.h>   // struct sockaddr_in
+
+typedef struct VL_link VL_link;
+
+VL_link *VL_open (void);
+// returns a new link with instant paths (no delay and unlimited
+// bandwidth) until VL_setPath says otherwise.  Its clock starts at 1
+// second, so a time of 0 can mean never.
+//
+// A return value of 0 indicates an error.
+
+void VL_close (VL_link *link);
+// frees the link, its sockets and the datagrams on their way.
+
+int VL_setPath (VL_link *link, long long bitsPerSec, int delayUsecs,
+		int queueBytes);
+// sets the path leading to each socket.  Datagrams sent to a socket go
+// out one after another at bitsPerSec (counting 28 bytes of IP and UDP
+// header each; 0 is unlimited) and arrive delayUsecs after they've gone
+// out.  A datagram sent while more than queueBytes are waiting to go out
+// ahead of it, itself included, is dropped, as by a router (0 is no
+// limit).  Everything sent to a socket shares its path, so senders to the
+// same socket share its bandwidth.
+//
+// A negative return value indicates an error.
+
+int VL_socket (VL_link *link);
+// returns a new unbound socket, or -1 if there's no memory for it.
+
+int VL_bind (VL_link *link, int sd, const struct sockaddr_in *addr);
+// binds socket sd to addr's port.  Returns -1 (with errno EADDRINUSE) if
+// another socket has it.
+
+void VL_closeSocket (VL_link *link, int sd);
+// closes socket sd.  Datagrams on their way to it are lost.
+
+struct mmsghdr;
+int VL_sendmsg (VL_link *link, int sd, const struct msghdr *msg, int flags);
+int VL_sendmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen,
+		 int flags);
+// send datagrams to the sockets bound to the ports in msg_name, which
+// must be set.  Datagrams to ports nobody is bound to are lost, as they
+// would be with UDP.  flags are ignored.
+//
+// VL_sendmsg returns the length of the datagram, and VL_sendmmsg the
+// number sent.  A negative return value indicates an error.
+
+int VL_recvmmsg (VL_link *link, int sd, struct mmsghdr *msgs, int vlen);
+// receives up to vlen datagrams that have arrived at socket sd by now,
+// without waiting, as recvmmsg with MSG_DONTWAIT does.  A datagram too
+// big for its iovecs is cut short and has MSG_TRUNC set in msg_flags.
+//
+// Returns the number received, or -1 (with errno EAGAIN) if none had
+// arrived.
+
+long long VL_now (VL_link *link);
+// returns the link's clock, in usecs.
+
+long long VL_nextArrival (VL_link *link);
+// returns when the next datagram on its way arrives, in usecs on the
+// link's clock, or 0 if there are none.
+
+void VL_advance (VL_link *link, long long time);
+// moves the link's clock on to time (usecs).  It never goes back.
+
+// what a link did with the datagrams sent over it
+struct VL_stats {
+  unsigned long long sent;         // datagrams that went on a path
+  unsigned long long bytes;        // and their bytes, without headers
+  unsigned long long overflowed;   // dropped by a full queue
+  unsigned long long unreachable;  // sent to ports nobody is bound to
+};
+
+void VL_getStats (VL_link *link, struct VL_stats *stats);
+// copies the link's counts to stats.
+#endif